@@ -0,0 +1,135 @@
+#include "Frustum.h"
+#include "Model.h"
+#if defined(__x86_64__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE 1
+#endif
+
+namespace labhelper
+{
+Frustum::Frustum(const glm::mat4& m)
+{
+	// Gribb and Hartmann: left, right, bottom, top, near and far are the
+	// last row plus or minus the others
+	const glm::vec4 rows[4] = { glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]),
+		                        glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]),
+		                        glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]),
+		                        glm::vec4(m[0][3], m[1][3], m[2][3], m[3][3]) };
+	for(int i = 0; i < 8; i++)
+	{
+		const int p = i % 6;
+		glm::vec4 plane = (p & 1) ? rows[3] - rows[p / 2] : rows[3] + rows[p / 2];
+		// Normalized, so that sphere radii compare with the distances
+		plane /= glm::length(glm::vec3(plane));
+		nx[i] = plane.x;
+		ny[i] = plane.y;
+		nz[i] = plane.z;
+		d[i] = plane.w;
+	}
+}
+
+Frustum::Result Frustum::testAABB(const glm::vec3& aabb_min, const glm::vec3& aabb_max) const
+{
+#ifdef FRUSTUM_SSE
+	const __m128 min_x = _mm_set1_ps(aabb_min.x), max_x = _mm_set1_ps(aabb_max.x);
+	const __m128 min_y = _mm_set1_ps(aabb_min.y), max_y = _mm_set1_ps(aabb_max.y);
+	const __m128 min_z = _mm_set1_ps(aabb_min.z), max_z = _mm_set1_ps(aabb_max.z);
+	const __m128 zero = _mm_setzero_ps();
+	int outside = 0, intersecting = 0;
+	for(int i = 0; i < 8; i += 4)
+	{
+		const __m128 a = _mm_load_ps(nx + i), b = _mm_load_ps(ny + i), c = _mm_load_ps(nz + i);
+		const __m128 x0 = _mm_mul_ps(a, min_x), x1 = _mm_mul_ps(a, max_x);
+		const __m128 y0 = _mm_mul_ps(b, min_y), y1 = _mm_mul_ps(b, max_y);
+		const __m128 z0 = _mm_mul_ps(c, min_z), z1 = _mm_mul_ps(c, max_z);
+		// The corners farthest along and against each normal
+		const __m128 far_corner = _mm_add_ps(
+		    _mm_add_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_add_ps(_mm_max_ps(z0, z1), _mm_load_ps(d + i)));
+		const __m128 near_corner = _mm_add_ps(
+		    _mm_add_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_add_ps(_mm_min_ps(z0, z1), _mm_load_ps(d + i)));
+		outside |= _mm_movemask_ps(_mm_cmplt_ps(far_corner, zero));
+		intersecting |= _mm_movemask_ps(_mm_cmplt_ps(near_corner, zero));
+	}
+	if(outside)
+		return OUTSIDE;
+	return intersecting ? INTERSECTING : INSIDE;
+#else
+	Result result = INSIDE;
+	for(int i = 0; i < 6; i++)
+	{
+		float far_corner = d[i], near_corner = d[i];
+		const float n[3] = { nx[i], ny[i], nz[i] };
+		for(int j = 0; j < 3; j++)
+		{
+			float a = n[j] * aabb_min[j], b = n[j] * aabb_max[j];
+			far_corner += a > b ? a : b;
+			near_corner += a > b ? b : a;
+		}
+		if(far_corner < 0.0f)
+			return OUTSIDE;
+		if(near_corner < 0.0f)
+			result = INTERSECTING;
+	}
+	return result;
+#endif
+}
+
+Frustum::Result Frustum::testSphere(const glm::vec3& center, float radius) const
+{
+	Result result = INSIDE;
+	for(int i = 0; i < 6; i++)
+	{
+		float distance = nx[i] * center.x + ny[i] * center.y + nz[i] * center.z + d[i];
+		if(distance < -radius)
+			return OUTSIDE;
+		if(distance < radius)
+			result = INTERSECTING;
+	}
+	return result;
+}
+
+void cullMeshes(const Model* model, const Frustum& frustum, std::vector<uint32_t>& visible)
+{
+	// Without a mesh BVH (e.g. a model that was not loaded from a file)
+	// nothing can be culled
+	if(model->m_mesh_bvh.empty())
+	{
+		for(uint32_t i = 0; i < model->m_meshes.size(); i++)
+			visible.push_back(i);
+		return;
+	}
+	uint32_t stack[64];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	while(stack_size > 0)
+	{
+		const MeshBVHNode& node = model->m_mesh_bvh[stack[--stack_size]];
+		Frustum::Result result = frustum.testAABB(node.m_aabb_min, node.m_aabb_max);
+		if(result == Frustum::OUTSIDE)
+			continue;
+		const uint32_t* order = &model->m_mesh_bvh_order[node.m_first];
+		if(result == Frustum::INSIDE)
+		{
+			visible.insert(visible.end(), order, order + node.m_count);
+		}
+		else if(node.m_right != 0)
+		{
+			stack[stack_size++] = node.m_right;
+			stack[stack_size++] = uint32_t(&node - &model->m_mesh_bvh[0]) + 1;
+		}
+		else
+		{
+			// The sphere is cheaper, and often settles it
+			for(uint32_t i = 0; i < node.m_count; i++)
+			{
+				const Mesh& mesh = model->m_meshes[order[i]];
+				Frustum::Result mesh_result = frustum.testSphere(mesh.m_sphere_center, mesh.m_sphere_radius);
+				if(mesh_result == Frustum::INTERSECTING)
+					mesh_result = frustum.testAABB(mesh.m_aabb_min, mesh.m_aabb_max);
+				if(mesh_result != Frustum::OUTSIDE)
+					visible.push_back(order[i]);
+			}
+		}
+	}
+}
+} // namespace labhelper
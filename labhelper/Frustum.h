@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+namespace labhelper
+{
+class Model;
+
+///////////////////////////////////////////////////////////////////////////////
+// The six planes of a clip volume, taken from a (model-)view-projection
+// matrix, so that boxes and spheres are tested in the space that matrix
+// transforms from. The planes are kept as four-wide columns (the last two
+// repeat the first two) and a box is tested against four at a time.
+///////////////////////////////////////////////////////////////////////////////
+struct Frustum
+{
+	enum Result
+	{
+		OUTSIDE,
+		INTERSECTING,
+		INSIDE
+	};
+
+	alignas(16) float nx[8];
+	alignas(16) float ny[8];
+	alignas(16) float nz[8];
+	alignas(16) float d[8];
+
+	Frustum(const glm::mat4& viewProjectionMatrix);
+	Result testAABB(const glm::vec3& aabb_min, const glm::vec3& aabb_max) const;
+	Result testSphere(const glm::vec3& center, float radius) const;
+};
+
+// Appends the meshes of model that may be inside frustum (made with the
+// model's model-view-projection matrix) to visible, walking its mesh BVH so
+// that subtrees outside are skipped, and those inside are taken untested.
+// A model without a mesh BVH has all of its meshes appended.
+void cullMeshes(const Model* model, const Frustum& frustum, std::vector<uint32_t>& visible);
+} // namespace labhelper
@@ -8,6 +8,9 @@
 #include <iomanip>
 #include <GL/glew.h>
 #include <stb_image.h>
+#include <cstring>
+#include <cfloat>
+#include "labhelper.h"
 
 namespace labhelper
 {
@@ -81,6 +84,128 @@ Model::~Model()
 	glDeleteBuffers(1, &m_normals_bo);
 	glDeleteBuffers(1, &m_texture_coordinates_bo);
 	glDeleteBuffers(1, &m_tangents_bo);
+	if(m_material_ubo != 0)
+		glDeleteBuffers(1, &m_material_ubo);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Bounding box and sphere of a mesh's vertices, for culling
+///////////////////////////////////////////////////////////////////////////
+static void computeMeshBounds(const Model* model, Mesh& mesh)
+{
+	mesh.m_aabb_min = glm::vec3(FLT_MAX);
+	mesh.m_aabb_max = glm::vec3(-FLT_MAX);
+	const uint32_t end = mesh.m_start_index + mesh.m_number_of_vertices;
+	for(uint32_t i = mesh.m_start_index; i < end; i++)
+	{
+		mesh.m_aabb_min = glm::min(mesh.m_aabb_min, model->m_positions[i]);
+		mesh.m_aabb_max = glm::max(mesh.m_aabb_max, model->m_positions[i]);
+	}
+	if(mesh.m_number_of_vertices == 0)
+		mesh.m_aabb_min = mesh.m_aabb_max = glm::vec3(0.0f);
+	// Around the box center, but only as large as the vertices need
+	mesh.m_sphere_center = 0.5f * (mesh.m_aabb_min + mesh.m_aabb_max);
+	float radius2 = 0.0f;
+	for(uint32_t i = mesh.m_start_index; i < end; i++)
+	{
+		glm::vec3 d = model->m_positions[i] - mesh.m_sphere_center;
+		radius2 = std::max(radius2, glm::dot(d, d));
+	}
+	mesh.m_sphere_radius = sqrtf(radius2);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Top down, splitting the meshes at the median of their box centers along
+// the longest axis, until there are few enough for a leaf
+///////////////////////////////////////////////////////////////////////////
+static const uint32_t MESH_BVH_LEAF_SIZE = 4;
+
+static uint32_t buildMeshBVHNode(Model* model, uint32_t first, uint32_t count)
+{
+	const uint32_t index = uint32_t(model->m_mesh_bvh.size());
+	model->m_mesh_bvh.push_back(MeshBVHNode());
+	glm::vec3 aabb_min(FLT_MAX), aabb_max(-FLT_MAX);
+	glm::vec3 center_min(FLT_MAX), center_max(-FLT_MAX);
+	for(uint32_t i = first; i < first + count; i++)
+	{
+		const Mesh& mesh = model->m_meshes[model->m_mesh_bvh_order[i]];
+		aabb_min = glm::min(aabb_min, mesh.m_aabb_min);
+		aabb_max = glm::max(aabb_max, mesh.m_aabb_max);
+		glm::vec3 center = mesh.m_aabb_min + mesh.m_aabb_max;
+		center_min = glm::min(center_min, center);
+		center_max = glm::max(center_max, center);
+	}
+	uint32_t right = 0;
+	if(count > MESH_BVH_LEAF_SIZE)
+	{
+		glm::vec3 extent = center_max - center_min;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		uint32_t* order = model->m_mesh_bvh_order.data();
+		const uint32_t half = count / 2;
+		std::nth_element(order + first, order + first + half, order + first + count,
+		                 [model, axis](uint32_t a, uint32_t b) {
+			                 const Mesh& mesh_a = model->m_meshes[a];
+			                 const Mesh& mesh_b = model->m_meshes[b];
+			                 return mesh_a.m_aabb_min[axis] + mesh_a.m_aabb_max[axis]
+			                        < mesh_b.m_aabb_min[axis] + mesh_b.m_aabb_max[axis];
+		                 });
+		buildMeshBVHNode(model, first, half);
+		right = buildMeshBVHNode(model, first + half, count - half);
+	}
+	MeshBVHNode& node = model->m_mesh_bvh[index];
+	node.m_aabb_min = aabb_min;
+	node.m_aabb_max = aabb_max;
+	node.m_first = first;
+	node.m_count = count;
+	node.m_right = right;
+	return index;
+}
+
+static void buildMeshBVH(Model* model)
+{
+	model->m_mesh_bvh.clear();
+	model->m_mesh_bvh_order.resize(model->m_meshes.size());
+	for(uint32_t i = 0; i < model->m_meshes.size(); i++)
+		model->m_mesh_bvh_order[i] = i;
+	if(!model->m_meshes.empty())
+		buildMeshBVHNode(model, 0, uint32_t(model->m_meshes.size()));
+}
+
+///////////////////////////////////////////////////////////////////////
+// The materials' uniform buffer, made once when the model is loaded
+///////////////////////////////////////////////////////////////////////
+static void createMaterialBuffer(Model* model)
+{
+	if(model->m_materials.empty())
+		return;
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	const uint32_t stride = uint32_t((sizeof(MaterialUniforms) + alignment - 1) / alignment * alignment);
+	std::vector<uint8_t> data(stride * model->m_materials.size(), 0);
+	for(size_t i = 0; i < model->m_materials.size(); i++)
+	{
+		const Material& material = model->m_materials[i];
+		MaterialUniforms uniforms = {};
+		uniforms.color = material.m_color;
+		uniforms.reflectivity = material.m_reflectivity;
+		uniforms.metalness = material.m_metalness;
+		uniforms.fresnel = material.m_fresnel;
+		uniforms.shininess = material.m_shininess;
+		uniforms.emission = material.m_emission;
+		uniforms.has_color_texture = material.m_color_texture.valid;
+		uniforms.has_reflectivity_texture = material.m_reflectivity_texture.valid;
+		uniforms.has_metalness_texture = material.m_metalness_texture.valid;
+		uniforms.has_fresnel_texture = material.m_fresnel_texture.valid;
+		uniforms.has_shininess_texture = material.m_shininess_texture.valid;
+		uniforms.has_emission_texture = material.m_emission_texture.valid;
+		uniforms.has_bump_texture = material.m_bump_texture.valid;
+		memcpy(&data[i * stride], &uniforms, sizeof(uniforms));
+	}
+	glGenBuffers(1, &model->m_material_ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, model->m_material_ubo);
+	glBufferData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	model->m_material_ubo_stride = stride;
 }
 
 Model* loadModelFromOBJ(std::string path)
@@ -343,6 +468,7 @@ Model* loadModelFromOBJ(std::string path)
 			// Finalize and push this mesh to the list
 			///////////////////////////////////////////////////////////////
 			mesh.m_number_of_vertices = vertices_so_far - mesh.m_start_index;
+			computeMeshBounds(model, mesh);
 			model->m_meshes.push_back(mesh);
 			finished_materials[current_material_index] = true;
 		}
@@ -381,6 +507,8 @@ Model* loadModelFromOBJ(std::string path)
 		GL_STATIC_DRAW);
 	glVertexAttribPointer(1, 3, GL_FLOAT, false, 0, 0);
 	glEnableVertexAttribArray(3);
+	createMaterialBuffer(model);
+	buildMeshBVH(model);
 
 	std::cout << "done.\n";
 	return model;
@@ -506,66 +634,87 @@ void freeModel(Model* model)
 }
 
 ///////////////////////////////////////////////////////////////////////
-// Loop through all Meshes in the Model and render them
+// The material as plain uniforms, for shaders without the
+// MaterialUniforms block
 ///////////////////////////////////////////////////////////////////////
+static void setMaterialUniforms(GLuint program, const Material& material)
+{
+	bool has_color_texture = material.m_color_texture.valid;
+	setUniform(program, "has_color_texture", GLint(has_color_texture));
+	setUniform(program, "has_reflectivity_texture", GLint(material.m_reflectivity_texture.valid));
+	setUniform(program, "has_metalness_texture", GLint(material.m_metalness_texture.valid));
+	setUniform(program, "has_fresnel_texture", GLint(material.m_fresnel_texture.valid));
+	setUniform(program, "has_shininess_texture", GLint(material.m_shininess_texture.valid));
+	setUniform(program, "has_emission_texture", GLint(material.m_emission_texture.valid));
+	setUniform(program, "has_bump_texture", GLint(material.m_bump_texture.valid));
+	setUniform(program, "material_color", material.m_color);
+	setUniform(program, "material_diffuse_color",
+	           material.m_color); //FIXME: Compatibility with old shading model of lab3.
+	setUniform(program, "material_emissive_color",
+	           material.m_color); //FIXME: Compatibility with old shading model of lab3.
+	setUniform(program, "has_diffuse_texture",
+	           GLint(has_color_texture)); //FIXME: Compatibility with old shading model of lab3.
+	setUniform(program, "material_reflectivity", material.m_reflectivity);
+	setUniform(program, "material_metalness", material.m_metalness);
+	setUniform(program, "material_fresnel", material.m_fresnel);
+	setUniform(program, "material_shininess", material.m_shininess);
+	setUniform(program, "material_emission", material.m_emission);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Loop through all Meshes in the Model and render them. A material is
+// its textures in one call, and a range of the model's material buffer
+// (or plain uniforms, with locations from the cache), and is only
+// submitted when it differs from the last mesh's.
+///////////////////////////////////////////////////////////////////////
+void bindMaterialTextures(const Material& material)
+{
+	// Units 0 to 5, the bump map is on 6 where the project keeps its
+	// environment map, so it is only bound if there is one
+	const Texture* textures[] = { &material.m_color_texture,     &material.m_reflectivity_texture,
+		                          &material.m_metalness_texture, &material.m_fresnel_texture,
+		                          &material.m_shininess_texture, &material.m_emission_texture };
+	GLuint texture_ids[6];
+	for(int i = 0; i < 6; i++)
+		texture_ids[i] = textures[i]->valid ? textures[i]->gl_id : 0;
+	glBindTextures(0, 6, texture_ids);
+	if(material.m_bump_texture.valid)
+		glBindTextures(6, 1, &material.m_bump_texture.gl_id);
+}
+
+bool hasMaterialBlock(const Model* model, uint32_t program)
+{
+	return model->m_material_ubo != 0
+	       && getUniformBlockIndex(program, "MaterialUniforms") != GL_INVALID_INDEX;
+}
+
+void bindMaterialUniforms(const Model* model, uint32_t material_idx, uint32_t program, bool material_block)
+{
+	if(material_block)
+		glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_UNIFORM_BINDING, model->m_material_ubo,
+		                  GLintptr(material_idx) * model->m_material_ubo_stride, sizeof(MaterialUniforms));
+	else
+		setMaterialUniforms(program, model->m_materials[material_idx]);
+}
+
 void render(const Model* model, const bool submitMaterials)
 {
 	glBindVertexArray(model->m_vaob);
+	GLint current_program = 0;
+	bool material_block = false;
+	if(submitMaterials)
+	{
+		glGetIntegerv(GL_CURRENT_PROGRAM, &current_program);
+		material_block = hasMaterialBlock(model, current_program);
+	}
+	uint32_t submitted_material = UINT32_MAX;
 	for(auto& mesh : model->m_meshes)
 	{
-		if(submitMaterials)
+		if(submitMaterials && mesh.m_material_idx != submitted_material)
 		{
-			const Material& material = model->m_materials[mesh.m_material_idx];
-
-			bool has_color_texture = material.m_color_texture.valid;
-			bool has_reflectivity_texture = material.m_reflectivity_texture.valid;
-			bool has_metalness_texture = material.m_metalness_texture.valid;
-			bool has_fresnel_texture = material.m_fresnel_texture.valid;
-			bool has_shininess_texture = material.m_shininess_texture.valid;
-			bool has_emission_texture = material.m_emission_texture.valid;
-			bool has_bump_texture = material.m_bump_texture.valid;
-			if(has_color_texture)
-				glBindTextures(0, 1, &material.m_color_texture.gl_id);
-			if(has_reflectivity_texture)
-				glBindTextures(1, 1, &material.m_reflectivity_texture.gl_id);
-			if(has_metalness_texture)
-				glBindTextures(2, 1, &material.m_metalness_texture.gl_id);
-			if(has_fresnel_texture)
-				glBindTextures(3, 1, &material.m_fresnel_texture.gl_id);
-			if(has_shininess_texture)
-				glBindTextures(4, 1, &material.m_shininess_texture.gl_id);
-			if(has_emission_texture)
-				glBindTextures(5, 1, &material.m_emission_texture.gl_id);
-			if(has_bump_texture)
-				glBindTextures(6, 1, &material.m_bump_texture.gl_id);
-			GLint current_program = 0;
-			glGetIntegerv(GL_CURRENT_PROGRAM, &current_program);
-			glUniform1i(glGetUniformLocation(current_program, "has_color_texture"), has_color_texture);
-			glUniform1i(glGetUniformLocation(current_program, "has_diffuse_texture"),
-			            has_color_texture ? 1 : 0); // FIXME
-			glUniform1i(glGetUniformLocation(current_program, "has_reflectivity_texture"),
-			            has_reflectivity_texture);
-			glUniform1i(glGetUniformLocation(current_program, "has_metalness_texture"), has_metalness_texture);
-			glUniform1i(glGetUniformLocation(current_program, "has_fresnel_texture"), has_fresnel_texture);
-			glUniform1i(glGetUniformLocation(current_program, "has_shininess_texture"), has_shininess_texture);
-			glUniform1i(glGetUniformLocation(current_program, "has_emission_texture"),
-			            has_emission_texture ? 1 : 0);
-			glUniform1i(glGetUniformLocation(current_program, "has_bump_texture"), has_bump_texture);
-			glUniform3fv(glGetUniformLocation(current_program, "material_color"), 1, &material.m_color.x);
-			glUniform3fv(glGetUniformLocation(current_program, "material_diffuse_color"), 1,
-			             &material.m_color.x); //FIXME: Compatibility with old shading model of lab3.
-			glUniform3fv(glGetUniformLocation(current_program, "material_emissive_color"), 1,
-			             &material.m_color.x); //FIXME: Compatibility with old shading model of lab3.
-			glUniform1i(glGetUniformLocation(current_program, "has_diffuse_texture"),
-			            has_color_texture); //FIXME: Compatibility with old shading model of lab3.
-			glUniform1fv(glGetUniformLocation(current_program, "material_reflectivity"), 1,
-			             &material.m_reflectivity);
-			glUniform1fv(glGetUniformLocation(current_program, "material_metalness"), 1,
-			             &material.m_metalness);
-			glUniform1fv(glGetUniformLocation(current_program, "material_fresnel"), 1, &material.m_fresnel);
-			glUniform1fv(glGetUniformLocation(current_program, "material_shininess"), 1,
-			             &material.m_shininess);
-			glUniform1fv(glGetUniformLocation(current_program, "material_emission"), 1, &material.m_emission);
+			submitted_material = mesh.m_material_idx;
+			bindMaterialTextures(model->m_materials[mesh.m_material_idx]);
+			bindMaterialUniforms(model, mesh.m_material_idx, current_program, material_block);
 		}
 		glDrawArrays(GL_TRIANGLES, mesh.m_start_index, (GLsizei)mesh.m_number_of_vertices);
 	}
@@ -42,6 +42,47 @@ struct Material
 	Texture m_emission_texture;
 };
 
+//////////////////////////////////////////////////////////////////////////////
+// A material as a std140 uniform block, render() binds the mesh's to
+// MATERIAL_UNIFORM_BINDING for shaders that declare it:
+//
+// layout(std140, binding = 2) uniform MaterialUniforms
+// {
+//	vec3 material_color;
+//	float material_reflectivity;
+//	float material_metalness;
+//	float material_fresnel;
+//	float material_shininess;
+//	float material_emission;
+//	int has_color_texture;
+//	int has_reflectivity_texture;
+//	int has_metalness_texture;
+//	int has_fresnel_texture;
+//	int has_shininess_texture;
+//	int has_emission_texture;
+//	int has_bump_texture;
+// };
+//////////////////////////////////////////////////////////////////////////////
+const uint32_t MATERIAL_UNIFORM_BINDING = 2;
+
+struct MaterialUniforms
+{
+	glm::vec3 color;
+	float reflectivity;
+	float metalness;
+	float fresnel;
+	float shininess;
+	float emission;
+	int32_t has_color_texture;
+	int32_t has_reflectivity_texture;
+	int32_t has_metalness_texture;
+	int32_t has_fresnel_texture;
+	int32_t has_shininess_texture;
+	int32_t has_emission_texture;
+	int32_t has_bump_texture;
+	int32_t padding;
+};
+
 struct Mesh
 {
 	std::string m_name;
@@ -49,6 +90,26 @@ struct Mesh
 	// Where this Mesh's vertices start
 	uint32_t m_start_index;
 	uint32_t m_number_of_vertices;
+	// Bounds of its vertices, in model space
+	glm::vec3 m_aabb_min;
+	glm::vec3 m_aabb_max;
+	glm::vec3 m_sphere_center;
+	float m_sphere_radius;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// A node of the bounding volume hierarchy over a Model's meshes. The meshes
+// under it are m_mesh_bvh_order[m_first] to [m_first + m_count - 1]. Inner
+// nodes have their children at the next index and at m_right, leaves have
+// m_right 0.
+//////////////////////////////////////////////////////////////////////////////
+struct MeshBVHNode
+{
+	glm::vec3 m_aabb_min;
+	uint32_t m_first;
+	glm::vec3 m_aabb_max;
+	uint32_t m_count;
+	uint32_t m_right;
 };
 
 class Model
@@ -63,6 +124,9 @@ public:
 	std::vector<Material> m_materials;
 	// A model will contain one or more "Meshes"
 	std::vector<Mesh> m_meshes;
+	// Bounding volume hierarchy over the meshes, the root first
+	std::vector<MeshBVHNode> m_mesh_bvh;
+	std::vector<uint32_t> m_mesh_bvh_order;
 	// Buffers on CPU
 	std::vector<glm::vec3> m_positions;
 	std::vector<glm::vec3> m_normals;
@@ -75,12 +139,21 @@ public:
 	uint32_t m_tangents_bo;
 	// Vertex Array Object
 	uint32_t m_vaob;
+	// The materials as MaterialUniforms, m_material_ubo_stride apart (the
+	// uniform buffer offset alignment)
+	uint32_t m_material_ubo = 0;
+	uint32_t m_material_ubo_stride = 0;
 };
 
 Model* loadModelFromOBJ(std::string filename);
 void saveModelToOBJ(Model* model, std::string filename);
 void freeModel(Model* model);
 void render(const Model* model, const bool submitMaterials = true);
+// The material parts of render(), for RenderQueue. material_block is whether
+// the program declares MaterialUniforms, as hasMaterialBlock() tells.
+void bindMaterialTextures(const Material& material);
+bool hasMaterialBlock(const Model* model, uint32_t program);
+void bindMaterialUniforms(const Model* model, uint32_t material_idx, uint32_t program, bool material_block);
 bool loadMaterials(Model* model);
 void renderSimpleModel(const Model* model);
 } // namespace labhelper
\ No newline at end of file
@@ -0,0 +1,243 @@
+#include "ParticleDepthOrder.h"
+#include "ParticleSystem.h"
+#include <algorithm>
+#include <cfloat>
+
+using namespace glm;
+
+static const int CHUNK_SIZE = 64 * 1024;
+static const int RADIX_BITS = 11;
+static const int RADIX = 1 << RADIX_BITS;
+static const uint32_t MAX_KEY = (1u << (2 * RADIX_BITS)) - 1;
+static const uint32_t NO_INDEX = ~0u;
+// Sorts to radix sort after the last order was found to have changed too
+// much, before trying to reuse it again
+static const int RETRY_INTERVAL = 16;
+
+///////////////////////////////////////////////////////////////////////////////
+// A key per particle: its view space z (more negative is farther) mapped
+// from the particles' range to [0, MAX_KEY], so ascending keys are back to
+// front
+///////////////////////////////////////////////////////////////////////////////
+void ParticleDepthOrder::computeKeys(const ParticleSystem& system, const mat4& viewMatrix)
+{
+	const int n = int(system.size());
+	const int chunks = (n + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	const float *px = system.particles.pos_x.data(), *py = system.particles.pos_y.data(),
+	            *pz = system.particles.pos_z.data();
+	const vec4 row(viewMatrix[0][2], viewMatrix[1][2], viewMatrix[2][2], viewMatrix[3][2]);
+	particle_keys.resize(n);
+	depths.resize(n);
+	float* depth = depths.data();
+	chunk_ranges.resize(2 * size_t(chunks));
+#pragma omp parallel for schedule(static) if(chunks > 1)
+	for(int c = 0; c < chunks; c++)
+	{
+		const int begin = c * CHUNK_SIZE, end = std::min(begin + CHUNK_SIZE, n);
+		float lo = FLT_MAX, hi = -FLT_MAX;
+		for(int i = begin; i < end; i++)
+		{
+			const float z = row.x * px[i] + row.y * py[i] + row.z * pz[i] + row.w;
+			depth[i] = z;
+			lo = std::min(lo, z);
+			hi = std::max(hi, z);
+		}
+		chunk_ranges[2 * c] = lo;
+		chunk_ranges[2 * c + 1] = hi;
+	}
+	float lo = FLT_MAX, hi = -FLT_MAX;
+	for(int c = 0; c < chunks; c++)
+	{
+		lo = std::min(lo, chunk_ranges[2 * c]);
+		hi = std::max(hi, chunk_ranges[2 * c + 1]);
+	}
+	const float scale = hi > lo ? float(MAX_KEY) / (hi - lo) : 0.0f;
+#pragma omp parallel for schedule(static) if(chunks > 1)
+	for(int c = 0; c < chunks; c++)
+	{
+		const int begin = c * CHUNK_SIZE, end = std::min(begin + CHUNK_SIZE, n);
+		for(int i = begin; i < end; i++)
+		{
+			const float key = (depth[i] - lo) * scale;
+			particle_keys[i] = std::min(uint32_t(key), MAX_KEY);
+		}
+	}
+	view_direction = -vec3(row);
+}
+
+void ParticleDepthOrder::sort(const ParticleSystem& system, const mat4& viewMatrix)
+{
+	const vec3 last_direction = view_direction;
+	computeKeys(system, viewMatrix);
+	const size_t n = system.size();
+
+	incremental = false;
+	if(valid && dot(view_direction, last_direction) >= coherent_cos && --retry_countdown <= 0)
+	{
+		incremental = reuseOrder(system);
+		if(!incremental)
+			retry_countdown = RETRY_INTERVAL;
+	}
+	if(!incremental)
+	{
+		indices.resize(n);
+		keys.resize(n);
+		for(size_t i = 0; i < n; i++)
+		{
+			indices[i] = uint32_t(i);
+			keys[i] = particle_keys[i];
+		}
+		radixSort();
+	}
+	update_count = system.update_count;
+	valid = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The last order, carried over the update() since (if there was at most
+// one) and fixed up with insertion sort, with the particles that were not
+// in it sorted and merged in. Returns false if there was no usable order,
+// or it had changed too much.
+///////////////////////////////////////////////////////////////////////////////
+bool ParticleDepthOrder::reuseOrder(const ParticleSystem& system)
+{
+	const size_t n = system.size();
+	const size_t sorted = indices.size();
+	if(system.update_count == update_count)
+	{
+		// Nothing moved or died, particles may have been emitted
+		if(n < sorted)
+			return false;
+		new_index.resize(sorted);
+		for(size_t i = 0; i < sorted; i++)
+			new_index[i] = uint32_t(i);
+	}
+	else if(system.update_count == update_count + 1)
+	{
+		new_index.assign(sorted, NO_INDEX);
+		const std::vector<uint32_t>& previous = system.previous_index;
+		for(size_t i = 0; i < previous.size(); i++)
+		{
+			if(previous[i] < sorted)
+				new_index[previous[i]] = uint32_t(i);
+		}
+	}
+	else
+	{
+		return false;
+	}
+
+	// The survivors of the last order, then the others, sorted
+	size_t carried = 0;
+	for(size_t k = 0; k < sorted; k++)
+	{
+		const uint32_t i = new_index[indices[k]];
+		if(i != NO_INDEX)
+			indices[carried++] = i;
+	}
+	indices.resize(carried);
+	keys.resize(carried);
+	for(size_t k = 0; k < carried; k++)
+		keys[k] = particle_keys[indices[k]];
+
+	const size_t budget = size_t(max_moves * float(carried)) + 1;
+	size_t moves = 0;
+	for(size_t k = 1; k < carried; k++)
+	{
+		const uint32_t key = keys[k], index = indices[k];
+		size_t j = k;
+		while(j > 0 && keys[j - 1] > key)
+		{
+			keys[j] = keys[j - 1];
+			indices[j] = indices[j - 1];
+			j--;
+		}
+		keys[j] = key;
+		indices[j] = index;
+		moves += k - j;
+		if(moves > budget)
+			return false;
+	}
+
+	// A particle is new if it did not get a place in the last order
+	scratch_keys.clear();
+	scratch_indices.clear();
+	std::vector<uint32_t>& seen = new_index;
+	seen.assign(n, 0);
+	for(size_t k = 0; k < carried; k++)
+		seen[indices[k]] = 1;
+	for(size_t i = 0; i < n; i++)
+	{
+		if(!seen[i])
+			scratch_indices.push_back(uint32_t(i));
+	}
+	std::sort(scratch_indices.begin(), scratch_indices.end(),
+	          [this](uint32_t a, uint32_t b) { return particle_keys[a] < particle_keys[b]; });
+
+	// Merge, back to front from the end so it can be done in place
+	indices.resize(n);
+	size_t a = carried, b = scratch_indices.size(), out = n;
+	while(b > 0)
+	{
+		if(a > 0 && keys[a - 1] > particle_keys[scratch_indices[b - 1]])
+			indices[--out] = indices[--a];
+		else
+			indices[--out] = scratch_indices[--b];
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LSD radix sort of (keys, indices), RADIX_BITS at a time. Every chunk
+// counts its digits, a prefix sum over digits and then chunks gives every
+// chunk where its elements of each digit go, and the chunks scatter them
+// there in parallel, which keeps each pass stable.
+///////////////////////////////////////////////////////////////////////////////
+void ParticleDepthOrder::radixSort()
+{
+	const int n = int(indices.size());
+	const int chunks = (n + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	scratch_keys.resize(n);
+	scratch_indices.resize(n);
+	histograms.resize(size_t(chunks) * RADIX);
+	for(int shift = 0; shift < 2 * RADIX_BITS; shift += RADIX_BITS)
+	{
+		const uint32_t* key_in = keys.data();
+		const uint32_t* index_in = indices.data();
+		uint32_t* key_out = scratch_keys.data();
+		uint32_t* index_out = scratch_indices.data();
+#pragma omp parallel for schedule(static) if(chunks > 1)
+		for(int c = 0; c < chunks; c++)
+		{
+			uint32_t* count = &histograms[size_t(c) * RADIX];
+			std::fill(count, count + RADIX, 0u);
+			const int begin = c * CHUNK_SIZE, end = std::min(begin + CHUNK_SIZE, n);
+			for(int i = begin; i < end; i++)
+				count[(key_in[i] >> shift) & (RADIX - 1)]++;
+		}
+		uint32_t offset = 0;
+		for(int d = 0; d < RADIX; d++)
+		{
+			for(int c = 0; c < chunks; c++)
+			{
+				const uint32_t count = histograms[size_t(c) * RADIX + d];
+				histograms[size_t(c) * RADIX + d] = offset;
+				offset += count;
+			}
+		}
+#pragma omp parallel for schedule(static) if(chunks > 1)
+		for(int c = 0; c < chunks; c++)
+		{
+			uint32_t* next = &histograms[size_t(c) * RADIX];
+			const int begin = c * CHUNK_SIZE, end = std::min(begin + CHUNK_SIZE, n);
+			for(int i = begin; i < end; i++)
+			{
+				const uint32_t to = next[(key_in[i] >> shift) & (RADIX - 1)]++;
+				key_out[to] = key_in[i];
+				index_out[to] = index_in[i];
+			}
+		}
+		keys.swap(scratch_keys);
+		indices.swap(scratch_indices);
+	}
+}
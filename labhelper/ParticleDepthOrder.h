@@ -0,0 +1,60 @@
+#pragma once
+
+
+#include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+class ParticleSystem;
+
+///////////////////////////////////////////////////////////////////////////////
+// The particles of a ParticleSystem ordered back to front, as indices into
+// its arrays (to draw with, or to read the particles in that order).
+//
+// Depths are quantized to 22 bit keys over the particles' depth range and
+// sorted with a parallel LSD radix sort, two passes of 11 bits. The order
+// barely changes between frames though: the depths along the view
+// direction only change with the particles' own motion and the turning
+// of the camera (moving it shifts them all alike). So when the camera has
+// turned little since the last sort, the last order is carried over the
+// particle system's compaction and fixed up with insertion sort, and the
+// new particles are sorted on their own and merged in. If the order turns
+// out to have changed too much for that (dense particles moving fast trade
+// places thousands at a time), it falls back to the radix sort, and does
+// not try again for a few sorts.
+///////////////////////////////////////////////////////////////////////////////
+class ParticleDepthOrder
+{
+public:
+	// Members
+	// Farthest particle first, after sort()
+	std::vector<uint32_t> indices;
+	// The last order is reused if the view direction turned less than this
+	// (cosine of the angle) since, set to more than 1 to always radix sort
+	float coherent_cos = 0.999f;
+	// Insertion sort gives up after this many moves per particle
+	float max_moves = 4.0f;
+	// Whether the last sort() reused the order before it
+	bool incremental = false;
+
+	// Methods
+	void sort(const ParticleSystem& system, const glm::mat4& viewMatrix);
+
+private:
+	std::vector<float> depths;
+	std::vector<uint32_t> particle_keys;
+	// Of indices, and the other halves of the radix passes
+	std::vector<uint32_t> keys;
+	std::vector<uint32_t> scratch_keys, scratch_indices;
+	std::vector<uint32_t> new_index;
+	std::vector<uint32_t> histograms;
+	std::vector<float> chunk_ranges;
+	glm::vec3 view_direction = glm::vec3(0.0f);
+	uint32_t update_count = 0;
+	int retry_countdown = 0;
+	bool valid = false;
+
+	void computeKeys(const ParticleSystem& system, const glm::mat4& viewMatrix);
+	bool reuseOrder(const ParticleSystem& system);
+	void radixSort();
+};
@@ -0,0 +1,263 @@
+#include "ParticleSystem.h"
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/constants.hpp>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PARTICLES_SSE2 1
+#endif
+
+using namespace glm;
+
+// Particles per task of emit() and update(), big enough that a task is
+// worth its scheduling, and small enough to keep every thread busy
+static const int CHUNK_SIZE = 16 * 1024;
+
+///////////////////////////////////////////////////////////////////////////////
+// ParticleArrays
+///////////////////////////////////////////////////////////////////////////////
+void ParticleArrays::fields(std::vector<float>* out[FIELD_COUNT])
+{
+	std::vector<float>* all[FIELD_COUNT] = { &pos_x, &pos_y, &pos_z, &vel_x, &vel_y, &vel_z, &lifetime, &life_length };
+	std::copy(all, all + FIELD_COUNT, out);
+}
+
+void ParticleArrays::resize(size_t n)
+{
+	std::vector<float>* f[FIELD_COUNT];
+	fields(f);
+	for(int k = 0; k < FIELD_COUNT; k++)
+		f[k]->resize(n);
+}
+
+void ParticleArrays::swap(ParticleArrays& other)
+{
+	std::vector<float>*a[FIELD_COUNT], *b[FIELD_COUNT];
+	fields(a);
+	other.fields(b);
+	for(int k = 0; k < FIELD_COUNT; k++)
+		a[k]->swap(*b[k]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A small random number generator (PCG32) per chunk of new particles, so
+// threads never share one (labhelper::uniform_randf is rand()), and the
+// particles come out the same however many threads there are
+///////////////////////////////////////////////////////////////////////////////
+struct ChunkRandom
+{
+	uint64_t state;
+	uint64_t increment;
+
+	ChunkRandom(uint32_t seed, uint32_t chunk)
+	    : state(0), increment((uint64_t(chunk) << 1) | 1u)
+	{
+		next();
+		state += seed;
+		next();
+	}
+
+	uint32_t next()
+	{
+		const uint64_t old = state;
+		state = old * 6364136223846793005ull + increment;
+		const uint32_t shifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+		const uint32_t rot = uint32_t(old >> 59u);
+		return (shifted >> rot) | (shifted << ((-int32_t(rot)) & 31));
+	}
+
+	// In [from, to)
+	float uniform(float from, float to)
+	{
+		return from + (to - from) * float(next() >> 8) * (1.0f / 16777216.0f);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// ParticleSystem
+///////////////////////////////////////////////////////////////////////////////
+ParticleSystem::ParticleSystem(int size) : max_size(size)
+{
+	std::vector<float>*a[ParticleArrays::FIELD_COUNT], *b[ParticleArrays::FIELD_COUNT];
+	particles.fields(a);
+	compacted.fields(b);
+	for(int k = 0; k < ParticleArrays::FIELD_COUNT; k++)
+	{
+		a[k]->reserve(max_size);
+		b[k]->reserve(max_size);
+	}
+}
+
+Particle ParticleSystem::particle(size_t i) const
+{
+	Particle p;
+	p.lifetime = particles.lifetime[i];
+	p.life_length = particles.life_length[i];
+	p.velocity = vec3(particles.vel_x[i], particles.vel_y[i], particles.vel_z[i]);
+	p.pos = position(i);
+	return p;
+}
+
+void ParticleSystem::spawn(const Particle& particle)
+{
+	if(max_size > 0 && int(size()) >= max_size)
+		return;
+	particles.pos_x.push_back(particle.pos.x);
+	particles.pos_y.push_back(particle.pos.y);
+	particles.pos_z.push_back(particle.pos.z);
+	particles.vel_x.push_back(particle.velocity.x);
+	particles.vel_y.push_back(particle.velocity.y);
+	particles.vel_z.push_back(particle.velocity.z);
+	particles.lifetime.push_back(particle.lifetime);
+	particles.life_length.push_back(particle.life_length);
+}
+
+int ParticleSystem::emit(const ParticleEmitter& emitter, int count)
+{
+	const int first = int(size());
+	if(max_size > 0)
+		count = std::min(count, std::max(max_size - first, 0));
+	if(count <= 0)
+		return 0;
+	particles.resize(size_t(first) + count);
+
+	// Every call draws different numbers
+	const uint32_t seed = emit_count++ * 0x9e3779b9u;
+	const int chunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+#pragma omp parallel for schedule(static) if(chunks > 1)
+	for(int c = 0; c < chunks; c++)
+	{
+		ChunkRandom random(seed, uint32_t(c));
+		const int begin = first + c * CHUNK_SIZE;
+		const int end = first + std::min((c + 1) * CHUNK_SIZE, count);
+		for(int i = begin; i < end; i++)
+		{
+			const float theta = random.uniform(0.0f, 2.0f * pi<float>());
+			const float u = random.uniform(-1.0f, 1.0f);
+			const float r = std::sqrt(std::max(1.0f - u * u, 0.0f));
+			const vec3 direction = vec3(u, r * std::cos(theta), r * std::sin(theta));
+			const vec3 velocity = emitter.velocity_scale * (emitter.orientation * (emitter.speed * direction));
+			particles.pos_x[i] = emitter.position.x;
+			particles.pos_y[i] = emitter.position.y;
+			particles.pos_z[i] = emitter.position.z;
+			particles.vel_x[i] = velocity.x;
+			particles.vel_y[i] = velocity.y;
+			particles.vel_z[i] = velocity.z;
+			particles.lifetime[i] = 0.0f;
+			particles.life_length[i] = emitter.life_length;
+		}
+	}
+	return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Age and move the particles in [begin, end), four at a time, and count the
+// ones still alive
+///////////////////////////////////////////////////////////////////////////////
+static int integrate(ParticleArrays& p, int begin, int end, float dt)
+{
+	float *px = p.pos_x.data(), *py = p.pos_y.data(), *pz = p.pos_z.data();
+	const float *vx = p.vel_x.data(), *vy = p.vel_y.data(), *vz = p.vel_z.data();
+	float* lifetime = p.lifetime.data();
+	const float* life_length = p.life_length.data();
+	int alive = 0;
+	int i = begin;
+#ifdef PARTICLES_SSE2
+	static const int bit_count[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+	const __m128 delta = _mm_set1_ps(dt);
+	for(; i + 4 <= end; i += 4)
+	{
+		_mm_storeu_ps(px + i, _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(_mm_loadu_ps(vx + i), delta)));
+		_mm_storeu_ps(py + i, _mm_add_ps(_mm_loadu_ps(py + i), _mm_mul_ps(_mm_loadu_ps(vy + i), delta)));
+		_mm_storeu_ps(pz + i, _mm_add_ps(_mm_loadu_ps(pz + i), _mm_mul_ps(_mm_loadu_ps(vz + i), delta)));
+		const __m128 age = _mm_add_ps(_mm_loadu_ps(lifetime + i), delta);
+		_mm_storeu_ps(lifetime + i, age);
+		alive += bit_count[_mm_movemask_ps(_mm_cmplt_ps(age, _mm_loadu_ps(life_length + i)))];
+	}
+#endif
+	for(; i < end; i++)
+	{
+		px[i] += vx[i] * dt;
+		py[i] += vy[i] * dt;
+		pz[i] += vz[i] * dt;
+		lifetime[i] += dt;
+		alive += lifetime[i] < life_length[i] ? 1 : 0;
+	}
+	return alive;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Update: every chunk is integrated and counts its survivors, a prefix sum
+// over the counts gives each chunk where its survivors go, and the chunks
+// then copy them there in parallel. The particles keep their order, unlike
+// swapping the last one into every hole.
+///////////////////////////////////////////////////////////////////////////////
+void ParticleSystem::update(float dt)
+{
+	const int n = int(size());
+	const int chunks = (n + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	chunk_offsets.assign(size_t(chunks) + 1, 0);
+#pragma omp parallel for schedule(static) if(chunks > 1)
+	for(int c = 0; c < chunks; c++)
+	{
+		const int begin = c * CHUNK_SIZE, end = std::min(begin + CHUNK_SIZE, n);
+		chunk_offsets[c + 1] = size_t(integrate(particles, begin, end, dt));
+	}
+	for(int c = 0; c < chunks; c++)
+		chunk_offsets[c + 1] += chunk_offsets[c];
+	const size_t alive = chunk_offsets[chunks];
+	update_count++;
+	previous_index.resize(alive);
+	if(alive == size_t(n))
+	{
+#pragma omp parallel for schedule(static) if(chunks > 1)
+		for(int i = 0; i < n; i++)
+			previous_index[i] = uint32_t(i);
+		return;
+	}
+
+	compacted.resize(alive);
+	std::vector<float>*from[ParticleArrays::FIELD_COUNT], *to[ParticleArrays::FIELD_COUNT];
+	particles.fields(from);
+	compacted.fields(to);
+	const float* lifetime = particles.lifetime.data();
+	const float* life_length = particles.life_length.data();
+#pragma omp parallel for schedule(static) if(chunks > 1)
+	for(int c = 0; c < chunks; c++)
+	{
+		const int begin = c * CHUNK_SIZE, end = std::min(begin + CHUNK_SIZE, n);
+		if(chunk_offsets[c + 1] == chunk_offsets[c])
+			continue;
+		uint32_t* index = previous_index.data() + chunk_offsets[c];
+		for(int i = begin; i < end; i++)
+		{
+			if(lifetime[i] < life_length[i])
+				*index++ = uint32_t(i);
+		}
+		for(int k = 0; k < ParticleArrays::FIELD_COUNT; k++)
+		{
+			const float* src = from[k]->data();
+			float* dst = to[k]->data() + chunk_offsets[c];
+			for(int i = begin; i < end; i++)
+			{
+				if(lifetime[i] < life_length[i])
+					*dst++ = src[i];
+			}
+		}
+	}
+	particles.swap(compacted);
+}
+
+void ParticleSystem::process_particles(float dt, mat4 fighterModelMatrix) // time between the last frame
+{
+	ParticleEmitter emitter;
+	emitter.position = vec3(fighterModelMatrix * vec4(15.0f, 3.5f, 0.0f, 1.0f));
+	emitter.speed = 40.0f;
+	// The exhaust follows the fighter (direction only, the baseline also
+	// added the translation to the velocity)
+	emitter.orientation = mat3(fighterModelMatrix);
+	emitter.velocity_scale = vec3(1.0f, 0.0f, 1.0f);
+	emitter.life_length = 5.0f;
+	emit(emitter, 30);
+	update(dt);
+}
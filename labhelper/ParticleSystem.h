@@ -0,0 +1,108 @@
+#pragma once
+
+
+#include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+struct Particle
+{
+	float lifetime;
+	float life_length;
+	glm::vec3 velocity;
+	glm::vec3 pos;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Where particles are born and how they start, see ParticleSystem::emit()
+///////////////////////////////////////////////////////////////////////////////
+struct ParticleEmitter
+{
+	glm::vec3 position = glm::vec3(0.0f);
+	// Velocities are uniformly random directions at this speed, turned by
+	// orientation (e.g. the emitting model's rotation), with each component
+	// then scaled by velocity_scale (e.g. (1, 0, 1) keeps the particles in
+	// the xz plane)
+	float speed = 40.0f;
+	glm::mat3 orientation = glm::mat3(1.0f);
+	glm::vec3 velocity_scale = glm::vec3(1.0f);
+	float life_length = 5.0f;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// The particles as a structure of arrays, particle i is element i of every
+// array
+///////////////////////////////////////////////////////////////////////////////
+struct ParticleArrays
+{
+	std::vector<float> pos_x, pos_y, pos_z;
+	std::vector<float> vel_x, vel_y, vel_z;
+	std::vector<float> lifetime, life_length;
+
+	static const int FIELD_COUNT = 8;
+
+	size_t size() const
+	{
+		return lifetime.size();
+	}
+	// All the arrays above, in order
+	void fields(std::vector<float>* out[FIELD_COUNT]);
+	void resize(size_t n);
+	void swap(ParticleArrays& other);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// The particle engine of both the pathtracer and the project. Emitting and
+// updating are split into chunks that run in parallel: every chunk of new
+// particles has its own random number generator, integration is done four
+// particles at a time (with SSE where available), and the particles that
+// die are removed with a stream compaction that keeps the others in order.
+///////////////////////////////////////////////////////////////////////////////
+class ParticleSystem
+{
+public:
+	// Members
+	ParticleArrays particles;
+	// At most this many particles alive, 0 for no limit
+	int max_size;
+	// Where each particle alive after the last update() was before it, for
+	// whoever keeps data per particle across frames (like ParticleDepthOrder).
+	// Particles emitted since are not in it.
+	std::vector<uint32_t> previous_index;
+	// Calls to update() so far
+	uint32_t update_count = 0;
+	// Ctor/Dtor
+	ParticleSystem() : max_size(0)
+	{
+	}
+	explicit ParticleSystem(int size);
+	~ParticleSystem()
+	{
+	}
+	// Methods
+	size_t size() const
+	{
+		return particles.size();
+	}
+	Particle particle(size_t i) const;
+	glm::vec3 position(size_t i) const
+	{
+		return glm::vec3(particles.pos_x[i], particles.pos_y[i], particles.pos_z[i]);
+	}
+	void spawn(const Particle& particle);
+	// Spawn count particles (fewer if that would go over max_size), returns
+	// how many were spawned
+	int emit(const ParticleEmitter& emitter, int count);
+	// Age and move every particle by dt, then remove the ones that have
+	// outlived their life_length
+	void update(float dt);
+	// The clouds of the pathtracer: emits a ring of particles from the
+	// fighter, spreading in the xz plane, and updates
+	void process_particles(float dt, glm::mat4 fighterModelMatrix);
+
+private:
+	// Survivors are compacted into these, then the two are swapped
+	ParticleArrays compacted;
+	std::vector<size_t> chunk_offsets;
+	uint32_t emit_count = 0;
+};
@@ -0,0 +1,154 @@
+#include "RenderQueue.h"
+#include "Model.h"
+#include "Frustum.h"
+#include <GL/glew.h>
+#include <algorithm>
+
+namespace labhelper
+{
+void RenderQueue::submit(const Model* model, uint32_t program, uint32_t object_buffer,
+                         uint32_t object_offset, uint32_t object_size, const Frustum* frustum)
+{
+	const uint32_t object = uint32_t(objects.size());
+	objects.push_back({ object_buffer, object_offset, object_size });
+
+	std::vector<uint32_t> material_sets(model->m_materials.size());
+	for(size_t i = 0; i < model->m_materials.size(); i++)
+	{
+		const Material& material = model->m_materials[i];
+		const Texture* textures[] = { &material.m_color_texture,     &material.m_reflectivity_texture,
+			                          &material.m_metalness_texture, &material.m_fresnel_texture,
+			                          &material.m_shininess_texture, &material.m_emission_texture,
+			                          &material.m_bump_texture };
+		std::array<uint32_t, 7> ids;
+		for(int t = 0; t < 7; t++)
+			ids[t] = textures[t]->valid ? textures[t]->gl_id : 0;
+		auto set = texture_sets.insert(std::make_pair(ids, uint32_t(texture_sets.size())));
+		material_sets[i] = set.first->second;
+	}
+
+	visible.clear();
+	if(frustum)
+	{
+		cullMeshes(model, *frustum, visible);
+		culled += uint32_t(model->m_meshes.size() - visible.size());
+	}
+	else
+	{
+		for(uint32_t i = 0; i < model->m_meshes.size(); i++)
+			visible.push_back(i);
+	}
+
+	for(uint32_t mesh_idx : visible)
+	{
+		const Mesh& mesh = model->m_meshes[mesh_idx];
+		if(mesh.m_number_of_vertices == 0)
+			continue;
+		DrawItem item;
+		item.program = program;
+		item.texture_set = material_sets[mesh.m_material_idx];
+		item.model = model;
+		item.material_idx = mesh.m_material_idx;
+		item.object = object;
+		item.start_index = mesh.m_start_index;
+		item.number_of_vertices = mesh.m_number_of_vertices;
+		items.push_back(item);
+	}
+}
+
+void RenderQueue::flush()
+{
+	// Without materials, meshes only differ by model and object
+	if(!m_bind_materials)
+	{
+		for(auto& item : items)
+			item.texture_set = item.material_idx = 0;
+	}
+	std::sort(items.begin(), items.end(), [](const DrawItem& a, const DrawItem& b) {
+		if(a.program != b.program)
+			return a.program < b.program;
+		if(a.texture_set != b.texture_set)
+			return a.texture_set < b.texture_set;
+		if(a.model != b.model)
+			return a.model < b.model;
+		if(a.material_idx != b.material_idx)
+			return a.material_idx < b.material_idx;
+		if(a.object != b.object)
+			return a.object < b.object;
+		return a.start_index < b.start_index;
+	});
+	auto sameDraw = [](const DrawItem& a, const DrawItem& b) {
+		return a.program == b.program && a.model == b.model && a.material_idx == b.material_idx
+		       && a.object == b.object;
+	};
+
+	m_meshes = uint32_t(items.size());
+	m_culled_meshes = culled;
+	culled = 0;
+	m_draw_calls = 0;
+	m_state_changes = 0;
+	const DrawItem* bound = nullptr;
+	bool material_block = false;
+	for(size_t i = 0; i < items.size();)
+	{
+		const DrawItem& item = items[i];
+		const bool new_program = !bound || item.program != bound->program;
+		const bool new_textures = new_program || item.texture_set != bound->texture_set;
+		const bool new_model = new_textures || item.model != bound->model;
+		if(new_program)
+		{
+			glUseProgram(item.program);
+			m_state_changes++;
+		}
+		if(new_textures && m_bind_materials)
+		{
+			bindMaterialTextures(item.model->m_materials[item.material_idx]);
+			m_state_changes++;
+		}
+		if(new_model)
+		{
+			if(!bound || item.model != bound->model)
+			{
+				glBindVertexArray(item.model->m_vaob);
+				m_state_changes++;
+			}
+			material_block = hasMaterialBlock(item.model, item.program);
+		}
+		if(m_bind_materials && (new_model || item.material_idx != bound->material_idx))
+		{
+			bindMaterialUniforms(item.model, item.material_idx, item.program, material_block);
+			m_state_changes++;
+		}
+		const ObjectRange& object = objects[item.object];
+		if(object.size != 0 && (!bound || item.object != bound->object))
+		{
+			glBindBufferRange(GL_UNIFORM_BUFFER, m_object_binding, object.buffer, object.offset, object.size);
+			m_state_changes++;
+		}
+		bound = &item;
+
+		// All meshes with the same state, where one starts where the last ended
+		// they are drawn as one
+		firsts.clear();
+		counts.clear();
+		for(; i < items.size() && sameDraw(items[i], item); i++)
+		{
+			if(!counts.empty() && uint32_t(firsts.back() + counts.back()) == items[i].start_index)
+				counts.back() += int32_t(items[i].number_of_vertices);
+			else
+			{
+				firsts.push_back(int32_t(items[i].start_index));
+				counts.push_back(int32_t(items[i].number_of_vertices));
+			}
+		}
+		if(firsts.size() == 1)
+			glDrawArrays(GL_TRIANGLES, firsts[0], counts[0]);
+		else
+			glMultiDrawArrays(GL_TRIANGLES, firsts.data(), counts.data(), GLsizei(firsts.size()));
+		m_draw_calls++;
+	}
+
+	items.clear();
+	objects.clear();
+}
+} // namespace labhelper
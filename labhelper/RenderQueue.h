@@ -0,0 +1,74 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <array>
+#include <stdint.h>
+
+namespace labhelper
+{
+class Model;
+struct Frustum;
+
+///////////////////////////////////////////////////////////////////////////////
+// Collects the meshes of all models drawn in a frame, and draws them sorted
+// by program, textures, model and material, so each of those is bound once
+// per run of meshes that share it rather than once per mesh. The meshes of
+// a run are drawn with one glMultiDrawArrays, and meshes that lie next to
+// each other in the model's buffers are merged into one range.
+//
+// Since all meshes of a draw share their material, its MaterialUniforms are
+// bound as in render() and the shaders need no per-draw material index.
+///////////////////////////////////////////////////////////////////////////////
+class RenderQueue
+{
+public:
+	// The uniform block binding object ranges are bound to, see submit()
+	uint32_t m_object_binding = 1;
+	// Off for depth-only passes, such as shadow maps, which need no textures
+	// or material uniforms
+	bool m_bind_materials = true;
+	// What the last flush() did: the meshes it drew (and those culled before),
+	// in how many draw calls, and how many programs, textures, vertex arrays
+	// and uniform ranges it bound
+	uint32_t m_meshes = 0;
+	uint32_t m_culled_meshes = 0;
+	uint32_t m_draw_calls = 0;
+	uint32_t m_state_changes = 0;
+
+	// Queue all meshes of model to be drawn with program. object_buffer is a
+	// uniform buffer with the model's per-object uniforms at object_offset,
+	// object_size bytes, which is bound to m_object_binding for its meshes (0
+	// to leave the binding alone). It has to keep them until flush(). With a
+	// frustum (from the model's model-view-projection matrix), only the
+	// meshes that may be inside it are queued.
+	void submit(const Model* model, uint32_t program, uint32_t object_buffer = 0,
+	            uint32_t object_offset = 0, uint32_t object_size = 0, const Frustum* frustum = nullptr);
+	// Draw and clear everything submitted
+	void flush();
+
+private:
+	struct DrawItem
+	{
+		uint32_t program;
+		uint32_t texture_set;
+		const Model* model;
+		uint32_t material_idx;
+		uint32_t object;
+		uint32_t start_index;
+		uint32_t number_of_vertices;
+	};
+	struct ObjectRange
+	{
+		uint32_t buffer, offset, size;
+	};
+	std::vector<DrawItem> items;
+	std::vector<ObjectRange> objects;
+	// Texture ids (0 where there is none) of the materials seen so far, and
+	// the number they are sorted by
+	std::map<std::array<uint32_t, 7>, uint32_t> texture_sets;
+	std::vector<uint32_t> visible;
+	uint32_t culled = 0;
+	std::vector<int32_t> firsts;
+	std::vector<int32_t> counts;
+};
+} // namespace labhelper
@@ -27,6 +27,7 @@
 #include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <unordered_map>
 
 #include <string>
 #include <fstream>
@@ -551,8 +552,74 @@ GLuint loadShaderProgram(const std::string& vertexShader, const std::string& fra
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+// The uniforms of every program asked about so far, see getUniformLocation()
+///////////////////////////////////////////////////////////////////////////////
+struct ProgramUniforms
+{
+	std::unordered_map<std::string, GLint> locations;
+	std::unordered_map<std::string, GLuint> blocks;
+};
+static std::unordered_map<GLuint, ProgramUniforms> program_uniforms;
+
+static const ProgramUniforms& getProgramUniforms(GLuint shaderProgram)
+{
+	auto cached = program_uniforms.find(shaderProgram);
+	if(cached != program_uniforms.end())
+		return cached->second;
+
+	ProgramUniforms& uniforms = program_uniforms[shaderProgram];
+	GLint count = 0, max_length = 0;
+	glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	std::vector<char> name(std::max(max_length, 1));
+	for(GLint i = 0; i < count; i++)
+	{
+		GLint size;
+		GLenum type;
+		GLsizei length = 0;
+		glGetActiveUniform(shaderProgram, GLuint(i), GLsizei(name.size()), &length, &size, &type, name.data());
+		const std::string uniform(name.data(), length);
+		// Uniforms in blocks have no location
+		const GLint location = glGetUniformLocation(shaderProgram, uniform.c_str());
+		if(location < 0)
+			continue;
+		uniforms.locations[uniform] = location;
+		// Arrays are listed as "name[0]", and set by "name"
+		const size_t bracket = uniform.find('[');
+		if(bracket != std::string::npos)
+			uniforms.locations[uniform.substr(0, bracket)] = location;
+	}
+
+	glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+	glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_length);
+	name.resize(std::max(max_length, 1));
+	for(GLint i = 0; i < count; i++)
+	{
+		GLsizei length = 0;
+		glGetActiveUniformBlockName(shaderProgram, GLuint(i), GLsizei(name.size()), &length, name.data());
+		uniforms.blocks[std::string(name.data(), length)] = GLuint(i);
+	}
+	return uniforms;
+}
+
+GLint getUniformLocation(GLuint shaderProgram, const char* name)
+{
+	const ProgramUniforms& uniforms = getProgramUniforms(shaderProgram);
+	auto location = uniforms.locations.find(name);
+	return location != uniforms.locations.end() ? location->second : -1;
+}
+
+GLuint getUniformBlockIndex(GLuint shaderProgram, const char* name)
+{
+	const ProgramUniforms& uniforms = getProgramUniforms(shaderProgram);
+	auto block = uniforms.blocks.find(name);
+	return block != uniforms.blocks.end() ? block->second : GL_INVALID_INDEX;
+}
+
 bool linkShaderProgram(GLuint shaderProgram, bool allow_errors)
 {
+	program_uniforms.erase(shaderProgram);
 	glLinkProgram(shaderProgram);
 	GLint linkOk = 0;
 	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &linkOk);
@@ -619,6 +686,27 @@ void setUniformSlow(GLuint shaderProgram, const char* name, const uint32_t nof_v
 	glUniform3fv(glGetUniformLocation(shaderProgram, name), nof_values, (float*)values);
 }
 
+void setUniform(GLuint shaderProgram, const char* name, const glm::mat4& matrix)
+{
+	glUniformMatrix4fv(getUniformLocation(shaderProgram, name), 1, false, &matrix[0].x);
+}
+void setUniform(GLuint shaderProgram, const char* name, const float value)
+{
+	glUniform1f(getUniformLocation(shaderProgram, name), value);
+}
+void setUniform(GLuint shaderProgram, const char* name, const GLint value)
+{
+	glUniform1i(getUniformLocation(shaderProgram, name), value);
+}
+void setUniform(GLuint shaderProgram, const char* name, const glm::vec3& value)
+{
+	glUniform3fv(getUniformLocation(shaderProgram, name), 1, &value.x);
+}
+void setUniform(GLuint shaderProgram, const char* name, const uint32_t nof_values, const glm::vec3* values)
+{
+	glUniform3fv(getUniformLocation(shaderProgram, name), nof_values, (float*)values);
+}
+
 void debugDrawLine(const glm::mat4& viewMatrix,
                    const glm::mat4& projectionMatrix,
                    const glm::vec3& worldSpaceLightPos)
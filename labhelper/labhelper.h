@@ -140,6 +140,25 @@ void setUniformSlow(GLuint shaderProgram, const char* name, const GLint value);
 void setUniformSlow(GLuint shaderProgram, const char* name, const glm::vec3& value);
 void setUniformSlow(GLuint shaderProgram, const char* name, const uint32_t nof_values, const glm::vec3* values);
 
+/**
+	 * Uniform locations and uniform block indices by name, from a cache per program. The first time a
+	 * program is asked about, all its active uniforms and blocks are read into the cache, so there are no
+	 * more calls to GL after that. Linking the program again (with linkShaderProgram) clears its cache.
+	 * Returns -1 (GL_INVALID_INDEX for blocks) if the program has no active uniform by that name.
+	 */
+GLint getUniformLocation(GLuint shaderProgram, const char* name);
+GLuint getUniformBlockIndex(GLuint shaderProgram, const char* name);
+
+/**
+	 * Like setUniformSlow, with the location from getUniformLocation(). For data that changes per frame or
+	 * per object, uniform buffers are still better.
+	 */
+void setUniform(GLuint shaderProgram, const char* name, const glm::mat4& matrix);
+void setUniform(GLuint shaderProgram, const char* name, const float value);
+void setUniform(GLuint shaderProgram, const char* name, const GLint value);
+void setUniform(GLuint shaderProgram, const char* name, const glm::vec3& value);
+void setUniform(GLuint shaderProgram, const char* name, const uint32_t nof_values, const glm::vec3* values);
+
 /**
 	* Helper to draw a single quad (two triangles) that cover the entire screen
 	*/
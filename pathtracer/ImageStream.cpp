@@ -0,0 +1,108 @@
+#include "ImageStream.h"
+
+///////////////////////////////////////////////////////////////////////////
+// (Re)create the texture and the buffers for a new image size
+///////////////////////////////////////////////////////////////////////////
+void ImageStream::allocate(int w, int h)
+{
+	release();
+	width = w;
+	height = h;
+	GLsizeiptr size = GLsizeiptr(w) * h * 4;
+
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	if(GLEW_ARB_texture_storage)
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, w, h);
+	else
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	persistent = GLEW_ARB_buffer_storage != 0;
+	glGenBuffers(RING_SIZE, buffers);
+	for(int i = 0; i < RING_SIZE; i++)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i]);
+		if(persistent)
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+			mapped[i] = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+		}
+		else
+		{
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	current = 0;
+}
+
+void ImageStream::release()
+{
+	for(int i = 0; i < RING_SIZE; i++)
+	{
+		if(fences[i] != nullptr)
+			glDeleteSync(fences[i]);
+		fences[i] = nullptr;
+		if(persistent && mapped[i] != nullptr)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i]);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		mapped[i] = nullptr;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if(buffers[0] != 0)
+		glDeleteBuffers(RING_SIZE, buffers);
+	for(int i = 0; i < RING_SIZE; i++)
+		buffers[i] = 0;
+	if(texture != 0)
+		glDeleteTextures(1, &texture);
+	texture = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Get memory for the next image. Waits (if at all) only for the upload
+// that used this slot RING_SIZE frames ago.
+///////////////////////////////////////////////////////////////////////////
+uint8_t* ImageStream::beginUpdate(int w, int h)
+{
+	if(w != width || h != height || texture == 0)
+		allocate(w, h);
+
+	current = (current + 1) % RING_SIZE;
+	GLsizeiptr size = GLsizeiptr(width) * height * 4;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[current]);
+	if(persistent)
+	{
+		if(fences[current] != nullptr)
+		{
+			glClientWaitSync(fences[current], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+			glDeleteSync(fences[current]);
+			fences[current] = nullptr;
+		}
+		return mapped[current];
+	}
+	return (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+	                                  GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Copy the image written since beginUpdate() into the texture
+///////////////////////////////////////////////////////////////////////////
+void ImageStream::endUpdate()
+{
+	// beginUpdate() left the buffer bound
+	if(!persistent)
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	if(persistent)
+		fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
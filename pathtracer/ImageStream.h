@@ -0,0 +1,35 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////
+// Streams RGBA8 images into an immutable texture through a ring of pixel
+// buffer objects. With GL_ARB_buffer_storage the buffers are persistently
+// mapped and guarded by fences, otherwise they are orphaned and mapped
+// each frame.
+//
+// Usage: ptr = beginUpdate(w, h); write w * h * 4 bytes; endUpdate();
+///////////////////////////////////////////////////////////////////////////
+class ImageStream
+{
+public:
+	static const int RING_SIZE = 3;
+
+	GLuint texture = 0;
+	int width = 0;
+	int height = 0;
+
+	uint8_t* beginUpdate(int w, int h);
+	void endUpdate();
+	// Free the GL objects (must be called while the context is alive)
+	void release();
+
+private:
+	bool persistent = false;
+	GLuint buffers[RING_SIZE] = {};
+	GLsync fences[RING_SIZE] = {};
+	uint8_t* mapped[RING_SIZE] = {};
+	int current = 0;
+
+	void allocate(int w, int h);
+};
@@ -4,11 +4,16 @@
 namespace pathtracer
 {
 	std::pair<vec3, vec3> DiskLight::sample()
+	{
+		return sample(randf(), randf());
+	}
+
+	std::pair<vec3, vec3> DiskLight::sample(float u1, float u2) const
 	{
 		float diskSampleX;
 		float diskSampleY;
 
-		concentricSampleDisk(&diskSampleX, &diskSampleY);
+		concentricSampleDisk(u1, u2, &diskSampleX, &diskSampleY);
 
 		vec3 diskSample = vec3(diskSampleX * radius, 0.0f, diskSampleY * radius) + position;
 
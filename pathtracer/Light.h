@@ -31,6 +31,8 @@ class DiskLight : public AreaLight
 public:
 	float radius;
 	virtual std::pair<vec3, vec3> sample();
+	// The point for u1, u2 in [0,1) (for stratified samples), and its color
+	std::pair<vec3, vec3> sample(float u1, float u2) const;
 };
 
 class QuadLight : public AreaLight
@@ -1,9 +1,15 @@
 #include "Noise.h"
+#include "noise_lattice.h"
 #include <stdlib.h> 
 #include <cmath>
 #include <random>
 #include <algorithm>
 #include <numeric>
+#include <chrono>
+#include <functional>
+
+using namespace glm;
+using namespace pathtracer;
 
 Noise::Noise(int seed)
 {
@@ -20,6 +26,10 @@ Noise::Noise(int seed)
 
 	// Duplicate the permutation vector
 	p.insert(p.end(), p.begin(), p.end());
+
+	// Seed of the float noise
+	seed_hash = uint32_t(seed) * noise_lattice::MIX;
+	seed_hash ^= seed_hash >> 16;
 }
 
 
@@ -82,3 +92,282 @@ double Noise::grad(int hash, double x, double y, double z)
 		v = h < 4 ? y : h == 12 || h == 14 ? x : z;
 	return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// Float noise (see noise_lattice.h)
+///////////////////////////////////////////////////////////////////////////////
+static float perlinLattice(const vec3& x, uint32_t seed, vec3* gradient)
+{
+	using namespace noise_lattice;
+	const vec3 cell = floor(x);
+	const vec3 f = x - cell;
+	const uint32_t xa = uint32_t(int32_t(cell.x)) * PRIME_X, xb = xa + PRIME_X;
+	const uint32_t ya = uint32_t(int32_t(cell.y)) * PRIME_Y, yb = ya + PRIME_Y;
+	const uint32_t za = uint32_t(int32_t(cell.z)) * PRIME_Z, zb = za + PRIME_Z;
+
+	// Gradients and their values at the corners, corner c is at
+	// (c & 1, (c >> 1) & 1, c >> 2)
+	vec3 g[8];
+	float v[8];
+	for(int c = 0; c < 8; c++)
+	{
+		uint32_t h = seed ^ ((c & 1) ? xb : xa) ^ ((c & 2) ? yb : ya) ^ ((c & 4) ? zb : za);
+		h = (h ^ (h >> 16)) * MIX;
+		const int i = int(h >> 28);
+		g[c] = vec3(GRADIENT_X[i], GRADIENT_Y[i], GRADIENT_Z[i]);
+		v[c] = dot(g[c], f - vec3(float(c & 1), float((c >> 1) & 1), float(c >> 2)));
+	}
+
+	// The trilinear interpolation written as a polynomial in the faded
+	// coordinates, so that it is easy to differentiate
+	const vec3 u = f * f * f * (f * (f * 6.0f - 15.0f) + 10.0f);
+	const float k1 = v[1] - v[0];
+	const float k2 = v[2] - v[0];
+	const float k3 = v[4] - v[0];
+	const float k4 = v[0] - v[1] - v[2] + v[3];
+	const float k5 = v[0] - v[2] - v[4] + v[6];
+	const float k6 = v[0] - v[1] - v[4] + v[5];
+	const float k7 = -v[0] + v[1] + v[2] - v[3] + v[4] - v[5] - v[6] + v[7];
+	if(gradient)
+	{
+		const vec3 du = 30.0f * f * f * (f * (f - 2.0f) + 1.0f);
+		vec3 d = g[0] + u.x * (g[1] - g[0]) + u.y * (g[2] - g[0]) + u.z * (g[4] - g[0])
+		         + u.x * u.y * (g[0] - g[1] - g[2] + g[3]) + u.y * u.z * (g[0] - g[2] - g[4] + g[6])
+		         + u.z * u.x * (g[0] - g[1] - g[4] + g[5])
+		         + u.x * u.y * u.z * (-g[0] + g[1] + g[2] - g[3] + g[4] - g[5] - g[6] + g[7]);
+		d += du * vec3(k1 + k4 * u.y + k6 * u.z + k7 * u.y * u.z, k2 + k5 * u.z + k4 * u.x + k7 * u.z * u.x,
+		               k3 + k6 * u.x + k5 * u.y + k7 * u.x * u.y);
+		*gradient = d;
+	}
+	return v[0] + k1 * u.x + k2 * u.y + k3 * u.z + k4 * u.x * u.y + k5 * u.y * u.z + k6 * u.z * u.x
+	       + k7 * u.x * u.y * u.z;
+}
+
+static float octavesLattice(const vec3& x, uint32_t seed, const NoiseOctaves& octaves, bool ridged,
+                            vec3* gradient)
+{
+	float sum = 0.0f;
+	vec3 d_sum(0.0f);
+	float amplitude = 1.0f;
+	float frequency = octaves.frequency;
+	for(int i = 0; i < octaves.octaves; i++)
+	{
+		vec3 d(0.0f);
+		float n = perlinLattice(x * frequency, seed + uint32_t(i) * noise_lattice::OCTAVE_SEED,
+		                        gradient ? &d : nullptr);
+		if(ridged)
+		{
+			const float r = 1.0f - abs(n);
+			d *= -2.0f * r * sign(n);
+			n = r * r;
+		}
+		sum += amplitude * n;
+		d_sum += (amplitude * frequency) * d;
+		amplitude *= octaves.gain;
+		frequency *= octaves.lacunarity;
+	}
+	if(gradient)
+		*gradient = d_sum;
+	return sum;
+}
+
+float Noise::perlin(const vec3& x, vec3* gradient) const
+{
+	return perlinLattice(x, seed_hash, gradient);
+}
+
+float Noise::fbm(const vec3& x, const NoiseOctaves& octaves, vec3* gradient) const
+{
+	return octavesLattice(x, seed_hash, octaves, false, gradient);
+}
+
+float Noise::ridged(const vec3& x, const NoiseOctaves& octaves, vec3* gradient) const
+{
+	return octavesLattice(x, seed_hash, octaves, true, gradient);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Batched float noise
+///////////////////////////////////////////////////////////////////////////////
+static SimdLevel batchLevel(SimdLevel requested)
+{
+	if(requested >= SIMD_AVX2 && DistributionsSoA::supportedLevel() >= SIMD_AVX2)
+		return SIMD_AVX2;
+	return SIMD_SCALAR;
+}
+
+static SimdLevel noise_level = batchLevel(SIMD_AVX2);
+
+SimdLevel Noise::level()
+{
+	return noise_level;
+}
+
+void Noise::setLevel(SimdLevel level)
+{
+	noise_level = batchLevel(level);
+}
+
+const char* Noise::levelName(SimdLevel level)
+{
+	return level == SIMD_AVX2 ? "AVX2" : "Scalar";
+}
+
+static void octavesBatch(int count, Vec3SoA x, uint32_t seed, const NoiseOctaves& octaves, bool ridged,
+                         float* value, const Vec3SoAOut* gradient)
+{
+#ifdef PATHTRACER_SIMD_X86
+	if(noise_level == SIMD_AVX2)
+	{
+		simd_avx2::noiseOctaves(count, x, seed, octaves, ridged, value, gradient);
+		return;
+	}
+#endif
+	for(int i = 0; i < count; i++)
+	{
+		vec3 d;
+		value[i] = octavesLattice(vec3(x.x[i], x.y[i], x.z[i]), seed, octaves, ridged, gradient ? &d : nullptr);
+		if(gradient)
+		{
+			gradient->x[i] = d.x;
+			gradient->y[i] = d.y;
+			gradient->z[i] = d.z;
+		}
+	}
+}
+
+void Noise::perlin(int count, Vec3SoA x, float* value, const Vec3SoAOut* gradient) const
+{
+	NoiseOctaves one;
+	one.octaves = 1;
+	octavesBatch(count, x, seed_hash, one, false, value, gradient);
+}
+
+void Noise::fbm(int count, Vec3SoA x, const NoiseOctaves& octaves, float* value, const Vec3SoAOut* gradient) const
+{
+	octavesBatch(count, x, seed_hash, octaves, false, value, gradient);
+}
+
+void Noise::ridged(int count, Vec3SoA x, const NoiseOctaves& octaves, float* value,
+                   const Vec3SoAOut* gradient) const
+{
+	octavesBatch(count, x, seed_hash, octaves, true, value, gradient);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Microbenchmark of the old double noise against the float noise
+///////////////////////////////////////////////////////////////////////////////
+NoiseBenchmark benchmarkNoise(int points)
+{
+	typedef std::chrono::high_resolution_clock clock;
+	auto mpoints = [points](clock::time_point start) {
+		float ms = std::chrono::duration<float, std::milli>(clock::now() - start).count();
+		return float(points) / (1000.0f * std::max(ms, 1e-3f));
+	};
+
+	Noise noise(1);
+	std::vector<float> x(points), y(points), z(points), scalar(points), batch(points);
+	std::mt19937 engine(1);
+	std::uniform_real_distribution<float> coordinate(0.0f, 64.0f);
+	for(int i = 0; i < points; i++)
+	{
+		x[i] = coordinate(engine);
+		y[i] = coordinate(engine);
+		z[i] = coordinate(engine);
+	}
+	Vec3SoA soa = { x.data(), y.data(), z.data() };
+	NoiseOctaves octaves;
+
+	NoiseBenchmark result;
+	result.points = points;
+	result.fbm_octaves = octaves.octaves;
+	result.batch_level = Noise::level();
+
+	auto start = clock::now();
+	for(int i = 0; i < points; i++)
+		scalar[i] = float(noise.getNoise(x[i], y[i], z[i]));
+	result.double_mpoints = mpoints(start);
+
+	start = clock::now();
+	for(int i = 0; i < points; i++)
+		scalar[i] = noise.perlin(vec3(x[i], y[i], z[i]));
+	result.perlin_mpoints = mpoints(start);
+
+	start = clock::now();
+	noise.perlin(points, soa, batch.data());
+	result.perlin_batch_mpoints = mpoints(start);
+
+	result.max_batch_error = 0.0f;
+	for(int i = 0; i < points; i++)
+		result.max_batch_error = std::max(result.max_batch_error, abs(batch[i] - scalar[i]));
+
+	start = clock::now();
+	for(int i = 0; i < points; i++)
+		scalar[i] = noise.fbm(vec3(x[i], y[i], z[i]), octaves);
+	result.fbm_mpoints = mpoints(start);
+
+	start = clock::now();
+	noise.fbm(points, soa, octaves, batch.data());
+	result.fbm_batch_mpoints = mpoints(start);
+
+	for(int i = 0; i < points; i++)
+		result.max_batch_error = std::max(result.max_batch_error, abs(batch[i] - scalar[i]));
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Batched against scalar noise
+///////////////////////////////////////////////////////////////////////////////
+float testNoiseBatch(int points)
+{
+	Noise noise(7);
+	std::vector<float> x(points), y(points), z(points);
+	std::mt19937 engine(7);
+	std::uniform_real_distribution<float> coordinate(-64.0f, 64.0f);
+	for(int i = 0; i < points; i++)
+	{
+		x[i] = coordinate(engine);
+		y[i] = coordinate(engine);
+		z[i] = coordinate(engine);
+		// Every fourth point on a lattice plane
+		if(i % 4 == 0)
+			y[i] = std::floor(y[i]);
+	}
+	Vec3SoA soa = { x.data(), y.data(), z.data() };
+
+	std::vector<float> value(points), gx(points), gy(points), gz(points);
+	Vec3SoAOut gradient = { gx.data(), gy.data(), gz.data() };
+	float max_error = 0.0f;
+	auto compare = [&max_error](float batch, float scalar) {
+		float error = abs(batch - scalar) / std::max(1.0f, abs(scalar));
+		// A NaN in either is a failure too
+		max_error = (error <= max_error) ? max_error : (error == error ? error : INFINITY);
+	};
+	auto compareAll = [&](const std::function<float(const vec3&, vec3*)>& scalar) {
+		for(int i = 0; i < points; i++)
+		{
+			vec3 d;
+			compare(value[i], scalar(vec3(x[i], y[i], z[i]), &d));
+			compare(gx[i], d.x);
+			compare(gy[i], d.y);
+			compare(gz[i], d.z);
+		}
+	};
+
+	NoiseOctaves octaves;
+	octaves.octaves = 5;
+	octaves.frequency = 0.3f;
+
+	noise.perlin(points, soa, value.data(), &gradient);
+	compareAll([&](const vec3& p, vec3* d) { return noise.perlin(p, d); });
+	noise.fbm(points, soa, octaves, value.data(), &gradient);
+	compareAll([&](const vec3& p, vec3* d) { return noise.fbm(p, octaves, d); });
+	noise.ridged(points, soa, octaves, value.data(), &gradient);
+	compareAll([&](const vec3& p, vec3* d) { return noise.ridged(p, octaves, d); });
+
+	// Without gradients
+	noise.fbm(points, soa, octaves, value.data());
+	for(int i = 0; i < points; i++)
+		compare(value[i], noise.fbm(vec3(x[i], y[i], z[i]), octaves));
+	return max_error;
+}
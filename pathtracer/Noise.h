@@ -1,5 +1,22 @@
 #pragma once
 #include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>
+#include "distributions_batch.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// The octaves summed by Noise::fbm() and Noise::ridged(). Every octave is
+// lacunarity times the frequency and gain times the amplitude of the one
+// before, the first has amplitude one.
+///////////////////////////////////////////////////////////////////////////////
+struct NoiseOctaves
+{
+	int octaves = 4;
+	float frequency = 1.0f;
+	float lacunarity = 2.0f;
+	float gain = 0.5f;
+};
+
 class Noise
 {
 	// based on:
@@ -11,9 +28,67 @@ public:
 	~Noise();
 	double getNoise(double x, double y, double z);
 	static float getPerlingNoise(float x, float y);
+
+	///////////////////////////////////////////////////////////////////////////
+	// Float gradient noise, in about [-1, 1]. The gradient of the lattice
+	// point is picked by hashing its coordinates with the seed (rather than
+	// through p), so the batched versions need no gathers. Writes the
+	// derivative to gradient if it is not null.
+	///////////////////////////////////////////////////////////////////////////
+	float perlin(const glm::vec3& x, glm::vec3* gradient = nullptr) const;
+	// Sum of octaves of perlin()
+	float fbm(const glm::vec3& x, const NoiseOctaves& octaves, glm::vec3* gradient = nullptr) const;
+	// Sum of octaves of (1 - |perlin()|)^2, sharp ridges where it is zero
+	float ridged(const glm::vec3& x, const NoiseOctaves& octaves, glm::vec3* gradient = nullptr) const;
+
+	///////////////////////////////////////////////////////////////////////////
+	// The same for count points at once, 8 at a time with AVX2 if the CPU
+	// supports it. gradient can be null.
+	///////////////////////////////////////////////////////////////////////////
+	void perlin(int count, pathtracer::Vec3SoA x, float* value,
+	            const pathtracer::Vec3SoAOut* gradient = nullptr) const;
+	void fbm(int count, pathtracer::Vec3SoA x, const NoiseOctaves& octaves, float* value,
+	         const pathtracer::Vec3SoAOut* gradient = nullptr) const;
+	void ridged(int count, pathtracer::Vec3SoA x, const NoiseOctaves& octaves, float* value,
+	            const pathtracer::Vec3SoAOut* gradient = nullptr) const;
+
+	// The instruction set of the batched functions (SIMD_AVX2 or SIMD_SCALAR)
+	static pathtracer::SimdLevel level();
+	// "AVX2" or "Scalar", for the levels the batched noise can run at
+	static const char* levelName(pathtracer::SimdLevel level);
+	// Force the scalar loop, e.g. to compare throughput
+	static void setLevel(pathtracer::SimdLevel level);
 private:
 	double fade(double t);
 	double lerp(double t, double a, double b);
 	double grad(int hash, double x, double y, double z);
+
+	uint32_t seed_hash;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Points per second (in millions) of getNoise(), perlin() and fbm() one
+// point at a time and batched, and the largest difference between the
+// batched and one-at-a-time results
+///////////////////////////////////////////////////////////////////////////////
+struct NoiseBenchmark
+{
+	int points;
+	int fbm_octaves;
+	pathtracer::SimdLevel batch_level;
+	float double_mpoints;
+	float perlin_mpoints;
+	float perlin_batch_mpoints;
+	float fbm_mpoints;
+	float fbm_batch_mpoints;
+	float max_batch_error;
 };
+NoiseBenchmark benchmarkNoise(int points);
 
+///////////////////////////////////////////////////////////////////////////////
+// Check the batched noise (at the current level) against the one point at a
+// time functions: perlin(), fbm() and ridged(), values and gradients. The
+// points include integer coordinates (lattice planes) and negative ones.
+// Returns the largest difference, relative to the magnitude when above one.
+///////////////////////////////////////////////////////////////////////////////
+float testNoiseBatch(int points);
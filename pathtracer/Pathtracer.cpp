@@ -3,9 +3,17 @@
 #include <iostream>
 #include <map>
 #include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cfloat>
 #include "material.h"
+#include "bsdf.h"
 #include "embree_copy.h"
 #include "sampling.h"
+#include "medium.h"
 #include "Model.h"
 
 
@@ -25,13 +33,81 @@ namespace pathtracer
 	SphereLight sphere_light[1];
 	CameraSettings cam_settings;
 
+	// Upper limit of settings.light_samples (shadow rays per hit)
+	static const int MAX_LIGHT_SAMPLES = 16;
+	// Shadow rays end this fraction of their length before the light, so
+	// they do not hit the light's own geometry
+	static const float SHADOW_RAY_SHORTENING = 1e-3f;
+
+	///////////////////////////////////////////////////////////////////////////
+	// Requests from the UI thread. Every change that invalidates the image
+	// bumps requested_version, the render thread picks up the latest one
+	// before its next pass.
+	///////////////////////////////////////////////////////////////////////////
+	static std::mutex request_mutex;
+	static std::condition_variable request_cv;
+	static uint64_t requested_version = 0;
+	static int requested_width = 0, requested_height = 0;
+	static mat4 requested_V, requested_P;
+	// Copies of settings, cam_settings and environment.multiplier, which
+	// belong to the UI thread
+	static Settings requested_settings;
+	static CameraSettings requested_cam_settings;
+	static float requested_environment_multiplier = 1.0f;
+	// Mirror of requested_version that can be polled without the lock
+	static std::atomic<uint64_t> latest_version(0);
+	static std::atomic<bool> stop_requested(false);
+	static std::thread render_thread;
+
+	///////////////////////////////////////////////////////////////////////////
+	// Render thread state. The settings are copied when a restart is picked
+	// up (see copyProgressSettings() for the exceptions), so that a pass
+	// never sees a half edited setting.
+	///////////////////////////////////////////////////////////////////////////
+	static uint64_t active_version = 0;
+	static Settings active_settings;
+	static CameraSettings active_cam_settings;
+	static float active_environment_multiplier = 1.0f;
+
+	///////////////////////////////////////////////////////////////////////////
+	// Triple buffer of completed passes. The render thread fills `back` and
+	// swaps it with `ready`, the UI thread swaps `ready` with `front`.
+	///////////////////////////////////////////////////////////////////////////
+	static Image framebuffers[3];
+	static int back_buffer = 0, ready_buffer = 1, front_buffer = 2;
+	static bool ready_is_new = false;
+	static std::mutex publish_mutex;
+
+	// Must be called with request_mutex held
+	static void copySettings()
+	{
+		requested_settings = settings;
+		requested_cam_settings = cam_settings;
+		requested_environment_multiplier = environment.multiplier;
+	}
+
+	// Must be called with request_mutex held
+	static void bumpVersion()
+	{
+		requested_version++;
+		latest_version.store(requested_version);
+		request_cv.notify_one();
+	}
+
+	static inline bool restartPending()
+	{
+		return latest_version.load(std::memory_order_relaxed) != active_version
+		       || stop_requested.load(std::memory_order_relaxed);
+	}
+
 	///////////////////////////////////////////////////////////////////////////
 	// Restart rendering of image
 	///////////////////////////////////////////////////////////////////////////
 	void restart()
 	{
-		// No need to clear image,
-		rendered_image.number_of_samples = 0;
+		std::lock_guard<std::mutex> lock(request_mutex);
+		copySettings();
+		bumpVersion();
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -40,10 +116,28 @@ namespace pathtracer
 	///////////////////////////////////////////////////////////////////////////
 	void resize(int w, int h)
 	{
-		rendered_image.width = w / settings.subsampling;
-		rendered_image.height = h / settings.subsampling;
-		rendered_image.data.resize(rendered_image.width * rendered_image.height);
-		restart();
+		std::lock_guard<std::mutex> lock(request_mutex);
+		requested_width = w / settings.subsampling;
+		requested_height = h / settings.subsampling;
+		copySettings();
+		bumpVersion();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Hand the camera over to the render thread, restarts if it moved. The
+	// settings that need no restart (e.g. max paths per pixel) are passed
+	// on here too.
+	///////////////////////////////////////////////////////////////////////////
+	void setCamera(const mat4& V, const mat4& P)
+	{
+		std::lock_guard<std::mutex> lock(request_mutex);
+		copySettings();
+		if (V != requested_V || P != requested_P)
+		{
+			requested_V = V;
+			requested_P = P;
+			bumpVersion();
+		}
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -60,43 +154,144 @@ namespace pathtracer
 		if (isnan(lookup.x) || isnan(lookup.y)) {
 			int x = 0;
 		}
-		return environment.multiplier * environment.map.sample(lookup.x, lookup.y);
+		return active_environment_multiplier * environment.map.sample(lookup.x, lookup.y);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Next event estimation: light_samples points stratified over the disk
+	// light, seen from p. Fills in the shadow rays (which end just short of
+	// the light), the directions to the light and the light arriving along
+	// them (divided by the number of samples). Samples on the back of the
+	// light, or below the plane of n unless n is zero, add nothing and are
+	// left out. Returns the number of samples filled in.
+	///////////////////////////////////////////////////////////////////////////
+	static int sampleLight(const vec3& p, const vec3& shadow_origin, const vec3& n, Ray shadow_rays[], vec3 wi[],
+	                       vec3 light_L[])
+	{
+		/*SphereLight light = sphere_light[0];
+		std::pair<vec3, vec3> light_sample = light.sample(hit.position);*/
+		const DiskLight& light = disk_light[0];
+		const int num_light_samples = clamp(active_settings.light_samples, 1, MAX_LIGHT_SAMPLES);
+		const float area = M_PI * (light.radius * light.radius);
+		const bool one_sided = n != vec3(0.0f);
+		int count = 0;
+		for (int i = 0; i < num_light_samples; i++)
+		{
+			vec2 u = stratifiedSample2D(i, num_light_samples);
+			std::pair<vec3, vec3> light_sample = light.sample(u.x, u.y);
+			vec3 shapeSample = light_sample.first;
+			vec3 lightColor = light_sample.second;
+
+			const float distance_to_light = length(shapeSample - p);
+			const vec3 w = (shapeSample - p) / distance_to_light;
+			const float cos_light = dot(-w, light.normal);
+			if (cos_light <= 0.0f || (one_sided && dot(w, n) <= 0.0f))
+				continue;
+
+			const float falloff_factor = 1.0f / (distance_to_light * distance_to_light);
+			vec3 Li = 2 * light.intensity_multiplier * lightColor * falloff_factor * cos_light * area;
+			Li /= 500.0f;
+			light_L[count] = Li / float(num_light_samples);
+			wi[count] = w;
+
+			// Stop just short of the light instead of searching past it
+			const vec3 to_light = shapeSample - shadow_origin;
+			const float shadow_distance = length(to_light);
+			shadow_rays[count] =
+			    Ray(shadow_origin, to_light / shadow_distance, 0.0f, shadow_distance * (1.0f - SHADOW_RAY_SHORTENING));
+			count++;
+		}
+		return count;
 	}
 
 	///////////////////////////////////////////////////////////////////////////
-	// Calculate the radiance going from one point (r.hitPosition()) in one
-	// direction (-r.d), through path tracing.
+	// How much light gets through each shadow ray: 0 if it is blocked by a
+	// surface, otherwise the transmittance of the media along it. The rays
+	// are traced together as one stream.
 	///////////////////////////////////////////////////////////////////////////
-	vec3 Li(Ray& primary_ray)
+	static void traceShadowRays(Ray shadow_rays[], int count, float visibility[])
+	{
+		occluded(shadow_rays, count);
+		const bool media = active_settings.media && hasMedia();
+		for (int i = 0; i < count; i++)
+		{
+			if (shadow_rays[i].geomID != RTC_INVALID_GEOMETRY_ID)
+				visibility[i] = 0.0f;
+			else
+				visibility[i] = media ? mediaTransmittance(shadow_rays[i]) : 1.0f;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Calculate the radiance arriving along primary_ray (from the point it
+	// hit, if hit_surface, or from the environment) through path tracing.
+	// Media along the way scatter the path with delta tracking.
+	///////////////////////////////////////////////////////////////////////////
+	vec3 Li(Ray& primary_ray, bool hit_surface)
 	{
 		vec3 L = vec3(0.0f);
 		vec3 path_throughput = vec3(1.0);
 		Ray current_ray = primary_ray;
+		const bool media = active_settings.media && hasMedia();
+		Ray shadow_rays[MAX_LIGHT_SAMPLES];
+		vec3 light_wi[MAX_LIGHT_SAMPLES];
+		vec3 light_L[MAX_LIGHT_SAMPLES];
+		float visibility[MAX_LIGHT_SAMPLES];
+
+		for (int bounces = 0; bounces <= active_settings.max_bounces; bounces++) {
+
+			///////////////////////////////////////////////////////////////
+			// Scattering in a medium before the surface (or escaping)
+			///////////////////////////////////////////////////////////////
+			MediumScatter scatter;
+			if (media && sampleMediumScatter(current_ray, hit_surface ? current_ray.tfar : FLT_MAX, scatter))
+			{
+				const Medium& medium = *scatter.medium;
+				const vec3 p = current_ray.o + scatter.t * current_ray.d;
+				path_throughput *= medium.albedo;
 
-		for (int bounces = 0; bounces <= settings.max_bounces; bounces++) {
+				int n = sampleLight(p, p, vec3(0.0f), shadow_rays, light_wi, light_L);
+				traceShadowRays(shadow_rays, n, visibility);
+				for (int i = 0; i < n; i++)
+				{
+					float phase = henyeyGreenstein(dot(current_ray.d, light_wi[i]), medium.g);
+					L += path_throughput * light_L[i] * (phase * visibility[i]);
+				}
+
+				if (path_throughput == vec3(0.0f)) {
+					return L;
+				}
+				current_ray = Ray(p, sampleHenyeyGreenstein(current_ray.d, medium.g));
+				hit_surface = intersect(current_ray);
+				continue;
+			}
+			if (!hit_surface) {
+				return L + (path_throughput * Lenvironment(current_ray.d));
+			}
 
 			// Get Intersection
 			Intersection hit = getIntersection(current_ray);
+			const MaterialParams& material = *hit.material_params;
 
-			vec3 diffuse_color = vec3(hit.material->m_color);
-			if (hit.material->m_color_texture.valid) {
-				diffuse_color = texSampleRGBA(hit.material->m_color_texture, hit.textCoord.x, hit.textCoord.y);
+			vec3 diffuse_color = material.color;
+			if (material.source->m_color_texture.valid) {
+				diffuse_color = texSampleRGBA(material.source->m_color_texture, hit.textCoord.x, hit.textCoord.y);
 				//diffuse_color = vec4(hit.material->m_color, hit.material->m_transparency);
 			}
 
-			float roughness = clamp(hit.material->m_shininess, 0.003f, 1.0f);
-			if (hit.material->m_shininess_texture.valid)
+			float roughness = clamp(material.roughness, 0.003f, 1.0f);
+			if (material.source->m_shininess_texture.valid)
 			{
-				roughness = texSampleR(hit.material->m_shininess_texture, hit.textCoord.x, hit.textCoord.y);
+				roughness = texSampleR(material.source->m_shininess_texture, hit.textCoord.x, hit.textCoord.y);
 				roughness = clamp(roughness, 0.003f, 0.2f);
 			}
 
 			vec3 normal = hit.shading_normal;
-			if (hit.material->m_bump_texture.valid)
+			if (material.source->m_bump_texture.valid)
 			{
 				vec3 t = hit.tangent;
 				vec3 b = normalize(cross(normal, t));
-				vec3 n = (texSampleRGB(hit.material->m_bump_texture, hit.textCoord.x, hit.textCoord.y));
+				vec3 n = (texSampleRGB(material.source->m_bump_texture, hit.textCoord.x, hit.textCoord.y));
 				n = normalize((n * 2.0f) - 1.0f);
 				mat3 tbn(t, b, normal);
 				
@@ -117,59 +312,32 @@ namespace pathtracer
 				no = 1.0f;				
 			}
 
-			Diffuse diffuse(diffuse_color);
-			BTDF transparent(roughness, hit.material->m_fresnel, ni, no);
-			BTDF_Metal metal(diffuse_color, roughness, hit.material->m_fresnel, ni, no);
-			LinearBlend metal_blend(hit.material->m_metalness, &metal, &transparent);
-			LinearBlend reflectivity_blend(hit.material->m_reflectivity, &metal_blend, &diffuse);
-			BRDF& mat = reflectivity_blend;
-
-
-			// Sample light point in disk
-
-
-			/*if (randf() < 0.5f) {
-				disk_light = disk_lights[0];
-			}
-			else {
-				disk_light = disk_lights[1];
-			}*/
-			
-			DiskLight light = disk_light[0];
-			std::pair<vec3, vec3> light_sample = light.sample();
-
-			/*SphereLight light = sphere_light[0];
-			std::pair<vec3, vec3> light_sample = light.sample(hit.position);*/
-
-			vec3 shapeSample = light_sample.first;
-			vec3 lightColor = light_sample.second;
+			// Only the lobes the material actually uses are evaluated
+			BSDF mat(material, diffuse_color, roughness, ni, no);
 
-			// Check if in shadow
-			Ray shadow_ray;
 
-			shadow_ray.o = hit.position + (EPSILON * hit.shading_normal);
-			shadow_ray.d = normalize(shapeSample - hit.position);
-
-			if (!occluded(shadow_ray)) {
-				// Direct illumination
-				float area = M_PI * (light.radius * light.radius);
-				const float distance_to_light = length(shapeSample - hit.position);
-				const float falloff_factor = 1.0f / (distance_to_light * distance_to_light);
-				vec3 wi = normalize(shapeSample - hit.position);
-				vec3 Li = 2 * light.intensity_multiplier * lightColor * falloff_factor * dot(-wi, light.normal) * area;
-				Li /= 500.0f;
-
-				L += path_throughput * (mat.f(wi, hit.wo, normal) * Li * std::max(0.0f, dot(wi, normal)));
+			// Direct illumination
+			const vec3 shadow_origin = hit.position + (EPSILON * hit.shading_normal);
+			int num_light_samples = sampleLight(hit.position, shadow_origin, normal, shadow_rays, light_wi, light_L);
+			traceShadowRays(shadow_rays, num_light_samples, visibility);
+			for (int i = 0; i < num_light_samples; i++)
+			{
+				if (visibility[i] > 0.0f)
+				{
+					const vec3& wi = light_wi[i];
+					L += path_throughput
+					     * (mat.f(wi, hit.wo, normal) * light_L[i] * (dot(wi, normal) * visibility[i]));
+				}
 			}
 
 			// Emitted radiance from intersection (need to check)
-			L += path_throughput * hit.material->m_emission;
+			L += path_throughput * material.emission;
 
 			// Sample an incoming direction (and the brdf and pdf for that direction)
-			vec3 rand_wi = vec3(0.0f);
-			float pdf = 0.0f;
-
-			vec3 brdf = mat.sample_wi(rand_wi, hit.wo, normal, pdf);
+			BSDFSample bsdf_sample = mat.sample(hit.wo, normal);
+			vec3 rand_wi = bsdf_sample.wi;
+			float pdf = bsdf_sample.pdf;
+			vec3 brdf = bsdf_sample.f;
 
 			
 			// Calculate cosine term to attenuate incoming light based on incident angle
@@ -193,7 +361,7 @@ namespace pathtracer
 			// Create next ray on path
 			Ray nextRayInPath;
 
-			if (isEnteringMaterial && transparent.isRefracted) {
+			if (isEnteringMaterial && bsdf_sample.refracted) {
 				nextRayInPath.o = hit.position - (EPSILON * normal);
 			}
 			else {
@@ -202,13 +370,16 @@ namespace pathtracer
 
 			nextRayInPath.d = rand_wi;
 
-			if (!intersect(nextRayInPath)) {
-				return L + (path_throughput * Lenvironment(nextRayInPath.d));
-			}
-
+			hit_surface = intersect(nextRayInPath);
 			current_ray = nextRayInPath;
 
 		}
+		// The last continuation ray may still escape to the environment
+		if (!hit_surface) {
+			float transmittance = media ? mediaTransmittance(current_ray) : 1.0f;
+			return L + (path_throughput * Lenvironment(current_ray.d)) * transmittance;
+		}
+		return L;
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -220,96 +391,191 @@ namespace pathtracer
 	}
 
 	///////////////////////////////////////////////////////////////////////////
-	// Trace one path per pixel and accumulate the result in an image
+	// Everything about the camera that is the same for all pixels of a frame
 	///////////////////////////////////////////////////////////////////////////
-	void tracePaths(const glm::mat4& V, const glm::mat4& P)
+	struct PrimaryCamera
 	{
-		// Stop here if we have as many samples as we want
-		if ((int(rendered_image.number_of_samples) > settings.max_paths_per_pixel)
-			&& (settings.max_paths_per_pixel != 0))
-		{
-			return;
-		}
-		vec3 camera_pos = vec3(glm::inverse(V) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
-		vec3 camera_forward = -vec3(V[0][2], V[1][2], V[2][2]);
-		// Trace one path per pixel (the omp parallel stuf magically distributes the
-		// pathtracing on all cores of your CPU).
-		int num_rays = 0;
-		vector<vec4> local_image(rendered_image.width * rendered_image.height, vec4(0.0f));
+		mat4 V;
+		mat4 inv_V;
+		mat4 inv_PV;
+		vec3 position;
+		vec3 forward;
+		vec3 right;
+		vec3 up;
+	};
+
+	static PrimaryCamera setupCamera(const glm::mat4& V, const glm::mat4& P)
+	{
+		PrimaryCamera cam;
+		cam.V = V;
+		cam.inv_V = glm::inverse(V);
+		cam.inv_PV = glm::inverse(P * V);
+		cam.position = vec3(cam.inv_V * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		cam.forward = -vec3(V[0][2], V[1][2], V[2][2]);
+		cam.right = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f) * V;
+		cam.up = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f) * V;
+		return cam;
+	}
 
-#pragma omp parallel for
-		for (int y = 0; y < rendered_image.height; y++)
-		{
-			for (int x = 0; x < rendered_image.width; x++)
-			{
-				vec3 color;
-				Ray primaryRay;
-				primaryRay.o = camera_pos;
-				// Create a ray that starts in the camera position and points toward
-				// the current pixel on a virtual screen.
-				vec2 screenCoord = vec2(float(x) / float(rendered_image.width),
-					float(y) / float(rendered_image.height));
-				// Calculate direction
-				vec4 viewCoord = vec4(screenCoord.x * 2.0f - 1.0f + ((randf() * 2.0f - 1.0f) / 400.0f), screenCoord.y * 2.0f - 1.0f + ((randf() * 2.0f - 1.0f) / 400.0f), 1.0f, 1.0f);
-				vec3 p = homogenize(inverse(P * V) * viewCoord);
-				primaryRay.d = normalize(p - camera_pos);
+	///////////////////////////////////////////////////////////////////////////
+	// Trace one path through pixel (x, y) and return its (exposed) radiance
+	///////////////////////////////////////////////////////////////////////////
+	static vec3 tracePixel(const PrimaryCamera& cam, int x, int y)
+	{
+		vec3 color;
+		Ray primaryRay;
+		primaryRay.o = cam.position;
+		// Create a ray that starts in the camera position and points toward
+		// the current pixel on a virtual screen.
+		vec2 screenCoord = vec2(float(x) / float(rendered_image.width),
+			float(y) / float(rendered_image.height));
+		// Calculate direction
+		vec4 viewCoord = vec4(screenCoord.x * 2.0f - 1.0f + ((randf() * 2.0f - 1.0f) / 400.0f), screenCoord.y * 2.0f - 1.0f + ((randf() * 2.0f - 1.0f) / 400.0f), 1.0f, 1.0f);
+		vec3 p = homogenize(cam.inv_PV * viewCoord);
+		primaryRay.d = normalize(p - cam.position);
 
-				// Depth of Field
-				vec4 sensor_plane(camera_forward, 0.0f);
-				sensor_plane.w = -dot(camera_forward, (camera_pos - camera_forward));
+		// Depth of Field
+		vec4 sensor_plane(cam.forward, 0.0f);
+		sensor_plane.w = -dot(cam.forward, (cam.position - cam.forward));
 
-				float t = -(dot(camera_pos, vec3(sensor_plane)) + sensor_plane.w) / dot(primaryRay.d, vec3(sensor_plane));
-				vec3 sensor_pos = camera_pos + primaryRay.d * t;
+		float t = -(dot(cam.position, vec3(sensor_plane)) + sensor_plane.w) / dot(primaryRay.d, vec3(sensor_plane));
+		vec3 sensor_pos = cam.position + primaryRay.d * t;
 
-				// convert sensor pos to camera space
-				vec3 cameraSpaceSensorPos = V * vec4(sensor_pos, 1.0f);
+		// convert sensor pos to camera space
+		vec3 cameraSpaceSensorPos = cam.V * vec4(sensor_pos, 1.0f);
 
-				cameraSpaceSensorPos.z *= cam_settings.focal_length;
+		cameraSpaceSensorPos.z *= active_cam_settings.focal_length;
 
-				// back to world space
-				sensor_pos = glm::inverse(V) * vec4(cameraSpaceSensorPos, 1.0f);
+		// back to world space
+		sensor_pos = cam.inv_V * vec4(cameraSpaceSensorPos, 1.0f);
 
 
-				// Point on aperture
-				float angle = randf() * 2.0f * M_PI;
-				float radius = sqrt(randf());
-				vec2 offset(cos(angle), sin(angle));
+		// Point on aperture
+		float angle = randf() * 2.0f * M_PI;
+		float radius = sqrt(randf());
+		vec2 offset(cos(angle), sin(angle));
 
-				offset = offset * radius * cam_settings.aperture;
-				
-				vec3 cameraRight = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f) * V;
-				vec3 cameraUp = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f) * V;
+		offset = offset * radius * active_cam_settings.aperture;
 
-				vec3 aperturePos = camera_pos + (cameraRight * offset.x) + (cameraUp * offset.y);
+		vec3 aperturePos = cam.position + (cam.right * offset.x) + (cam.up * offset.y);
 
-				vec3 focal_point = primaryRay.o + (cam_settings.focal_distance * primaryRay.d);
+		vec3 focal_point = primaryRay.o + (active_cam_settings.focal_distance * primaryRay.d);
 
-				primaryRay.o = aperturePos;
-				primaryRay.d = normalize(focal_point - aperturePos);
+		primaryRay.o = aperturePos;
+		primaryRay.d = normalize(focal_point - aperturePos);
 
-				// Intersect ray with scene
-				if (intersect(primaryRay))
-				{
-					// If it hit something, evaluate the radiance from that point
+		// Intersect ray with scene and evaluate the radiance from what it
+		// hit, or from the environment (through any media on the way)
+		bool hit = intersect(primaryRay);
+		color = Li(primaryRay, hit);
 
-					vec3 radiance = Li(primaryRay);
+		// Exposure and tone mapping are applied on display
+		return color;
+	}
 
-					if (isnan(radiance.x)) {
-						int x = 1;
-					}
+	///////////////////////////////////////////////////////////////////////////
+	// One pass of the progressive preview. Traces the pixels that lie on the
+	// grid with spacing `stride` but not on the coarser grid (those already
+	// have their sample), then fills every other pixel from the traced pixel
+	// at the top-left of its stride x stride block.
+	///////////////////////////////////////////////////////////////////////////
+	static bool tracePreviewPass(const PrimaryCamera& cam, int stride, bool first_pass)
+	{
+		const int coarse = stride * 2;
+#pragma omp parallel for schedule(dynamic)
+		for (int y = 0; y < rendered_image.height; y += stride)
+		{
+			if (restartPending())
+				continue;
+			bool coarse_row = (y % coarse) == 0;
+			for (int x = 0; x < rendered_image.width; x += stride)
+			{
+				if (!first_pass && coarse_row && (x % coarse) == 0)
+					continue;
+				rendered_image.data[y * rendered_image.width + x] = tracePixel(cam, x, y);
+			}
+		}
 
-					color = radiance;
+		if (restartPending())
+			return false;
+		if (stride == 1)
+			return true;
+#pragma omp parallel for
+		for (int y = 0; y < rendered_image.height; y++)
+		{
+			const vec3* anchor_row = &rendered_image.data[(y - y % stride) * rendered_image.width];
+			vec3* row = &rendered_image.data[y * rendered_image.width];
+			bool anchor_row_itself = (y % stride) == 0;
+			for (int x = 0; x < rendered_image.width; x++)
+			{
+				if (anchor_row_itself && (x % stride) == 0)
+					continue;
+				row[x] = anchor_row[x - x % stride];
+			}
+		}
+		return true;
+	}
 
-				}
-				else
+	///////////////////////////////////////////////////////////////////////////
+	// True when the image has as many samples as we want
+	///////////////////////////////////////////////////////////////////////////
+	static bool imageDone()
+	{
+		if (rendered_image.width == 0 || rendered_image.height == 0)
+			return true;
+		return (int(rendered_image.number_of_samples) > active_settings.max_paths_per_pixel)
+		       && (active_settings.max_paths_per_pixel != 0);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Trace one path per pixel and accumulate the result in an image
+	///////////////////////////////////////////////////////////////////////////
+	bool tracePaths(const glm::mat4& V, const glm::mat4& P)
+	{
+		// Stop here if we have as many samples as we want
+		if (imageDone())
+		{
+			return false;
+		}
+		PrimaryCamera cam = setupCamera(V, P);
+
+		///////////////////////////////////////////////////////////////////////
+		// Progressive preview after a restart. Refine from the coarsest grid
+		// until the frame budget is used up (but always do at least one pass)
+		// and pick up from there next frame. Once the finest level is done
+		// every pixel has exactly one sample and we accumulate as usual.
+		///////////////////////////////////////////////////////////////////////
+		if (rendered_image.preview_stride > 0)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			const int first_stride = 1 << active_settings.preview_levels;
+			do
+			{
+				int stride = rendered_image.preview_stride;
+				if (!tracePreviewPass(cam, stride, stride == first_stride))
+					return false;
+				rendered_image.preview_stride = stride / 2;
+				if (stride == 1)
 				{
-					// Otherwise evaluate environment
-					color = vec4(Lenvironment(primaryRay.d), 1.0f);
+					rendered_image.number_of_samples = 1;
+					return true;
 				}
+			} while (std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+			         < active_settings.frame_budget_ms);
+			return true;
+		}
 
-				//exposure
-				color *= cam_settings.exposure;
-
+		// Trace one path per pixel (the omp parallel stuf magically distributes the
+		// pathtracing on all cores of your CPU).
+#pragma omp parallel for
+		for (int y = 0; y < rendered_image.height; y++)
+		{
+			// Drop the rest of the pass if it is already out of date
+			if (restartPending())
+				continue;
+			for (int x = 0; x < rendered_image.width; x++)
+			{
+				vec3 color = tracePixel(cam, x, y);
 
 				// Accumulate the obtained radiance to the pixels color
 				float n = float(rendered_image.number_of_samples);
@@ -318,6 +584,135 @@ namespace pathtracer
 					+ (1.0f / (n + 1.0f)) * color;
 			}
 		}
+		if (restartPending())
+			return false;
 		rendered_image.number_of_samples += 1;
+		return true;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Copy the accumulated image into the back buffer and make it the most
+	// recent completed one
+	///////////////////////////////////////////////////////////////////////////
+	static void publish()
+	{
+		Image& back = framebuffers[back_buffer];
+		back.width = rendered_image.width;
+		back.height = rendered_image.height;
+		back.number_of_samples = rendered_image.number_of_samples;
+		back.preview_stride = rendered_image.preview_stride;
+		back.data = rendered_image.data;
+
+		std::lock_guard<std::mutex> lock(publish_mutex);
+		std::swap(back_buffer, ready_buffer);
+		ready_is_new = true;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// The settings that only decide how long to keep on accumulating, which
+	// are picked up without a restart. Must be called with request_mutex held.
+	///////////////////////////////////////////////////////////////////////////
+	static void copyProgressSettings()
+	{
+		active_settings.max_paths_per_pixel = requested_settings.max_paths_per_pixel;
+		active_settings.frame_budget_ms = requested_settings.frame_budget_ms;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// The render thread. Applies the latest restart request, traces a pass
+	// and publishes it, or sleeps if the image is done.
+	///////////////////////////////////////////////////////////////////////////
+	static void renderLoop()
+	{
+		while (true)
+		{
+			mat4 V, P;
+			uint64_t version;
+			int width, height;
+			{
+				std::unique_lock<std::mutex> lock(request_mutex);
+				copyProgressSettings();
+				// Wake up now and then since max paths per pixel can change
+				// without a restart
+				while (!stop_requested && requested_version == active_version && imageDone())
+				{
+					request_cv.wait_for(lock, std::chrono::milliseconds(100));
+					copyProgressSettings();
+				}
+				if (stop_requested)
+					return;
+				// Everything else only changes with a restart, so that the
+				// samples of one image are all made with the same settings
+				if (requested_version != active_version)
+				{
+					active_settings = requested_settings;
+					active_cam_settings = requested_cam_settings;
+					active_environment_multiplier = requested_environment_multiplier;
+				}
+				version = requested_version;
+				width = requested_width;
+				height = requested_height;
+				V = requested_V;
+				P = requested_P;
+			}
+
+			if (version != active_version)
+			{
+				if (width != rendered_image.width || height != rendered_image.height)
+				{
+					rendered_image.width = width;
+					rendered_image.height = height;
+					rendered_image.data.resize(width * height);
+				}
+				// Material edits and moved or deformed models come with a restart
+				updateMaterials();
+				applySceneUpdates();
+				// No need to clear image,
+				rendered_image.number_of_samples = 0;
+				// With progressive preview on, start over from the coarsest level
+				rendered_image.preview_stride =
+				    active_settings.progressive ? (1 << active_settings.preview_levels) : 0;
+				active_version = version;
+			}
+
+			if (tracePaths(V, P))
+			{
+				publish();
+			}
+		}
+	}
+
+	void startRenderThread()
+	{
+		stop_requested = false;
+		{
+			std::lock_guard<std::mutex> lock(request_mutex);
+			copySettings();
+		}
+		render_thread = std::thread(renderLoop);
+	}
+
+	void stopRenderThread()
+	{
+		{
+			std::lock_guard<std::mutex> lock(request_mutex);
+			stop_requested = true;
+			request_cv.notify_one();
+		}
+		if (render_thread.joinable())
+			render_thread.join();
+	}
+
+	bool acquireLatestImage(Image*& image)
+	{
+		{
+			std::lock_guard<std::mutex> lock(publish_mutex);
+			if (!ready_is_new)
+				return false;
+			std::swap(front_buffer, ready_buffer);
+			ready_is_new = false;
+		}
+		image = &framebuffers[front_buffer];
+		return true;
 	}
 }; // namespace pathtracer
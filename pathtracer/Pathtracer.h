@@ -5,6 +5,7 @@
 #include <omp.h>
 #include "HDRImage.h"
 #include "Light.h"
+#include "tonemap.h"
 
 
 #ifdef M_PI
@@ -26,6 +27,15 @@ extern struct Settings
 	int subsampling;
 	int max_bounces;
 	int max_paths_per_pixel;
+	// Points sampled (stratified) on the light at every hit
+	int light_samples;
+	// Scatter in the participating media (see medium.h)
+	bool media;
+	// Progressive preview: after a restart, render at 1/2^preview_levels
+	// resolution first and refine for as long as frame_budget_ms allows
+	bool progressive;
+	int preview_levels;
+	float frame_budget_ms;
 } settings;
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -38,11 +48,14 @@ extern struct Environment
 } environment;
 
 ///////////////////////////////////////////////////////////////////////////
-// The rendered image
+// The rendered image. rendered_image is the accumulation buffer and is
+// owned by the render thread, use acquireLatestImage() to display it.
 ///////////////////////////////////////////////////////////////////////////
 extern struct Image
 {
 	int width, height, number_of_samples = 0;
+	// Grid spacing of the next preview pass, 0 when the preview is done
+	int preview_stride = 0;
 	std::vector<glm::vec3> data;
 	float* getPtr()
 	{
@@ -75,12 +88,25 @@ extern struct CameraSettings
 	float focal_length;
 	float focal_distance;
 	float aperture;
+	// Applied when the image is displayed, changing these needs no restart
 	float exposure;
+	ToneMapOperator tonemap;
 } cam_settings;
 
 // Global array of lights
-DiskLight disk_light[];
-SphereLight sphere_light[];
+extern DiskLight disk_light[];
+extern SphereLight sphere_light[];
+
+///////////////////////////////////////////////////////////////////////////
+// Rendering runs on its own thread (which drives the OpenMP workers).
+// The functions below are called from the UI thread. They only post a
+// versioned request, the render thread picks up the latest one before its
+// next pass and abandons a pass that has gone out of date.
+// settings, cam_settings and environment.multiplier belong to the UI
+// thread, restart(), resize() and setCamera() hand copies of them over.
+///////////////////////////////////////////////////////////////////////////
+void startRenderThread();
+void stopRenderThread();
 
 ///////////////////////////////////////////////////////////////////////////
 // Restart rendering of image
@@ -94,7 +120,19 @@ void restart();
 void resize(int w, int h);
 
 ///////////////////////////////////////////////////////////////////////////
-// Trace one path per pixel
+// Hand the current camera to the render thread. Restarts if it changed.
+///////////////////////////////////////////////////////////////////////////
+void setCamera(const mat4& V, const mat4& P);
+
+///////////////////////////////////////////////////////////////////////////
+// If a pass was completed since the last call, point image at it and
+// return true. The image stays valid until the next call.
+///////////////////////////////////////////////////////////////////////////
+bool acquireLatestImage(Image*& image);
+
+///////////////////////////////////////////////////////////////////////////
+// Trace one path per pixel (called by the render thread). Returns false if
+// there was nothing to do or the pass was abandoned for a restart.
 ///////////////////////////////////////////////////////////////////////////
-void tracePaths(const mat4& V, const mat4& P);
+bool tracePaths(const mat4& V, const mat4& P);
 }; // namespace pathtracer
@@ -0,0 +1,90 @@
+#include "bsdf.h"
+#include <map>
+#include <mutex>
+#include "Pathtracer.h"
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// All preprocessed materials of the scene, and the models they belong to
+///////////////////////////////////////////////////////////////////////////
+std::vector<MaterialParams> material_params;
+std::vector<const labhelper::Model*> material_models;
+
+///////////////////////////////////////////////////////////////////////////
+// Edited parameter blocks, by index, waiting for the render thread
+///////////////////////////////////////////////////////////////////////////
+static std::mutex pending_mutex;
+static std::map<uint32_t, MaterialParams> pending_materials;
+
+///////////////////////////////////////////////////////////////////////////
+// Turn a labhelper::Material into a parameter block with lobe flags
+///////////////////////////////////////////////////////////////////////////
+static MaterialParams prepareMaterial(const labhelper::Material& material)
+{
+	MaterialParams params;
+	params.source = &material;
+	params.color = material.m_color;
+	params.roughness = material.m_shininess;
+	params.reflectivity = clamp(material.m_reflectivity, 0.0f, 1.0f);
+	params.metalness = clamp(material.m_metalness, 0.0f, 1.0f);
+	params.fresnel = material.m_fresnel;
+	params.emission = material.m_emission;
+
+	params.lobes = 0;
+	if(params.reflectivity < 1.0f)
+		params.lobes |= LOBE_DIFFUSE;
+	if(params.reflectivity > 0.0f)
+	{
+		if(params.metalness > 0.0f)
+			params.lobes |= LOBE_METAL;
+		if(params.metalness < 1.0f)
+			params.lobes |= LOBE_DIELECTRIC;
+	}
+	return params;
+}
+
+uint32_t addMaterials(const labhelper::Model* model)
+{
+	uint32_t offset = uint32_t(material_params.size());
+	for(auto& material : model->m_materials)
+	{
+		material_params.push_back(prepareMaterial(material));
+	}
+	material_models.push_back(model);
+	return offset;
+}
+
+void updateMaterial(const labhelper::Model* model, uint32_t material_index)
+{
+	// A model that was added more than once has a block for each time
+	const MaterialParams params = prepareMaterial(model->m_materials[material_index]);
+	uint32_t offset = 0;
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		for(auto m : material_models)
+		{
+			if(m == model)
+				pending_materials[offset + material_index] = params;
+			offset += uint32_t(m->m_materials.size());
+		}
+	}
+	restart();
+}
+
+void updateMaterials()
+{
+	std::lock_guard<std::mutex> lock(pending_mutex);
+	for(auto& pending : pending_materials)
+	{
+		material_params[pending.first] = pending.second;
+	}
+	pending_materials.clear();
+}
+
+const MaterialParams* getMaterialParams(uint32_t index)
+{
+	return &material_params[index];
+}
+
+} // namespace pathtracer
@@ -0,0 +1,331 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <Model.h>
+#include "material.h"
+#include "sampling.h"
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// The lobes a material is made of. These are decided once per material
+// when the scene is built, so that lobes with zero weight are never
+// evaluated or sampled.
+///////////////////////////////////////////////////////////////////////////
+enum LobeFlags : uint32_t
+{
+	LOBE_DIFFUSE = 1 << 0,
+	LOBE_DIELECTRIC = 1 << 1,
+	LOBE_METAL = 1 << 2,
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Compact parameter block for a labhelper::Material. Textures are still
+// looked up through the source material at each hit.
+///////////////////////////////////////////////////////////////////////////
+struct MaterialParams
+{
+	const labhelper::Material* source;
+	vec3 color;
+	float roughness;
+	float reflectivity;
+	float metalness;
+	float fresnel;
+	float emission;
+	uint32_t lobes;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Preprocess the materials of a model and return the index of its first
+// material in the material table.
+///////////////////////////////////////////////////////////////////////////
+uint32_t addMaterials(const labhelper::Model* model);
+
+///////////////////////////////////////////////////////////////////////////
+// Record an edit of model->m_materials[material_index] from the UI thread
+// and restart the pathtracer. The new parameter block is made here, the
+// render thread swaps it in with updateMaterials() before its next pass.
+///////////////////////////////////////////////////////////////////////////
+void updateMaterial(const labhelper::Model* model, uint32_t material_index);
+void updateMaterials();
+
+///////////////////////////////////////////////////////////////////////////
+// Look up a parameter block by index
+///////////////////////////////////////////////////////////////////////////
+const MaterialParams* getMaterialParams(uint32_t index);
+
+///////////////////////////////////////////////////////////////////////////
+// The result of sampling a direction
+///////////////////////////////////////////////////////////////////////////
+struct BSDFSample
+{
+	vec3 f = vec3(0.0f);
+	vec3 wi = vec3(0.0f);
+	float pdf = 0.0f;
+	bool refracted = false;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// A Lambertian (diffuse) lobe
+///////////////////////////////////////////////////////////////////////////
+struct DiffuseLobe
+{
+	vec3 color;
+
+	inline vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const
+	{
+		if(dot(wi, n) <= 0.0f)
+			return vec3(0.0f);
+		if(!sameHemisphere(wi, wo, n))
+			return vec3(0.0f);
+		return (1.0f / M_PI) * color;
+	}
+
+	inline void sample(BSDFSample& s, const vec3& wo, const vec3& n) const
+	{
+		vec3 tangent = normalize(perpendicular(n));
+		vec3 bitangent = normalize(cross(tangent, n));
+		vec3 sample = cosineSampleHemisphere();
+		s.wi = normalize(sample.x * tangent + sample.y * bitangent + sample.z * n);
+		if(dot(s.wi, n) <= 0.0f)
+			s.pdf = 0.0f;
+		else
+			s.pdf = max(0.0f, dot(n, s.wi)) / M_PI;
+		s.f = f(s.wi, wo, n);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// A GGX microfacet dielectric lobe with reflection and refraction
+///////////////////////////////////////////////////////////////////////////
+struct DielectricLobe
+{
+	float shininess;
+	float R0;
+	float refr_index_i;
+	float refr_index_o;
+
+	inline vec3 reflection(const vec3& wi, const vec3& wo, const vec3& n) const
+	{
+		float signWH = dot(n, wi) < 0.0f ? -1.0f : 1.0f;
+		vec3 wh = normalize(signWH * (wi + wo));
+		float F = Distributions::FresnelSchlick(wi, wh, R0);
+		float D = Distributions::GGX_D(n, wh, shininess);
+		float G = Distributions::GGXSmith_G(wi, wo, wh, n, shininess);
+		float brdf = (F * D * G) / (4 * abs(dot(n, wo)) * abs(dot(n, wi)));
+		return vec3(brdf);
+	}
+
+	inline vec3 refraction(const vec3& wi, const vec3& wo, const vec3& n) const
+	{
+		float eta_i = refr_index_o;
+		float eta_o = refr_index_i;
+		vec3 wh = normalize(-(eta_i * wi + eta_o * wo));
+		float F = Distributions::FresnelSchlick(wi, wh, R0);
+		float D = Distributions::GGX_D(n, wh, shininess);
+		float G = Distributions::GGXSmith_G(wi, wo, wh, n, shininess);
+		float wiwh = dot(wi, wh);
+		float wowh = dot(wo, wh);
+		float frac = abs(wiwh) * abs(wowh) / (abs(dot(n, wo)) * abs(dot(n, wi)));
+		float numerator = (eta_o * eta_o) * (1.0f - F) * G * D;
+		float denominator = (eta_i * wiwh) + (eta_o * wowh);
+		return vec3(frac * numerator / (denominator * denominator));
+	}
+
+	inline vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const
+	{
+		return reflection(wi, wo, n) + refraction(wi, wo, n);
+	}
+
+	// Samples the microfacet normal and picks reflection or refraction
+	// based on Fresnel. Leaves the value of the brdf to the caller.
+	inline void sampleDirection(BSDFSample& s, const vec3& wo, const vec3& n) const
+	{
+		vec3 wh = Distributions::GGX_sample_wh(n, shininess);
+		float F = Distributions::FresnelSchlick(-wo, wh, R0);
+
+		// Total internal reflection
+		float eta = refr_index_i / refr_index_o;
+		float cosX = dot(n, -wo);
+		float sinX = (eta * eta) * (1.0f - (cosX * cosX));
+		if(sinX > 1.0f)
+			F = 1.0f;
+
+		float D = Distributions::GGX_D(n, wh, shininess);
+		float pwh = D * abs(dot(n, wh));
+
+		if(randf() <= F)
+		{
+			s.wi = reflect(-wo, wh);
+			float j = 1.0f / (4 * abs(dot(wo, wh)));
+			s.pdf = pwh * j * F;
+			s.refracted = false;
+		}
+		else
+		{
+			float signNI = (dot(n, wo) < 0.0f) ? -1.0f : 1.0f;
+			float wowh = dot(wo, wh);
+			float sqr = 1.0f + (eta * eta) * ((wowh * wowh) - 1.0f);
+			if(sqr < 0.0f)
+			{
+				s.pdf = 0.0f;
+				return;
+			}
+			s.wi = (eta * wowh - (signNI * sqrt(sqr))) * wh - eta * wo;
+			s.refracted = true;
+
+			vec3 ht = normalize(-(refr_index_o * wo + refr_index_i * s.wi));
+			float denominator = refr_index_i * dot(s.wi, ht) + refr_index_o * dot(wo, ht);
+			float j = ((refr_index_o * refr_index_o) * abs(dot(wo, ht))) / (denominator * denominator);
+			s.pdf = pwh * j * (1.0f - F);
+		}
+	}
+
+	inline void sample(BSDFSample& s, const vec3& wo, const vec3& n) const
+	{
+		sampleDirection(s, wo, n);
+		if(s.pdf == 0.0f)
+			return;
+		s.f = s.refracted ? refraction(s.wi, wo, n) : reflection(s.wi, wo, n);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// A GGX microfacet metal lobe (tinted reflection, no refraction)
+///////////////////////////////////////////////////////////////////////////
+struct MetalLobe
+{
+	vec3 color;
+	DielectricLobe base;
+
+	inline vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const
+	{
+		return base.reflection(wi, wo, n) * color;
+	}
+
+	inline void sample(BSDFSample& s, const vec3& wo, const vec3& n) const
+	{
+		base.sampleDirection(s, wo, n);
+		if(s.pdf == 0.0f)
+			return;
+		// A refracted sample carries no energy for a metal
+		s.f = s.refracted ? vec3(0.0f) : f(s.wi, wo, n);
+		s.refracted = false;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// A Linear Blend between two statically known lobes
+///////////////////////////////////////////////////////////////////////////
+template<typename A, typename B>
+struct BlendLobe
+{
+	float w;
+	A a;
+	B b;
+
+	inline vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const
+	{
+		return (w * a.f(wi, wo, n)) + ((1 - w) * b.f(wi, wo, n));
+	}
+
+	inline void sample(BSDFSample& s, const vec3& wo, const vec3& n) const
+	{
+		if(randf() < w)
+		{
+			a.sample(s, wo, n);
+			s.pdf *= w;
+		}
+		else
+		{
+			b.sample(s, wo, n);
+			s.pdf *= (1 - w);
+		}
+	}
+};
+
+template<typename A, typename B>
+inline BlendLobe<A, B> blend(float w, const A& a, const B& b)
+{
+	return BlendLobe<A, B>{ w, a, b };
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The BSDF at a single hit. Picks the composition of lobes that the
+// material actually uses, so only non-zero lobes are ever touched.
+///////////////////////////////////////////////////////////////////////////
+struct BSDF
+{
+	uint32_t lobes;
+	float reflectivity;
+	float metalness;
+	DiffuseLobe diffuse;
+	DielectricLobe dielectric;
+	MetalLobe metal;
+
+	BSDF(const MaterialParams& params, const vec3& color, float roughness, float ni, float no)
+	    : lobes(params.lobes)
+	    , reflectivity(params.reflectivity)
+	    , metalness(params.metalness)
+	    , diffuse{ color }
+	    , dielectric{ roughness, params.fresnel, ni, no }
+	    , metal{ color, dielectric }
+	{
+	}
+
+	inline vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const
+	{
+		switch(lobes)
+		{
+		case LOBE_DIFFUSE:
+			return diffuse.f(wi, wo, n);
+		case LOBE_DIELECTRIC:
+			return dielectric.f(wi, wo, n);
+		case LOBE_METAL:
+			return metal.f(wi, wo, n);
+		case LOBE_DIELECTRIC | LOBE_METAL:
+			return blend(metalness, metal, dielectric).f(wi, wo, n);
+		case LOBE_DIFFUSE | LOBE_DIELECTRIC:
+			return blend(reflectivity, dielectric, diffuse).f(wi, wo, n);
+		case LOBE_DIFFUSE | LOBE_METAL:
+			return blend(reflectivity, metal, diffuse).f(wi, wo, n);
+		default:
+			return blend(reflectivity, blend(metalness, metal, dielectric), diffuse).f(wi, wo, n);
+		}
+	}
+
+	inline BSDFSample sample(const vec3& wo, const vec3& n) const
+	{
+		BSDFSample s;
+		switch(lobes)
+		{
+		case LOBE_DIFFUSE:
+			diffuse.sample(s, wo, n);
+			break;
+		case LOBE_DIELECTRIC:
+			dielectric.sample(s, wo, n);
+			break;
+		case LOBE_METAL:
+			metal.sample(s, wo, n);
+			break;
+		case LOBE_DIELECTRIC | LOBE_METAL:
+			blend(metalness, metal, dielectric).sample(s, wo, n);
+			break;
+		case LOBE_DIFFUSE | LOBE_DIELECTRIC:
+			blend(reflectivity, dielectric, diffuse).sample(s, wo, n);
+			break;
+		case LOBE_DIFFUSE | LOBE_METAL:
+			blend(reflectivity, metal, diffuse).sample(s, wo, n);
+			break;
+		default:
+			blend(reflectivity, blend(metalness, metal, dielectric), diffuse).sample(s, wo, n);
+			break;
+		}
+		return s;
+	}
+};
+
+} // namespace pathtracer
@@ -0,0 +1,688 @@
+#include "bvh.h"
+#include "embree_copy.h"
+#include "watertight.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BVH_SSE2 1
+#endif
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Build
+///////////////////////////////////////////////////////////////////////////
+static const int MAX_BINS = 64;
+// Deeper binary nodes become leaves, that bounds the traversal stack
+static const int MAX_BUILD_DEPTH = 64;
+// (a 4-wide node is at least one binary level deeper than its parent)
+static const int TRAVERSAL_STACK_SIZE = 3 * MAX_BUILD_DEPTH + 1;
+// Subtrees with more triangles than this are built as separate tasks
+static const uint32_t PARALLEL_BUILD_THRESHOLD = 4096;
+
+struct Box
+{
+	vec3 bmin = vec3(FLT_MAX);
+	vec3 bmax = vec3(-FLT_MAX);
+
+	void grow(const vec3& p)
+	{
+		bmin = min(bmin, p);
+		bmax = max(bmax, p);
+	}
+	void grow(const Box& b)
+	{
+		bmin = min(bmin, b.bmin);
+		bmax = max(bmax, b.bmax);
+	}
+	float area() const
+	{
+		vec3 e = bmax - bmin;
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+};
+
+struct BuildPrim
+{
+	Box box;
+	vec3 centroid;
+	uint32_t index;
+};
+
+struct BVHBuildNode
+{
+	Box box;
+	BVHBuildNode* children[2] = { nullptr, nullptr };
+	// Range in the (partitioned) primitive array, for leaves
+	uint32_t first = 0;
+	uint32_t count = 0;
+
+	~BVHBuildNode()
+	{
+		delete children[0];
+		delete children[1];
+	}
+	bool isLeaf() const
+	{
+		return children[0] == nullptr;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Find the best binned SAH split of prims[begin, end). Returns the cost
+// (relative to intersecting all triangles, so a leaf costs count) and the
+// axis and bin that the right side starts at.
+///////////////////////////////////////////////////////////////////////////
+static float findSplit(const vector<BuildPrim>& prims, uint32_t begin, uint32_t end, const Box& centroids,
+                       const Box& box, const BVHBuildSettings& settings, int& best_axis, int& best_bin)
+{
+	const int num_bins = std::min(std::max(settings.bins, 2), MAX_BINS);
+	float best_cost = FLT_MAX;
+	best_axis = -1;
+	best_bin = 0;
+	for(int axis = 0; axis < 3; axis++)
+	{
+		float extent = centroids.bmax[axis] - centroids.bmin[axis];
+		if(extent <= 0.0f)
+			continue;
+		float scale = float(num_bins) * 0.99999f / extent;
+
+		Box bin_box[MAX_BINS];
+		uint32_t bin_count[MAX_BINS] = {};
+		for(uint32_t i = begin; i < end; i++)
+		{
+			int b = std::min(num_bins - 1, int((prims[i].centroid[axis] - centroids.bmin[axis]) * scale));
+			bin_box[b].grow(prims[i].box);
+			bin_count[b]++;
+		}
+
+		// Sweep from the right, then from the left
+		float right_area[MAX_BINS];
+		uint32_t right_count[MAX_BINS];
+		Box acc;
+		uint32_t count = 0;
+		for(int b = num_bins - 1; b > 0; b--)
+		{
+			acc.grow(bin_box[b]);
+			count += bin_count[b];
+			right_area[b] = count > 0 ? acc.area() : 0.0f;
+			right_count[b] = count;
+		}
+		acc = Box();
+		count = 0;
+		for(int b = 1; b < num_bins; b++)
+		{
+			acc.grow(bin_box[b - 1]);
+			count += bin_count[b - 1];
+			if(count == 0 || right_count[b] == 0)
+				continue;
+			float cost = acc.area() * float(count) + right_area[b] * float(right_count[b]);
+			if(cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = b;
+			}
+		}
+	}
+	if(best_axis < 0)
+		return FLT_MAX;
+	float area = box.area();
+	return settings.traversal_cost + (area > 0.0f ? best_cost / area : float(end - begin));
+}
+
+static BVHBuildNode* buildRecursive(vector<BuildPrim>& prims, uint32_t begin, uint32_t end, int depth,
+                                       const BVHBuildSettings& settings)
+{
+	BVHBuildNode* node = new BVHBuildNode();
+	Box centroids;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		node->box.grow(prims[i].box);
+		centroids.grow(prims[i].centroid);
+	}
+	uint32_t count = end - begin;
+	node->first = begin;
+	node->count = count;
+	if(count <= 1 || depth >= MAX_BUILD_DEPTH)
+		return node;
+
+	int axis, bin;
+	float split_cost = findSplit(prims, begin, end, centroids, node->box, settings, axis, bin);
+	if(count <= uint32_t(settings.max_leaf_size) && float(count) <= split_cost)
+		return node;
+
+	uint32_t mid;
+	if(axis >= 0)
+	{
+		const int num_bins = std::min(std::max(settings.bins, 2), MAX_BINS);
+		float cmin = centroids.bmin[axis];
+		float scale = float(num_bins) * 0.99999f / (centroids.bmax[axis] - cmin);
+		auto it = std::partition(prims.begin() + begin, prims.begin() + end, [&](const BuildPrim& p) {
+			return std::min(num_bins - 1, int((p.centroid[axis] - cmin) * scale)) < bin;
+		});
+		mid = uint32_t(it - prims.begin());
+	}
+	else
+	{
+		// All centroids are the same, split in the middle
+		mid = begin + count / 2;
+	}
+
+	node->count = 0;
+#pragma omp task if(count > PARALLEL_BUILD_THRESHOLD) shared(prims, settings)
+	node->children[0] = buildRecursive(prims, begin, mid, depth + 1, settings);
+	node->children[1] = buildRecursive(prims, mid, end, depth + 1, settings);
+#pragma omp taskwait
+	return node;
+}
+
+static void setEmpty(float bounds[6][4], int slot)
+{
+	for(int k = 0; k < 3; k++)
+	{
+		bounds[k][slot] = FLT_MAX;
+		bounds[k + 3][slot] = -FLT_MAX;
+	}
+}
+
+static void setBounds(float bounds[6][4], int slot, const vec3& bmin, const vec3& bmax)
+{
+	for(int k = 0; k < 3; k++)
+	{
+		bounds[k][slot] = bmin[k];
+		bounds[k + 3][slot] = bmax[k];
+	}
+}
+
+void BVH4::setChild(Node& node, int slot, const BVHBuildNode* child)
+{
+	setBounds(node.bounds, slot, child->box.bmin, child->box.bmax);
+	if(child->isLeaf())
+	{
+		node.child[slot] = child->first;
+		node.count[slot] = child->count;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Turn a binary inner node into a 4-wide node by repeatedly opening the
+// child with the largest surface area. Nodes are stored parents first.
+///////////////////////////////////////////////////////////////////////////
+uint32_t BVH4::collapse(const BVHBuildNode* node)
+{
+	uint32_t index = uint32_t(nodes.size());
+	nodes.push_back(Node());
+
+	const BVHBuildNode* children[4] = { node->children[0], node->children[1], nullptr, nullptr };
+	int n = 2;
+	while(n < 4)
+	{
+		int best = -1;
+		float best_area = -1.0f;
+		for(int i = 0; i < n; i++)
+		{
+			if(!children[i]->isLeaf() && children[i]->box.area() > best_area)
+			{
+				best = i;
+				best_area = children[i]->box.area();
+			}
+		}
+		if(best < 0)
+			break;
+		const BVHBuildNode* opened = children[best];
+		children[best] = opened->children[0];
+		children[n++] = opened->children[1];
+	}
+
+	for(int slot = 0; slot < 4; slot++)
+	{
+		if(slot >= n)
+		{
+			setEmpty(nodes[index].bounds, slot);
+			nodes[index].child[slot] = EMPTY_CHILD;
+			nodes[index].count[slot] = 0;
+			continue;
+		}
+		// collapse() grows the node array, so nodes[index] is looked up again
+		uint32_t child_index = children[slot]->isLeaf() ? 0 : collapse(children[slot]);
+		Node& parent = nodes[index];
+		parent.child[slot] = child_index;
+		parent.count[slot] = 0;
+		setChild(parent, slot, children[slot]);
+	}
+	return index;
+}
+
+void BVH4::build(const vec3* positions, const BVHTriangleRef* refs, size_t count, const BVHBuildSettings& settings)
+{
+	nodes.clear();
+	triangles.clear();
+	if(count == 0)
+		return;
+
+	vector<BuildPrim> prims(count);
+#pragma omp parallel for
+	for(int64_t i = 0; i < int64_t(count); i++)
+	{
+		const vec3* v = positions + refs[i].first_vertex;
+		BuildPrim& p = prims[i];
+		p.box = Box();
+		p.box.grow(v[0]);
+		p.box.grow(v[1]);
+		p.box.grow(v[2]);
+		p.centroid = 0.5f * (p.box.bmin + p.box.bmax);
+		p.index = uint32_t(i);
+	}
+
+	BVHBuildNode* root = nullptr;
+#pragma omp parallel
+#pragma omp single
+	root = buildRecursive(prims, 0, uint32_t(count), 0, settings);
+
+	// Triangles in the order the leaves refer to them
+	triangles.resize(count);
+	for(size_t i = 0; i < count; i++)
+	{
+		const BVHTriangleRef& ref = refs[prims[i].index];
+		const vec3* v = positions + ref.first_vertex;
+		Triangle& t = triangles[i];
+		t.v0 = v[0];
+		t.v1 = v[1];
+		t.v2 = v[2];
+		t.geom_ID = ref.geom_ID;
+		t.prim_ID = ref.prim_ID;
+		t.first_vertex = ref.first_vertex;
+	}
+
+	if(root->isLeaf())
+	{
+		// A single leaf still gets a node to live in
+		nodes.push_back(Node());
+		for(int slot = 1; slot < 4; slot++)
+		{
+			setEmpty(nodes[0].bounds, slot);
+			nodes[0].child[slot] = EMPTY_CHILD;
+			nodes[0].count[slot] = 0;
+		}
+		setChild(nodes[0], 0, root);
+	}
+	else
+	{
+		collapse(root);
+	}
+	delete root;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Refit: children are stored after their parents, so a backwards sweep
+// sees every child before its parent.
+///////////////////////////////////////////////////////////////////////////
+static void slotBounds(const float bounds[6][4], vec3& bmin, vec3& bmax)
+{
+	bmin = vec3(FLT_MAX);
+	bmax = vec3(-FLT_MAX);
+	for(int slot = 0; slot < 4; slot++)
+	{
+		for(int k = 0; k < 3; k++)
+		{
+			bmin[k] = std::min(bmin[k], bounds[k][slot]);
+			bmax[k] = std::max(bmax[k], bounds[k + 3][slot]);
+		}
+	}
+}
+
+void BVH4::refit(const vec3* positions)
+{
+#pragma omp parallel for
+	for(int64_t i = 0; i < int64_t(triangles.size()); i++)
+	{
+		Triangle& t = triangles[i];
+		t.v0 = positions[t.first_vertex + 0];
+		t.v1 = positions[t.first_vertex + 1];
+		t.v2 = positions[t.first_vertex + 2];
+	}
+	for(size_t i = nodes.size(); i-- > 0;)
+	{
+		Node& node = nodes[i];
+		for(int slot = 0; slot < 4; slot++)
+		{
+			if(node.child[slot] == EMPTY_CHILD)
+				continue;
+			Box box;
+			if(node.count[slot] > 0)
+			{
+				for(uint32_t j = 0; j < node.count[slot]; j++)
+				{
+					const Triangle& t = triangles[node.child[slot] + j];
+					box.grow(t.v0);
+					box.grow(t.v1);
+					box.grow(t.v2);
+				}
+			}
+			else
+			{
+				slotBounds(nodes[node.child[slot]].bounds, box.bmin, box.bmax);
+			}
+			setBounds(node.bounds, slot, box.bmin, box.bmax);
+		}
+	}
+}
+
+vec3 BVH4::boundsMin() const
+{
+	vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+	if(!nodes.empty())
+		slotBounds(nodes[0].bounds, bmin, bmax);
+	return bmin;
+}
+
+vec3 BVH4::boundsMax() const
+{
+	vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+	if(!nodes.empty())
+		slotBounds(nodes[0].bounds, bmin, bmax);
+	return bmax;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Traversal. Each node tests its four child boxes at once with the slab
+// test, with the far distances scaled by ROBUST_FAR_SCALE. Triangles are
+// intersected with the watertight test of watertight.h.
+///////////////////////////////////////////////////////////////////////////
+struct TraversalRay
+{
+	float o[3];
+	float inv_d[3];
+	// Rows of Node::bounds to use as the near and far planes per axis
+	int near_row[3];
+	int far_row[3];
+
+	TraversalRay() {}
+	TraversalRay(const Ray& r)
+	{
+		for(int k = 0; k < 3; k++)
+		{
+			float d = r.d[k];
+			// Avoid 0 * inf = NaN in the slab test
+			if(std::abs(d) < 1e-20f)
+				d = d < 0.0f ? -1e-20f : 1e-20f;
+			o[k] = r.o[k];
+			inv_d[k] = 1.0f / d;
+			near_row[k] = d >= 0.0f ? k : k + 3;
+			far_row[k] = d >= 0.0f ? k + 3 : k;
+		}
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Returns a bit per child that the ray enters within [tnear, tfar], and
+// the entry distances.
+///////////////////////////////////////////////////////////////////////////
+#ifdef BVH_SSE2
+struct TraversalRaySSE
+{
+	__m128 o[3];
+	__m128 inv_d[3];
+
+	TraversalRaySSE() {}
+	TraversalRaySSE(const TraversalRay& tr)
+	{
+		for(int k = 0; k < 3; k++)
+		{
+			o[k] = _mm_set1_ps(tr.o[k]);
+			inv_d[k] = _mm_set1_ps(tr.inv_d[k]);
+		}
+	}
+};
+
+static inline int intersectChildren(const float bounds[6][4], const TraversalRay& tr, const TraversalRaySSE& sr,
+                                    float tnear, float tfar, float dist[4])
+{
+	__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds[tr.near_row[0]]), sr.o[0]), sr.inv_d[0]);
+	__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds[tr.near_row[1]]), sr.o[1]), sr.inv_d[1]);
+	__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds[tr.near_row[2]]), sr.o[2]), sr.inv_d[2]);
+	__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds[tr.far_row[0]]), sr.o[0]), sr.inv_d[0]);
+	__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds[tr.far_row[1]]), sr.o[1]), sr.inv_d[1]);
+	__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds[tr.far_row[2]]), sr.o[2]), sr.inv_d[2]);
+	__m128 t0 = _mm_max_ps(_mm_max_ps(t0x, t0y), _mm_max_ps(t0z, _mm_set1_ps(tnear)));
+	__m128 t1 = _mm_min_ps(_mm_min_ps(t1x, t1y), _mm_min_ps(t1z, _mm_set1_ps(tfar)));
+	t1 = _mm_mul_ps(t1, _mm_set1_ps(ROBUST_FAR_SCALE));
+	_mm_storeu_ps(dist, t0);
+	return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+#else
+struct TraversalRaySSE
+{
+	TraversalRaySSE() {}
+	TraversalRaySSE(const TraversalRay&) {}
+};
+
+static inline int intersectChildren(const float bounds[6][4], const TraversalRay& tr, const TraversalRaySSE&,
+                                    float tnear, float tfar, float dist[4])
+{
+	int mask = 0;
+	for(int i = 0; i < 4; i++)
+	{
+		float t0 = tnear, t1 = tfar;
+		for(int k = 0; k < 3; k++)
+		{
+			t0 = std::max(t0, (bounds[tr.near_row[k]][i] - tr.o[k]) * tr.inv_d[k]);
+			t1 = std::min(t1, (bounds[tr.far_row[k]][i] - tr.o[k]) * tr.inv_d[k]);
+		}
+		dist[i] = t0;
+		if(t0 <= t1 * ROBUST_FAR_SCALE)
+			mask |= 1 << i;
+	}
+	return mask;
+}
+#endif
+
+struct StackEntry
+{
+	uint32_t child;
+	uint32_t count;
+	float dist;
+};
+
+bool BVH4::intersect(Ray& r) const
+{
+	if(nodes.empty())
+		return false;
+	const TraversalRay tr(r);
+	const TraversalRaySSE sr(tr);
+	const WatertightRay wr(r);
+
+	StackEntry stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, 0, r.tnear };
+	const Triangle* hit = nullptr;
+	while(stack_size > 0)
+	{
+		const StackEntry entry = stack[--stack_size];
+		if(entry.dist > r.tfar)
+			continue;
+
+		if(entry.count > 0)
+		{
+			for(uint32_t i = 0; i < entry.count; i++)
+			{
+				const Triangle& tri = triangles[entry.child + i];
+				float t, u, v;
+				if(intersectTriangle(wr, tri.v0, tri.v1, tri.v2, r.tnear, r.tfar, t, u, v))
+				{
+					r.tfar = t;
+					r.u = u;
+					r.v = v;
+					hit = &tri;
+				}
+			}
+			continue;
+		}
+
+		const Node& node = nodes[entry.child];
+		float dist[4];
+		int mask = intersectChildren(node.bounds, tr, sr, r.tnear, r.tfar, dist);
+		if(mask == 0)
+			continue;
+		// Push the hit children farthest first, so the nearest is visited next
+		StackEntry hits[4];
+		int num_hits = 0;
+		for(int slot = 0; slot < 4; slot++)
+		{
+			if(mask & (1 << slot))
+			{
+				StackEntry e = { node.child[slot], node.count[slot], dist[slot] };
+				int j = num_hits++;
+				while(j > 0 && hits[j - 1].dist < e.dist)
+				{
+					hits[j] = hits[j - 1];
+					j--;
+				}
+				hits[j] = e;
+			}
+		}
+		for(int i = 0; i < num_hits; i++)
+			stack[stack_size++] = hits[i];
+	}
+
+	if(hit == nullptr)
+		return false;
+	r.n = cross(hit->v0 - hit->v1, hit->v2 - hit->v0);
+	r.geomID = hit->geom_ID;
+	r.primID = hit->prim_ID;
+	return true;
+}
+
+bool BVH4::occluded(const Ray& r) const
+{
+	if(nodes.empty())
+		return false;
+	const TraversalRay tr(r);
+	const TraversalRaySSE sr(tr);
+	const WatertightRay wr(r);
+
+	// Any hit will do, so children are pushed in any order
+	StackEntry stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, 0, r.tnear };
+	while(stack_size > 0)
+	{
+		const StackEntry entry = stack[--stack_size];
+		if(entry.count > 0)
+		{
+			for(uint32_t i = 0; i < entry.count; i++)
+			{
+				const Triangle& tri = triangles[entry.child + i];
+				float t, u, v;
+				if(intersectTriangle(wr, tri.v0, tri.v1, tri.v2, r.tnear, r.tfar, t, u, v))
+					return true;
+			}
+			continue;
+		}
+
+		const Node& node = nodes[entry.child];
+		float dist[4];
+		int mask = intersectChildren(node.bounds, tr, sr, r.tnear, r.tfar, dist);
+		for(int slot = 0; slot < 4; slot++)
+		{
+			if(mask & (1 << slot))
+				stack[stack_size++] = { node.child[slot], node.count[slot], dist[slot] };
+		}
+	}
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Packet any-hit: the rays share one traversal, a node is fetched once for
+// all rays that reach it and each stack entry carries the mask of those
+// rays. Rays drop out of every entry as soon as they are occluded.
+///////////////////////////////////////////////////////////////////////////
+struct PacketStackEntry
+{
+	uint32_t child;
+	uint32_t count;
+	uint64_t mask;
+};
+
+uint64_t BVH4::occluded(const Ray* rays, int count, uint64_t active) const
+{
+	if(nodes.empty() || active == 0)
+		return 0;
+	count = std::min(count, MAX_PACKET_SIZE);
+	TraversalRay tr[MAX_PACKET_SIZE];
+	TraversalRaySSE sr[MAX_PACKET_SIZE];
+	WatertightRay wr[MAX_PACKET_SIZE];
+	for(int i = 0; i < count; i++)
+	{
+		if(active & (uint64_t(1) << i))
+		{
+			tr[i] = TraversalRay(rays[i]);
+			sr[i] = TraversalRaySSE(tr[i]);
+			wr[i] = WatertightRay(rays[i]);
+		}
+	}
+
+	uint64_t occluded_mask = 0;
+	PacketStackEntry stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = { 0, 0, active };
+	while(stack_size > 0)
+	{
+		const PacketStackEntry entry = stack[--stack_size];
+		const uint64_t mask = entry.mask & ~occluded_mask;
+		if(mask == 0)
+			continue;
+
+		if(entry.count > 0)
+		{
+			for(int i = 0; i < count; i++)
+			{
+				const uint64_t bit = uint64_t(1) << i;
+				if(!(mask & bit))
+					continue;
+				for(uint32_t j = 0; j < entry.count; j++)
+				{
+					const Triangle& tri = triangles[entry.child + j];
+					float t, u, v;
+					if(intersectTriangle(wr[i], tri.v0, tri.v1, tri.v2, rays[i].tnear, rays[i].tfar, t, u, v))
+					{
+						occluded_mask |= bit;
+						break;
+					}
+				}
+			}
+			if((active & ~occluded_mask) == 0)
+				return occluded_mask;
+			continue;
+		}
+
+		const Node& node = nodes[entry.child];
+		uint64_t child_mask[4] = { 0, 0, 0, 0 };
+		for(int i = 0; i < count; i++)
+		{
+			const uint64_t bit = uint64_t(1) << i;
+			if(!(mask & bit))
+				continue;
+			float dist[4];
+			int hits = intersectChildren(node.bounds, tr[i], sr[i], rays[i].tnear, rays[i].tfar, dist);
+			for(int slot = 0; slot < 4; slot++)
+			{
+				if(hits & (1 << slot))
+					child_mask[slot] |= bit;
+			}
+		}
+		for(int slot = 0; slot < 4; slot++)
+		{
+			if(child_mask[slot] != 0)
+				stack[stack_size++] = { node.child[slot], node.count[slot], child_mask[slot] };
+		}
+	}
+	return occluded_mask;
+}
+} // namespace pathtracer
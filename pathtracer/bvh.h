@@ -0,0 +1,96 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+
+namespace pathtracer
+{
+struct Ray;
+struct BVHBuildNode;
+
+///////////////////////////////////////////////////////////////////////////
+// A triangle to put in a BVH: three consecutive vertices starting at
+// first_vertex, and the IDs reported when it is hit.
+///////////////////////////////////////////////////////////////////////////
+struct BVHTriangleRef
+{
+	uint32_t first_vertex;
+	uint32_t geom_ID;
+	uint32_t prim_ID;
+};
+
+struct BVHBuildSettings
+{
+	// Centroid bins per axis for the SAH
+	int bins = 16;
+	// Leaves are split until they have at most this many triangles
+	int max_leaf_size = 4;
+	// Cost of a traversal step relative to a triangle test
+	float traversal_cost = 1.0f;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// A 4-wide BVH over triangles. It is built as a binary BVH with binned
+// SAH and then collapsed so that each node holds the bounds of up to four
+// children, which are tested against a ray at once (with SSE where
+// available). Triangles are intersected with the watertight test of Woop
+// et al. 2013, so rays do not slip through shared edges.
+///////////////////////////////////////////////////////////////////////////
+class BVH4
+{
+public:
+	void build(const glm::vec3* positions, const BVHTriangleRef* refs, size_t count,
+	           const BVHBuildSettings& settings);
+	// Update the bounds for new vertex positions (same triangles)
+	void refit(const glm::vec3* positions);
+
+	// Closest hit in (r.tnear, r.tfar), the ray is in this BVH's space.
+	// On a hit, tfar, u, v, n, geomID and primID of r are set.
+	bool intersect(Ray& r) const;
+	// Any hit in (r.tnear, r.tfar)
+	bool occluded(const Ray& r) const;
+	// Any hit for up to MAX_PACKET_SIZE rays (those with their bit set in
+	// active) in one traversal, returns a bit per occluded ray
+	static const int MAX_PACKET_SIZE = 64;
+	uint64_t occluded(const Ray* rays, int count, uint64_t active) const;
+
+	glm::vec3 boundsMin() const;
+	glm::vec3 boundsMax() const;
+	size_t nodeCount() const
+	{
+		return nodes.size();
+	}
+	size_t memoryBytes() const
+	{
+		return nodes.size() * sizeof(Node) + triangles.size() * sizeof(Triangle);
+	}
+
+	// Children with count == 0 are inner nodes, EMPTY_CHILD marks unused
+	// slots (whose bounds are inverted so they are never hit).
+	static const uint32_t EMPTY_CHILD = 0xFFFFFFFF;
+
+private:
+	struct alignas(16) Node
+	{
+		// [min x, min y, min z, max x, max y, max z][child]
+		float bounds[6][4];
+		// Inner node index, or first triangle of a leaf
+		uint32_t child[4];
+		uint32_t count[4];
+	};
+	struct Triangle
+	{
+		glm::vec3 v0;
+		uint32_t geom_ID;
+		glm::vec3 v1;
+		uint32_t prim_ID;
+		glm::vec3 v2;
+		uint32_t first_vertex;
+	};
+	std::vector<Node> nodes;
+	std::vector<Triangle> triangles;
+
+	uint32_t collapse(const BVHBuildNode* node);
+	void setChild(Node& node, int slot, const BVHBuildNode* child);
+};
+} // namespace pathtracer
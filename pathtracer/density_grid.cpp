@@ -0,0 +1,318 @@
+#include "density_grid.h"
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+using namespace glm;
+
+namespace pathtracer
+{
+// glm takes the sizes by reference, so they need definitions
+const int DensityGrid::BRICK_SIZE;
+const int DensityGrid::TILE_SIZE;
+const uint32_t DensityGrid::CONSTANT_BRICK;
+const uint32_t DensityGrid::EMPTY_TILE;
+
+static const int BRICK_VOXELS = DensityGrid::BRICK_SIZE * DensityGrid::BRICK_SIZE * DensityGrid::BRICK_SIZE;
+static const int TILE_BRICKS = DensityGrid::TILE_SIZE * DensityGrid::TILE_SIZE * DensityGrid::TILE_SIZE;
+
+///////////////////////////////////////////////////////////////////////////
+// Half to float for the lookups (glm::unpackHalf1x16 branches on every
+// case). Rebias the exponent, and let the FPU normalize denormals.
+///////////////////////////////////////////////////////////////////////////
+static inline float halfToFloat(uint16_t h)
+{
+	const uint32_t shifted_exponent = 0x7c00u << 13;
+	uint32_t bits = uint32_t(h & 0x7fffu) << 13;
+	const uint32_t exponent = bits & shifted_exponent;
+	bits += (127 - 15) << 23;
+	float f;
+	if(exponent == shifted_exponent)
+	{
+		// Inf or NaN
+		bits += (128 - 16) << 23;
+		memcpy(&f, &bits, sizeof(f));
+	}
+	else if(exponent == 0)
+	{
+		// Zero or denormal
+		bits += 1 << 23;
+		memcpy(&f, &bits, sizeof(f));
+		f -= 6.103515625e-05f;
+	}
+	else
+	{
+		memcpy(&f, &bits, sizeof(f));
+	}
+	return (h & 0x8000u) ? -f : f;
+}
+
+void DensityGrid::build(const vec3& bounds_min, const vec3& bounds_max, float voxel_size,
+                        const DensityFunction& density_function)
+{
+	origin = bounds_min;
+	this->voxel_size = voxel_size;
+	inv_voxel_size = 1.0f / voxel_size;
+	resolution = max(ivec3(1), ivec3(ceil((bounds_max - bounds_min) * inv_voxel_size)));
+	brick_resolution = (resolution + (BRICK_SIZE - 1)) / BRICK_SIZE;
+	tile_resolution = (brick_resolution + (TILE_SIZE - 1)) / TILE_SIZE;
+	const int brick_count = brick_resolution.x * brick_resolution.y * brick_resolution.z;
+	const int tile_count = tile_resolution.x * tile_resolution.y * tile_resolution.z;
+
+	tiles.assign(tile_count, EMPTY_TILE);
+	brick_entries.clear();
+	voxels.clear();
+	// Largest and smallest voxel of every brick, before the neighbours are
+	// included
+	std::vector<float> brick_max(brick_count, 0.0f);
+	std::vector<float> brick_min(brick_count, 0.0f);
+
+	///////////////////////////////////////////////////////////////////////
+	// Fill the tiles in parallel. Each thread samples a whole tile, and
+	// only appends its non constant bricks to the shared arrays.
+	///////////////////////////////////////////////////////////////////////
+#pragma omp parallel
+	{
+		std::vector<float> values(BRICK_VOXELS);
+		std::vector<float> px(BRICK_VOXELS), py(BRICK_VOXELS), pz(BRICK_VOXELS);
+		const Vec3SoA positions = { px.data(), py.data(), pz.data() };
+		std::vector<uint16_t> tile_voxels;
+		tile_voxels.reserve(TILE_BRICKS * BRICK_VOXELS);
+#pragma omp for schedule(dynamic)
+		for(int tile_index = 0; tile_index < tile_count; tile_index++)
+		{
+			const ivec3 tile(tile_index % tile_resolution.x, (tile_index / tile_resolution.x) % tile_resolution.y,
+			                 tile_index / (tile_resolution.x * tile_resolution.y));
+			uint32_t entries[TILE_BRICKS];
+			bool empty = true;
+			tile_voxels.clear();
+			for(int i = 0; i < TILE_BRICKS; i++)
+			{
+				const ivec3 brick = tile * TILE_SIZE + ivec3(i % TILE_SIZE, (i / TILE_SIZE) % TILE_SIZE,
+				                                             i / (TILE_SIZE * TILE_SIZE));
+				entries[i] = CONSTANT_BRICK;
+				if(any(greaterThanEqual(brick, brick_resolution)))
+					continue;
+				int v = 0;
+				for(int z = 0; z < BRICK_SIZE; z++)
+				{
+					for(int y = 0; y < BRICK_SIZE; y++)
+					{
+						for(int x = 0; x < BRICK_SIZE; x++, v++)
+						{
+							const vec3 p = origin + (vec3(brick * BRICK_SIZE + ivec3(x, y, z)) + 0.5f) * voxel_size;
+							px[v] = p.x;
+							py[v] = p.y;
+							pz[v] = p.z;
+						}
+					}
+				}
+				density_function(BRICK_VOXELS, positions, values.data());
+				float lo = FLT_MAX, hi = 0.0f;
+				v = 0;
+				for(int z = 0; z < BRICK_SIZE; z++)
+				{
+					for(int y = 0; y < BRICK_SIZE; y++)
+					{
+						for(int x = 0; x < BRICK_SIZE; x++, v++)
+						{
+							// Voxels past the resolution (in the last bricks) are zero
+							const ivec3 voxel = brick * BRICK_SIZE + ivec3(x, y, z);
+							float d = 0.0f;
+							if(all(lessThan(voxel, resolution)))
+								d = std::max(0.0f, values[v]);
+							values[v] = d;
+							lo = std::min(lo, d);
+							hi = std::max(hi, d);
+						}
+					}
+				}
+				brick_max[brickIndex(brick)] = hi;
+				brick_min[brickIndex(brick)] = lo;
+				const uint16_t lo_half = packHalf1x16(lo);
+				if(lo_half == packHalf1x16(hi))
+				{
+					entries[i] = CONSTANT_BRICK | lo_half;
+				}
+				else
+				{
+					// Offset within this tile's voxels for now
+					entries[i] = uint32_t(tile_voxels.size());
+					for(int j = 0; j < BRICK_VOXELS; j++)
+						tile_voxels.push_back(packHalf1x16(values[j]));
+				}
+				empty &= entries[i] == CONSTANT_BRICK;
+			}
+			if(empty)
+				continue;
+#pragma omp critical(density_grid_append)
+			{
+				const uint32_t voxels_offset = uint32_t(voxels.size());
+				tiles[tile_index] = uint32_t(brick_entries.size());
+				for(int i = 0; i < TILE_BRICKS; i++)
+				{
+					if(!(entries[i] & CONSTANT_BRICK))
+						entries[i] += voxels_offset;
+					brick_entries.push_back(entries[i]);
+				}
+				voxels.insert(voxels.end(), tile_voxels.begin(), tile_voxels.end());
+			}
+		}
+	}
+	voxels.shrink_to_fit();
+	brick_entries.shrink_to_fit();
+
+	///////////////////////////////////////////////////////////////////////
+	// Majorants and minorants. Interpolating at a point in a brick reads
+	// voxels of the neighbouring bricks too, so those are included, and
+	// past the border of the grid the density is zero. The half floats
+	// round by at most 2^-11, which the bounds are widened by.
+	///////////////////////////////////////////////////////////////////////
+	brick_majorants.assign(brick_count, 0.0f);
+	tile_majorants.assign(tile_count, 0.0f);
+	brick_minorants.assign(brick_count, 0.0f);
+	tile_minorants.assign(tile_count, FLT_MAX);
+	max_density = 0.0f;
+	const float rounding = 1.0f + 1.0f / 1024.0f;
+	for(int z = 0; z < brick_resolution.z; z++)
+	{
+		for(int y = 0; y < brick_resolution.y; y++)
+		{
+			for(int x = 0; x < brick_resolution.x; x++)
+			{
+				const ivec3 brick(x, y, z);
+				const ivec3 lo = max(brick - 1, ivec3(0));
+				const ivec3 hi = min(brick + 1, brick_resolution - 1);
+				float m = 0.0f;
+				float n = (any(equal(brick, ivec3(0))) || any(equal(brick, brick_resolution - 1))) ? 0.0f : FLT_MAX;
+				for(int nz = lo.z; nz <= hi.z; nz++)
+					for(int ny = lo.y; ny <= hi.y; ny++)
+						for(int nx = lo.x; nx <= hi.x; nx++)
+						{
+							m = std::max(m, brick_max[brickIndex(ivec3(nx, ny, nz))]);
+							n = std::min(n, brick_min[brickIndex(ivec3(nx, ny, nz))]);
+						}
+				m *= rounding;
+				n /= rounding;
+				brick_majorants[brickIndex(brick)] = m;
+				brick_minorants[brickIndex(brick)] = n;
+				float& tile_majorant = tile_majorants[tileIndex(brick / TILE_SIZE)];
+				tile_majorant = std::max(tile_majorant, m);
+				float& tile_minorant = tile_minorants[tileIndex(brick / TILE_SIZE)];
+				tile_minorant = std::min(tile_minorant, n);
+				max_density = std::max(max_density, m);
+			}
+		}
+	}
+}
+
+size_t DensityGrid::memoryBytes() const
+{
+	return tiles.capacity() * sizeof(uint32_t) + brick_entries.capacity() * sizeof(uint32_t)
+	       + voxels.capacity() * sizeof(uint16_t) + brick_majorants.capacity() * sizeof(float)
+	       + tile_majorants.capacity() * sizeof(float) + brick_minorants.capacity() * sizeof(float)
+	       + tile_minorants.capacity() * sizeof(float);
+}
+
+float DensityGrid::voxel(int x, int y, int z) const
+{
+	const ivec3 v(x, y, z);
+	if(any(lessThan(v, ivec3(0))) || any(greaterThanEqual(v, brick_resolution * BRICK_SIZE)))
+		return 0.0f;
+	const uint32_t tile = tiles[tileIndex(v / (BRICK_SIZE * TILE_SIZE))];
+	if(tile == EMPTY_TILE)
+		return 0.0f;
+	const ivec3 b = (v / BRICK_SIZE) % TILE_SIZE;
+	const uint32_t entry = brick_entries[tile + (b.z * TILE_SIZE + b.y) * TILE_SIZE + b.x];
+	if(entry & CONSTANT_BRICK)
+		return halfToFloat(uint16_t(entry));
+	const ivec3 i = v % BRICK_SIZE;
+	return halfToFloat(voxels[entry + (i.z * BRICK_SIZE + i.y) * BRICK_SIZE + i.x]);
+}
+
+float DensityGrid::density(const vec3& p) const
+{
+	const vec3 c = (p - origin) * inv_voxel_size - 0.5f;
+	const vec3 c0 = floor(c);
+	const vec3 w = c - c0;
+	const ivec3 i = ivec3(c0);
+
+	float d[8];
+	const ivec3 in_brick = i & (BRICK_SIZE - 1);
+	if(all(greaterThanEqual(i, ivec3(0))) && all(lessThan(in_brick, ivec3(BRICK_SIZE - 1)))
+	   && all(lessThan(i, brick_resolution * BRICK_SIZE)))
+	{
+		// All eight voxels are in one brick, look it up once
+		const uint32_t tile = tiles[tileIndex(i / (BRICK_SIZE * TILE_SIZE))];
+		if(tile == EMPTY_TILE)
+			return 0.0f;
+		const ivec3 b = (i / BRICK_SIZE) % TILE_SIZE;
+		const uint32_t entry = brick_entries[tile + (b.z * TILE_SIZE + b.y) * TILE_SIZE + b.x];
+		if(entry & CONSTANT_BRICK)
+			return halfToFloat(uint16_t(entry));
+		const uint16_t* v = &voxels[entry + (in_brick.z * BRICK_SIZE + in_brick.y) * BRICK_SIZE + in_brick.x];
+		const int dy = BRICK_SIZE, dz = BRICK_SIZE * BRICK_SIZE;
+		d[0] = halfToFloat(v[0]);
+		d[1] = halfToFloat(v[1]);
+		d[2] = halfToFloat(v[dy]);
+		d[3] = halfToFloat(v[dy + 1]);
+		d[4] = halfToFloat(v[dz]);
+		d[5] = halfToFloat(v[dz + 1]);
+		d[6] = halfToFloat(v[dz + dy]);
+		d[7] = halfToFloat(v[dz + dy + 1]);
+	}
+	else
+	{
+		for(int k = 0; k < 8; k++)
+			d[k] = voxel(i.x + (k & 1), i.y + ((k >> 1) & 1), i.z + (k >> 2));
+	}
+	const float x0 = mix(mix(d[0], d[1], w.x), mix(d[2], d[3], w.x), w.y);
+	const float x1 = mix(mix(d[4], d[5], w.x), mix(d[6], d[7], w.x), w.y);
+	return mix(x0, x1, w.z);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// One step of a DDA through the bricks: the majorant of the brick the ray
+// is in at t0, until it leaves the brick. Where a whole tile is empty the
+// step goes to the end of the tile instead.
+///////////////////////////////////////////////////////////////////////////
+float DensityGrid::majorant(const Ray& r, float t0, float t1, float& t_end, float& minorant) const
+{
+	// In voxels from here on
+	const vec3 p = (r.o + t0 * r.d - origin) * inv_voxel_size;
+	const ivec3 brick = clamp(ivec3(floor(p / float(BRICK_SIZE))), ivec3(0), brick_resolution - 1);
+	const ivec3 tile = brick / TILE_SIZE;
+
+	float m;
+	vec3 cell_min, cell_max;
+	if(tile_majorants[tileIndex(tile)] == 0.0f)
+	{
+		m = 0.0f;
+		minorant = 0.0f;
+		cell_min = vec3(tile * (TILE_SIZE * BRICK_SIZE));
+		cell_max = cell_min + float(TILE_SIZE * BRICK_SIZE);
+	}
+	else
+	{
+		m = brick_majorants[brickIndex(brick)];
+		minorant = brick_minorants[brickIndex(brick)];
+		cell_min = vec3(brick * BRICK_SIZE);
+		cell_max = cell_min + float(BRICK_SIZE);
+	}
+
+	float t_exit = t1;
+	for(int k = 0; k < 3; k++)
+	{
+		const float d = r.d[k] * inv_voxel_size;
+		if(d > 0.0f)
+			t_exit = std::min(t_exit, t0 + (cell_max[k] - p[k]) / d);
+		else if(d < 0.0f)
+			t_exit = std::min(t_exit, t0 + (cell_min[k] - p[k]) / d);
+	}
+	// A point on the boundary may round into the brick it is leaving. The
+	// neighbours' majorants are included, so stepping a little is safe.
+	t_end = std::min(t1, std::max(t_exit, t0 + 1e-3f * voxel_size));
+	return m;
+}
+} // namespace pathtracer
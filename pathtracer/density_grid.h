@@ -0,0 +1,118 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <functional>
+#include <vector>
+#include <stdint.h>
+#include "medium.h"
+#include "distributions_batch.h"
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// A sparse voxel grid of densities in a world space box. Voxels are
+// grouped in bricks of 8^3 and bricks in tiles of 4^3. A tile with nothing
+// in it takes one index entry, a brick with a constant value (typically
+// zero) takes one entry in its tile, and only the other bricks store their
+// voxels, as half floats. A lookup is a tile entry, a brick entry and the
+// brick's voxels.
+//
+// The largest and smallest density that can be interpolated anywhere in a
+// brick (and in a tile) are kept. The maxima are the majorants delta
+// tracking uses to skip through empty and thin parts of the grid, the
+// minima let ratio tracking take the dense, uniform parts out analytically.
+///////////////////////////////////////////////////////////////////////////
+class DensityGrid
+{
+public:
+	static const int BRICK_SIZE = 8;
+	static const int TILE_SIZE = 4;
+
+	// Densities at count points
+	typedef std::function<void(int count, Vec3SoA p, float* density)> DensityFunction;
+
+	// Sample density_function at the voxel centers, a brick at a time (in
+	// parallel, the function is called from several threads at once)
+	void build(const glm::vec3& bounds_min, const glm::vec3& bounds_max, float voxel_size,
+	           const DensityFunction& density_function);
+
+	// Trilinear interpolation of the voxels, zero outside the grid
+	float density(const glm::vec3& p) const;
+	// Bounds of density() along r from t0 for as long as the ray stays in
+	// one brick (or one tile, if the whole tile is empty), see
+	// Medium::majorant()
+	float majorant(const Ray& r, float t0, float t1, float& t_end, float& minorant) const;
+
+	float maxDensity() const
+	{
+		return max_density;
+	}
+	size_t brickCount() const
+	{
+		return voxels.size() / (BRICK_SIZE * BRICK_SIZE * BRICK_SIZE);
+	}
+	size_t memoryBytes() const;
+
+private:
+	// Brick entries with this bit set hold a constant (half float) value
+	// in the low bits instead of an offset into voxels
+	static const uint32_t CONSTANT_BRICK = 0x80000000u;
+	static const uint32_t EMPTY_TILE = 0xffffffffu;
+
+	glm::vec3 origin;
+	float voxel_size = 1.0f;
+	float inv_voxel_size = 1.0f;
+	glm::ivec3 resolution = glm::ivec3(0);
+	glm::ivec3 brick_resolution = glm::ivec3(0);
+	glm::ivec3 tile_resolution = glm::ivec3(0);
+	float max_density = 0.0f;
+
+	// Per tile, its first entry in brick_entries (TILE_SIZE^3 of them) or
+	// EMPTY_TILE
+	std::vector<uint32_t> tiles;
+	std::vector<uint32_t> brick_entries;
+	// Voxels of the bricks that are not constant, x fastest
+	std::vector<uint16_t> voxels;
+	// Majorants and minorants of all bricks and tiles (dense, but 512 and
+	// 32768 times smaller than the voxels), including what the neighbours
+	// contribute through interpolation
+	std::vector<float> brick_majorants;
+	std::vector<float> tile_majorants;
+	std::vector<float> brick_minorants;
+	std::vector<float> tile_minorants;
+
+	float voxel(int x, int y, int z) const;
+	int brickIndex(const glm::ivec3& b) const
+	{
+		return (b.z * brick_resolution.y + b.y) * brick_resolution.x + b.x;
+	}
+	int tileIndex(const glm::ivec3& t) const
+	{
+		return (t.z * tile_resolution.y + t.y) * tile_resolution.x + t.x;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+// A medium with its density in a DensityGrid
+///////////////////////////////////////////////////////////////////////////
+class GridMedium : public Medium
+{
+public:
+	// The grid must be built, and outlive the medium
+	GridMedium(const DensityGrid* grid, const glm::vec3& bounds_min, const glm::vec3& bounds_max)
+	    : Medium(bounds_min, bounds_max), grid(grid)
+	{
+		max_density = grid->maxDensity();
+	}
+	float density(const glm::vec3& p) const override
+	{
+		return grid->density(p);
+	}
+	float majorant(const Ray& r, float t0, float t1, float& t_end, float& minorant) const override
+	{
+		return grid->majorant(r, t0, t1, t_end, minorant);
+	}
+
+private:
+	const DensityGrid* grid;
+};
+} // namespace pathtracer
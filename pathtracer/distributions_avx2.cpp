@@ -0,0 +1,82 @@
+#include "distributions_batch.h"
+
+#ifdef PATHTRACER_SIMD_X86
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+
+namespace pathtracer
+{
+namespace simd_avx2
+{
+static const SimdLevel simd_level = SIMD_AVX2;
+
+///////////////////////////////////////////////////////////////////////////
+// 8-wide float and mask wrappers. This file is compiled with AVX2/FMA
+// enabled and must only be called after checking the CPU supports it.
+///////////////////////////////////////////////////////////////////////////
+struct vmask
+{
+	__m256 m;
+};
+
+struct vfloat
+{
+	enum { width = 8 };
+	__m256 v;
+	vfloat() {}
+	vfloat(__m256 x) : v(x) {}
+	vfloat(float f) : v(_mm256_set1_ps(f)) {}
+	static vfloat load(const float* p) { return _mm256_loadu_ps(p); }
+	void store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+
+static inline vfloat operator+(const vfloat& a, const vfloat& b) { return _mm256_add_ps(a.v, b.v); }
+static inline vfloat operator-(const vfloat& a, const vfloat& b) { return _mm256_sub_ps(a.v, b.v); }
+static inline vfloat operator*(const vfloat& a, const vfloat& b) { return _mm256_mul_ps(a.v, b.v); }
+static inline vfloat operator/(const vfloat& a, const vfloat& b) { return _mm256_div_ps(a.v, b.v); }
+static inline vfloat operator-(const vfloat& a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+
+static inline vmask operator<(const vfloat& a, const vfloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+static inline vmask operator<=(const vfloat& a, const vfloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+static inline vmask operator>(const vfloat& a, const vfloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+static inline vmask operator>=(const vfloat& a, const vfloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+static inline vmask operator!=(const vfloat& a, const vfloat& b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ) }; }
+static inline vmask operator&(const vmask& a, const vmask& b) { return { _mm256_and_ps(a.m, b.m) }; }
+static inline vmask operator|(const vmask& a, const vmask& b) { return { _mm256_or_ps(a.m, b.m) }; }
+static inline vmask operator!=(const vmask& a, const vmask& b) { return { _mm256_xor_ps(a.m, b.m) }; }
+
+static inline vfloat select(const vmask& m, const vfloat& a, const vfloat& b)
+{
+	return _mm256_blendv_ps(b.v, a.v, m.m);
+}
+
+static inline vfloat min(const vfloat& a, const vfloat& b) { return _mm256_min_ps(a.v, b.v); }
+static inline vfloat max(const vfloat& a, const vfloat& b) { return _mm256_max_ps(a.v, b.v); }
+static inline vfloat sqrt(const vfloat& a) { return _mm256_sqrt_ps(a.v); }
+static inline vfloat abs(const vfloat& a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+static inline vfloat floor(const vfloat& a) { return _mm256_floor_ps(a.v); }
+
+// 2^n for integral n in [-126, 127]
+static inline vfloat pow2i(const vfloat& n)
+{
+	__m256i e = _mm256_add_epi32(_mm256_cvttps_epi32(n.v), _mm256_set1_epi32(127));
+	return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+}
+
+// Split x > 0 into a mantissa in [0.5, 1) and an exponent
+static inline vfloat frexp(const vfloat& x, vfloat& e)
+{
+	__m256i i = _mm256_castps_si256(x.v);
+	__m256i exponent = _mm256_and_si256(_mm256_srli_epi32(i, 23), _mm256_set1_epi32(0xff));
+	e = _mm256_cvtepi32_ps(_mm256_sub_epi32(exponent, _mm256_set1_epi32(126)));
+	i = _mm256_or_si256(_mm256_and_si256(i, _mm256_set1_epi32(0x807fffff)), _mm256_set1_epi32(0x3f000000));
+	return _mm256_castsi256_ps(i);
+}
+
+#include "distributions_simd.inl"
+
+} // namespace simd_avx2
+} // namespace pathtracer
+
+#endif // PATHTRACER_SIMD_X86
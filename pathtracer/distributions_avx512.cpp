@@ -0,0 +1,92 @@
+#include "distributions_batch.h"
+
+#ifdef PATHTRACER_SIMD_X86
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+
+namespace pathtracer
+{
+namespace simd_avx512
+{
+static const SimdLevel simd_level = SIMD_AVX512;
+
+///////////////////////////////////////////////////////////////////////////
+// 16-wide float and mask wrappers. Only AVX-512F is used (float bitwise
+// ops go through the integer unit since _mm512_and_ps needs AVX-512DQ).
+// This file must only be called after checking the CPU supports it.
+///////////////////////////////////////////////////////////////////////////
+struct vmask
+{
+	__mmask16 m;
+};
+
+struct vfloat
+{
+	enum { width = 16 };
+	__m512 v;
+	vfloat() {}
+	vfloat(__m512 x) : v(x) {}
+	vfloat(float f) : v(_mm512_set1_ps(f)) {}
+	static vfloat load(const float* p) { return _mm512_loadu_ps(p); }
+	void store(float* p) const { _mm512_storeu_ps(p, v); }
+};
+
+static inline vfloat operator+(const vfloat& a, const vfloat& b) { return _mm512_add_ps(a.v, b.v); }
+static inline vfloat operator-(const vfloat& a, const vfloat& b) { return _mm512_sub_ps(a.v, b.v); }
+static inline vfloat operator*(const vfloat& a, const vfloat& b) { return _mm512_mul_ps(a.v, b.v); }
+static inline vfloat operator/(const vfloat& a, const vfloat& b) { return _mm512_div_ps(a.v, b.v); }
+static inline vfloat operator-(const vfloat& a)
+{
+	return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a.v), _mm512_set1_epi32(0x80000000)));
+}
+
+static inline vmask operator<(const vfloat& a, const vfloat& b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+static inline vmask operator<=(const vfloat& a, const vfloat& b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ) }; }
+static inline vmask operator>(const vfloat& a, const vfloat& b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ) }; }
+static inline vmask operator>=(const vfloat& a, const vfloat& b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ) }; }
+static inline vmask operator!=(const vfloat& a, const vfloat& b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_NEQ_UQ) }; }
+static inline vmask operator&(const vmask& a, const vmask& b) { return { __mmask16(a.m & b.m) }; }
+static inline vmask operator|(const vmask& a, const vmask& b) { return { __mmask16(a.m | b.m) }; }
+static inline vmask operator!=(const vmask& a, const vmask& b) { return { __mmask16(a.m ^ b.m) }; }
+
+static inline vfloat select(const vmask& m, const vfloat& a, const vfloat& b)
+{
+	return _mm512_mask_blend_ps(m.m, b.v, a.v);
+}
+
+static inline vfloat min(const vfloat& a, const vfloat& b) { return _mm512_min_ps(a.v, b.v); }
+static inline vfloat max(const vfloat& a, const vfloat& b) { return _mm512_max_ps(a.v, b.v); }
+static inline vfloat sqrt(const vfloat& a) { return _mm512_sqrt_ps(a.v); }
+static inline vfloat abs(const vfloat& a)
+{
+	return _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a.v), _mm512_set1_epi32(0x7fffffff)));
+}
+static inline vfloat floor(const vfloat& a)
+{
+	return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+}
+
+// 2^n for integral n in [-126, 127]
+static inline vfloat pow2i(const vfloat& n)
+{
+	__m512i e = _mm512_add_epi32(_mm512_cvttps_epi32(n.v), _mm512_set1_epi32(127));
+	return _mm512_castsi512_ps(_mm512_slli_epi32(e, 23));
+}
+
+// Split x > 0 into a mantissa in [0.5, 1) and an exponent
+static inline vfloat frexp(const vfloat& x, vfloat& e)
+{
+	__m512i i = _mm512_castps_si512(x.v);
+	__m512i exponent = _mm512_and_si512(_mm512_srli_epi32(i, 23), _mm512_set1_epi32(0xff));
+	e = _mm512_cvtepi32_ps(_mm512_sub_epi32(exponent, _mm512_set1_epi32(126)));
+	i = _mm512_or_si512(_mm512_and_si512(i, _mm512_set1_epi32(0x807fffff)), _mm512_set1_epi32(0x3f000000));
+	return _mm512_castsi512_ps(i);
+}
+
+#include "distributions_simd.inl"
+
+} // namespace simd_avx512
+} // namespace pathtracer
+
+#endif // PATHTRACER_SIMD_X86
@@ -0,0 +1,293 @@
+#include "distributions_batch.h"
+#include "material.h"
+#include "sampling.h"
+#include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace glm;
+
+namespace pathtracer
+{
+#ifdef PATHTRACER_SIMD_X86
+namespace simd_sse2
+{
+extern const DistributionKernels kernels;
+}
+namespace simd_avx2
+{
+extern const DistributionKernels kernels;
+}
+namespace simd_avx512
+{
+extern const DistributionKernels kernels;
+}
+#endif
+
+namespace scalar
+{
+///////////////////////////////////////////////////////////////////////////
+// Width 1 fallback, just loops over the Distributions functions
+///////////////////////////////////////////////////////////////////////////
+static inline vec3 get(const Vec3SoA& a, int i)
+{
+	return vec3(a.x[i], a.y[i], a.z[i]);
+}
+
+static void FresnelSchlick(int count, Vec3SoA wi, Vec3SoA wh, const float* R0, float* F)
+{
+	for(int i = 0; i < count; i++)
+		F[i] = Distributions::FresnelSchlick(get(wi, i), get(wh, i), R0[i]);
+}
+
+static void GGX_D(int count, Vec3SoA n, Vec3SoA wh, const float* shininess, float* D)
+{
+	for(int i = 0; i < count; i++)
+		D[i] = Distributions::GGX_D(get(n, i), get(wh, i), shininess[i]);
+}
+
+static void GGXSmith_G1(int count, Vec3SoA v, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G1)
+{
+	for(int i = 0; i < count; i++)
+		G1[i] = Distributions::GGXSmith_G1(get(v, i), get(wh, i), get(n, i), shininess[i]);
+}
+
+static void GGXSmith_G(int count, Vec3SoA wi, Vec3SoA wo, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G)
+{
+	for(int i = 0; i < count; i++)
+		G[i] = Distributions::GGXSmith_G(get(wi, i), get(wo, i), get(wh, i), get(n, i), shininess[i]);
+}
+
+static void GGX_pdf(int count, Vec3SoA n, Vec3SoA wh, Vec3SoA wo, const float* shininess, float* pdf)
+{
+	for(int i = 0; i < count; i++)
+	{
+		vec3 h = get(wh, i);
+		float pwh = Distributions::GGX_D(get(n, i), h, shininess[i]) * abs(dot(get(n, i), h));
+		pdf[i] = pwh / (4.0f * abs(dot(get(wo, i), h)));
+	}
+}
+
+static vec3 sampleAround(const vec3& n, float cos_theta, float u1)
+{
+	vec3 tangent = normalize(perpendicular(n));
+	vec3 bitangent = normalize(cross(tangent, n));
+	float phi = 2.0f * M_PI * u1;
+	float sin_theta = sqrt(max(0.0f, 1.0f - (cos_theta * cos_theta)));
+	return normalize(sin_theta * cos(phi) * tangent + sin_theta * sin(phi) * bitangent + cos_theta * n);
+}
+
+static void GGX_sample_wh(int count, Vec3SoA n, const float* shininess, const float* u1, const float* u2, Vec3SoAOut wh)
+{
+	for(int i = 0; i < count; i++)
+	{
+		float a2 = shininess[i] * shininess[i];
+		float cos_theta = sqrt((1.0f - u2[i]) / ((a2 - 1.0f) * u2[i] + 1.0f));
+		vec3 h = sampleAround(get(n, i), cos_theta, u1[i]);
+		wh.x[i] = h.x;
+		wh.y[i] = h.y;
+		wh.z[i] = h.z;
+	}
+}
+
+static void Beckmann_D(int count, Vec3SoA n, Vec3SoA wh, const float* shininess, float* D)
+{
+	for(int i = 0; i < count; i++)
+		D[i] = Distributions::Beckmann_D(get(n, i), get(wh, i), shininess[i]);
+}
+
+static void BeckmannSmith_G1(int count, Vec3SoA v, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G1)
+{
+	for(int i = 0; i < count; i++)
+		G1[i] = Distributions::BeckmannSmith_G1(get(v, i), get(wh, i), get(n, i), shininess[i]);
+}
+
+static void BeckmannSmith_G(int count, Vec3SoA wi, Vec3SoA wo, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G)
+{
+	for(int i = 0; i < count; i++)
+		G[i] = Distributions::BeckmannSmith_G(get(wi, i), get(wo, i), get(wh, i), get(n, i), shininess[i]);
+}
+
+static void Beckmann_pdf(int count, Vec3SoA n, Vec3SoA wh, Vec3SoA wo, const float* shininess, float* pdf)
+{
+	for(int i = 0; i < count; i++)
+	{
+		vec3 h = get(wh, i);
+		float pwh = Distributions::Beckmann_D(get(n, i), h, shininess[i]) * abs(dot(get(n, i), h));
+		pdf[i] = pwh / (4.0f * abs(dot(get(wo, i), h)));
+	}
+}
+
+static void Beckmann_sample_wh(int count, Vec3SoA n, const float* shininess, const float* u1, const float* u2, Vec3SoAOut wh)
+{
+	for(int i = 0; i < count; i++)
+	{
+		float a2 = shininess[i] * shininess[i];
+		float cos_theta = sqrt(1.0f / (1.0f - a2 * log(1.0f - u2[i])));
+		vec3 h = sampleAround(get(n, i), cos_theta, u1[i]);
+		wh.x[i] = h.x;
+		wh.y[i] = h.y;
+		wh.z[i] = h.z;
+	}
+}
+
+static const DistributionKernels kernels = {
+	SIMD_SCALAR,      1,              &FresnelSchlick,  &GGX_D,     &GGXSmith_G1,
+	&GGXSmith_G,      &GGX_pdf,       &GGX_sample_wh,   &Beckmann_D, &BeckmannSmith_G1,
+	&BeckmannSmith_G, &Beckmann_pdf,  &Beckmann_sample_wh,
+};
+} // namespace scalar
+
+///////////////////////////////////////////////////////////////////////////
+// Runtime CPU detection
+///////////////////////////////////////////////////////////////////////////
+static SimdLevel detectLevel()
+{
+#if !defined(PATHTRACER_SIMD_X86)
+	return SIMD_SCALAR;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool fma = (info[2] & (1 << 12)) != 0;
+	if(!osxsave)
+		return SIMD_SSE2;
+	unsigned long long xcr0 = _xgetbv(0);
+	__cpuidex(info, 7, 0);
+	bool avx2 = (info[1] & (1 << 5)) != 0;
+	bool avx512f = (info[1] & (1 << 16)) != 0;
+	if(avx512f && (xcr0 & 0xe6) == 0xe6)
+		return SIMD_AVX512;
+	if(avx2 && fma && (xcr0 & 0x6) == 0x6)
+		return SIMD_AVX2;
+	return SIMD_SSE2;
+#else
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+		return SIMD_AVX512;
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return SIMD_AVX2;
+	return SIMD_SSE2;
+#endif
+}
+
+SimdLevel DistributionsSoA::supportedLevel()
+{
+	static const SimdLevel supported = detectLevel();
+	return supported;
+}
+
+const DistributionKernels& DistributionsSoA::kernels(SimdLevel level)
+{
+	level = std::min(level, supportedLevel());
+	switch(level)
+	{
+#ifdef PATHTRACER_SIMD_X86
+	case SIMD_AVX512:
+		return simd_avx512::kernels;
+	case SIMD_AVX2:
+		return simd_avx2::kernels;
+	case SIMD_SSE2:
+		return simd_sse2::kernels;
+#endif
+	default:
+		return scalar::kernels;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The kernels in use, the best supported ones unless setLevel() is called
+///////////////////////////////////////////////////////////////////////////
+static const DistributionKernels* current_kernels =
+    &DistributionsSoA::kernels(DistributionsSoA::supportedLevel());
+
+static inline const DistributionKernels& current()
+{
+	return *current_kernels;
+}
+
+SimdLevel DistributionsSoA::level()
+{
+	return current().level;
+}
+
+void DistributionsSoA::setLevel(SimdLevel level)
+{
+	current_kernels = &kernels(level);
+}
+
+const char* DistributionsSoA::levelName(SimdLevel level)
+{
+	switch(level)
+	{
+	case SIMD_SSE2:
+		return "SSE2";
+	case SIMD_AVX2:
+		return "AVX2";
+	case SIMD_AVX512:
+		return "AVX-512";
+	default:
+		return "Scalar";
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Dispatch
+///////////////////////////////////////////////////////////////////////////
+void DistributionsSoA::FresnelSchlick(int count, Vec3SoA wi, Vec3SoA wh, const float* R0, float* F)
+{
+	current().FresnelSchlick(count, wi, wh, R0, F);
+}
+
+void DistributionsSoA::GGX_D(int count, Vec3SoA n, Vec3SoA wh, const float* shininess, float* D)
+{
+	current().GGX_D(count, n, wh, shininess, D);
+}
+
+void DistributionsSoA::GGXSmith_G1(int count, Vec3SoA v, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G1)
+{
+	current().GGXSmith_G1(count, v, wh, n, shininess, G1);
+}
+
+void DistributionsSoA::GGXSmith_G(int count, Vec3SoA wi, Vec3SoA wo, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G)
+{
+	current().GGXSmith_G(count, wi, wo, wh, n, shininess, G);
+}
+
+void DistributionsSoA::GGX_pdf(int count, Vec3SoA n, Vec3SoA wh, Vec3SoA wo, const float* shininess, float* pdf)
+{
+	current().GGX_pdf(count, n, wh, wo, shininess, pdf);
+}
+
+void DistributionsSoA::GGX_sample_wh(int count, Vec3SoA n, const float* shininess, const float* u1, const float* u2, Vec3SoAOut wh)
+{
+	current().GGX_sample_wh(count, n, shininess, u1, u2, wh);
+}
+
+void DistributionsSoA::Beckmann_D(int count, Vec3SoA n, Vec3SoA wh, const float* shininess, float* D)
+{
+	current().Beckmann_D(count, n, wh, shininess, D);
+}
+
+void DistributionsSoA::BeckmannSmith_G1(int count, Vec3SoA v, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G1)
+{
+	current().BeckmannSmith_G1(count, v, wh, n, shininess, G1);
+}
+
+void DistributionsSoA::BeckmannSmith_G(int count, Vec3SoA wi, Vec3SoA wo, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G)
+{
+	current().BeckmannSmith_G(count, wi, wo, wh, n, shininess, G);
+}
+
+void DistributionsSoA::Beckmann_pdf(int count, Vec3SoA n, Vec3SoA wh, Vec3SoA wo, const float* shininess, float* pdf)
+{
+	current().Beckmann_pdf(count, n, wh, wo, shininess, pdf);
+}
+
+void DistributionsSoA::Beckmann_sample_wh(int count, Vec3SoA n, const float* shininess, const float* u1, const float* u2, Vec3SoAOut wh)
+{
+	current().Beckmann_sample_wh(count, n, shininess, u1, u2, wh);
+}
+
+} // namespace pathtracer
@@ -0,0 +1,96 @@
+#pragma once
+#include <glm/glm.hpp>
+
+// The SSE2/AVX2/AVX-512 kernels are only built for 64-bit x86, elsewhere
+// the batched functions fall back to looping over the scalar versions.
+#if defined(__x86_64__) || defined(_M_X64)
+#define PATHTRACER_SIMD_X86 1
+#endif
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// A block of vectors stored as structure-of-arrays. All arrays passed to
+// a batched function have (at least) `count` elements.
+///////////////////////////////////////////////////////////////////////////
+struct Vec3SoA
+{
+	const float* x;
+	const float* y;
+	const float* z;
+};
+
+struct Vec3SoAOut
+{
+	float* x;
+	float* y;
+	float* z;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// The instruction sets the batched kernels are compiled for
+///////////////////////////////////////////////////////////////////////////
+enum SimdLevel
+{
+	SIMD_SCALAR = 0,
+	SIMD_SSE2,
+	SIMD_AVX2,
+	SIMD_AVX512,
+};
+
+///////////////////////////////////////////////////////////////////////////
+// One set of kernels, all compiled for the same instruction set
+///////////////////////////////////////////////////////////////////////////
+struct DistributionKernels
+{
+	SimdLevel level;
+	int width;
+	void (*FresnelSchlick)(int count, Vec3SoA wi, Vec3SoA wh, const float* R0, float* F);
+	void (*GGX_D)(int count, Vec3SoA n, Vec3SoA wh, const float* shininess, float* D);
+	void (*GGXSmith_G1)(int count, Vec3SoA v, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G1);
+	void (*GGXSmith_G)(int count, Vec3SoA wi, Vec3SoA wo, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G);
+	void (*GGX_pdf)(int count, Vec3SoA n, Vec3SoA wh, Vec3SoA wo, const float* shininess, float* pdf);
+	void (*GGX_sample_wh)(int count, Vec3SoA n, const float* shininess, const float* u1, const float* u2, Vec3SoAOut wh);
+	void (*Beckmann_D)(int count, Vec3SoA n, Vec3SoA wh, const float* shininess, float* D);
+	void (*BeckmannSmith_G1)(int count, Vec3SoA v, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G1);
+	void (*BeckmannSmith_G)(int count, Vec3SoA wi, Vec3SoA wo, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G);
+	void (*Beckmann_pdf)(int count, Vec3SoA n, Vec3SoA wh, Vec3SoA wo, const float* shininess, float* pdf);
+	void (*Beckmann_sample_wh)(int count, Vec3SoA n, const float* shininess, const float* u1, const float* u2, Vec3SoAOut wh);
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Batched versions of the Distributions functions in material.h. They
+// evaluate a whole block of hits at once, 4/8/16 lanes at a time
+// depending on what the CPU supports (chosen at runtime).
+//
+// The sampling functions take their random numbers as input instead of
+// calling randf(), u1 is used for phi and u2 for theta.
+///////////////////////////////////////////////////////////////////////////
+class DistributionsSoA
+{
+public:
+	static void FresnelSchlick(int count, Vec3SoA wi, Vec3SoA wh, const float* R0, float* F);
+	static void GGX_D(int count, Vec3SoA n, Vec3SoA wh, const float* shininess, float* D);
+	static void GGXSmith_G1(int count, Vec3SoA v, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G1);
+	static void GGXSmith_G(int count, Vec3SoA wi, Vec3SoA wo, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G);
+	static void GGX_pdf(int count, Vec3SoA n, Vec3SoA wh, Vec3SoA wo, const float* shininess, float* pdf);
+	static void GGX_sample_wh(int count, Vec3SoA n, const float* shininess, const float* u1, const float* u2, Vec3SoAOut wh);
+	static void Beckmann_D(int count, Vec3SoA n, Vec3SoA wh, const float* shininess, float* D);
+	static void BeckmannSmith_G1(int count, Vec3SoA v, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G1);
+	static void BeckmannSmith_G(int count, Vec3SoA wi, Vec3SoA wo, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G);
+	static void Beckmann_pdf(int count, Vec3SoA n, Vec3SoA wh, Vec3SoA wo, const float* shininess, float* pdf);
+	static void Beckmann_sample_wh(int count, Vec3SoA n, const float* shininess, const float* u1, const float* u2, Vec3SoAOut wh);
+
+	// The best level supported by this CPU
+	static SimdLevel supportedLevel();
+	// The level currently used by the functions above
+	static SimdLevel level();
+	// Force a (lower) level, e.g. to compare throughput between widths.
+	// Clamped to what the CPU supports.
+	static void setLevel(SimdLevel level);
+	static const char* levelName(SimdLevel level);
+	// The kernels for a specific level (clamped to what the CPU supports)
+	static const DistributionKernels& kernels(SimdLevel level);
+};
+
+} // namespace pathtracer
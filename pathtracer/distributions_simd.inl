@@ -0,0 +1,354 @@
+///////////////////////////////////////////////////////////////////////////
+// Batched microfacet distribution kernels, written once against a small
+// SIMD wrapper. Each distributions_<isa>.cpp defines `vfloat`, `vmask`
+// and `simd_level` in its own namespace and then includes this file, so
+// the same code is compiled once per instruction set.
+//
+// The math mirrors the scalar Distributions functions in material.cpp.
+///////////////////////////////////////////////////////////////////////////
+
+#define SIMD_PI 3.14159265359f
+
+struct vec3x
+{
+	vfloat x, y, z;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Loads and stores that handle the partial block at the end of an array
+///////////////////////////////////////////////////////////////////////////
+static inline vfloat loadN(const float* p, int n)
+{
+	if(n == vfloat::width)
+		return vfloat::load(p);
+	float tmp[vfloat::width] = {};
+	for(int i = 0; i < n; i++)
+		tmp[i] = p[i];
+	return vfloat::load(tmp);
+}
+
+static inline void storeN(float* p, const vfloat& v, int n)
+{
+	if(n == vfloat::width)
+	{
+		v.store(p);
+		return;
+	}
+	float tmp[vfloat::width];
+	v.store(tmp);
+	for(int i = 0; i < n; i++)
+		p[i] = tmp[i];
+}
+
+static inline vec3x load3(const Vec3SoA& a, int i, int n)
+{
+	vec3x r = { loadN(a.x + i, n), loadN(a.y + i, n), loadN(a.z + i, n) };
+	return r;
+}
+
+static inline void store3(const Vec3SoAOut& a, int i, const vec3x& v, int n)
+{
+	storeN(a.x + i, v.x, n);
+	storeN(a.y + i, v.y, n);
+	storeN(a.z + i, v.z, n);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Vector helpers
+///////////////////////////////////////////////////////////////////////////
+static inline vfloat dot(const vec3x& a, const vec3x& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline vec3x cross(const vec3x& a, const vec3x& b)
+{
+	vec3x r = { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+	return r;
+}
+
+static inline vec3x normalize(const vec3x& a)
+{
+	vfloat inv_len = vfloat(1.0f) / sqrt(dot(a, a));
+	vec3x r = { a.x * inv_len, a.y * inv_len, a.z * inv_len };
+	return r;
+}
+
+static inline vfloat pow5(const vfloat& x)
+{
+	vfloat x2 = x * x;
+	return x2 * x2 * x;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// exp, log and sincos (Cephes single precision polynomials)
+///////////////////////////////////////////////////////////////////////////
+static inline vfloat vexp(vfloat x)
+{
+	x = min(max(x, vfloat(-87.3f)), vfloat(88.3f));
+	vfloat n = floor(x * 1.44269504088896341f + 0.5f);
+	x = x - n * 0.693359375f + n * 2.12194440e-4f;
+	vfloat z = x * x;
+	vfloat p = vfloat(1.9875691500E-4f);
+	p = p * x + 1.3981999507E-3f;
+	p = p * x + 8.3334519073E-3f;
+	p = p * x + 4.1665795894E-2f;
+	p = p * x + 1.6666665459E-1f;
+	p = p * x + 5.0000001201E-1f;
+	p = p * z + x + 1.0f;
+	return p * pow2i(n);
+}
+
+static inline vfloat vlog(const vfloat& in)
+{
+	vfloat e;
+	vfloat m = frexp(in, e);
+	vmask small = m < 0.707106781186547524f;
+	m = select(small, m + m, m) - 1.0f;
+	e = select(small, e - 1.0f, e);
+	vfloat z = m * m;
+	vfloat y = vfloat(7.0376836292E-2f);
+	y = y * m - 1.1514610310E-1f;
+	y = y * m + 1.1676998740E-1f;
+	y = y * m - 1.2420140846E-1f;
+	y = y * m + 1.4249322787E-1f;
+	y = y * m - 1.6668057665E-1f;
+	y = y * m + 2.0000714765E-1f;
+	y = y * m - 2.4999993993E-1f;
+	y = y * m + 3.3333331174E-1f;
+	y = y * m * z;
+	y = y - e * 2.12194440e-4f;
+	y = y - 0.5f * z;
+	vfloat r = m + y + e * 0.693359375f;
+	return select(in <= 0.0f, vfloat(-INFINITY), r);
+}
+
+static inline void vsincos(const vfloat& x, vfloat& s, vfloat& c)
+{
+	vfloat xa = abs(x);
+	// Octant, rounded up to an even number
+	vfloat j = floor(xa * 1.27323954473516f);
+	j = j + (j - 2.0f * floor(j * 0.5f));
+	vfloat r = ((xa - j * 0.78515625f) - j * 2.4187564849853515625e-4f) - j * 3.77489497744594108e-8f;
+	vfloat z = r * r;
+
+	vfloat pc = vfloat(2.443315711809948E-005f);
+	pc = pc * z - 1.388731625493765E-003f;
+	pc = pc * z + 4.166664568298827E-002f;
+	pc = pc * z * z - 0.5f * z + 1.0f;
+
+	vfloat ps = vfloat(-1.9515295891E-4f);
+	ps = ps * z + 8.3321608736E-3f;
+	ps = ps * z - 1.6666654611E-1f;
+	ps = ps * z * r + r;
+
+	// (j & 2), (j & 4) and ((j - 2) & 4) in float arithmetic
+	vfloat q4 = j * 0.25f;
+	vmask swap = (q4 - floor(q4)) >= 0.5f;
+	vfloat q8 = j * 0.125f;
+	vmask neg_sin = (q8 - floor(q8)) >= 0.5f;
+	vfloat q8c = (j - 2.0f) * 0.125f;
+	vmask neg_cos = (q8c - floor(q8c)) < 0.5f;
+	neg_sin = neg_sin != (x < 0.0f);
+
+	s = select(swap, pc, ps);
+	c = select(swap, ps, pc);
+	s = select(neg_sin, -s, s);
+	c = select(neg_cos, -c, c);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Per-lane versions of the Distributions functions
+///////////////////////////////////////////////////////////////////////////
+static inline vfloat fresnelSchlick(const vec3x& wi, const vec3x& wh, const vfloat& R0)
+{
+	return R0 + (1.0f - R0) * pow5(1.0f - abs(dot(wh, wi)));
+}
+
+static inline vfloat ggxD(const vec3x& n, const vec3x& wh, const vfloat& shininess)
+{
+	vfloat a2 = shininess * shininess;
+	vfloat nwh = dot(n, wh);
+	vfloat pwr = nwh * nwh * (a2 - 1.0f) + 1.0f;
+	vfloat D = a2 / (SIMD_PI * pwr * pwr);
+	return select((nwh > 0.0f) & (pwr != 0.0f), D, vfloat(0.0f));
+}
+
+static inline vfloat ggxSmithG1(const vec3x& v, const vec3x& wh, const vec3x& n, const vfloat& shininess)
+{
+	vfloat vwh = dot(v, wh);
+	vfloat nv = dot(v, n);
+	vfloat nv2 = nv * nv;
+	vfloat tan_v = (1.0f - nv2) / nv2;
+	vfloat G1 = 2.0f / (1.0f + sqrt(1.0f + shininess * shininess * tan_v));
+	return select((nv != 0.0f) & ((vwh / nv) > 0.0f), G1, vfloat(0.0f));
+}
+
+static inline vfloat beckmannD(const vec3x& n, const vec3x& wh, const vfloat& shininess)
+{
+	vfloat a2 = shininess * shininess;
+	vfloat c = dot(n, wh);
+	vfloat c2 = c * c;
+	vfloat tan2 = (1.0f - c2) / c2;
+	vfloat D = vexp(-tan2 / a2) / (SIMD_PI * a2 * c2 * c2);
+	return select(c > 0.0f, D, vfloat(0.0f));
+}
+
+static inline vfloat beckmannSmithG1(const vec3x& v, const vec3x& wh, const vec3x& n, const vfloat& shininess)
+{
+	vfloat vwh = dot(v, wh);
+	vfloat nv = dot(n, v);
+	vfloat tanNV = sqrt(1.0f - nv * nv) / nv;
+	vfloat alfa = 1.0f / (shininess * tanNV);
+	vfloat num = 3.535f * alfa + 2.181f * alfa * alfa;
+	vfloat den = 1.0f + 2.276f * alfa + 2.577f * alfa * alfa;
+	vfloat G1 = select(alfa < 1.6f, num / den, vfloat(1.0f));
+	return select(((vwh / nv) > 0.0f) & (tanNV != 0.0f), G1, vfloat(0.0f));
+}
+
+// Build wh from spherical coordinates around n, like the scalar samplers
+static inline vec3x sampleAround(const vec3x& n, const vfloat& cos_theta, const vfloat& u1)
+{
+	vmask use_x = abs(n.x) < abs(n.y);
+	vec3x tangent = { select(use_x, vfloat(0.0f), -n.z), select(use_x, -n.z, vfloat(0.0f)),
+		              select(use_x, n.y, n.x) };
+	tangent = normalize(tangent);
+	vec3x bitangent = normalize(cross(tangent, n));
+	vfloat sin_theta = sqrt(max(vfloat(0.0f), 1.0f - cos_theta * cos_theta));
+	vfloat sin_phi, cos_phi;
+	vsincos(2.0f * SIMD_PI * u1, sin_phi, cos_phi);
+	vfloat a = sin_theta * cos_phi;
+	vfloat b = sin_theta * sin_phi;
+	vec3x wh = { a * tangent.x + b * bitangent.x + cos_theta * n.x,
+		         a * tangent.y + b * bitangent.y + cos_theta * n.y,
+		         a * tangent.z + b * bitangent.z + cos_theta * n.z };
+	return normalize(wh);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The kernels, looping over a block W lanes at a time
+///////////////////////////////////////////////////////////////////////////
+#define FOR_EACH_BLOCK(count)                                                                            \
+	for(int i = 0, lanes = std::min(int(vfloat::width), count); i < count;                               \
+	    i += vfloat::width, lanes = std::min(int(vfloat::width), count - i))
+
+static void FresnelSchlick(int count, Vec3SoA wi, Vec3SoA wh, const float* R0, float* F)
+{
+	FOR_EACH_BLOCK(count)
+	{
+		storeN(F + i, fresnelSchlick(load3(wi, i, lanes), load3(wh, i, lanes), loadN(R0 + i, lanes)), lanes);
+	}
+}
+
+static void GGX_D(int count, Vec3SoA n, Vec3SoA wh, const float* shininess, float* D)
+{
+	FOR_EACH_BLOCK(count)
+	{
+		storeN(D + i, ggxD(load3(n, i, lanes), load3(wh, i, lanes), loadN(shininess + i, lanes)), lanes);
+	}
+}
+
+static void GGXSmith_G1(int count, Vec3SoA v, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G1)
+{
+	FOR_EACH_BLOCK(count)
+	{
+		vfloat g = ggxSmithG1(load3(v, i, lanes), load3(wh, i, lanes), load3(n, i, lanes),
+		                      loadN(shininess + i, lanes));
+		storeN(G1 + i, g, lanes);
+	}
+}
+
+static void GGXSmith_G(int count, Vec3SoA wi, Vec3SoA wo, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G)
+{
+	FOR_EACH_BLOCK(count)
+	{
+		vec3x h = load3(wh, i, lanes);
+		vec3x nn = load3(n, i, lanes);
+		vfloat a = loadN(shininess + i, lanes);
+		vfloat g = ggxSmithG1(load3(wi, i, lanes), h, nn, a) * ggxSmithG1(load3(wo, i, lanes), h, nn, a);
+		storeN(G + i, g, lanes);
+	}
+}
+
+static void GGX_pdf(int count, Vec3SoA n, Vec3SoA wh, Vec3SoA wo, const float* shininess, float* pdf)
+{
+	FOR_EACH_BLOCK(count)
+	{
+		vec3x nn = load3(n, i, lanes);
+		vec3x h = load3(wh, i, lanes);
+		vfloat pwh = ggxD(nn, h, loadN(shininess + i, lanes)) * abs(dot(nn, h));
+		storeN(pdf + i, pwh / (4.0f * abs(dot(load3(wo, i, lanes), h))), lanes);
+	}
+}
+
+static void GGX_sample_wh(int count, Vec3SoA n, const float* shininess, const float* u1, const float* u2, Vec3SoAOut wh)
+{
+	FOR_EACH_BLOCK(count)
+	{
+		vfloat a = loadN(shininess + i, lanes);
+		vfloat r = loadN(u2 + i, lanes);
+		vfloat cos_theta = sqrt((1.0f - r) / ((a * a - 1.0f) * r + 1.0f));
+		store3(wh, i, sampleAround(load3(n, i, lanes), cos_theta, loadN(u1 + i, lanes)), lanes);
+	}
+}
+
+static void Beckmann_D(int count, Vec3SoA n, Vec3SoA wh, const float* shininess, float* D)
+{
+	FOR_EACH_BLOCK(count)
+	{
+		storeN(D + i, beckmannD(load3(n, i, lanes), load3(wh, i, lanes), loadN(shininess + i, lanes)), lanes);
+	}
+}
+
+static void BeckmannSmith_G1(int count, Vec3SoA v, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G1)
+{
+	FOR_EACH_BLOCK(count)
+	{
+		vfloat g = beckmannSmithG1(load3(v, i, lanes), load3(wh, i, lanes), load3(n, i, lanes),
+		                           loadN(shininess + i, lanes));
+		storeN(G1 + i, g, lanes);
+	}
+}
+
+static void BeckmannSmith_G(int count, Vec3SoA wi, Vec3SoA wo, Vec3SoA wh, Vec3SoA n, const float* shininess, float* G)
+{
+	FOR_EACH_BLOCK(count)
+	{
+		vec3x h = load3(wh, i, lanes);
+		vec3x nn = load3(n, i, lanes);
+		vfloat a = loadN(shininess + i, lanes);
+		vfloat g = beckmannSmithG1(load3(wi, i, lanes), h, nn, a) * beckmannSmithG1(load3(wo, i, lanes), h, nn, a);
+		storeN(G + i, g, lanes);
+	}
+}
+
+static void Beckmann_pdf(int count, Vec3SoA n, Vec3SoA wh, Vec3SoA wo, const float* shininess, float* pdf)
+{
+	FOR_EACH_BLOCK(count)
+	{
+		vec3x nn = load3(n, i, lanes);
+		vec3x h = load3(wh, i, lanes);
+		vfloat pwh = beckmannD(nn, h, loadN(shininess + i, lanes)) * abs(dot(nn, h));
+		storeN(pdf + i, pwh / (4.0f * abs(dot(load3(wo, i, lanes), h))), lanes);
+	}
+}
+
+static void Beckmann_sample_wh(int count, Vec3SoA n, const float* shininess, const float* u1, const float* u2, Vec3SoAOut wh)
+{
+	FOR_EACH_BLOCK(count)
+	{
+		vfloat a = loadN(shininess + i, lanes);
+		vfloat cos_theta = sqrt(1.0f / (1.0f - a * a * vlog(1.0f - loadN(u2 + i, lanes))));
+		store3(wh, i, sampleAround(load3(n, i, lanes), cos_theta, loadN(u1 + i, lanes)), lanes);
+	}
+}
+
+#undef FOR_EACH_BLOCK
+#undef SIMD_PI
+
+extern const DistributionKernels kernels;
+const DistributionKernels kernels = {
+	simd_level,         vfloat::width,    &FresnelSchlick,   &GGX_D,          &GGXSmith_G1,
+	&GGXSmith_G,        &GGX_pdf,         &GGX_sample_wh,    &Beckmann_D,     &BeckmannSmith_G1,
+	&BeckmannSmith_G,   &Beckmann_pdf,    &Beckmann_sample_wh,
+};
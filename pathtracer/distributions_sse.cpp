@@ -0,0 +1,87 @@
+#include "distributions_batch.h"
+
+#ifdef PATHTRACER_SIMD_X86
+#include <emmintrin.h>
+#include <algorithm>
+#include <cmath>
+
+namespace pathtracer
+{
+namespace simd_sse2
+{
+static const SimdLevel simd_level = SIMD_SSE2;
+
+///////////////////////////////////////////////////////////////////////////
+// 4-wide float and mask wrappers (SSE2 only, no SSE4.1 floor/blend)
+///////////////////////////////////////////////////////////////////////////
+struct vmask
+{
+	__m128 m;
+};
+
+struct vfloat
+{
+	enum { width = 4 };
+	__m128 v;
+	vfloat() {}
+	vfloat(__m128 x) : v(x) {}
+	vfloat(float f) : v(_mm_set1_ps(f)) {}
+	static vfloat load(const float* p) { return _mm_loadu_ps(p); }
+	void store(float* p) const { _mm_storeu_ps(p, v); }
+};
+
+static inline vfloat operator+(const vfloat& a, const vfloat& b) { return _mm_add_ps(a.v, b.v); }
+static inline vfloat operator-(const vfloat& a, const vfloat& b) { return _mm_sub_ps(a.v, b.v); }
+static inline vfloat operator*(const vfloat& a, const vfloat& b) { return _mm_mul_ps(a.v, b.v); }
+static inline vfloat operator/(const vfloat& a, const vfloat& b) { return _mm_div_ps(a.v, b.v); }
+static inline vfloat operator-(const vfloat& a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+
+static inline vmask operator<(const vfloat& a, const vfloat& b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+static inline vmask operator<=(const vfloat& a, const vfloat& b) { return { _mm_cmple_ps(a.v, b.v) }; }
+static inline vmask operator>(const vfloat& a, const vfloat& b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+static inline vmask operator>=(const vfloat& a, const vfloat& b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+static inline vmask operator!=(const vfloat& a, const vfloat& b) { return { _mm_cmpneq_ps(a.v, b.v) }; }
+static inline vmask operator&(const vmask& a, const vmask& b) { return { _mm_and_ps(a.m, b.m) }; }
+static inline vmask operator|(const vmask& a, const vmask& b) { return { _mm_or_ps(a.m, b.m) }; }
+static inline vmask operator!=(const vmask& a, const vmask& b) { return { _mm_xor_ps(a.m, b.m) }; }
+
+static inline vfloat select(const vmask& m, const vfloat& a, const vfloat& b)
+{
+	return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v));
+}
+
+static inline vfloat min(const vfloat& a, const vfloat& b) { return _mm_min_ps(a.v, b.v); }
+static inline vfloat max(const vfloat& a, const vfloat& b) { return _mm_max_ps(a.v, b.v); }
+static inline vfloat sqrt(const vfloat& a) { return _mm_sqrt_ps(a.v); }
+static inline vfloat abs(const vfloat& a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+
+// Only valid for |x| < 2^31, which is all the kernels need
+static inline vfloat floor(const vfloat& a)
+{
+	__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.0f)));
+}
+
+// 2^n for integral n in [-126, 127]
+static inline vfloat pow2i(const vfloat& n)
+{
+	__m128i e = _mm_add_epi32(_mm_cvttps_epi32(n.v), _mm_set1_epi32(127));
+	return _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+}
+
+// Split x > 0 into a mantissa in [0.5, 1) and an exponent
+static inline vfloat frexp(const vfloat& x, vfloat& e)
+{
+	__m128i i = _mm_castps_si128(x.v);
+	__m128i exponent = _mm_and_si128(_mm_srli_epi32(i, 23), _mm_set1_epi32(0xff));
+	e = _mm_cvtepi32_ps(_mm_sub_epi32(exponent, _mm_set1_epi32(126)));
+	i = _mm_or_si128(_mm_and_si128(i, _mm_set1_epi32(0x807fffff)), _mm_set1_epi32(0x3f000000));
+	return _mm_castsi128_ps(i);
+}
+
+#include "distributions_simd.inl"
+
+} // namespace simd_sse2
+} // namespace pathtracer
+
+#endif // PATHTRACER_SIMD_X86
@@ -0,0 +1,353 @@
+#include "rt_backend.h"
+#include <iostream>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Embree 2: every model is its own embree scene (in object space),
+// instanced into a dynamic top level scene. A heightfield is a user
+// geometry in its own scene, and embree calls HeightField::intersect() for
+// the rays that reach its bounds.
+///////////////////////////////////////////////////////////////////////////
+class EmbreeBackend : public RTBackend
+{
+public:
+	EmbreeBackend(BVHProfile profile);
+	~EmbreeBackend();
+
+	void addModel(uint32_t handle, const labhelper::Model* model, const vec3* positions, const mat4& model_matrix,
+	              bool deformable) override;
+	void addHeightField(uint32_t handle, const HeightField* heightfield, const mat4& model_matrix) override;
+	void setTransform(uint32_t handle, const mat4& model_matrix) override;
+	void updateVertices(uint32_t handle, const vec3* positions) override;
+	void commit() override;
+	bool intersect(Ray& r) override;
+	bool occluded(Ray& r) override;
+	void occludedStream(Ray* rays, int count) override;
+	int64_t memoryBytes() const override
+	{
+		return memory + heightfield_memory;
+	}
+
+private:
+	struct Model
+	{
+		// One of model and heightfield is set
+		const labhelper::Model* model;
+		const HeightField* heightfield;
+		RTCScene scene;
+		uint32_t inst_ID;
+		bool deformable;
+		// Needs an rtcCommit()
+		bool changed;
+	};
+
+	BVHProfile profile;
+	RTCDevice device;
+	RTCScene top_scene;
+	vector<Model> models;
+	// Embree hands out geometry IDs densely from zero, so the instance ID
+	// of a hit is looked up directly instead of going through a map.
+	vector<uint32_t> map_inst_ID_to_handle;
+	// Bytes currently allocated by embree, kept by the memory monitor
+	std::atomic<int64_t> memory;
+	// The heightfields are not allocated by embree
+	int64_t heightfield_memory;
+
+	RTCSceneFlags modelSceneFlags(bool deformable) const;
+	RTCGeometryFlags modelGeometryFlags(bool deformable) const;
+	void copyVertices(Model& m, const vec3* positions);
+	void addInstance(uint32_t handle, const mat4& model_matrix);
+	static bool memoryMonitor(void* user_ptr, const ssize_t bytes, const bool post);
+};
+
+RTBackend* createEmbreeBackend(BVHProfile profile)
+{
+	return new EmbreeBackend(profile);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Called when there is an embree error
+///////////////////////////////////////////////////////////////////////////
+static void embreeErrorHandler(const RTCError /*code*/, const char* str)
+{
+	cout << "Embree ERROR: " << str << endl;
+	exit(1);
+}
+
+bool EmbreeBackend::memoryMonitor(void* user_ptr, const ssize_t bytes, const bool /*post*/)
+{
+	((EmbreeBackend*)user_ptr)->memory += int64_t(bytes);
+	return true;
+}
+
+EmbreeBackend::EmbreeBackend(BVHProfile profile) : profile(profile), memory(0), heightfield_memory(0)
+{
+	cout << "Initializing embree..." << flush;
+	device = rtcNewDevice();
+	rtcDeviceSetErrorFunction(device, embreeErrorHandler);
+	rtcDeviceSetMemoryMonitorFunction2(device, memoryMonitor, this);
+	// Instances can move, so the top level is dynamic
+	top_scene = rtcDeviceNewScene(device, RTC_SCENE_DYNAMIC, RTC_INTERSECT1 | RTC_INTERSECT_STREAM);
+	cout << "done.\n";
+}
+
+EmbreeBackend::~EmbreeBackend()
+{
+	rtcDeleteScene(top_scene);
+	for(auto& m : models)
+		rtcDeleteScene(m.scene);
+	rtcDeleteDevice(device);
+}
+
+RTCSceneFlags EmbreeBackend::modelSceneFlags(bool deformable) const
+{
+	int flags = deformable ? RTC_SCENE_DYNAMIC : RTC_SCENE_STATIC;
+	switch(profile)
+	{
+	case BVH_PROFILE_FAST_BUILD:
+		// A dynamic scene of dynamic geometry gets the Morton builder
+		flags |= RTC_SCENE_DYNAMIC;
+		break;
+	case BVH_PROFILE_HIGH_QUALITY:
+		if(!deformable)
+			flags |= RTC_SCENE_HIGH_QUALITY;
+		break;
+	case BVH_PROFILE_COMPACT:
+		flags |= RTC_SCENE_COMPACT | RTC_SCENE_ROBUST;
+		break;
+	default:
+		break;
+	}
+	return RTCSceneFlags(flags);
+}
+
+RTCGeometryFlags EmbreeBackend::modelGeometryFlags(bool deformable) const
+{
+	if(deformable)
+		return RTC_GEOMETRY_DEFORMABLE;
+	return profile == BVH_PROFILE_FAST_BUILD ? RTC_GEOMETRY_DYNAMIC : RTC_GEOMETRY_STATIC;
+}
+
+void EmbreeBackend::copyVertices(Model& m, const vec3* positions)
+{
+	for(uint32_t geom_ID = 0; geom_ID < m.model->m_meshes.size(); geom_ID++)
+	{
+		const labhelper::Mesh& mesh = m.model->m_meshes[geom_ID];
+		vec4* embree_vertices = (vec4*)rtcMapBuffer(m.scene, geom_ID, RTC_VERTEX_BUFFER);
+		for(uint32_t i = 0; i < mesh.m_number_of_vertices; i++)
+		{
+			embree_vertices[i] = vec4(positions[mesh.m_start_index + i], 1.0f);
+		}
+		rtcUnmapBuffer(m.scene, geom_ID, RTC_VERTEX_BUFFER);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Create the embree scene of a model and instance it in the top level
+///////////////////////////////////////////////////////////////////////////
+void EmbreeBackend::addModel(uint32_t handle, const labhelper::Model* model, const vec3* positions,
+                             const mat4& model_matrix, bool deformable)
+{
+	if(handle >= models.size())
+		models.resize(handle + 1);
+	Model& m = models[handle];
+	m.model = model;
+	m.heightfield = nullptr;
+	m.deformable = deformable;
+	m.changed = true;
+	m.scene = rtcDeviceNewScene(device, modelSceneFlags(deformable), RTC_INTERSECT1 | RTC_INTERSECT_STREAM);
+	for(auto& mesh : model->m_meshes)
+	{
+		uint32_t geom_ID = rtcNewTriangleMesh(m.scene, modelGeometryFlags(deformable),
+		                                      mesh.m_number_of_vertices / 3, mesh.m_number_of_vertices);
+		// Commit triangle indices
+		int* embree_tri_idxs = (int*)rtcMapBuffer(m.scene, geom_ID, RTC_INDEX_BUFFER);
+		for(uint32_t i = 0; i < mesh.m_number_of_vertices; i++)
+		{
+			embree_tri_idxs[i] = i;
+		}
+		rtcUnmapBuffer(m.scene, geom_ID, RTC_INDEX_BUFFER);
+	}
+	copyVertices(m, positions);
+	addInstance(handle, model_matrix);
+}
+
+void EmbreeBackend::addInstance(uint32_t handle, const mat4& model_matrix)
+{
+	Model& m = models[handle];
+	m.inst_ID = rtcNewInstance2(top_scene, m.scene);
+	if(m.inst_ID >= map_inst_ID_to_handle.size())
+	{
+		map_inst_ID_to_handle.resize(m.inst_ID + 1, 0);
+	}
+	map_inst_ID_to_handle[m.inst_ID] = handle;
+	setTransform(handle, model_matrix);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// User geometry callbacks, the user data is the HeightField. Rays are
+// traced one at a time whether embree hands them over alone, in a packet
+// or as a stream.
+///////////////////////////////////////////////////////////////////////////
+static void heightFieldBounds(void* ptr, size_t /*item*/, RTCBounds& bounds)
+{
+	const HeightField* heightfield = (const HeightField*)ptr;
+	const vec3 bmin = heightfield->boundsMin(), bmax = heightfield->boundsMax();
+	bounds.lower_x = bmin.x;
+	bounds.lower_y = bmin.y;
+	bounds.lower_z = bmin.z;
+	bounds.upper_x = bmax.x;
+	bounds.upper_y = bmax.y;
+	bounds.upper_z = bmax.z;
+}
+
+static void heightFieldIntersect(void* ptr, RTCRay& ray, size_t /*item*/)
+{
+	((const HeightField*)ptr)->intersect((Ray&)ray);
+}
+
+static void heightFieldOccluded(void* ptr, RTCRay& ray, size_t /*item*/)
+{
+	if(((const HeightField*)ptr)->occluded((Ray&)ray))
+		ray.geomID = 0;
+}
+
+static void heightFieldIntersect1Mp(void* ptr, const RTCIntersectContext*, RTCRay** rays, size_t M, size_t item)
+{
+	for(size_t i = 0; i < M; i++)
+		heightFieldIntersect(ptr, *rays[i], item);
+}
+
+static void heightFieldOccluded1Mp(void* ptr, const RTCIntersectContext*, RTCRay** rays, size_t M, size_t item)
+{
+	for(size_t i = 0; i < M; i++)
+		heightFieldOccluded(ptr, *rays[i], item);
+}
+
+static Ray loadRay(RTCRayN* rays, size_t N, size_t i)
+{
+	Ray r(vec3(RTCRayN_org_x(rays, N, i), RTCRayN_org_y(rays, N, i), RTCRayN_org_z(rays, N, i)),
+	      vec3(RTCRayN_dir_x(rays, N, i), RTCRayN_dir_y(rays, N, i), RTCRayN_dir_z(rays, N, i)),
+	      RTCRayN_tnear(rays, N, i), RTCRayN_tfar(rays, N, i));
+	return r;
+}
+
+static void heightFieldIntersectN(const int* valid, void* ptr, const RTCIntersectContext*, RTCRayN* rays, size_t N,
+                                  size_t /*item*/)
+{
+	for(size_t i = 0; i < N; i++)
+	{
+		Ray r = loadRay(rays, N, i);
+		if(!valid[i] || !((const HeightField*)ptr)->intersect(r))
+			continue;
+		RTCRayN_tfar(rays, N, i) = r.tfar;
+		RTCRayN_u(rays, N, i) = r.u;
+		RTCRayN_v(rays, N, i) = r.v;
+		RTCRayN_Ng_x(rays, N, i) = r.n.x;
+		RTCRayN_Ng_y(rays, N, i) = r.n.y;
+		RTCRayN_Ng_z(rays, N, i) = r.n.z;
+		RTCRayN_geomID(rays, N, i) = r.geomID;
+		RTCRayN_primID(rays, N, i) = r.primID;
+	}
+}
+
+static void heightFieldOccludedN(const int* valid, void* ptr, const RTCIntersectContext*, RTCRayN* rays, size_t N,
+                                 size_t /*item*/)
+{
+	for(size_t i = 0; i < N; i++)
+	{
+		if(valid[i] && ((const HeightField*)ptr)->occluded(loadRay(rays, N, i)))
+			RTCRayN_geomID(rays, N, i) = 0;
+	}
+}
+
+void EmbreeBackend::addHeightField(uint32_t handle, const HeightField* heightfield, const mat4& model_matrix)
+{
+	if(handle >= models.size())
+		models.resize(handle + 1);
+	Model& m = models[handle];
+	m.model = nullptr;
+	m.heightfield = heightfield;
+	m.deformable = false;
+	m.changed = true;
+	m.scene = rtcDeviceNewScene(device, modelSceneFlags(false), RTC_INTERSECT1 | RTC_INTERSECT_STREAM);
+	const uint32_t geom_ID = rtcNewUserGeometry3(m.scene, RTC_GEOMETRY_STATIC, 1);
+	rtcSetUserData(m.scene, geom_ID, (void*)heightfield);
+	rtcSetBoundsFunction(m.scene, geom_ID, heightFieldBounds);
+	rtcSetIntersectFunction(m.scene, geom_ID, heightFieldIntersect);
+	rtcSetOccludedFunction(m.scene, geom_ID, heightFieldOccluded);
+	rtcSetIntersectFunction1Mp(m.scene, geom_ID, heightFieldIntersect1Mp);
+	rtcSetOccludedFunction1Mp(m.scene, geom_ID, heightFieldOccluded1Mp);
+	rtcSetIntersectFunctionN(m.scene, geom_ID, heightFieldIntersectN);
+	rtcSetOccludedFunctionN(m.scene, geom_ID, heightFieldOccludedN);
+	heightfield_memory += int64_t(heightfield->memoryBytes());
+	addInstance(handle, model_matrix);
+}
+
+void EmbreeBackend::setTransform(uint32_t handle, const mat4& model_matrix)
+{
+	const Model& m = models[handle];
+	rtcSetTransform2(top_scene, m.inst_ID, RTC_MATRIX_COLUMN_MAJOR_ALIGNED16, &model_matrix[0].x);
+	rtcUpdate(top_scene, m.inst_ID);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Embree refits the BVH of RTC_GEOMETRY_DEFORMABLE geometry on commit
+///////////////////////////////////////////////////////////////////////////
+void EmbreeBackend::updateVertices(uint32_t handle, const vec3* positions)
+{
+	Model& m = models[handle];
+	copyVertices(m, positions);
+	for(uint32_t geom_ID = 0; geom_ID < m.model->m_meshes.size(); geom_ID++)
+	{
+		rtcUpdateBuffer(m.scene, geom_ID, RTC_VERTEX_BUFFER);
+	}
+	m.changed = true;
+	// The instance's bounds changed as well
+	rtcUpdate(top_scene, m.inst_ID);
+}
+
+void EmbreeBackend::commit()
+{
+	for(auto& m : models)
+	{
+		if(m.changed)
+			rtcCommit(m.scene);
+		m.changed = false;
+	}
+	rtcCommit(top_scene);
+}
+
+bool EmbreeBackend::intersect(Ray& r)
+{
+	rtcIntersect(top_scene, *((RTCRay*)&r));
+	if(r.geomID == RTC_INVALID_GEOMETRY_ID)
+		return false;
+	r.instID = map_inst_ID_to_handle[r.instID];
+	return true;
+}
+
+bool EmbreeBackend::occluded(Ray& r)
+{
+	rtcOccluded(top_scene, *((RTCRay*)&r));
+	return r.geomID != RTC_INVALID_GEOMETRY_ID;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Streams let embree trace the rays together (they typically share their
+// origin, or at least the light they go to)
+///////////////////////////////////////////////////////////////////////////
+void EmbreeBackend::occludedStream(Ray* rays, int count)
+{
+	RTCIntersectContext context;
+	context.flags = RTC_INTERSECT_COHERENT;
+	context.userRayExt = nullptr;
+	rtcOccluded1M(top_scene, &context, (RTCRay*)rays, count, sizeof(Ray));
+}
+} // namespace pathtracer
@@ -1,6 +1,13 @@
 #include "embree_copy.h"
 #include <iostream>
 #include <map>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include "rt_backend.h"
+#include "heightfield.h"
+#include "bsdf.h"
+#include "Pathtracer.h"
 
 
 using namespace std;
@@ -9,100 +16,524 @@ using namespace glm;
 namespace pathtracer
 {
 ///////////////////////////////////////////////////////////////////////////
-// Global variables
+// A model in the scene. The backend keeps its BVH, this is what is needed
+// to turn a hit into an Intersection.
 ///////////////////////////////////////////////////////////////////////////
-RTCDevice embree_device;
-RTCScene embree_scene;
+struct SceneModel
+{
+	const labhelper::Model* model;
+	bool deformable;
+	mat4 transform;
+	mat3 normal_matrix;
+	uint32_t material_offset;
+	// Indexed by the geometry ID of a hit
+	vector<const labhelper::Mesh*> meshes;
+	// The meshes' m_material_idx, as the render thread sees them
+	vector<uint32_t> material_indices;
+	// Set for heightfields, which have no meshes
+	const HeightField* heightfield;
+};
+vector<SceneModel> scene_models;
+
+static RTBackend* backend = nullptr;
+static RTBackendType backend_type = RT_BACKEND_EMBREE;
 
 ///////////////////////////////////////////////////////////////////////////
-// Build an acceleration structure for the scene
+// Updates recorded by the UI thread, applied by the render thread
 ///////////////////////////////////////////////////////////////////////////
-void buildBVH()
+struct PendingUpdate
 {
-	cout << "Embree building BVH..." << flush;
-	rtcCommit(embree_scene);
-	cout << "done.\n";
+	bool transform_changed = false;
+	mat4 transform;
+	bool vertices_changed = false;
+	vector<vec3> positions;
+	// (mesh index, material index)
+	vector<std::pair<uint32_t, uint32_t>> mesh_materials;
+};
+static std::mutex pending_mutex;
+static std::map<uint32_t, PendingUpdate> pending_updates;
+static BVHProfile pending_profile;
+static bool profile_changed = false;
+static RTBackendType pending_backend_type;
+static bool backend_changed = false;
+static bool comparison_requested = false;
+
+///////////////////////////////////////////////////////////////////////////
+// BVH profile and statistics
+///////////////////////////////////////////////////////////////////////////
+static BVHProfile bvh_profile = BVH_PROFILE_DEFAULT;
+static BVHStats bvh_stats = {};
+static RTBackendComparison backend_comparison = {};
+
+static RTBackend* createBackend(RTBackendType type)
+{
+	if(type == RT_BACKEND_NATIVE)
+		return createNativeBackend(bvh_profile);
+	return createEmbreeBackend(bvh_profile);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Times a commit and reports what it cost
+///////////////////////////////////////////////////////////////////////////
+struct CommitTimer
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	int64_t memory_before = backend->memoryBytes();
+
+	void report(size_t models_built)
+	{
+		BVHStats stats;
+		stats.backend = backend_type;
+		stats.profile = bvh_profile;
+		stats.build_ms =
+		    std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		stats.memory_bytes = backend->memoryBytes();
+		stats.memory_delta_bytes = stats.memory_bytes - memory_before;
+		stats.nodes = backend->nodeCount();
+		stats.models = scene_models.size();
+		stats.models_built = models_built;
+		stats.triangles = 0;
+		for(auto& m : scene_models)
+		{
+			for(auto mesh : m.meshes)
+				stats.triangles += mesh->m_number_of_vertices / 3;
+			if(m.heightfield)
+				stats.triangles += m.heightfield->triangleCount();
+		}
+		cout << "BVH: " << stats.build_ms << " ms, " << models_built << "/" << stats.models
+		     << " models built, " << stats.triangles << " triangles, ";
+		if(stats.nodes >= 0)
+			cout << stats.nodes << " nodes, ";
+		cout << float(stats.memory_bytes) / (1024.0f * 1024.0f) << " MB ("
+		     << float(stats.memory_delta_bytes) / (1024.0f * 1024.0f) << " MB change)\n";
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		bvh_stats = stats;
+	}
+};
+
+BVHStats getBVHStats()
+{
+	std::lock_guard<std::mutex> lock(pending_mutex);
+	return bvh_stats;
+}
+
+BVHProfile getBVHProfile()
+{
+	std::lock_guard<std::mutex> lock(pending_mutex);
+	return profile_changed ? pending_profile : bvh_profile;
+}
+
+void setBVHProfile(BVHProfile profile)
+{
+	// Nothing has been built yet, just use it
+	if(scene_models.empty())
+	{
+		bvh_profile = profile;
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		pending_profile = profile;
+		profile_changed = true;
+	}
+	restart();
+}
+
+RTBackendType getRTBackend()
+{
+	std::lock_guard<std::mutex> lock(pending_mutex);
+	return backend_changed ? pending_backend_type : backend_type;
+}
+
+void setRTBackend(RTBackendType type)
+{
+	if(scene_models.empty())
+	{
+		backend_type = type;
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		pending_backend_type = type;
+		backend_changed = true;
+	}
+	restart();
 }
 
 ///////////////////////////////////////////////////////////////////////////
-// Called when there is an embree error
+// Add a scene model to a (new) backend
 ///////////////////////////////////////////////////////////////////////////
-void embreeErrorHandler(const RTCError code, const char* str)
+static void addToBackend(RTBackend* b, uint32_t handle, const SceneModel& m)
 {
-	cout << "Embree ERROR: " << str << endl;
-	exit(1);
+	if(m.heightfield)
+		b->addHeightField(handle, m.heightfield, m.transform);
+	else
+		b->addModel(handle, m.model, m.model->m_positions.data(), m.transform, m.deformable);
 }
 
 ///////////////////////////////////////////////////////////////////////////
-// Used to map an Embree geometry ID to our scene Meshes and Materials
+// Build an acceleration structure for the scene
 ///////////////////////////////////////////////////////////////////////////
-map<uint32_t, const labhelper::Model*> map_geom_ID_to_model;
-map<uint32_t, const labhelper::Mesh*> map_geom_ID_to_mesh;
+void buildBVH()
+{
+	cout << "Building BVH..." << flush;
+	CommitTimer timer;
+	backend->commit();
+	cout << "done.\n";
+	timer.report(scene_models.size());
+}
+
+static void setModelMatrix(SceneModel& m, const mat4& model_matrix)
+{
+	m.transform = model_matrix;
+	m.normal_matrix = inverse(transpose(mat3(model_matrix)));
+}
 
 ///////////////////////////////////////////////////////////////////////////
-// Add a model to the embree scene
+// Add a model to the scene
 ///////////////////////////////////////////////////////////////////////////
-void addModel(const labhelper::Model* model, const mat4& model_matrix)
+uint32_t addModel(const labhelper::Model* model, const mat4& model_matrix, bool deformable)
 {
+	// Lazy initialize the backend on first use
+	if(backend == nullptr)
+	{
+		backend = createBackend(backend_type);
+	}
+
 	///////////////////////////////////////////////////////////////////////
-	// Lazy initialize embree on first use
+	// Each mesh in the model is a geometry (with the mesh's index as its
+	// ID), so that we can connect a hit to a Material.
 	///////////////////////////////////////////////////////////////////////
-	cout << "Initializing embree..." << flush;
-	static bool embree_is_initialized = false;
-	if(!embree_is_initialized)
+	cout << "Adding " << model->m_name << " to the scene..." << flush;
+	uint32_t handle = uint32_t(scene_models.size());
+	scene_models.push_back(SceneModel());
+	SceneModel& m = scene_models.back();
+	m.model = model;
+	m.deformable = deformable;
+	m.heightfield = nullptr;
+	m.material_offset = addMaterials(model);
+	for(auto& mesh : model->m_meshes)
+	{
+		m.meshes.push_back(&mesh);
+		m.material_indices.push_back(uint32_t(mesh.m_material_idx));
+	}
+	setModelMatrix(m, model_matrix);
+	backend->addModel(handle, model, model->m_positions.data(), model_matrix, deformable);
+	cout << "done.\n";
+	return handle;
+}
+
+uint32_t addHeightField(const HeightField* heightfield, const labhelper::Model* material_model,
+                        const mat4& model_matrix)
+{
+	if(backend == nullptr)
 	{
-		embree_is_initialized = true;
-		embree_device = rtcNewDevice();
-		rtcDeviceSetErrorFunction(embree_device, embreeErrorHandler);
-		embree_scene = rtcDeviceNewScene(embree_device, RTC_SCENE_STATIC, RTC_INTERSECT1);
+		backend = createBackend(backend_type);
 	}
+	cout << "Adding heightfield " << material_model->m_name << " to the scene..." << flush;
+	uint32_t handle = uint32_t(scene_models.size());
+	scene_models.push_back(SceneModel());
+	SceneModel& m = scene_models.back();
+	m.model = material_model;
+	m.deformable = false;
+	m.heightfield = heightfield;
+	m.material_offset = addMaterials(material_model);
+	setModelMatrix(m, model_matrix);
+	backend->addHeightField(handle, heightfield, model_matrix);
 	cout << "done.\n";
+	return handle;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Record changes for the render thread
+///////////////////////////////////////////////////////////////////////////
+void setModelTransform(uint32_t handle, const mat4& model_matrix)
+{
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		PendingUpdate& update = pending_updates[handle];
+		update.transform_changed = true;
+		update.transform = model_matrix;
+	}
+	restart();
+}
+
+void setMeshMaterial(uint32_t handle, uint32_t mesh_index, uint32_t material_index)
+{
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		pending_updates[handle].mesh_materials.push_back(std::make_pair(mesh_index, material_index));
+	}
+	restart();
+}
+
+void updateModelVertices(uint32_t handle)
+{
+	const SceneModel& m = scene_models[handle];
+	if(!m.deformable)
+	{
+		cout << "updateModelVertices: " << m.model->m_name << " was not added as deformable\n";
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		PendingUpdate& update = pending_updates[handle];
+		update.vertices_changed = true;
+		update.positions = m.model->m_positions;
+	}
+	restart();
+}
+
+void compareRTBackends()
+{
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		comparison_requested = true;
+	}
+	restart();
+}
+
+RTBackendComparison getRTBackendComparison()
+{
+	std::lock_guard<std::mutex> lock(pending_mutex);
+	return backend_comparison;
+}
+
+static void runBackendComparison();
+
+///////////////////////////////////////////////////////////////////////////
+// Apply the recorded changes. Deformed models are refitted, moved models
+// only need the top level to be updated.
+///////////////////////////////////////////////////////////////////////////
+bool applySceneUpdates()
+{
+	std::map<uint32_t, PendingUpdate> updates;
+	bool rebuild = false;
+	bool compare = false;
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		if(pending_updates.empty() && !profile_changed && !backend_changed && !comparison_requested)
+			return false;
+		updates.swap(pending_updates);
+		if(profile_changed && pending_profile != bvh_profile)
+		{
+			bvh_profile = pending_profile;
+			rebuild = true;
+		}
+		if(backend_changed && pending_backend_type != backend_type)
+		{
+			backend_type = pending_backend_type;
+			rebuild = true;
+		}
+		profile_changed = false;
+		backend_changed = false;
+		compare = comparison_requested;
+		comparison_requested = false;
+	}
 
 	///////////////////////////////////////////////////////////////////////
-	// Transform and add each mesh in the model as a geometry in embree,
-	// and create mappings so that we can connect an embree geom_ID to a
-	// Material.
+	// A new profile or backend means new BVHs for all models
 	///////////////////////////////////////////////////////////////////////
-	cout << "Adding " << model->m_name << " to embree scene..." << flush;
-	for(auto& mesh : model->m_meshes)
+	if(rebuild)
 	{
-		uint32_t geom_ID = rtcNewTriangleMesh(embree_scene, RTC_GEOMETRY_STATIC,
-		                                      mesh.m_number_of_vertices / 3, mesh.m_number_of_vertices);
-		map_geom_ID_to_mesh[geom_ID] = &mesh;
-		map_geom_ID_to_model[geom_ID] = model;
-		// Transform and commit vertices
-		vec4* embree_vertices = (vec4*)rtcMapBuffer(embree_scene, geom_ID, RTC_VERTEX_BUFFER);
-		for(uint32_t i = 0; i < mesh.m_number_of_vertices; i++)
+		delete backend;
+		backend = createBackend(backend_type);
+	}
+	CommitTimer timer;
+	size_t models_built = 0;
+	if(rebuild)
+	{
+		for(uint32_t handle = 0; handle < scene_models.size(); handle++)
 		{
-			embree_vertices[i] = model_matrix * vec4(model->m_positions[mesh.m_start_index + i], 1.0f);
+			addToBackend(backend, handle, scene_models[handle]);
 		}
-		rtcUnmapBuffer(embree_scene, geom_ID, RTC_VERTEX_BUFFER);
-		// Commit triangle indices
-		int* embree_tri_idxs = (int*)rtcMapBuffer(embree_scene, geom_ID, RTC_INDEX_BUFFER);
-		for(uint32_t i = 0; i < mesh.m_number_of_vertices; i++)
+		models_built = scene_models.size();
+	}
+
+	for(auto& u : updates)
+	{
+		SceneModel& m = scene_models[u.first];
+		if(u.second.vertices_changed)
 		{
-			embree_tri_idxs[i] = i;
+			// The positions are kept in updates until after the commit
+			backend->updateVertices(u.first, u.second.positions.data());
+			models_built++;
+		}
+		if(u.second.transform_changed)
+		{
+			setModelMatrix(m, u.second.transform);
+			backend->setTransform(u.first, u.second.transform);
+		}
+		for(auto& mesh_material : u.second.mesh_materials)
+		{
+			m.material_indices[mesh_material.first] = mesh_material.second;
 		}
-		rtcUnmapBuffer(embree_scene, geom_ID, RTC_INDEX_BUFFER);
 	}
-	cout << "done.\n";
+	backend->commit();
+	timer.report(models_built);
+
+	if(compare)
+		runBackendComparison();
+	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////
-// Extract an intersection from an embree ray.
+// Random rays for the comparison: from points in the scene's bounds in
+// uniformly random directions, and shadow rays between two such points.
+///////////////////////////////////////////////////////////////////////////
+static void makeTestRays(int count, vector<Ray>& closest_rays, vector<Ray>& shadow_rays)
+{
+	vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+	for(auto& m : scene_models)
+	{
+		if(m.heightfield)
+		{
+			const vec3 hmin = m.heightfield->boundsMin(), hmax = m.heightfield->boundsMax();
+			for(int corner = 0; corner < 8; corner++)
+			{
+				vec3 p((corner & 1) ? hmax.x : hmin.x, (corner & 2) ? hmax.y : hmin.y, (corner & 4) ? hmax.z : hmin.z);
+				vec3 w = vec3(m.transform * vec4(p, 1.0f));
+				bmin = min(bmin, w);
+				bmax = max(bmax, w);
+			}
+			continue;
+		}
+		for(auto& p : m.model->m_positions)
+		{
+			vec3 w = vec3(m.transform * vec4(p, 1.0f));
+			bmin = min(bmin, w);
+			bmax = max(bmax, w);
+		}
+	}
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	auto randomPoint = [&]() {
+		return bmin + (bmax - bmin) * vec3(uniform(rng), uniform(rng), uniform(rng));
+	};
+	closest_rays.clear();
+	shadow_rays.clear();
+	for(int i = 0; i < count; i++)
+	{
+		float z = 1.0f - 2.0f * uniform(rng);
+		float phi = 2.0f * M_PI * uniform(rng);
+		float s = sqrt(std::max(0.0f, 1.0f - z * z));
+		closest_rays.push_back(Ray(randomPoint(), vec3(s * cos(phi), s * sin(phi), z)));
+		vec3 from = randomPoint();
+		shadow_rays.push_back(Ray(from, randomPoint() - from, 0.0f, 1.0f));
+	}
+}
+
+template <typename F>
+static float traceAll(vector<Ray>& rays, vector<uint8_t>& hits, F trace)
+{
+	hits.resize(rays.size());
+	auto start = std::chrono::high_resolution_clock::now();
+#pragma omp parallel for schedule(dynamic, 256)
+	for(int i = 0; i < int(rays.size()); i++)
+	{
+		hits[i] = trace(rays[i]) ? 1 : 0;
+	}
+	float seconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+	return float(rays.size()) / (seconds * 1e6f);
+}
+
+static void runBackendComparison()
+{
+	const int num_rays = 1 << 18;
+	vector<Ray> closest_rays, shadow_rays;
+	makeTestRays(num_rays, closest_rays, shadow_rays);
+
+	RTBackendComparison c = {};
+	c.rays = num_rays;
+	vector<Ray> closest_result[RT_BACKEND_COUNT];
+	vector<uint8_t> closest_hits[RT_BACKEND_COUNT], shadow_hits[RT_BACKEND_COUNT];
+	for(int type = 0; type < RT_BACKEND_COUNT; type++)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		RTBackend* b = createBackend(RTBackendType(type));
+		for(uint32_t handle = 0; handle < scene_models.size(); handle++)
+		{
+			addToBackend(b, handle, scene_models[handle]);
+		}
+		b->commit();
+		c.build_ms[type] =
+		    std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		c.memory_bytes[type] = b->memoryBytes();
+
+		closest_result[type] = closest_rays;
+		c.closest_mrays[type] = traceAll(closest_result[type], closest_hits[type], [b](Ray& r) {
+			return b->intersect(r);
+		});
+		vector<Ray> shadow_result = shadow_rays;
+		c.shadow_mrays[type] = traceAll(shadow_result, shadow_hits[type], [b](Ray& r) {
+			return b->occluded(r);
+		});
+		delete b;
+	}
+
+	for(int i = 0; i < num_rays; i++)
+	{
+		for(int type = 1; type < RT_BACKEND_COUNT; type++)
+		{
+			const Ray& a = closest_result[RT_BACKEND_EMBREE][i];
+			const Ray& b = closest_result[type][i];
+			// Distances are compared rather than IDs, ties may be broken
+			// differently where triangles meet
+			if(closest_hits[RT_BACKEND_EMBREE][i] != closest_hits[type][i]
+			   || (closest_hits[type][i] && abs(a.tfar - b.tfar) > 1e-4f * std::max(1.0f, a.tfar)))
+				c.closest_mismatches++;
+			if(shadow_hits[RT_BACKEND_EMBREE][i] != shadow_hits[type][i])
+				c.shadow_mismatches++;
+		}
+	}
+	c.valid = true;
+
+	cout << "Backend comparison, " << num_rays << " rays:\n";
+	const char* names[] = { "Embree", "Native" };
+	for(int type = 0; type < RT_BACKEND_COUNT; type++)
+	{
+		cout << "  " << names[type] << ": build " << c.build_ms[type] << " ms, "
+		     << float(c.memory_bytes[type]) / (1024.0f * 1024.0f) << " MB, closest " << c.closest_mrays[type]
+		     << " Mrays/s, shadow " << c.shadow_mrays[type] << " Mrays/s\n";
+	}
+	cout << "  Mismatches: " << c.closest_mismatches << " closest, " << c.shadow_mismatches << " shadow\n";
+	std::lock_guard<std::mutex> lock(pending_mutex);
+	backend_comparison = c;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Extract an intersection from a ray. The hit is in the model's
+// object space, normals and tangents are brought to world space.
 ///////////////////////////////////////////////////////////////////////////
 Intersection getIntersection(const Ray& r)
 {
-	const labhelper::Model* model = map_geom_ID_to_model[r.geomID];
-	const labhelper::Mesh* mesh = map_geom_ID_to_mesh[r.geomID];
+	const SceneModel& m = scene_models[r.instID];
+	const labhelper::Model* model = m.model;
+	if(m.heightfield)
+	{
+		Intersection i;
+		i.material = &(model->m_materials[0]);
+		i.material_params = getMaterialParams(m.material_offset);
+		vec3 normal, tangent;
+		m.heightfield->surface(r.primID, r.u, r.v, i.textCoord, normal, tangent);
+		i.shading_normal = normalize(m.normal_matrix * normal);
+		i.geometry_normal = -normalize(m.normal_matrix * r.n);
+		i.tangent = normalize(mat3(m.transform) * tangent);
+		i.position = r.o + r.tfar * r.d;
+		i.wo = normalize(-r.d);
+		return i;
+	}
+	const labhelper::Mesh* mesh = m.meshes[r.geomID];
+	const uint32_t material_index = m.material_indices[r.geomID];
 	Intersection i;
-	i.material = &(model->m_materials[mesh->m_material_idx]);
+	i.material = &(model->m_materials[material_index]);
+	i.material_params = getMaterialParams(m.material_offset + material_index);
 	vec3 n0 = model->m_normals[((mesh->m_start_index / 3) + r.primID) * 3 + 0];
 	vec3 n1 = model->m_normals[((mesh->m_start_index / 3) + r.primID) * 3 + 1];
 	vec3 n2 = model->m_normals[((mesh->m_start_index / 3) + r.primID) * 3 + 2];
 	float w = 1.0f - (r.u + r.v);
-	i.shading_normal = normalize(w * n0 + r.u * n1 + r.v * n2);
-	i.geometry_normal = -normalize(r.n);
+	i.shading_normal = normalize(m.normal_matrix * (w * n0 + r.u * n1 + r.v * n2));
+	i.geometry_normal = -normalize(m.normal_matrix * r.n);
 
 	vec2 t0 = model->m_texture_coordinates[((mesh->m_start_index / 3) + r.primID) * 3 + 0];
 	vec2 t1 = model->m_texture_coordinates[((mesh->m_start_index / 3) + r.primID) * 3 + 1];
@@ -112,7 +543,7 @@ Intersection getIntersection(const Ray& r)
 	vec3 tan0 = model->m_tangents[((mesh->m_start_index / 3) + r.primID) * 3 + 0];
 	vec3 tan1 = model->m_tangents[((mesh->m_start_index / 3) + r.primID) * 3 + 1];
 	vec3 tan2 = model->m_tangents[((mesh->m_start_index / 3) + r.primID) * 3 + 2];
-	i.tangent = normalize(w * tan0 + r.u * tan1 + r.v * tan2);
+	i.tangent = normalize(mat3(m.transform) * (w * tan0 + r.u * tan1 + r.v * tan2));
 
 	i.position = r.o + r.tfar * r.d;
 	i.wo = normalize(-r.d);
@@ -124,8 +555,7 @@ Intersection getIntersection(const Ray& r)
 ///////////////////////////////////////////////////////////////////////////
 bool intersect(Ray& r)
 {
-	rtcIntersect(embree_scene, *((RTCRay*)&r));
-	return r.geomID != RTC_INVALID_GEOMETRY_ID;
+	return backend->intersect(r);
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -134,7 +564,11 @@ bool intersect(Ray& r)
 ///////////////////////////////////////////////////////////////////////////
 bool occluded(Ray& r)
 {
-	rtcOccluded(embree_scene, *((RTCRay*)&r));
-	return r.geomID != RTC_INVALID_GEOMETRY_ID;
+	return backend->occluded(r);
+}
+
+void occluded(Ray* rays, int count)
+{
+	backend->occludedStream(rays, count);
 }
-} // namespace pathtracer
\ No newline at end of file
+} // namespace pathtracer
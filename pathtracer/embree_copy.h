@@ -8,9 +8,42 @@
 namespace pathtracer
 {
 ///////////////////////////////////////////////////////////////////////////
-// Add a model to the embree scene
+// The scene can be traced by embree or by our own BVH (bvh.h). Both keep
+// a BVH per model, instanced into a top level with the model's matrix.
 ///////////////////////////////////////////////////////////////////////////
-void addModel(const labhelper::Model* model, const glm::mat4& model_matrix);
+enum RTBackendType
+{
+	RT_BACKEND_EMBREE = 0,
+	RT_BACKEND_NATIVE,
+	RT_BACKEND_COUNT
+};
+
+// For ImGui::Combo
+#define RT_BACKEND_NAMES "Embree\0Native BVH4\0"
+
+///////////////////////////////////////////////////////////////////////////
+// Select the backend. Like setBVHProfile(), this must be called before
+// addModel() or is applied by the render thread (rebuilding all models).
+///////////////////////////////////////////////////////////////////////////
+void setRTBackend(RTBackendType type);
+RTBackendType getRTBackend();
+
+///////////////////////////////////////////////////////////////////////////
+// Add a model to the scene. Returns a handle for the functions below.
+// Set deformable if the vertices will be updated, that makes the backend
+// refit the model's BVH instead of building a static one.
+///////////////////////////////////////////////////////////////////////////
+uint32_t addModel(const labhelper::Model* model, const glm::mat4& model_matrix, bool deformable = false);
+
+///////////////////////////////////////////////////////////////////////////
+// Add a terrain as a heightfield, traced from its height grid (see
+// heightfield.h) rather than as triangles. It uses the first material of
+// material_model, and must be built and outlive the scene. Returns a
+// handle like addModel() (it can be moved, not deformed).
+///////////////////////////////////////////////////////////////////////////
+class HeightField;
+uint32_t addHeightField(const HeightField* heightfield, const labhelper::Model* material_model,
+                        const glm::mat4& model_matrix);
 
 ///////////////////////////////////////////////////////////////////////////
 // Build an acceleration structure for the scene
@@ -18,7 +51,97 @@ void addModel(const labhelper::Model* model, const glm::mat4& model_matrix);
 void buildBVH();
 
 ///////////////////////////////////////////////////////////////////////////
-// This struct is what an embree Ray must look like. It contains the
+// Trade-offs between build time, memory and trace speed for the models'
+// BVHs (deformable models are always refitted). The comments describe
+// what embree does, the native backend varies its SAH bins and leaf size.
+///////////////////////////////////////////////////////////////////////////
+enum BVHProfile
+{
+	BVH_PROFILE_DEFAULT = 0,  // Binned SAH
+	BVH_PROFILE_FAST_BUILD,   // Morton build, for interactive editing
+	BVH_PROFILE_HIGH_QUALITY, // SAH with spatial splits, for final renders
+	BVH_PROFILE_COMPACT,      // Less memory and robust traversal, for large scenes
+};
+
+// For ImGui::Combo
+#define BVH_PROFILE_NAMES "Default\0Fast build\0High quality\0Compact + robust\0"
+
+///////////////////////////////////////////////////////////////////////////
+// Statistics of the last commit (buildBVH() or applySceneUpdates())
+///////////////////////////////////////////////////////////////////////////
+struct BVHStats
+{
+	RTBackendType backend;
+	BVHProfile profile;
+	float build_ms;
+	// Memory held by the backend after the commit, and what the commit added
+	int64_t memory_bytes;
+	int64_t memory_delta_bytes;
+	size_t models;
+	size_t models_built;
+	size_t triangles;
+	// BVH nodes of all models, -1 with embree, which keeps its BVH to itself
+	int64_t nodes;
+};
+BVHStats getBVHStats();
+
+///////////////////////////////////////////////////////////////////////////
+// Select the profile. Must be called before addModel() or, like the
+// updates below, is applied by the render thread (rebuilding all models).
+///////////////////////////////////////////////////////////////////////////
+void setBVHProfile(BVHProfile profile);
+BVHProfile getBVHProfile();
+
+///////////////////////////////////////////////////////////////////////////
+// Move a model rigidly. Only the instance transform changes, so the
+// top level BVH is updated but the model's own BVH is left alone.
+///////////////////////////////////////////////////////////////////////////
+void setModelTransform(uint32_t handle, const glm::mat4& model_matrix);
+
+///////////////////////////////////////////////////////////////////////////
+// Assign another of the model's materials to a mesh (after setting
+// m_material_idx, which the render thread does not read).
+///////////////////////////////////////////////////////////////////////////
+void setMeshMaterial(uint32_t handle, uint32_t mesh_index, uint32_t material_index);
+
+///////////////////////////////////////////////////////////////////////////
+// Re-read model->m_positions of a deformable model (the vertex count must
+// not change). The positions are copied when this is called, and the
+// model's BVH is refitted.
+///////////////////////////////////////////////////////////////////////////
+void updateModelVertices(uint32_t handle);
+
+///////////////////////////////////////////////////////////////////////////
+// The calls above are only recorded (and restart the pathtracer). The
+// render thread applies them with this, between passes, and commits only
+// what changed. Returns true if anything was applied.
+///////////////////////////////////////////////////////////////////////////
+bool applySceneUpdates();
+
+///////////////////////////////////////////////////////////////////////////
+// Trace the same random rays through a fresh build of every backend:
+// counts the rays where they disagree and measures the speed of each.
+// Like the updates, this is only recorded and run by the render thread.
+///////////////////////////////////////////////////////////////////////////
+struct RTBackendComparison
+{
+	bool valid;
+	int rays;
+	float build_ms[RT_BACKEND_COUNT];
+	int64_t memory_bytes[RT_BACKEND_COUNT];
+	// Millions of rays per second, over all threads
+	float closest_mrays[RT_BACKEND_COUNT];
+	float shadow_mrays[RT_BACKEND_COUNT];
+	// Rays where a backend disagrees with embree (hit or not, or distance)
+	int closest_mismatches;
+	int shadow_mismatches;
+};
+void compareRTBackends();
+RTBackendComparison getRTBackendComparison();
+
+///////////////////////////////////////////////////////////////////////////
+// This struct is what an embree Ray must look like (the native backend
+// uses the same layout). It contains the
 // information about the ray to be shot and (after intersect() has been
 // called) the geometry the ray hit.
 ///////////////////////////////////////////////////////////////////////////
@@ -50,9 +173,10 @@ struct RTCORE_ALIGN(16) Ray
 	uint32_t instID = RTC_INVALID_GEOMETRY_ID;
 };
 
+struct MaterialParams;
+
 ///////////////////////////////////////////////////////////////////////////
-// This struct describes an intersection, as extracted from the Embree
-// ray.
+// This struct describes an intersection, as extracted from a ray.
 ///////////////////////////////////////////////////////////////////////////
 struct Intersection
 {
@@ -63,6 +187,7 @@ struct Intersection
 	glm::vec3 tangent;
 	glm::vec3 wo;
 	const labhelper::Material* material;
+	const MaterialParams* material_params;
 };
 Intersection getIntersection(const Ray& r);
 
@@ -76,4 +201,11 @@ bool intersect(Ray& r);
 // intersection).
 ///////////////////////////////////////////////////////////////////////////
 bool occluded(Ray& r);
+
+///////////////////////////////////////////////////////////////////////////
+// Test a stream of rays for occlusion, e.g. the shadow rays of one hit.
+// Afterwards rays[i].geomID is 0 for the occluded rays and
+// RTC_INVALID_GEOMETRY_ID for the others.
+///////////////////////////////////////////////////////////////////////////
+void occluded(Ray* rays, int count);
 } // namespace pathtracer
\ No newline at end of file
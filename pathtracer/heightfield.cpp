@@ -0,0 +1,312 @@
+#include "heightfield.h"
+#include "watertight.h"
+#include <algorithm>
+#include <cfloat>
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Build: the cells are level 0, every level above halves the blocks per
+// side (rounding up) until a single block covers the whole grid.
+///////////////////////////////////////////////////////////////////////////
+void HeightField::build(const float* heights, int cols, int rows, float spacing, const vec2& origin)
+{
+	this->cols = cols;
+	this->rows = rows;
+	this->spacing = spacing;
+	this->origin = origin;
+	this->heights.assign(heights, heights + size_t(cols) * rows);
+	levels.clear();
+	min_max.clear();
+	if(cols < 2 || rows < 2)
+		return;
+
+	size_t blocks = 0;
+	levels.push_back({ cols - 1, rows - 1, 0 });
+	while(levels.back().width > 1 || levels.back().height > 1)
+	{
+		const Level& below = levels.back();
+		Level level = { (below.width + 1) / 2, (below.height + 1) / 2, blocks };
+		blocks += size_t(level.width) * level.height;
+		levels.push_back(level);
+	}
+	min_max.resize(blocks);
+	min_max.shrink_to_fit();
+
+	for(int l = 1; l < int(levels.size()); l++)
+	{
+		const Level& level = levels[l];
+		const Level& below = levels[l - 1];
+#pragma omp parallel for schedule(dynamic, 16)
+		for(int z = 0; z < level.height; z++)
+		{
+			for(int x = 0; x < level.width; x++)
+			{
+				vec2 range(FLT_MAX, -FLT_MAX);
+				for(int c = 0; c < 4; c++)
+				{
+					const int cx = 2 * x + (c & 1), cz = 2 * z + (c >> 1);
+					if(cx >= below.width || cz >= below.height)
+						continue;
+					const vec2 child = blockRange(l - 1, cx, cz);
+					range = vec2(std::min(range.x, child.x), std::max(range.y, child.y));
+				}
+				min_max[level.offset + size_t(z) * level.width + x] = range;
+			}
+		}
+	}
+}
+
+vec2 HeightField::blockRange(int level, int x, int z) const
+{
+	if(level > 0)
+		return min_max[levels[level].offset + size_t(z) * levels[level].width + x];
+	const float h00 = height(x, z), h10 = height(x + 1, z);
+	const float h01 = height(x, z + 1), h11 = height(x + 1, z + 1);
+	return vec2(std::min(std::min(h00, h10), std::min(h01, h11)), std::max(std::max(h00, h10), std::max(h01, h11)));
+}
+
+void HeightField::blockBounds(int level, int x, int z, vec3& bmin, vec3& bmax) const
+{
+	const vec2 range = blockRange(level, x, z);
+	const int x0 = x << level, z0 = z << level;
+	const int x1 = std::min((x + 1) << level, cols - 1), z1 = std::min((z + 1) << level, rows - 1);
+	bmin = vec3(origin.x + x0 * spacing, range.x, origin.y + z0 * spacing);
+	bmax = vec3(origin.x + x1 * spacing, range.y, origin.y + z1 * spacing);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The corners of a cell, x fastest: p00, p10, p01, p11
+///////////////////////////////////////////////////////////////////////////
+void HeightField::cellVertices(int x, int z, vec3 v[4]) const
+{
+	for(int c = 0; c < 4; c++)
+	{
+		const int px = x + (c & 1), pz = z + (c >> 1);
+		v[c] = vec3(origin.x + px * spacing, height(px, pz), origin.y + pz * spacing);
+	}
+}
+
+vec3 HeightField::boundsMin() const
+{
+	if(levels.empty())
+		return vec3(FLT_MAX);
+	return vec3(origin.x, blockRange(int(levels.size()) - 1, 0, 0).x, origin.y);
+}
+
+vec3 HeightField::boundsMax() const
+{
+	if(levels.empty())
+		return vec3(-FLT_MAX);
+	return vec3(origin.x + (cols - 1) * spacing, blockRange(int(levels.size()) - 1, 0, 0).y,
+	            origin.y + (rows - 1) * spacing);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Traversal
+///////////////////////////////////////////////////////////////////////////
+// Levels are at most 31 (cells are indexed with ints), and every level
+// adds at most three entries to the stack
+static const int TRAVERSAL_STACK_SIZE = 3 * 32 + 1;
+
+struct BlockRay
+{
+	vec3 o;
+	vec3 inv_d;
+
+	BlockRay(const Ray& r) : o(r.o)
+	{
+		for(int k = 0; k < 3; k++)
+		{
+			float d = r.d[k];
+			// Avoid 0 * inf = NaN in the slab test
+			if(std::abs(d) < 1e-20f)
+				d = d < 0.0f ? -1e-20f : 1e-20f;
+			inv_d[k] = 1.0f / d;
+		}
+	}
+
+	// Does the ray enter the box within [tnear, tfar], and where
+	bool hits(const vec3& bmin, const vec3& bmax, float tnear, float tfar, float& dist) const
+	{
+		const vec3 ta = (bmin - o) * inv_d;
+		const vec3 tb = (bmax - o) * inv_d;
+		const vec3 tn = min(ta, tb), tf = max(ta, tb);
+		const float t0 = std::max(std::max(tn.x, tn.y), std::max(tn.z, tnear));
+		const float t1 = std::min(std::min(tf.x, tf.y), std::min(tf.z, tfar));
+		dist = t0;
+		return t0 <= t1 * ROBUST_FAR_SCALE;
+	}
+};
+
+struct BlockEntry
+{
+	int level;
+	int x, z;
+	float dist;
+};
+
+bool HeightField::intersect(Ray& r) const
+{
+	if(levels.empty())
+		return false;
+	const BlockRay br(r);
+	const WatertightRay wr(r);
+
+	const int top = int(levels.size()) - 1;
+	vec3 bmin, bmax;
+	float dist;
+	blockBounds(top, 0, 0, bmin, bmax);
+	if(!br.hits(bmin, bmax, r.tnear, r.tfar, dist))
+		return false;
+
+	BlockEntry stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = { top, 0, 0, dist };
+	int64_t hit_prim = -1;
+	vec3 hit_v[3];
+	while(stack_size > 0)
+	{
+		const BlockEntry entry = stack[--stack_size];
+		if(entry.dist > r.tfar)
+			continue;
+
+		if(entry.level == 0)
+		{
+			vec3 v[4];
+			cellVertices(entry.x, entry.z, v);
+			const vec3* triangles[2][3] = { { &v[0], &v[2], &v[1] }, { &v[1], &v[2], &v[3] } };
+			for(int k = 0; k < 2; k++)
+			{
+				float t, u, w;
+				if(intersectTriangle(wr, *triangles[k][0], *triangles[k][1], *triangles[k][2], r.tnear, r.tfar, t,
+				                     u, w))
+				{
+					r.tfar = t;
+					r.u = u;
+					r.v = w;
+					hit_prim = (int64_t(entry.z) * (cols - 1) + entry.x) * 2 + k;
+					for(int i = 0; i < 3; i++)
+						hit_v[i] = *triangles[k][i];
+				}
+			}
+			continue;
+		}
+
+		// Push the children the ray enters farthest first, so the nearest
+		// is visited next
+		const Level& below = levels[entry.level - 1];
+		BlockEntry children[4];
+		int num_children = 0;
+		for(int c = 0; c < 4; c++)
+		{
+			const int cx = 2 * entry.x + (c & 1), cz = 2 * entry.z + (c >> 1);
+			if(cx >= below.width || cz >= below.height)
+				continue;
+			blockBounds(entry.level - 1, cx, cz, bmin, bmax);
+			if(!br.hits(bmin, bmax, r.tnear, r.tfar, dist))
+				continue;
+			BlockEntry e = { entry.level - 1, cx, cz, dist };
+			int j = num_children++;
+			while(j > 0 && children[j - 1].dist < e.dist)
+			{
+				children[j] = children[j - 1];
+				j--;
+			}
+			children[j] = e;
+		}
+		for(int i = 0; i < num_children; i++)
+			stack[stack_size++] = children[i];
+	}
+
+	if(hit_prim < 0)
+		return false;
+	r.n = cross(hit_v[0] - hit_v[1], hit_v[2] - hit_v[0]);
+	r.geomID = 0;
+	r.primID = uint32_t(hit_prim);
+	return true;
+}
+
+bool HeightField::occluded(const Ray& r) const
+{
+	if(levels.empty())
+		return false;
+	const BlockRay br(r);
+	const WatertightRay wr(r);
+
+	// Any hit will do, so children are pushed in any order
+	BlockEntry stack[TRAVERSAL_STACK_SIZE];
+	int stack_size = 0;
+	stack[stack_size++] = { int(levels.size()) - 1, 0, 0, r.tnear };
+	while(stack_size > 0)
+	{
+		const BlockEntry entry = stack[--stack_size];
+		vec3 bmin, bmax;
+		float dist;
+		blockBounds(entry.level, entry.x, entry.z, bmin, bmax);
+		if(!br.hits(bmin, bmax, r.tnear, r.tfar, dist))
+			continue;
+
+		if(entry.level == 0)
+		{
+			vec3 v[4];
+			cellVertices(entry.x, entry.z, v);
+			float t, u, w;
+			if(intersectTriangle(wr, v[0], v[2], v[1], r.tnear, r.tfar, t, u, w)
+			   || intersectTriangle(wr, v[1], v[2], v[3], r.tnear, r.tfar, t, u, w))
+				return true;
+			continue;
+		}
+
+		const Level& below = levels[entry.level - 1];
+		for(int c = 0; c < 4; c++)
+		{
+			const int cx = 2 * entry.x + (c & 1), cz = 2 * entry.z + (c >> 1);
+			if(cx < below.width && cz < below.height)
+				stack[stack_size++] = { entry.level - 1, cx, cz, 0.0f };
+		}
+	}
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Shading: the slopes at the grid points are central differences of the
+// heights (one sided on the borders), as for terrainGenerator's normals
+///////////////////////////////////////////////////////////////////////////
+vec2 HeightField::slope(int x, int z) const
+{
+	const int left = std::max(x - 1, 0), right = std::min(x + 1, cols - 1);
+	const int up = std::max(z - 1, 0), down = std::min(z + 1, rows - 1);
+	return vec2((height(right, z) - height(left, z)) / ((right - left) * spacing),
+	            (height(x, down) - height(x, up)) / ((down - up) * spacing));
+}
+
+void HeightField::surface(uint32_t prim_ID, float u, float v, vec2& tex_coord, vec3& normal, vec3& tangent) const
+{
+	const uint32_t cell = prim_ID / 2;
+	const int x = int(cell % uint32_t(cols - 1)), z = int(cell / uint32_t(cols - 1));
+	// Grid points of the triangle, in the order it was intersected
+	ivec2 p[3];
+	if((prim_ID & 1) == 0)
+	{
+		p[0] = ivec2(x, z);
+		p[1] = ivec2(x, z + 1);
+		p[2] = ivec2(x + 1, z);
+	}
+	else
+	{
+		p[0] = ivec2(x + 1, z);
+		p[1] = ivec2(x, z + 1);
+		p[2] = ivec2(x + 1, z + 1);
+	}
+	const float w = 1.0f - (u + v);
+	const vec2 grid = w * vec2(p[0]) + u * vec2(p[1]) + v * vec2(p[2]);
+	const vec2 s = w * slope(p[0].x, p[0].y) + u * slope(p[1].x, p[1].y) + v * slope(p[2].x, p[2].y);
+	tex_coord = grid / vec2(float(cols - 1), float(rows - 1));
+	normal = normalize(vec3(-s.x, 1.0f, -s.y));
+	tangent = normalize(vec3(1.0f, s.x, 0.0f));
+}
+} // namespace pathtracer
@@ -0,0 +1,81 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <stdint.h>
+
+namespace pathtracer
+{
+struct Ray;
+
+///////////////////////////////////////////////////////////////////////////
+// A terrain traced directly from its height grid instead of as triangles.
+// Grid point (x, z) is at (origin.x + x * spacing, height, origin.y +
+// z * spacing), and each cell is the two triangles terrainGenerator makes
+// of it: (p00, p01, p10) and (p10, p01, p11).
+//
+// On top of the cells is a pyramid of min/max heights, level i holding
+// blocks of 2^i x 2^i cells. A ray descends it from the single top block,
+// nearest child first, and only reaches the cells below blocks whose box
+// it enters before its closest hit so far. Per grid point that is the
+// height plus about a third of a min/max pair, a fraction of what a
+// triangle BVH over the same terrain needs, and it is built in one pass.
+///////////////////////////////////////////////////////////////////////////
+class HeightField
+{
+public:
+	// heights[z * cols + x] is the height of grid point (x, z)
+	void build(const float* heights, int cols, int rows, float spacing, const glm::vec2& origin);
+
+	// Closest hit in (r.tnear, r.tfar), the ray is in the heightfield's
+	// space. On a hit, tfar, n, u and v are set like for a triangle, with
+	// geomID = 0 and primID = 2 * cell + triangle (cells row major).
+	bool intersect(Ray& r) const;
+	// Any hit in (r.tnear, r.tfar)
+	bool occluded(const Ray& r) const;
+
+	// Texture coordinates (over the whole grid, like terrainGenerator),
+	// shading normal and tangent (along +x, the direction of increasing u)
+	// at a hit, from the per grid point slopes interpolated over the
+	// triangle.
+	void surface(uint32_t prim_ID, float u, float v, glm::vec2& tex_coord, glm::vec3& normal,
+	             glm::vec3& tangent) const;
+
+	glm::vec3 boundsMin() const;
+	glm::vec3 boundsMax() const;
+	size_t triangleCount() const
+	{
+		return size_t(cols - 1) * (rows - 1) * 2;
+	}
+	size_t memoryBytes() const
+	{
+		return heights.capacity() * sizeof(float) + min_max.capacity() * sizeof(glm::vec2);
+	}
+
+private:
+	struct Level
+	{
+		int width, height;
+		// Of the level's first block in min_max
+		size_t offset;
+	};
+
+	int cols = 0, rows = 0;
+	float spacing = 1.0f;
+	glm::vec2 origin = glm::vec2(0.0f);
+	std::vector<float> heights;
+	// Min and max height of every block of every level (from level 1, a
+	// cell's own range is read from its four heights)
+	std::vector<glm::vec2> min_max;
+	// levels[0] is the cells
+	std::vector<Level> levels;
+
+	float height(int x, int z) const
+	{
+		return heights[size_t(z) * cols + x];
+	}
+	glm::vec2 blockRange(int level, int x, int z) const;
+	void blockBounds(int level, int x, int z, glm::vec3& bmin, glm::vec3& bmax) const;
+	void cellVertices(int x, int z, glm::vec3 v[4]) const;
+	glm::vec2 slope(int x, int z) const;
+};
+} // namespace pathtracer
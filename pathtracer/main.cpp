@@ -12,10 +12,17 @@
 #include <string>
 #include <algorithm>
 #include "Pathtracer.h"
+#include "ImageStream.h"
+#include "bsdf.h"
+#include "distributions_batch.h"
 #include "terrainGenerator.h"
 #include "ParticleSystem.h"
 #include "embree_copy.h"
 #include "embree.h"
+#include "medium.h"
+#include "density_grid.h"
+#include "heightfield.h"
+#include "Noise.h"
 
 using namespace glm;
 using namespace std;
@@ -39,9 +46,11 @@ bool g_isMouseDragging = false;
 GLuint shaderProgram;
 
 ///////////////////////////////////////////////////////////////////////////////
-// GL texture to put pathtracing result into
+// GL texture to put the tone-mapped pathtracing result into
 ///////////////////////////////////////////////////////////////////////////////
-uint32_t pathtracer_result_txt_id;
+ImageStream pathtracer_result;
+// The pass currently shown (owned by the pathtracer)
+pathtracer::Image* displayed_image = nullptr;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Camera parameters.
@@ -54,9 +63,17 @@ vec3 worldUp(0.0f, 1.0f, 0.0f);
 // Models
 ///////////////////////////////////////////////////////////////////////////////
 vector<pair<labhelper::Model*, mat4>> models;
+// Pathtracer scene handles of the models above
+vector<uint32_t> model_handles;
 
 mat4 terrainModelMatrix;
 labhelper::Model* terrainModel = nullptr;
+// The pathtracer traces the terrain as a heightfield, if trace_terrain is
+// set. It is not part of the default scene (and makes every pass slower).
+bool trace_terrain = false;
+pathtracer::HeightField terrain_heightfield;
+labhelper::Model* terrainMaterials = nullptr;
+mat4 terrainHeightFieldMatrix = translate(vec3(0.0f, -30.0f, 0.0f));
 
 // Clouds
 ParticleSystem particle_system = ParticleSystem(100000);
@@ -64,28 +81,39 @@ std::vector<glm::vec4> dataParticles;
 mat4 ardillaModelMatrix;
 labhelper::Model* ardillaModel = nullptr;
 mat4 cloudsModelMatrix(1.0f);
+// Volumetric clouds for the pathtracer, a layer of fBm noise
+Noise cloud_noise(1337);
+pathtracer::DensityGrid cloud_grid;
+pathtracer::Medium* cloud_medium = nullptr;
 
 
 ///////////////////////////////////////////////////////////////////////////////
 // Terrain
 ///////////////////////////////////////////////////////////////////////////////
-terrainGenerator* terrain = new terrainGenerator(300.0f, 300.0f, 10.0f);
+// Generated with the batched noise, so only when it is first used (after
+// testNoiseBatch() has run in initialize())
+terrainGenerator* terrain_generator = nullptr;
+terrainGenerator* getTerrain()
+{
+	if(terrain_generator == nullptr)
+	{
+		terrain_generator = new terrainGenerator(300.0f, 300.0f, 10.0f);
+	}
+	return terrain_generator;
+}
 labhelper::Model* createTerrainModel() {
+	terrainGenerator* terrain = getTerrain();
 	labhelper::Model* model = new labhelper::Model;
 	model->m_name = "terrain";
 	model->m_filename = "terrain.obj";
 	model->m_positions = terrain->getVerticesPosition();
 	model->m_normals = terrain->getNormals();
-	int sizeOfVertices = model->m_positions.size();
-	model->m_texture_coordinates.resize(sizeOfVertices);
-	/*for (int i = 0; i < sizeOfVertices; i++) {
-		std::cout <<"Y: "<<&model->m_positions[0]<<"\n" ;
-	}*/
+	model->m_texture_coordinates = terrain->getTextureCoordinates();
 
 	labhelper::Mesh m;
 	m.m_material_idx = 0;
 	m.m_name = "terrain_mesh";
-	m.m_number_of_vertices = terrain->vertices.size();
+	m.m_number_of_vertices = model->m_positions.size();
 	m.m_start_index = 0;
 	model->m_meshes.push_back(m);
 
@@ -116,19 +144,77 @@ labhelper::Model* createTerrainModel() {
 	return model;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// The heightfield of the terrain for the pathtracer, and what it saves
+// compared to the triangles of createTerrainModel()
+///////////////////////////////////////////////////////////////////////////////
+void createTerrainHeightField()
+{
+	const terrainGenerator* terrain = getTerrain();
+	const int cols = terrain->getCols(), rows = terrain->getRows();
+	auto start = std::chrono::high_resolution_clock::now();
+	terrain_heightfield.build(terrain->heights.data(), cols, rows, terrain->getScale(),
+	                          vec2(-0.5f * (cols - 1), -0.5f * (rows - 1)) * terrain->getScale());
+	float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	// Embree copies three vec4 vertices and three indices per triangle,
+	// before it builds anything
+	size_t triangle_bytes = terrain_heightfield.triangleCount() * 3 * (sizeof(vec4) + sizeof(int));
+	std::cout << "Terrain heightfield: " << terrain_heightfield.triangleCount() << " triangles, built in " << ms
+	          << " ms, " << terrain_heightfield.memoryBytes() / 1024 << " KB (" << triangle_bytes / 1024
+	          << " KB as triangle buffers)\n";
+
+	terrainMaterials = new labhelper::Model;
+	terrainMaterials->m_name = "terrain";
+	labhelper::loadMaterials(terrainMaterials);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Clouds
 ///////////////////////////////////////////////////////////////////////////////
+// Density of the cloud layer: four octaves of noise, with only the part
+// above the coverage threshold kept and faded out towards the bottom and
+// top of the layer.
+void cloudDensity(int count, pathtracer::Vec3SoA p, float* density)
+{
+	const float bottom = 8.0f, top = 14.0f, coverage = 0.1f;
+	NoiseOctaves octaves;
+	octaves.frequency = 0.15f;
+	cloud_noise.fbm(count, p, octaves, density);
+	for(int i = 0; i < count; i++)
+	{
+		float h = (p.y[i] - bottom) / (top - bottom);
+		float height_falloff = clamp(4.0f * h * (1.0f - h), 0.0f, 1.0f);
+		// Most of the fbm is within [-0.9, 0.9]
+		density[i] = clamp((density[i] - coverage) / (0.9f - coverage), 0.0f, 1.0f) * height_falloff;
+	}
+}
+
+// The noise is far too slow to evaluate at every step of delta tracking,
+// so it is sampled into a sparse grid once
+pathtracer::Medium* createCloudMedium()
+{
+	const vec3 bounds_min(-15.0f, 8.0f, -15.0f), bounds_max(15.0f, 14.0f, 15.0f);
+	auto start = std::chrono::high_resolution_clock::now();
+	cloud_grid.build(bounds_min, bounds_max, 0.15f, cloudDensity);
+	float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	std::cout << "Cloud grid: " << cloud_grid.brickCount() << " bricks, " << cloud_grid.memoryBytes() / 1024
+	          << " KB, built in " << ms << " ms\n";
+	pathtracer::Medium* medium = new pathtracer::GridMedium(&cloud_grid, bounds_min, bounds_max);
+	medium->sigma_t = 3.0f;
+	medium->albedo = vec3(0.99f);
+	medium->g = 0.6f;
+	return medium;
+}
+
 float cloudDeltaTime = 0.0f;
 void drawCloud(const mat4& viewMatrix, const mat4& projMatrix) {
-	dataParticles.clear();
-	dataParticles.reserve(int(particle_system.particles.size() * 1.5) + 1);
-	for (Particle p : particle_system.particles) {
-		vec3 pos = vec3(viewMatrix * vec4(p.pos, 1.0f));
-		dataParticles.push_back(vec4(pos, p.lifetime));
+	dataParticles.resize(particle_system.size());
+	for (size_t i = 0; i < dataParticles.size(); i++) {
+		vec3 pos = vec3(viewMatrix * vec4(particle_system.position(i), 1.0f));
+		dataParticles[i] = vec4(pos, particle_system.particles.lifetime[i]);
 	}
 	// sort particles with sort from c++ standard library
-	std::sort(dataParticles.begin(), std::next(dataParticles.begin(), dataParticles.size()),
+	std::sort(dataParticles.begin(), dataParticles.end(),
 		[](const vec4& lhs, const vec4& rhs) { return lhs.z < rhs.z; });
 	
 	particle_system.process_particles(cloudDeltaTime, cloudsModelMatrix);
@@ -151,10 +237,29 @@ void initialize()
 	///////////////////////////////////////////////////////////////////////////
 	pathtracer::settings.max_bounces = 100;
 	pathtracer::settings.max_paths_per_pixel = 0; // 0 = Infinite
+	pathtracer::settings.light_samples = 4;
+	pathtracer::settings.media = false;
+	pathtracer::settings.progressive = true;
+
+	///////////////////////////////////////////////////////////////////////////
+	// The clouds and the terrain are built with the batched noise, check it
+	// before they are
+	///////////////////////////////////////////////////////////////////////////
+	std::cout << "Batched distributions: "
+	          << pathtracer::DistributionsSoA::levelName(pathtracer::DistributionsSoA::level()) << "\n";
+	float noise_error = testNoiseBatch(10007);
+	std::cout << "Batched noise: " << Noise::levelName(Noise::level()) << ", largest difference to scalar "
+	          << noise_error << "\n";
+	if(!(noise_error < 1e-4f))
+	{
+		std::cout << "WARNING: batched noise does not match the scalar noise\n";
+	}
+	pathtracer::settings.preview_levels = 3; // Start at 1/8 resolution
+	pathtracer::settings.frame_budget_ms = 33.0f;
 #ifdef _DEBUG
-	pathtracer::settings.subsampling = 16;
-#else
 	pathtracer::settings.subsampling = 4;
+#else
+	pathtracer::settings.subsampling = 1;
 #endif
 
 	///////////////////////////////////////////////////////////////////////////
@@ -190,6 +295,7 @@ void initialize()
 	pathtracer::cam_settings.focal_distance = 1.0f;
 	pathtracer::cam_settings.aperture = 0.0f;
 	pathtracer::cam_settings.exposure = 1.0f;
+	pathtracer::cam_settings.tonemap = pathtracer::TONEMAP_ACES;
 
 	///////////////////////////////////////////////////////////////////////////
 	// Load environment map
@@ -225,6 +331,11 @@ void initialize()
 
 	//models.push_back(make_pair(terrainModel, translate(vec3(-1000.0f, -1500.0f, 5000.0f)) * scale(vec3(20.0f, 1.0f, 20.0f))));
 
+	// Clouds are a participating medium ("Clouds" in the gui), they used to be
+	// instances of a cloud mesh placed by the particle system:
+	cloud_medium = createCloudMedium();
+	pathtracer::addMedium(cloud_medium);
+
 	/*ardillaModel = labhelper::loadModelFromOBJ("../scenes/cloudOnMaya.obj");
 	mat4 cloudViewMatrix = lookAt(cameraPosition, cameraPosition + cameraDirection, worldUp);
 	
@@ -249,20 +360,19 @@ void initialize()
 	///////////////////////////////////////////////////////////////////////////
 	for(auto m : models)
 	{
-		pathtracer::addModel(m.first, m.second);
+		model_handles.push_back(pathtracer::addModel(m.first, m.second));
+	}
+	if(trace_terrain)
+	{
+		createTerrainHeightField();
+		pathtracer::addHeightField(&terrain_heightfield, terrainMaterials, terrainHeightFieldMatrix);
 	}
 	pathtracer::buildBVH();
 
 	///////////////////////////////////////////////////////////////////////////
-	// Generate result texture
+	// Start rendering in the background
 	///////////////////////////////////////////////////////////////////////////
-	glGenTextures(1, &pathtracer_result_txt_id);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, pathtracer_result_txt_id);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	pathtracer::startRenderThread();
 
 	///////////////////////////////////////////////////////////////////////////
 	// This is INCORRECT! But an easy way to get us a brighter image that
@@ -284,29 +394,41 @@ void display(void)
 		{
 			pathtracer::resize(w, h);
 			windowWidth = w;
-			windowWidth = h;
+			windowHeight = h;
 			old_subsampling = pathtracer::settings.subsampling;
 		}
 	}
 
 	///////////////////////////////////////////////////////////////////////////
-	// Trace one path per pixel
+	// Hand the camera to the render thread (restarts it if it moved)
 	///////////////////////////////////////////////////////////////////////////
 	mat4 viewMatrix = lookAt(cameraPosition, cameraPosition + cameraDirection, worldUp);
-	mat4 projMatrix = perspective(radians(45.0f),
-	                              float(pathtracer::rendered_image.width)
-	                                  / float(pathtracer::rendered_image.height),
-	                              0.1f, 100.0f);
-
-	
-
-	pathtracer::tracePaths(viewMatrix, projMatrix);
+	mat4 projMatrix = perspective(radians(45.0f), float(windowWidth) / float(windowHeight), 0.1f, 100.0f);
+	pathtracer::setCamera(viewMatrix, projMatrix);
 
 	///////////////////////////////////////////////////////////////////////////
-	// Copy pathtraced image to texture for display
+	// Tone map the latest completed pass and stream it to the texture. Also
+	// redone when exposure or the curve changes, without a restart.
 	///////////////////////////////////////////////////////////////////////////
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, pathtracer::rendered_image.width,
-	             pathtracer::rendered_image.height, 0, GL_RGB, GL_FLOAT, pathtracer::rendered_image.getPtr());
+	static float displayed_exposure = -1.0f;
+	static pathtracer::ToneMapOperator displayed_tonemap;
+	pathtracer::Image* image;
+	bool new_image = pathtracer::acquireLatestImage(image);
+	if(new_image)
+	{
+		displayed_image = image;
+	}
+	if(displayed_image != nullptr
+	   && (new_image || displayed_exposure != pathtracer::cam_settings.exposure
+	       || displayed_tonemap != pathtracer::cam_settings.tonemap))
+	{
+		uint8_t* pixels = pathtracer_result.beginUpdate(displayed_image->width, displayed_image->height);
+		pathtracer::tonemapToSRGB8(displayed_image->getPtr(), displayed_image->width * displayed_image->height,
+		                           pathtracer::cam_settings.exposure, pathtracer::cam_settings.tonemap, pixels);
+		pathtracer_result.endUpdate();
+		displayed_exposure = pathtracer::cam_settings.exposure;
+		displayed_tonemap = pathtracer::cam_settings.tonemap;
+	}
 
 	///////////////////////////////////////////////////////////////////////////
 	// Render a fullscreen quad, textured with our pathtraced image.
@@ -318,6 +440,8 @@ void display(void)
 	glEnable(GL_CULL_FACE);
 	SDL_GetWindowSize(g_window, &windowWidth, &windowHeight);
 	glUseProgram(shaderProgram);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, pathtracer_result.texture);
 	labhelper::drawFullScreenQuad();
 }
 
@@ -458,8 +582,70 @@ void gui()
 	if(ImGui::CollapsingHeader("Pathtracer", "pathtracer_ch", true, true))
 	{
 		ImGui::SliderInt("Subsampling", &pathtracer::settings.subsampling, 1, 16);
-		ImGui::SliderInt("Max Bounces", &pathtracer::settings.max_bounces, 0, 16);
 		ImGui::SliderInt("Max Paths Per Pixel", &pathtracer::settings.max_paths_per_pixel, 0, 1024);
+		bool preview_changed = false;
+		// The estimate changes, so the accumulated samples do not mix
+		preview_changed |= ImGui::SliderInt("Max Bounces", &pathtracer::settings.max_bounces, 0, 16);
+		preview_changed |= ImGui::SliderInt("Light Samples", &pathtracer::settings.light_samples, 1, 16);
+		preview_changed |= ImGui::Checkbox("Clouds", &pathtracer::settings.media);
+		preview_changed |= ImGui::Checkbox("Progressive Preview", &pathtracer::settings.progressive);
+		preview_changed |= ImGui::SliderInt("Preview Levels", &pathtracer::settings.preview_levels, 1, 5);
+		ImGui::SliderFloat("Frame Budget (ms)", &pathtracer::settings.frame_budget_ms, 5.0f, 200.0f);
+		if(preview_changed)
+		{
+			pathtracer::restart();
+		}
+		int rt_backend = pathtracer::getRTBackend();
+		if(ImGui::Combo("Ray Tracer", &rt_backend, RT_BACKEND_NAMES))
+		{
+			pathtracer::setRTBackend(pathtracer::RTBackendType(rt_backend));
+		}
+		int bvh_profile = pathtracer::getBVHProfile();
+		if(ImGui::Combo("BVH Profile", &bvh_profile, BVH_PROFILE_NAMES))
+		{
+			pathtracer::setBVHProfile(pathtracer::BVHProfile(bvh_profile));
+		}
+		pathtracer::BVHStats bvh_stats = pathtracer::getBVHStats();
+		ImGui::Text("BVH: %.1f ms, %d/%d models built, %d triangles, %.1f MB", bvh_stats.build_ms,
+		            int(bvh_stats.models_built), int(bvh_stats.models), int(bvh_stats.triangles),
+		            float(bvh_stats.memory_bytes) / (1024.0f * 1024.0f));
+		if(bvh_stats.nodes >= 0)
+			ImGui::Text("BVH nodes: %d", int(bvh_stats.nodes));
+		if(ImGui::Button("Compare Ray Tracers"))
+		{
+			pathtracer::compareRTBackends();
+		}
+		pathtracer::RTBackendComparison comparison = pathtracer::getRTBackendComparison();
+		if(comparison.valid)
+		{
+			ImGui::Text("Embree: %.2f / %.2f Mrays/s (closest / shadow)", comparison.closest_mrays[0],
+			            comparison.shadow_mrays[0]);
+			ImGui::Text("Native: %.2f / %.2f Mrays/s (closest / shadow)", comparison.closest_mrays[1],
+			            comparison.shadow_mrays[1]);
+			ImGui::Text("Mismatches: %d / %d of %d rays", comparison.closest_mismatches,
+			            comparison.shadow_mismatches, comparison.rays);
+		}
+		static NoiseBenchmark noise_benchmark;
+		static bool noise_benchmark_valid = false;
+		if(ImGui::Button("Benchmark Noise"))
+		{
+			noise_benchmark = benchmarkNoise(1 << 18);
+			noise_benchmark_valid = true;
+		}
+		if(noise_benchmark_valid)
+		{
+			const char* level = Noise::levelName(noise_benchmark.batch_level);
+			ImGui::Text("getNoise (double): %.1f Mpoints/s", noise_benchmark.double_mpoints);
+			ImGui::Text("perlin: %.1f / %.1f Mpoints/s (scalar / %s)", noise_benchmark.perlin_mpoints,
+			            noise_benchmark.perlin_batch_mpoints, level);
+			ImGui::Text("fbm, %d octaves: %.1f / %.1f Mpoints/s", noise_benchmark.fbm_octaves,
+			            noise_benchmark.fbm_mpoints, noise_benchmark.fbm_batch_mpoints);
+			ImGui::Text("Largest difference: %g", noise_benchmark.max_batch_error);
+		}
+		if(displayed_image != nullptr && displayed_image->preview_stride > 0)
+			ImGui::Text("Preview 1/%d", displayed_image->preview_stride * 2);
+		else if(displayed_image != nullptr)
+			ImGui::Text("Samples: %d", displayed_image->number_of_samples);
 		if(ImGui::Button("Restart Pathtracing"))
 		{
 			pathtracer::restart();
@@ -483,6 +669,15 @@ void gui()
 			material_index = model->m_meshes[mesh_index].m_material_idx;
 		}
 
+		// Moving a model only updates its instance transform in the pathtracer
+		mat4& model_matrix = models[model_index].second;
+		vec3 translation = vec3(model_matrix[3]);
+		if(ImGui::DragFloat3("Position", &translation.x, 0.1f))
+		{
+			model_matrix[3] = vec4(translation, 1.0f);
+			pathtracer::setModelTransform(model_handles[model_index], model_matrix);
+		}
+
 		///////////////////////////////////////////////////////////////////////////
 		// List all meshes in the model and show properties for the selected
 		///////////////////////////////////////////////////////////////////////////
@@ -507,6 +702,7 @@ void gui()
 			                int(model->m_materials.size())))
 			{
 				mesh.m_material_idx = material_index;
+				pathtracer::setMeshMaterial(model_handles[model_index], mesh_index, material_index);
 			}
 		}
 
@@ -524,13 +720,18 @@ void gui()
 			{
 				material.m_name = name;
 			}
-			ImGui::ColorEdit3("Color", &material.m_color.x);
-			ImGui::SliderFloat("Reflectivity", &material.m_reflectivity, 0.0f, 1.0f);
-			ImGui::SliderFloat("Metalness", &material.m_metalness, 0.0f, 1.0f);
-			ImGui::SliderFloat("Fresnel", &material.m_fresnel, 0.0f, 1.0f);
-			ImGui::SliderFloat("shininess", &material.m_shininess, 0.0f, 1.0f);
-			ImGui::SliderFloat("Emission", &material.m_emission, 0.0f, 10.0f);
-			ImGui::SliderFloat("Transparency", &material.m_transparency, 0.0f, 1.0f);
+			bool material_changed = false;
+			material_changed |= ImGui::ColorEdit3("Color", &material.m_color.x);
+			material_changed |= ImGui::SliderFloat("Reflectivity", &material.m_reflectivity, 0.0f, 1.0f);
+			material_changed |= ImGui::SliderFloat("Metalness", &material.m_metalness, 0.0f, 1.0f);
+			material_changed |= ImGui::SliderFloat("Fresnel", &material.m_fresnel, 0.0f, 1.0f);
+			material_changed |= ImGui::SliderFloat("shininess", &material.m_shininess, 0.0f, 1.0f);
+			material_changed |= ImGui::SliderFloat("Emission", &material.m_emission, 0.0f, 10.0f);
+			material_changed |= ImGui::SliderFloat("Transparency", &material.m_transparency, 0.0f, 1.0f);
+			if(material_changed)
+			{
+				pathtracer::updateMaterial(model, material_index);
+			}
 
 			///////////////////////////////////////////////////////////////////////////
 			// A button for saving your results
@@ -548,7 +749,10 @@ void gui()
 	if(ImGui::CollapsingHeader("Light sources", "lights_ch", true, true))
 	{
 		
-		ImGui::SliderFloat("Environment multiplier", &pathtracer::environment.multiplier, 0.0f, 10.0f);
+		if(ImGui::SliderFloat("Environment multiplier", &pathtracer::environment.multiplier, 0.0f, 10.0f))
+		{
+			pathtracer::restart();
+		}
 		/*
 		ImGui::ColorEdit3("Point light color", &pathtracer::point_light.color.x);
 		ImGui::SliderFloat("Point light intensity multiplier", &pathtracer::point_light.intensity_multiplier,
@@ -572,17 +776,29 @@ void gui()
 
 	if (ImGui::CollapsingHeader("Camera Settings", "camera_ch", true, true))
 	{
-		ImGui::SliderFloat("Focal Length", &pathtracer::cam_settings.focal_length,
+		bool camera_changed = false;
+		camera_changed |= ImGui::SliderFloat("Focal Length", &pathtracer::cam_settings.focal_length,
 			0.5f, 3.0f);
 
-		ImGui::SliderFloat("Focal Distance", &pathtracer::cam_settings.focal_distance,
+		camera_changed |= ImGui::SliderFloat("Focal Distance", &pathtracer::cam_settings.focal_distance,
 			1.0f, 10.0f);
 
-		ImGui::SliderFloat("Aperture", &pathtracer::cam_settings.aperture,
+		camera_changed |= ImGui::SliderFloat("Aperture", &pathtracer::cam_settings.aperture,
 			0.0f, 0.1f);
 
+		if (camera_changed)
+		{
+			pathtracer::restart();
+		}
+
+		// Only affect the display, no restart needed
 		ImGui::SliderFloat("Exposure", &pathtracer::cam_settings.exposure,
 			0.0f, 2.0f);
+		int tonemap = pathtracer::cam_settings.tonemap;
+		if (ImGui::Combo("Tone Mapping", &tonemap, TONEMAP_OPERATOR_NAMES))
+		{
+			pathtracer::cam_settings.tonemap = pathtracer::ToneMapOperator(tonemap);
+		}
 	}
 
 	ImGui::End(); // Control Panel
@@ -620,6 +836,10 @@ int main(int argc, char* argv[])
 		stopRendering = handleEvents();
 	}
 
+	// The render thread must be done with the scene before it goes away
+	pathtracer::stopRenderThread();
+	pathtracer_result.release();
+
 	// Delete Models
 	for(auto& m : models)
 	{
@@ -46,7 +46,9 @@ vec3 BlinnPhong::refraction_brdf(const vec3& wi, const vec3& wo, const vec3& n)
 	vec3 wh = normalize(wi + wo);
 
 	// Fresnel term
-	float F = R0 + ((1 - R0) * pow(1.0f - abs(dot(wh, wi)), 5.0f));
+	float c = 1.0f - abs(dot(wh, wi));
+	float c2 = c * c;
+	float F = R0 + ((1 - R0) * (c2 * c2 * c));
 
 	vec3 brdf = (1.0f - F) * refraction_layer->f(wi, wo, n);
 
@@ -61,7 +63,9 @@ vec3 BlinnPhong::reflection_brdf(const vec3& wi, const vec3& wo, const vec3& n)
 	vec3 wh = normalize(wi + wo);
 
 	// Fresnel term
-	float F = R0 + ((1 - R0) * pow(1.0f - abs(dot(wh, wi)), 5.0f));
+	float c = 1.0f - abs(dot(wh, wi));
+	float c2 = c * c;
+	float F = R0 + ((1 - R0) * (c2 * c2 * c));
 
 	// Microfacet Distributon Function
 	float nwh = dot(n, wh);
@@ -360,7 +364,9 @@ float Distributions::FresnelExact(const vec3& wi, const vec3& wh, const float re
 }
 
 float Distributions::FresnelSchlick(const vec3& wi, const vec3& wh, const float R0) {
-	float F = R0 + ((1 - R0) * pow(1.0f - abs(dot(wh, wi)), 5.0f));
+	float c = 1.0f - abs(dot(wh, wi));
+	float c2 = c * c;
+	float F = R0 + ((1 - R0) * (c2 * c2 * c));
 	return F;
 }
 
@@ -422,7 +428,7 @@ float Distributions::Beckmann_D(const vec3& n, const vec3& wh, const float shini
 	if (cosNWH > 0.0f) {
 		float tanNWH = (1 - (cosNWH * cosNWH)) / (cosNWH * cosNWH); // tan^2(n, wh)
 		float pwrTerm = -tanNWH / (shininess * shininess);
-		float denominator = M_PI * (shininess * shininess) * pow(cosNWH, 4.0f);
+		float denominator = M_PI * (shininess * shininess) * (cosNWH * cosNWH) * (cosNWH * cosNWH);
 		float D = exp(pwrTerm) / denominator;
 		return D;
 	}
@@ -0,0 +1,181 @@
+#include "medium.h"
+#include "sampling.h"
+#include <vector>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+
+using namespace glm;
+
+namespace pathtracer
+{
+static std::vector<const Medium*> media;
+
+void addMedium(const Medium* medium)
+{
+	media.push_back(medium);
+}
+
+void clearMedia()
+{
+	media.clear();
+}
+
+bool hasMedia()
+{
+	return !media.empty();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Clip [t0, t1] to the part of the ray inside the medium's box
+///////////////////////////////////////////////////////////////////////////
+static bool clipToBox(const Ray& r, const Medium& m, float& t0, float& t1)
+{
+	for(int k = 0; k < 3; k++)
+	{
+		float inv_d = 1.0f / r.d[k];
+		float tn = (m.bounds_min[k] - r.o[k]) * inv_d;
+		float tf = (m.bounds_max[k] - r.o[k]) * inv_d;
+		if(inv_d < 0.0f)
+			std::swap(tn, tf);
+		// NaN (parallel to a side) leaves the interval alone
+		t0 = tn > t0 ? tn : t0;
+		t1 = tf < t1 ? tf : t1;
+	}
+	return t0 < t1;
+}
+
+static inline float exponentialStep(float sigma)
+{
+	return -std::log(1.0f - std::min(randf(), 0.99999994f)) / sigma;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Delta tracking in one medium: tentative collisions are drawn with the
+// majorant and accepted with probability density / majorant. The majorant
+// is piecewise, each piece starts over (the exponential is memoryless).
+///////////////////////////////////////////////////////////////////////////
+static bool deltaTrack(const Medium& m, const Ray& r, float t0, float t1, float& t_collision)
+{
+	float t_piece = t0;
+	while(t_piece < t1)
+	{
+		float t_end, minorant;
+		float sigma_max = m.majorant(r, t_piece, t1, t_end, minorant) * m.sigma_t;
+		if(sigma_max > 0.0f)
+		{
+			float t = t_piece;
+			for(;;)
+			{
+				t += exponentialStep(sigma_max);
+				if(t >= t_end)
+					break;
+				if(randf() * sigma_max < m.density(r.o + t * r.d) * m.sigma_t)
+				{
+					t_collision = t;
+					return true;
+				}
+			}
+		}
+		t_piece = t_end;
+	}
+	return false;
+}
+
+bool sampleMediumScatter(const Ray& r, float t_max, MediumScatter& scatter)
+{
+	// Media are independent, the first collision is the closest over all
+	bool scattered = false;
+	for(const Medium* m : media)
+	{
+		float t0 = r.tnear;
+		float t1 = scattered ? scatter.t : t_max;
+		if(!clipToBox(r, *m, t0, t1))
+			continue;
+		float t;
+		if(deltaTrack(*m, r, t0, t1, t))
+		{
+			scatter.medium = m;
+			scatter.t = t;
+			scattered = true;
+		}
+	}
+	return scattered;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Residual ratio tracking: the minorant's part of the density is taken out
+// analytically, and only the rest (up to majorant - minorant) is ratio
+// tracked. Each tentative collision multiplies the estimate by the
+// probability of it being a null collision. Pieces where the bounds meet
+// (e.g. constant bricks) need no steps at all. Russian roulette ends rays
+// that have become dark.
+///////////////////////////////////////////////////////////////////////////
+float mediaTransmittance(const Ray& r)
+{
+	float transmittance = 1.0f;
+	for(const Medium* m : media)
+	{
+		float t0 = r.tnear;
+		float t1 = r.tfar;
+		if(!clipToBox(r, *m, t0, t1))
+			continue;
+		float t_piece = t0;
+		while(t_piece < t1)
+		{
+			float t_end, minorant;
+			const float sigma_max = m->majorant(r, t_piece, t1, t_end, minorant) * m->sigma_t;
+			const float sigma_min = minorant * m->sigma_t;
+			transmittance *= std::exp(-sigma_min * (t_end - t_piece));
+			const float sigma_residual = sigma_max - sigma_min;
+			if(sigma_residual > 0.0f)
+			{
+				float t = t_piece;
+				for(;;)
+				{
+					t += exponentialStep(sigma_residual);
+					if(t >= t_end)
+						break;
+					transmittance *=
+					    1.0f - (m->density(r.o + t * r.d) * m->sigma_t - sigma_min) / sigma_residual;
+					if(transmittance < 0.1f)
+					{
+						if(randf() < 0.5f)
+							return 0.0f;
+						transmittance *= 2.0f;
+					}
+				}
+			}
+			t_piece = t_end;
+		}
+	}
+	return transmittance;
+}
+
+float henyeyGreenstein(float cos_theta, float g)
+{
+	float denom = 1.0f + g * g - 2.0f * g * cos_theta;
+	return (1.0f - g * g) / (4.0f * float(M_PI) * denom * std::sqrt(denom));
+}
+
+vec3 sampleHenyeyGreenstein(const vec3& d, float g)
+{
+	float u1 = randf();
+	float u2 = randf();
+	float cos_theta;
+	if(std::abs(g) < 1e-3f)
+	{
+		cos_theta = 1.0f - 2.0f * u1;
+	}
+	else
+	{
+		float s = (1.0f - g * g) / (1.0f - g + 2.0f * g * u1);
+		cos_theta = clamp((1.0f + g * g - s * s) / (2.0f * g), -1.0f, 1.0f);
+	}
+	float sin_theta = std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+	float phi = 2.0f * float(M_PI) * u2;
+	vec3 t = normalize(perpendicular(d));
+	vec3 b = cross(d, t);
+	return normalize(sin_theta * std::cos(phi) * t + sin_theta * std::sin(phi) * b + cos_theta * d);
+}
+} // namespace pathtracer
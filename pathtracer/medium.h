@@ -0,0 +1,100 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <functional>
+#include "embree_copy.h"
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// A participating medium inside a world space box. The extinction at a
+// point is sigma_t * density(p), the part of it that scatters (rather than
+// absorbs) is albedo, and light scatters with the Henyey-Greenstein phase
+// function with anisotropy g.
+///////////////////////////////////////////////////////////////////////////
+class Medium
+{
+public:
+	Medium(const glm::vec3& bounds_min, const glm::vec3& bounds_max)
+	    : bounds_min(bounds_min), bounds_max(bounds_max)
+	{
+	}
+	virtual ~Medium()
+	{
+	}
+
+	// Density at a world space point in the box, at most max_density
+	virtual float density(const glm::vec3& p) const = 0;
+	// An upper bound of density() along r for t in [t0, t_end), where
+	// t_end <= t1 is where the bound stops holding, and a lower bound over
+	// the same piece in minorant. The default is max_density and 0 for the
+	// whole box, finer bounds skip empty space.
+	virtual float majorant(const Ray& /*r*/, float /*t0*/, float t1, float& t_end, float& minorant) const
+	{
+		t_end = t1;
+		minorant = 0.0f;
+		return max_density;
+	}
+
+	glm::vec3 bounds_min;
+	glm::vec3 bounds_max;
+	float max_density = 1.0f;
+	float sigma_t = 1.0f;
+	glm::vec3 albedo = glm::vec3(1.0f);
+	float g = 0.0f;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// A medium with its density given by a function
+///////////////////////////////////////////////////////////////////////////
+class ProceduralMedium : public Medium
+{
+public:
+	ProceduralMedium(const glm::vec3& bounds_min, const glm::vec3& bounds_max,
+	                 std::function<float(const glm::vec3&)> density_function, float max_density)
+	    : Medium(bounds_min, bounds_max), density_function(density_function)
+	{
+		this->max_density = max_density;
+	}
+	float density(const glm::vec3& p) const override
+	{
+		return density_function(p);
+	}
+
+private:
+	std::function<float(const glm::vec3&)> density_function;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// The media in the scene. They are not owned by the pathtracer and must
+// be added before the render thread is started.
+///////////////////////////////////////////////////////////////////////////
+void addMedium(const Medium* medium);
+void clearMedia();
+bool hasMedia();
+
+///////////////////////////////////////////////////////////////////////////
+// Sample where a ray (with a normalized direction) first scatters in the
+// media before t_max, with delta tracking. Returns false if it gets
+// through. The path throughput only needs the medium's albedo applied.
+///////////////////////////////////////////////////////////////////////////
+struct MediumScatter
+{
+	const Medium* medium;
+	float t;
+};
+bool sampleMediumScatter(const Ray& r, float t_max, MediumScatter& scatter);
+
+///////////////////////////////////////////////////////////////////////////
+// Unbiased estimate of the transmittance along r in [r.tnear, r.tfar]
+// (residual ratio tracking against the minorants), for shadow rays.
+///////////////////////////////////////////////////////////////////////////
+float mediaTransmittance(const Ray& r);
+
+///////////////////////////////////////////////////////////////////////////
+// Henyey-Greenstein phase function of the angle between the direction a
+// ray travelled in and the one it leaves in. Sampling it gives a weight
+// (phase / pdf) of one.
+///////////////////////////////////////////////////////////////////////////
+float henyeyGreenstein(float cos_theta, float g);
+glm::vec3 sampleHenyeyGreenstein(const glm::vec3& d, float g);
+} // namespace pathtracer
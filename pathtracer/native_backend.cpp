@@ -0,0 +1,305 @@
+#include "rt_backend.h"
+#include "bvh.h"
+#include <iostream>
+#include <cfloat>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// The in-house backend: a BVH4 per model in object space, and a list of
+// instances (with world space bounds) on top. Scenes have a handful of
+// models, so the top level is not a tree. Heightfields are instances that
+// trace their own grid instead of a BVH.
+///////////////////////////////////////////////////////////////////////////
+class NativeBackend : public RTBackend
+{
+public:
+	NativeBackend(BVHProfile profile);
+
+	void addModel(uint32_t handle, const labhelper::Model* model, const vec3* positions, const mat4& model_matrix,
+	              bool deformable) override;
+	void addHeightField(uint32_t handle, const HeightField* heightfield, const mat4& model_matrix) override;
+	void setTransform(uint32_t handle, const mat4& model_matrix) override;
+	void updateVertices(uint32_t handle, const vec3* positions) override;
+	void commit() override;
+	bool intersect(Ray& r) override;
+	bool occluded(Ray& r) override;
+	void occludedStream(Ray* rays, int count) override;
+	int64_t memoryBytes() const override;
+	int64_t nodeCount() const override;
+
+private:
+	struct Instance
+	{
+		const labhelper::Model* model = nullptr;
+		BVH4 bvh;
+		// Instead of model and bvh
+		const HeightField* heightfield = nullptr;
+		mat4 world_to_object;
+		mat4 object_to_world;
+		vec3 world_min = vec3(FLT_MAX);
+		vec3 world_max = vec3(-FLT_MAX);
+		// Work for the next commit(), the positions are kept by the caller
+		const vec3* positions = nullptr;
+		bool needs_build = false;
+		bool needs_refit = false;
+	};
+
+	BVHBuildSettings settings;
+	vector<Instance> instances;
+
+	void updateWorldBounds(Instance& inst);
+	static bool intersect(const Instance& inst, Ray& local)
+	{
+		return inst.heightfield ? inst.heightfield->intersect(local) : inst.bvh.intersect(local);
+	}
+	static bool occluded(const Instance& inst, const Ray& local)
+	{
+		return inst.heightfield ? inst.heightfield->occluded(local) : inst.bvh.occluded(local);
+	}
+};
+
+RTBackend* createNativeBackend(BVHProfile profile)
+{
+	return new NativeBackend(profile);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The profiles map to SAH parameters (there are no spatial splits, and
+// deformable models are refitted whatever the profile)
+///////////////////////////////////////////////////////////////////////////
+NativeBackend::NativeBackend(BVHProfile profile)
+{
+	switch(profile)
+	{
+	case BVH_PROFILE_FAST_BUILD:
+		settings.bins = 8;
+		settings.max_leaf_size = 8;
+		break;
+	case BVH_PROFILE_HIGH_QUALITY:
+		settings.bins = 32;
+		settings.max_leaf_size = 2;
+		break;
+	case BVH_PROFILE_COMPACT:
+		settings.bins = 16;
+		settings.max_leaf_size = 16;
+		break;
+	default:
+		break;
+	}
+}
+
+void NativeBackend::addModel(uint32_t handle, const labhelper::Model* model, const vec3* positions,
+                             const mat4& model_matrix, bool /*deformable*/)
+{
+	if(handle >= instances.size())
+		instances.resize(handle + 1);
+	Instance& inst = instances[handle];
+	inst.model = model;
+	inst.positions = positions;
+	inst.needs_build = true;
+	setTransform(handle, model_matrix);
+}
+
+void NativeBackend::addHeightField(uint32_t handle, const HeightField* heightfield, const mat4& model_matrix)
+{
+	if(handle >= instances.size())
+		instances.resize(handle + 1);
+	instances[handle].heightfield = heightfield;
+	setTransform(handle, model_matrix);
+}
+
+void NativeBackend::setTransform(uint32_t handle, const mat4& model_matrix)
+{
+	Instance& inst = instances[handle];
+	inst.object_to_world = model_matrix;
+	inst.world_to_object = inverse(model_matrix);
+	updateWorldBounds(inst);
+}
+
+void NativeBackend::updateVertices(uint32_t handle, const vec3* positions)
+{
+	Instance& inst = instances[handle];
+	inst.positions = positions;
+	inst.needs_refit = true;
+}
+
+void NativeBackend::updateWorldBounds(Instance& inst)
+{
+	inst.world_min = vec3(FLT_MAX);
+	inst.world_max = vec3(-FLT_MAX);
+	if(inst.heightfield == nullptr && inst.bvh.nodeCount() == 0)
+		return;
+	vec3 bmin = inst.heightfield ? inst.heightfield->boundsMin() : inst.bvh.boundsMin();
+	vec3 bmax = inst.heightfield ? inst.heightfield->boundsMax() : inst.bvh.boundsMax();
+	for(int corner = 0; corner < 8; corner++)
+	{
+		vec3 p((corner & 1) ? bmax.x : bmin.x, (corner & 2) ? bmax.y : bmin.y, (corner & 4) ? bmax.z : bmin.z);
+		vec3 w = vec3(inst.object_to_world * vec4(p, 1.0f));
+		inst.world_min = min(inst.world_min, w);
+		inst.world_max = max(inst.world_max, w);
+	}
+}
+
+void NativeBackend::commit()
+{
+	for(auto& inst : instances)
+	{
+		if(inst.needs_build)
+		{
+			vector<BVHTriangleRef> refs;
+			refs.reserve(inst.model->m_positions.size() / 3);
+			for(uint32_t geom_ID = 0; geom_ID < inst.model->m_meshes.size(); geom_ID++)
+			{
+				const labhelper::Mesh& mesh = inst.model->m_meshes[geom_ID];
+				for(uint32_t prim_ID = 0; prim_ID < mesh.m_number_of_vertices / 3; prim_ID++)
+				{
+					refs.push_back({ mesh.m_start_index + 3 * prim_ID, geom_ID, prim_ID });
+				}
+			}
+			inst.bvh.build(inst.positions, refs.data(), refs.size(), settings);
+		}
+		else if(inst.needs_refit)
+		{
+			inst.bvh.refit(inst.positions);
+		}
+		if(inst.needs_build || inst.needs_refit)
+			updateWorldBounds(inst);
+		inst.needs_build = false;
+		inst.needs_refit = false;
+		inst.positions = nullptr;
+	}
+}
+
+int64_t NativeBackend::memoryBytes() const
+{
+	int64_t bytes = int64_t(instances.size() * sizeof(Instance));
+	for(auto& inst : instances)
+		bytes += int64_t(inst.heightfield ? inst.heightfield->memoryBytes() : inst.bvh.memoryBytes());
+	return bytes;
+}
+
+int64_t NativeBackend::nodeCount() const
+{
+	int64_t nodes = 0;
+	for(auto& inst : instances)
+		nodes += int64_t(inst.bvh.nodeCount());
+	return nodes;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Does the ray enter the box within (tnear, tfar)?
+///////////////////////////////////////////////////////////////////////////
+static inline bool hitsBox(const Ray& r, const vec3& bmin, const vec3& bmax)
+{
+	float t0 = r.tnear, t1 = r.tfar;
+	for(int k = 0; k < 3; k++)
+	{
+		float inv_d = 1.0f / r.d[k];
+		float tn = (bmin[k] - r.o[k]) * inv_d;
+		float tf = (bmax[k] - r.o[k]) * inv_d;
+		if(inv_d < 0.0f)
+			std::swap(tn, tf);
+		// NaN (a zero direction in the plane of a side) keeps the old values
+		t0 = tn > t0 ? tn : t0;
+		t1 = tf < t1 ? tf : t1;
+	}
+	return t0 <= t1 * 1.0000004f;
+}
+
+static inline Ray toObjectSpace(const Ray& r, const mat4& world_to_object)
+{
+	Ray local = r;
+	local.o = vec3(world_to_object * vec4(r.o, 1.0f));
+	// Not normalized, so distances along the ray stay the same
+	local.d = mat3(world_to_object) * r.d;
+	return local;
+}
+
+bool NativeBackend::intersect(Ray& r)
+{
+	bool hit = false;
+	for(uint32_t handle = 0; handle < instances.size(); handle++)
+	{
+		const Instance& inst = instances[handle];
+		if(!hitsBox(r, inst.world_min, inst.world_max))
+			continue;
+		Ray local = toObjectSpace(r, inst.world_to_object);
+		if(intersect(inst, local))
+		{
+			r.tfar = local.tfar;
+			r.u = local.u;
+			r.v = local.v;
+			r.n = local.n;
+			r.geomID = local.geomID;
+			r.primID = local.primID;
+			r.instID = handle;
+			hit = true;
+		}
+	}
+	return hit;
+}
+
+bool NativeBackend::occluded(Ray& r)
+{
+	for(auto& inst : instances)
+	{
+		if(!hitsBox(r, inst.world_min, inst.world_max))
+			continue;
+		if(occluded(inst, toObjectSpace(r, inst.world_to_object)))
+		{
+			r.geomID = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The stream is cut into packets, each packet goes through every instance
+// it touches in one traversal (BVH4::occluded for several rays).
+// Heightfields take the rays of a packet one at a time.
+///////////////////////////////////////////////////////////////////////////
+void NativeBackend::occludedStream(Ray* rays, int count)
+{
+	const int packet_size = BVH4::MAX_PACKET_SIZE;
+	Ray local[packet_size];
+	for(int first = 0; first < count; first += packet_size)
+	{
+		Ray* packet = rays + first;
+		int n = std::min(packet_size, count - first);
+		uint64_t occluded_mask = 0;
+		for(auto& inst : instances)
+		{
+			uint64_t active = 0;
+			for(int i = 0; i < n; i++)
+			{
+				const uint64_t bit = uint64_t(1) << i;
+				if(!(occluded_mask & bit) && hitsBox(packet[i], inst.world_min, inst.world_max))
+				{
+					local[i] = toObjectSpace(packet[i], inst.world_to_object);
+					active |= bit;
+				}
+			}
+			if(inst.heightfield == nullptr)
+			{
+				occluded_mask |= inst.bvh.occluded(local, n, active);
+				continue;
+			}
+			for(int i = 0; i < n; i++)
+			{
+				if((active & (uint64_t(1) << i)) && inst.heightfield->occluded(local[i]))
+					occluded_mask |= uint64_t(1) << i;
+			}
+		}
+		for(int i = 0; i < n; i++)
+		{
+			packet[i].geomID = (occluded_mask & (uint64_t(1) << i)) ? 0 : RTC_INVALID_GEOMETRY_ID;
+		}
+	}
+}
+} // namespace pathtracer
@@ -0,0 +1,221 @@
+#include "noise_lattice.h"
+
+#ifdef PATHTRACER_SIMD_X86
+#include <immintrin.h>
+
+namespace pathtracer
+{
+namespace simd_avx2
+{
+///////////////////////////////////////////////////////////////////////////
+// The float noise of Noise.cpp, 8 points at a time. This file is compiled
+// with AVX2/FMA enabled and must only be called after checking the CPU
+// supports it.
+///////////////////////////////////////////////////////////////////////////
+struct Lattice
+{
+	// GRADIENT_* in two registers each, looked up with permutes
+	__m256 gradient_lo[3];
+	__m256 gradient_hi[3];
+};
+
+static inline __m256 lookup(const __m256& lo, const __m256& hi, const __m256i& h)
+{
+	// The top four bits pick the gradient: bit 31 the register, the three
+	// below it the lane (permutevar only looks at the low three bits)
+	const __m256i index = _mm256_srli_epi32(h, 28);
+	return _mm256_blendv_ps(_mm256_permutevar8x32_ps(lo, index), _mm256_permutevar8x32_ps(hi, index),
+	                        _mm256_castsi256_ps(h));
+}
+
+static inline __m256 fmadd(const __m256& a, const __m256& b, const __m256& c)
+{
+	return _mm256_fmadd_ps(a, b, c);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// perlinLattice() for 8 points, the derivative only if d is not null
+///////////////////////////////////////////////////////////////////////////
+static inline __m256 perlin8(const Lattice& lattice, const __m256 x[3], const __m256i& seed, __m256 d[3])
+{
+	using namespace noise_lattice;
+	__m256 f[3];
+	__m256i a[3], b[3];
+	const __m256i primes[3] = { _mm256_set1_epi32(int(PRIME_X)), _mm256_set1_epi32(int(PRIME_Y)),
+		                        _mm256_set1_epi32(int(PRIME_Z)) };
+	for(int k = 0; k < 3; k++)
+	{
+		const __m256 cell = _mm256_floor_ps(x[k]);
+		f[k] = _mm256_sub_ps(x[k], cell);
+		a[k] = _mm256_mullo_epi32(_mm256_cvttps_epi32(cell), primes[k]);
+		b[k] = _mm256_add_epi32(a[k], primes[k]);
+	}
+
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256i mix = _mm256_set1_epi32(int(MIX));
+	__m256 g[8][3];
+	__m256 v[8];
+	for(int c = 0; c < 8; c++)
+	{
+		__m256i h = _mm256_xor_si256(seed, (c & 1) ? b[0] : a[0]);
+		h = _mm256_xor_si256(h, (c & 2) ? b[1] : a[1]);
+		h = _mm256_xor_si256(h, (c & 4) ? b[2] : a[2]);
+		h = _mm256_mullo_epi32(_mm256_xor_si256(h, _mm256_srli_epi32(h, 16)), mix);
+		for(int k = 0; k < 3; k++)
+			g[c][k] = lookup(lattice.gradient_lo[k], lattice.gradient_hi[k], h);
+		const __m256 ox = (c & 1) ? _mm256_sub_ps(f[0], one) : f[0];
+		const __m256 oy = (c & 2) ? _mm256_sub_ps(f[1], one) : f[1];
+		const __m256 oz = (c & 4) ? _mm256_sub_ps(f[2], one) : f[2];
+		v[c] = fmadd(g[c][0], ox, fmadd(g[c][1], oy, _mm256_mul_ps(g[c][2], oz)));
+	}
+
+	// Fade, as a polynomial in u like the scalar version
+	__m256 u[3];
+	for(int k = 0; k < 3; k++)
+	{
+		const __m256 f3 = _mm256_mul_ps(_mm256_mul_ps(f[k], f[k]), f[k]);
+		const __m256 p = fmadd(f[k], _mm256_set1_ps(6.0f), _mm256_set1_ps(-15.0f));
+		u[k] = _mm256_mul_ps(f3, fmadd(f[k], p, _mm256_set1_ps(10.0f)));
+	}
+	const __m256 k1 = _mm256_sub_ps(v[1], v[0]);
+	const __m256 k2 = _mm256_sub_ps(v[2], v[0]);
+	const __m256 k3 = _mm256_sub_ps(v[4], v[0]);
+	const __m256 k4 = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(v[0], v[1]), v[2]), v[3]);
+	const __m256 k5 = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(v[0], v[2]), v[4]), v[6]);
+	const __m256 k6 = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(v[0], v[1]), v[4]), v[5]);
+	const __m256 k7 = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(v[1], v[0]), _mm256_sub_ps(v[2], v[3])),
+	                                _mm256_add_ps(_mm256_sub_ps(v[4], v[5]), _mm256_sub_ps(v[7], v[6])));
+	const __m256 uxy = _mm256_mul_ps(u[0], u[1]);
+	const __m256 uyz = _mm256_mul_ps(u[1], u[2]);
+	const __m256 uzx = _mm256_mul_ps(u[2], u[0]);
+	const __m256 uxyz = _mm256_mul_ps(uxy, u[2]);
+
+	if(d)
+	{
+		for(int k = 0; k < 3; k++)
+		{
+			__m256 gk = g[0][k];
+			gk = fmadd(u[0], _mm256_sub_ps(g[1][k], g[0][k]), gk);
+			gk = fmadd(u[1], _mm256_sub_ps(g[2][k], g[0][k]), gk);
+			gk = fmadd(u[2], _mm256_sub_ps(g[4][k], g[0][k]), gk);
+			const __m256 g4 = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(g[0][k], g[1][k]), g[2][k]), g[3][k]);
+			const __m256 g5 = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(g[0][k], g[2][k]), g[4][k]), g[6][k]);
+			const __m256 g6 = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(g[0][k], g[1][k]), g[4][k]), g[5][k]);
+			const __m256 g7 =
+			    _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(g[1][k], g[0][k]), _mm256_sub_ps(g[2][k], g[3][k])),
+			                  _mm256_add_ps(_mm256_sub_ps(g[4][k], g[5][k]), _mm256_sub_ps(g[7][k], g[6][k])));
+			gk = fmadd(uxy, g4, gk);
+			gk = fmadd(uyz, g5, gk);
+			gk = fmadd(uzx, g6, gk);
+			d[k] = fmadd(uxyz, g7, gk);
+		}
+		__m256 du[3];
+		for(int k = 0; k < 3; k++)
+		{
+			const __m256 f2 = _mm256_mul_ps(_mm256_set1_ps(30.0f), _mm256_mul_ps(f[k], f[k]));
+			du[k] = _mm256_mul_ps(f2, fmadd(f[k], _mm256_sub_ps(f[k], _mm256_set1_ps(2.0f)), one));
+		}
+		d[0] = fmadd(du[0], fmadd(k7, uyz, fmadd(k6, u[2], fmadd(k4, u[1], k1))), d[0]);
+		d[1] = fmadd(du[1], fmadd(k7, uzx, fmadd(k4, u[0], fmadd(k5, u[2], k2))), d[1]);
+		d[2] = fmadd(du[2], fmadd(k7, uxy, fmadd(k5, u[1], fmadd(k6, u[0], k3))), d[2]);
+	}
+
+	__m256 n = fmadd(k1, u[0], v[0]);
+	n = fmadd(k2, u[1], n);
+	n = fmadd(k3, u[2], n);
+	n = fmadd(k4, uxy, n);
+	n = fmadd(k5, uyz, n);
+	n = fmadd(k6, uzx, n);
+	return fmadd(k7, uxyz, n);
+}
+
+static inline __m256 loadN(const float* p, int n)
+{
+	if(n == 8)
+		return _mm256_loadu_ps(p);
+	float tmp[8] = {};
+	for(int i = 0; i < n; i++)
+		tmp[i] = p[i];
+	return _mm256_loadu_ps(tmp);
+}
+
+static inline void storeN(float* p, const __m256& v, int n)
+{
+	if(n == 8)
+	{
+		_mm256_storeu_ps(p, v);
+		return;
+	}
+	float tmp[8];
+	_mm256_storeu_ps(tmp, v);
+	for(int i = 0; i < n; i++)
+		p[i] = tmp[i];
+}
+
+void noiseOctaves(int count, Vec3SoA x, uint32_t seed, const NoiseOctaves& octaves, bool ridged, float* value,
+                  const Vec3SoAOut* gradient)
+{
+	using namespace noise_lattice;
+	Lattice lattice;
+	const float* tables[3] = { GRADIENT_X, GRADIENT_Y, GRADIENT_Z };
+	for(int k = 0; k < 3; k++)
+	{
+		lattice.gradient_lo[k] = _mm256_loadu_ps(tables[k]);
+		lattice.gradient_hi[k] = _mm256_loadu_ps(tables[k] + 8);
+	}
+	const __m256 sign_bit = _mm256_set1_ps(-0.0f);
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	for(int i = 0; i < count; i += 8)
+	{
+		const int n = count - i < 8 ? count - i : 8;
+		const __m256 p[3] = { loadN(x.x + i, n), loadN(x.y + i, n), loadN(x.z + i, n) };
+		__m256 sum = _mm256_setzero_ps();
+		__m256 d_sum[3] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+		float amplitude = 1.0f;
+		float frequency = octaves.frequency;
+		for(int octave = 0; octave < octaves.octaves; octave++)
+		{
+			const __m256 scale = _mm256_set1_ps(frequency);
+			const __m256 q[3] = { _mm256_mul_ps(p[0], scale), _mm256_mul_ps(p[1], scale),
+				                  _mm256_mul_ps(p[2], scale) };
+			const __m256i octave_seed = _mm256_set1_epi32(int(seed + uint32_t(octave) * OCTAVE_SEED));
+			__m256 d[3];
+			__m256 noise = perlin8(lattice, q, octave_seed, gradient ? d : nullptr);
+			if(ridged)
+			{
+				// r = 1 - |n|, d *= -2 r sign(n) (sign(0) is 0)
+				const __m256 r = _mm256_sub_ps(one, _mm256_andnot_ps(sign_bit, noise));
+				const __m256 nonzero = _mm256_cmp_ps(noise, _mm256_setzero_ps(), _CMP_NEQ_OQ);
+				const __m256 sign = _mm256_and_ps(_mm256_or_ps(_mm256_and_ps(noise, sign_bit), one), nonzero);
+				const __m256 scale_d = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(-2.0f), r), sign);
+				if(gradient)
+				{
+					for(int k = 0; k < 3; k++)
+						d[k] = _mm256_mul_ps(d[k], scale_d);
+				}
+				noise = _mm256_mul_ps(r, r);
+			}
+			sum = fmadd(_mm256_set1_ps(amplitude), noise, sum);
+			if(gradient)
+			{
+				const __m256 d_scale = _mm256_set1_ps(amplitude * frequency);
+				for(int k = 0; k < 3; k++)
+					d_sum[k] = fmadd(d_scale, d[k], d_sum[k]);
+			}
+			amplitude *= octaves.gain;
+			frequency *= octaves.lacunarity;
+		}
+		storeN(value + i, sum, n);
+		if(gradient)
+		{
+			storeN(gradient->x + i, d_sum[0], n);
+			storeN(gradient->y + i, d_sum[1], n);
+			storeN(gradient->z + i, d_sum[2], n);
+		}
+	}
+}
+} // namespace simd_avx2
+} // namespace pathtracer
+
+#endif // PATHTRACER_SIMD_X86
@@ -0,0 +1,39 @@
+#pragma once
+#include <stdint.h>
+#include "Noise.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// What the scalar and the SIMD float noise share, so they agree on every
+// lattice point. The hash of a lattice point is
+//
+//   h = seed ^ x * PRIME_X ^ y * PRIME_Y ^ z * PRIME_Z
+//   h = (h ^ (h >> 16)) * MIX
+//
+// and its top four bits pick one of Perlin's gradients (the twelve edge
+// directions of a cube, four of them twice). Octave i hashes with
+// seed + i * OCTAVE_SEED.
+///////////////////////////////////////////////////////////////////////////////
+namespace noise_lattice
+{
+static const uint32_t PRIME_X = 0x8da6b343u;
+static const uint32_t PRIME_Y = 0xd8163841u;
+static const uint32_t PRIME_Z = 0xcb1ab31fu;
+static const uint32_t MIX = 0x2c1b3c6du;
+static const uint32_t OCTAVE_SEED = 0x9e3779b9u;
+
+static const float GRADIENT_X[16] = { 1, -1, 1, -1, 1, -1, 1, -1, 0, 0, 0, 0, 1, 0, -1, 0 };
+static const float GRADIENT_Y[16] = { 1, 1, -1, -1, 0, 0, 0, 0, 1, -1, 1, -1, 1, -1, 1, -1 };
+static const float GRADIENT_Z[16] = { 0, 0, 0, 0, 1, 1, -1, -1, 1, 1, -1, -1, 0, 1, 0, -1 };
+} // namespace noise_lattice
+
+namespace pathtracer
+{
+#ifdef PATHTRACER_SIMD_X86
+namespace simd_avx2
+{
+// fbm (or ridged) of the lattice with the given seed, in noise_avx2.cpp
+void noiseOctaves(int count, Vec3SoA x, uint32_t seed, const NoiseOctaves& octaves, bool ridged, float* value,
+                  const Vec3SoAOut* gradient);
+} // namespace simd_avx2
+#endif
+} // namespace pathtracer
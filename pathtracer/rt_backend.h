@@ -0,0 +1,56 @@
+#pragma once
+#include "embree_copy.h"
+#include "heightfield.h"
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// What embree_copy.cpp needs from a ray tracing backend. A model is
+// referred to by its handle (they are dense, from zero) and its meshes by
+// their index in model->m_meshes. Hits are reported in the Ray like
+// embree does it: tfar, u, v, the unnormalized geometry normal n in object
+// space, geomID = mesh index, primID = triangle in the mesh and
+// instID = model handle. occluded() sets geomID to 0 on a hit. A
+// heightfield reports its hits the way HeightField::intersect() does.
+//
+// All calls except intersect() and occluded() are made by one thread at a
+// time, and never while rays are traced.
+///////////////////////////////////////////////////////////////////////////
+class RTBackend
+{
+public:
+	virtual ~RTBackend() {}
+
+	// Add a model with the given vertex positions (m_positions layout)
+	virtual void addModel(uint32_t handle, const labhelper::Model* model, const glm::vec3* positions,
+	                      const glm::mat4& model_matrix, bool deformable) = 0;
+	// Add a heightfield, which is intersected as is (it is built, and kept
+	// by the caller)
+	virtual void addHeightField(uint32_t handle, const HeightField* heightfield, const glm::mat4& model_matrix) = 0;
+	virtual void setTransform(uint32_t handle, const glm::mat4& model_matrix) = 0;
+	// Only for models added as deformable
+	virtual void updateVertices(uint32_t handle, const glm::vec3* positions) = 0;
+	// Build or update what has changed since the last commit
+	virtual void commit() = 0;
+
+	virtual bool intersect(Ray& r) = 0;
+	virtual bool occluded(Ray& r) = 0;
+	// occluded() for count rays at once, the results are in their geomID
+	virtual void occludedStream(Ray* rays, int count)
+	{
+		for(int i = 0; i < count; i++)
+			occluded(rays[i]);
+	}
+
+	// Bytes held by the acceleration structures
+	virtual int64_t memoryBytes() const = 0;
+	// Nodes in the BVHs of all models, or -1 if the backend does not tell
+	virtual int64_t nodeCount() const
+	{
+		return -1;
+	}
+};
+
+RTBackend* createEmbreeBackend(BVHProfile profile);
+RTBackend* createNativeBackend(BVHProfile profile);
+} // namespace pathtracer
@@ -23,10 +23,13 @@ float randf()
 // Generate uniform points on a disc
 ///////////////////////////////////////////////////////////////////////////
 void concentricSampleDisk(float* dx, float* dy)
+{
+	concentricSampleDisk(randf(), randf(), dx, dy);
+}
+
+void concentricSampleDisk(float u1, float u2, float* dx, float* dy)
 {
 	float r, theta;
-	float u1 = randf();
-	float u2 = randf();
 	// Map uniform random numbers to $[-1,1]^2$
 	float sx = 2 * u1 - 1;
 	float sy = 2 * u2 - 1;
@@ -125,6 +128,19 @@ glm::vec3 cosineSampleHemisphere()
 	return ret;
 }
 
+///////////////////////////////////////////////////////////////////////////
+// A jittered point in cell `index` of a grid of `count` cells covering
+// [0,1)^2. The grid is as square as count allows.
+///////////////////////////////////////////////////////////////////////////
+glm::vec2 stratifiedSample2D(int index, int count)
+{
+	int cols = std::max(1, int(sqrt(float(count))));
+	while(count % cols != 0)
+		cols--;
+	int rows = count / cols;
+	return glm::vec2((float(index % cols) + randf()) / float(cols), (float(index / cols) + randf()) / float(rows));
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // Generate a vector that is perpendicular to another
 ///////////////////////////////////////////////////////////////////////////
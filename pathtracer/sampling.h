@@ -12,6 +12,12 @@ float randf();
 // Generate uniform points on a disc
 ///////////////////////////////////////////////////////////////////////////
 void concentricSampleDisk(float* dx, float* dy);
+// The same mapping for given u1, u2 in [0,1)
+void concentricSampleDisk(float u1, float u2, float* dx, float* dy);
+///////////////////////////////////////////////////////////////////////////
+// Jittered sample `index` of `count` stratified samples on [0,1)^2
+///////////////////////////////////////////////////////////////////////////
+glm::vec2 stratifiedSample2D(int index, int count);
 ///////////////////////////////////////////////////////////////////////////
 // Generate uniform points on a sphere
 ///////////////////////////////////////////////////////////////////////////
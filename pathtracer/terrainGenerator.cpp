@@ -1,17 +1,17 @@
 #include "terrainGenerator.h"
-#include "Noise.h"
+#include <algorithm>
 
-terrainGenerator::terrainGenerator(float w, float h, float scl)
+terrainGenerator::terrainGenerator(float w, float h, float scl, int seed) : noise(seed)
 {
-	this->cols =(int) w / scl;
-	this->rows =(int) h / scl;
+	this->cols = std::max(int(w / scl), 1) + 1;
+	this->rows = std::max(int(h / scl), 1) + 1;
 	this->scl = scl;
 
-	this->zValues = new float* [rows];
-	for (int i = 0; i < rows; i++) {
-		this->zValues[i] = new float[cols];
-		
-	}
+	// Features a few times smaller than the terrain, and hills about a
+	// tenth of its size
+	octaves.octaves = 6;
+	octaves.frequency = 4.0f / std::max(w, h);
+	height_scale = 0.1f * std::max(w, h);
 
 	this->createTerrain();
 }
@@ -20,157 +20,107 @@ terrainGenerator::~terrainGenerator()
 {
 }
 
-std::vector<glm::vec3> terrainGenerator::getVerticesPosition()
-{	
-	return vertices;
+void terrainGenerator::createTerrain()
+{
+	this->setHeighWithNoise();
+	this->createMesh();
 }
 
-std::vector<glm::vec3> terrainGenerator::getVerticesPositionTest()
+///////////////////////////////////////////////////////////////////////////////
+// One noise sample per grid point, a row at a time with the batched noise
+///////////////////////////////////////////////////////////////////////////////
+void terrainGenerator::setHeighWithNoise()
 {
-	/*vertices = { {0.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f} };
-	return vertices; */
-
-	int m_meshResolution = 20;
-
-	int size = m_meshResolution * m_meshResolution * 2 * 3 * 3;
-	float* positions = new float[size]();
-
-	double triangleWidth = 2 / m_meshResolution;
-	float startX = -1.0f;
-	float startZ = 1.0f;
-	float x1 = 0;
-	float x2 = 0;
-	float z1 = 0;
-	float z2 = 0;
-	int index = 0;
-
-	
-
-	//For each row
-	for (int r = 0; r < m_meshResolution; r++) {
-		//For each column
-		for (int c = 0; c < m_meshResolution; c++) {
-			x1 = startX + c * this->scl;
-			x2 = startX + (c + 1) * this->scl;
-			z1 = startZ - r * this->scl;
-			z2 = startZ - (r + 1) * this->scl;
-			//Generate one triangle
-			//float y1 = noise->getNoise(x1, 0, z1);
-			//float y2 = noise->getNoise(x2, 0, z2);
-
-			vertices.push_back(glm::vec3(x1, 0, z1));
-			vertices.push_back(glm::vec3(x2, 0, z2));
-			vertices.push_back(glm::vec3(x2, 0, z1));
-
-			//Generate other triangle
-			vertices.push_back(glm::vec3(x1, 0, z1));
-			vertices.push_back(glm::vec3(x1, 0, z2));
-			vertices.push_back(glm::vec3(x2, 0, z2));
-
+	heights.resize(size_t(cols) * rows);
+	vertices.resize(heights.size());
+	const float x0 = -0.5f * (cols - 1) * scl;
+	const float z0 = -0.5f * (rows - 1) * scl;
+
+#pragma omp parallel
+	{
+		std::vector<float> x(cols), y(cols, 0.0f), z(cols);
+		for (int i = 0; i < cols; i++) {
+			x[i] = x0 + i * scl;
+		}
+		pathtracer::Vec3SoA points = { x.data(), y.data(), z.data() };
+#pragma omp for schedule(dynamic, 16)
+		for (int row = 0; row < rows; row++) {
+			float* row_heights = &heights[size_t(row) * cols];
+			std::fill(z.begin(), z.end(), z0 + row * scl);
+			noise.fbm(cols, points, octaves, row_heights);
+			for (int i = 0; i < cols; i++) {
+				row_heights[i] *= height_scale;
+				vertices[size_t(row) * cols + i] = glm::vec3(x[i], row_heights[i], z[i]);
+			}
 		}
 	}
-
-	std::reverse(vertices.begin(), vertices.end());
-
-	return vertices;
 }
 
-void terrainGenerator::createTerrain()
+///////////////////////////////////////////////////////////////////////////////
+// Normals from central differences of the heights (one sided on the
+// borders), texture coordinates over the whole terrain and the indices
+///////////////////////////////////////////////////////////////////////////////
+void terrainGenerator::createMesh()
 {
-	//this->getZvalues();
-
-	this->getVerticesPositionTest();
-	this->setHeighWithNoise();
-
-	/*vertices.push_back(glm::vec3(1,1,0));
-	vertices.push_back(glm::vec3(4,2,0));
-	vertices.push_back(glm::vec3(1,3,0));
-	vertices.push_back(glm::vec3(1,3,0));
-	vertices.push_back(glm::vec3(4,2,0));
-	vertices.push_back(glm::vec3(4,4,0));*/
-
-	//std::vector<glm::vec3> tempvex;
-	//for (int y = 0; y < rows - 1; y++) {
-	//	for (int x = 0; x < cols; x++) {
-	//		tempvex.push_back(
-	//			glm::vec3(x * scl, y * scl, zValues[x][y])
-	//		);
-	//		tempvex.push_back(
-	//			glm::vec3(x * scl, (y + 1) * scl, zValues[x][y])
-	//		);
-	//		
-	//	}
-	//}
-
-	//int currentIndex = 0;
-
-
-	//for (int i = 0; i < tempvex.size(); i++) {
-	//	if (i + 2 >= tempvex.size())
-	//		break;
-
-	//	vertices.push_back(tempvex[i]);
-	//	vertices.push_back(tempvex[i+1]);
-	//	vertices.push_back(tempvex[i+2]);
-
-
-	//}
+	normals.resize(heights.size());
+	texture_coordinates.resize(heights.size());
+	indices.resize(size_t(cols - 1) * (rows - 1) * 6);
+
+#pragma omp parallel for schedule(dynamic, 16)
+	for (int row = 0; row < rows; row++) {
+		const int up = std::max(row - 1, 0), down = std::min(row + 1, rows - 1);
+		for (int i = 0; i < cols; i++) {
+			const int left = std::max(i - 1, 0), right = std::min(i + 1, cols - 1);
+			const float dh_dx = (getHeight(right, row) - getHeight(left, row)) / ((right - left) * scl);
+			const float dh_dz = (getHeight(i, down) - getHeight(i, up)) / ((down - up) * scl);
+			const size_t index = size_t(row) * cols + i;
+			normals[index] = glm::normalize(glm::vec3(-dh_dx, 1.0f, -dh_dz));
+			texture_coordinates[index] = glm::vec2(float(i) / (cols - 1), float(row) / (rows - 1));
+		}
 
+		if (row == rows - 1)
+			continue;
+		// Counterclockwise seen from above
+		uint32_t* cell = &indices[size_t(row) * (cols - 1) * 6];
+		for (int i = 0; i < cols - 1; i++, cell += 6) {
+			const uint32_t p00 = uint32_t(row * cols + i), p10 = p00 + 1;
+			const uint32_t p01 = p00 + uint32_t(cols), p11 = p01 + 1;
+			cell[0] = p00;
+			cell[1] = p01;
+			cell[2] = p10;
+			cell[3] = p10;
+			cell[4] = p01;
+			cell[5] = p11;
+		}
+	}
 }
 
-// creas una textura, generar una imagen(tabla de valores, un valor por cada vertice que vas a tener) con valores aleatorios y usas los valores de esa imagen apra crear el mesh
-
-std::vector<glm::vec3> terrainGenerator::getNormals()
+std::vector<glm::vec3> terrainGenerator::getVerticesPosition()
 {
-	std::vector<glm::vec3> normals;
-
-	for (glm::vec3 v : vertices) {
-		normals.push_back(glm::normalize(v));
-		//normals.push_back(glm::normalize(v)*glm::vec3(1.0f, 1.0f, 1.0f));
+	std::vector<glm::vec3> soup(indices.size());
+#pragma omp parallel for
+	for (int i = 0; i < int(indices.size()); i++) {
+		soup[i] = vertices[indices[i]];
 	}
-	
-	return normals;
+	return soup;
 }
 
-float** terrainGenerator::getZvalues()
+std::vector<glm::vec3> terrainGenerator::getNormals()
 {
-	const float constantCol = this->cols;
-	
-
-	float yoffset = 0;
-	for (int y = 0; y < rows; y++) {
-		float xoffset = 0;
-		for (int x = 0; x < cols; x++) {
-			zValues[x][y] = rand() % 100 + -100;
-			xoffset += 0.2;
-		}
-		yoffset += 0.2;
+	std::vector<glm::vec3> soup(indices.size());
+#pragma omp parallel for
+	for (int i = 0; i < int(indices.size()); i++) {
+		soup[i] = normals[indices[i]];
 	}
-	float a = zValues[0][0];
-	return zValues;
+	return soup;
 }
 
-void terrainGenerator::setHeighWithNoise()
+std::vector<glm::vec2> terrainGenerator::getTextureCoordinates()
 {
-	Noise* noise = new Noise(867);
-	
-	for (int i = 0; i < 2000; i++) {
-		
-		float newZ = 100 * noise->getNoise(
-			this->vertices[i].x, 
-			0.8, 
-			this->vertices[i].z
-		);
-		newZ = newZ - floor(newZ);
-
-		for (int j = 0; j < 2000; j++) {
-			if (this->vertices[j].x == this->vertices[i].x && 
-				this->vertices[j].z == this->vertices[i].z) {
-				this->vertices[j].y = floor(255 * newZ);
-			}
-		}
-	};
-
-	
+	std::vector<glm::vec2> soup(indices.size());
+#pragma omp parallel for
+	for (int i = 0; i < int(indices.size()); i++) {
+		soup[i] = texture_coordinates[indices[i]];
+	}
+	return soup;
 }
-
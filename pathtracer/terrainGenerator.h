@@ -1,26 +1,61 @@
 #pragma once
 #include <glm/glm.hpp>
 #include <vector>
+#include <stdint.h>
+#include "Noise.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// A w x h terrain centered on the origin (in the xz plane), with a grid
+// point every scl units. The heights are fbm noise sampled once per grid
+// point, and the mesh is indexed: one vertex per grid point (row major,
+// rows along z) and two triangles per cell.
+///////////////////////////////////////////////////////////////////////////////
 class terrainGenerator
 {
 public:
-	terrainGenerator(float w, float h, float scl);
+	terrainGenerator(float w, float h, float scl, int seed = 867);
 	~terrainGenerator();
 
-	std::vector <glm::vec3> vertices;
+	// Height noise, applied by createTerrain()
+	NoiseOctaves octaves;
+	float height_scale;
+
+	std::vector<float> heights;
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> texture_coordinates;
+	std::vector<uint32_t> indices;
+
+	// The mesh as a triangle soup (three vertices per triangle), the way
+	// labhelper::Model stores it
 	std::vector<glm::vec3> getVerticesPosition();
-	std::vector<glm::vec3> getVerticesPositionTest();
-	void createTerrain();
 	std::vector<glm::vec3> getNormals();
+	std::vector<glm::vec2> getTextureCoordinates();
+	void createTerrain();
+
+	// Grid points along x and z
+	int getCols() const
+	{
+		return cols;
+	}
+	int getRows() const
+	{
+		return rows;
+	}
+	float getScale() const
+	{
+		return scl;
+	}
+	float getHeight(int x, int z) const
+	{
+		return heights[z * cols + x];
+	}
+
 private:
 	int cols, rows;
 	float scl;
-	float** zValues;
+	Noise noise;
 
-	float** getZvalues();
 	void setHeighWithNoise();
-
-
-
+	void createMesh();
 };
-
@@ -0,0 +1,121 @@
+#include "tonemap.h"
+#include <cmath>
+#include <algorithm>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TONEMAP_SSE2 1
+#endif
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Linear [0, 1] to 8 bit sRGB, looked up with 12 bits of precision
+///////////////////////////////////////////////////////////////////////////
+static const int SRGB_LUT_SIZE = 4096;
+
+struct SRGBTable
+{
+	uint8_t lut[SRGB_LUT_SIZE];
+	SRGBTable()
+	{
+		for(int i = 0; i < SRGB_LUT_SIZE; i++)
+		{
+			float l = float(i) / float(SRGB_LUT_SIZE - 1);
+			float s = l <= 0.0031308f ? 12.92f * l : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+			lut[i] = uint8_t(std::min(255.0f, s * 255.0f + 0.5f));
+		}
+	}
+};
+static const SRGBTable srgb_table;
+
+///////////////////////////////////////////////////////////////////////////
+// The curves, for a single value
+///////////////////////////////////////////////////////////////////////////
+static inline float tonemap(float x, ToneMapOperator op)
+{
+	switch(op)
+	{
+	case TONEMAP_REINHARD:
+		return x / (1.0f + x);
+	case TONEMAP_ACES:
+		// Narkowicz' fit of the ACES filmic curve
+		return (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+	default:
+		return x;
+	}
+}
+
+static inline int lutIndex(float x)
+{
+	return int(x * float(SRGB_LUT_SIZE - 1) + 0.5f);
+}
+
+#ifdef TONEMAP_SSE2
+///////////////////////////////////////////////////////////////////////////
+// The curves for four values, returns their lookup table indices
+///////////////////////////////////////////////////////////////////////////
+static inline __m128i tonemapIndices(__m128 x, __m128 exposure, ToneMapOperator op)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	x = _mm_max_ps(_mm_mul_ps(x, exposure), _mm_setzero_ps());
+	switch(op)
+	{
+	case TONEMAP_REINHARD:
+		x = _mm_div_ps(x, _mm_add_ps(one, x));
+		break;
+	case TONEMAP_ACES:
+	{
+		__m128 num = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), x), _mm_set1_ps(0.03f)));
+		__m128 den = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), x), _mm_set1_ps(0.59f))),
+		                        _mm_set1_ps(0.14f));
+		x = _mm_div_ps(num, den);
+		break;
+	}
+	default:
+		break;
+	}
+	// min() also maps NaN to 1 (it returns the second operand)
+	x = _mm_min_ps(x, one);
+	__m128 scaled = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(float(SRGB_LUT_SIZE - 1))), _mm_set1_ps(0.5f));
+	return _mm_cvttps_epi32(scaled);
+}
+#endif
+
+void tonemapToSRGB8(const float* rgb, int pixel_count, float exposure, ToneMapOperator op, uint8_t* rgba8)
+{
+	const uint8_t* lut = srgb_table.lut;
+	int i = 0;
+#ifdef TONEMAP_SSE2
+	// Four pixels (twelve floats, three registers) at a time
+	const __m128 e = _mm_set1_ps(exposure);
+	alignas(16) int32_t idx[12];
+	for(; i + 4 <= pixel_count; i += 4)
+	{
+		const float* src = rgb + 3 * i;
+		_mm_store_si128((__m128i*)&idx[0], tonemapIndices(_mm_loadu_ps(src + 0), e, op));
+		_mm_store_si128((__m128i*)&idx[4], tonemapIndices(_mm_loadu_ps(src + 4), e, op));
+		_mm_store_si128((__m128i*)&idx[8], tonemapIndices(_mm_loadu_ps(src + 8), e, op));
+		uint8_t* dst = rgba8 + 4 * i;
+		for(int p = 0; p < 4; p++)
+		{
+			dst[4 * p + 0] = lut[idx[3 * p + 0]];
+			dst[4 * p + 1] = lut[idx[3 * p + 1]];
+			dst[4 * p + 2] = lut[idx[3 * p + 2]];
+			dst[4 * p + 3] = 255;
+		}
+	}
+#endif
+	for(; i < pixel_count; i++)
+	{
+		for(int c = 0; c < 3; c++)
+		{
+			// Same NaN handling as the SSE path: NaN in gives 0, NaN out
+			// of the curve (inf / inf) gives 1
+			float x = rgb[3 * i + c] * exposure;
+			x = tonemap(x > 0.0f ? x : 0.0f, op);
+			rgba8[4 * i + c] = lut[lutIndex(x <= 1.0f ? x : 1.0f)];
+		}
+		rgba8[4 * i + 3] = 255;
+	}
+}
+} // namespace pathtracer
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Tone-mapping curves applied before the sRGB encoding
+///////////////////////////////////////////////////////////////////////////
+enum ToneMapOperator
+{
+	TONEMAP_CLAMP = 0,
+	TONEMAP_REINHARD,
+	TONEMAP_ACES,
+};
+
+// For ImGui::Combo
+#define TONEMAP_OPERATOR_NAMES "Clamp\0Reinhard\0ACES (fitted)\0"
+
+///////////////////////////////////////////////////////////////////////////
+// Convert pixel_count linear RGB float pixels to 8 bit sRGB (with alpha
+// set to 255): rgba8 = srgb(tonemap(exposure * rgb)).
+///////////////////////////////////////////////////////////////////////////
+void tonemapToSRGB8(const float* rgb, int pixel_count, float exposure, ToneMapOperator op, uint8_t* rgba8);
+} // namespace pathtracer
@@ -0,0 +1,82 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "embree_copy.h"
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Watertight ray/triangle intersection (Woop, Benthin and Wald 2013). The
+// ray is sheared so it points along +z, the triangle is then tested in 2D
+// with edge functions that are exact for shared edges. Barycentrics and
+// the geometry normal follow embree's conventions.
+///////////////////////////////////////////////////////////////////////////
+struct WatertightRay
+{
+	glm::vec3 o;
+	int kx, ky, kz;
+	float sx, sy, sz;
+
+	WatertightRay() {}
+	WatertightRay(const Ray& r) : o(r.o)
+	{
+		glm::vec3 ad = glm::abs(r.d);
+		kz = ad.x > ad.y ? (ad.x > ad.z ? 0 : 2) : (ad.y > ad.z ? 1 : 2);
+		kx = (kz + 1) % 3;
+		ky = (kx + 1) % 3;
+		// Keep the winding of the triangles
+		if(r.d[kz] < 0.0f)
+			std::swap(kx, ky);
+		sx = r.d[kx] / r.d[kz];
+		sy = r.d[ky] / r.d[kz];
+		sz = 1.0f / r.d[kz];
+	}
+};
+
+inline bool intersectTriangle(const WatertightRay& wr, const glm::vec3& v0, const glm::vec3& v1,
+                              const glm::vec3& v2, float tnear, float tfar, float& t, float& u, float& v)
+{
+	const glm::vec3 a = v0 - wr.o;
+	const glm::vec3 b = v1 - wr.o;
+	const glm::vec3 c = v2 - wr.o;
+	const float ax = a[wr.kx] - wr.sx * a[wr.kz];
+	const float ay = a[wr.ky] - wr.sy * a[wr.kz];
+	const float bx = b[wr.kx] - wr.sx * b[wr.kz];
+	const float by = b[wr.ky] - wr.sy * b[wr.kz];
+	const float cx = c[wr.kx] - wr.sx * c[wr.kz];
+	const float cy = c[wr.ky] - wr.sy * c[wr.kz];
+
+	float U = cx * by - cy * bx;
+	float V = ax * cy - ay * cx;
+	float W = bx * ay - by * ax;
+	// On an edge (in float), decide it in double precision
+	if(U == 0.0f || V == 0.0f || W == 0.0f)
+	{
+		U = float(double(cx) * double(by) - double(cy) * double(bx));
+		V = float(double(ax) * double(cy) - double(ay) * double(cx));
+		W = float(double(bx) * double(ay) - double(by) * double(ax));
+	}
+	if((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f))
+		return false;
+	const float det = U + V + W;
+	if(det == 0.0f)
+		return false;
+
+	const float T = U * (wr.sz * a[wr.kz]) + V * (wr.sz * b[wr.kz]) + W * (wr.sz * c[wr.kz]);
+	const float rcp_det = 1.0f / det;
+	t = T * rcp_det;
+	if(!(t > tnear && t < tfar))
+		return false;
+	u = V * rcp_det;
+	v = W * rcp_det;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Slab tests scale their far distance by this, so that rounding can not
+// make a box that is touched by the ray look missed (Ize 2013).
+///////////////////////////////////////////////////////////////////////////
+static const float ROBUST_FAR_SCALE = 1.0f + 2.0f * (3.0f * FLT_EPSILON * 0.5f) / (1.0f - 3.0f * FLT_EPSILON * 0.5f);
+} // namespace pathtracer
@@ -1 +0,0 @@
-#include "ParticleSystem.h"
@@ -0,0 +1,210 @@
+#version 420
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+///////////////////////////////////////////////////////////////////////////////
+// The lighting pass of the deferred path: shading.frag's model, once per
+// pixel from the G-buffer (gbuffer.frag) rather than once per fragment
+// drawn, for the point light and the lights in LightUniforms. Pixels
+// without a surface are discarded, to leave the background.
+///////////////////////////////////////////////////////////////////////////////
+layout(binding = 0) uniform sampler2D albedoTexture;
+layout(binding = 1) uniform sampler2D normalTexture;
+layout(binding = 2) uniform sampler2D materialTexture;
+layout(binding = 3) uniform sampler2D emissionTexture;
+layout(binding = 4) uniform sampler2D depthTexture;
+///////////////////////////////////////////////////////////////////////////////
+// Environment
+///////////////////////////////////////////////////////////////////////////////
+layout(binding = 7) uniform sampler2D irradianceMap;
+layout(binding = 8) uniform sampler2D reflectionMap;
+///////////////////////////////////////////////////////////////////////////////
+// Camera, light source and environment, per frame
+///////////////////////////////////////////////////////////////////////////////
+layout(std140, binding = 0) uniform FrameUniforms
+{
+	mat4 viewInverse;
+	vec3 viewSpaceLightPosition;
+	float environment_multiplier;
+	vec3 point_light_color;
+	float point_light_intensity_multiplier;
+	vec3 viewSpaceLightDir;
+	int ambient_occlusion_enabled;
+};
+layout(binding = 11) uniform sampler2D ambientOcclusionMap;
+///////////////////////////////////////////////////////////////////////////////
+// Shadow maps (see shadowmaps.h)
+///////////////////////////////////////////////////////////////////////////////
+layout(std140, binding = 3) uniform ShadowUniforms
+{
+	mat4 cascadeMatrices[4];
+	vec4 cascadeSplits;
+	vec2 pointShadowDepth;
+	float shadowBias;
+	int shadowsEnabled;
+};
+layout(binding = 9) uniform samplerCubeShadow pointShadowMap;
+///////////////////////////////////////////////////////////////////////////////
+// More point lights, unshadowed, that reach no further than their radius
+///////////////////////////////////////////////////////////////////////////////
+#define MAX_LIGHTS 128
+layout(std140, binding = 4) uniform LightUniforms
+{
+	int numLights;
+	// xyz: view space position, w: radius
+	vec4 lightPositions[MAX_LIGHTS];
+	// rgb: color times intensity
+	vec4 lightColors[MAX_LIGHTS];
+};
+
+uniform mat4 inverseProjectionMatrix;
+
+#define PI 3.14159265359
+
+layout(location = 0) out vec4 fragmentColor;
+
+// The surface, from the G-buffer
+vec3 viewSpacePosition;
+vec3 material_color;
+float material_reflectivity;
+float material_metalness;
+float material_fresnel;
+float material_shininess;
+
+float getPointLightVisibility()
+{
+	if(shadowsEnabled == 0)
+		return 1.0;
+	vec3 fromLight = mat3(viewInverse) * (viewSpacePosition - viewSpaceLightPosition);
+	vec3 a = abs(fromLight);
+	float depth = pointShadowDepth.x - pointShadowDepth.y / max(a.x, max(a.y, a.z));
+	return texture(pointShadowMap, vec4(fromLight, depth - shadowBias));
+}
+// Without the color, the caller multiplies with the (textured) base color
+vec3 getDiffuseTerm(vec3 normal, vec3 wi, vec3 Li) {
+	return (1.0f/PI) *
+		abs(dot(normal,wi))*Li;
+}
+vec3 getWh(vec3 wo,vec3 wi) {
+	return  normalize(wi+wo);
+}
+float getFresnel(vec3 wi,vec3 wh){
+	return material_fresnel+(1-material_fresnel)
+		*pow(
+			(1.0f-dot(wh,wi)),5
+		);
+}
+float getMicrofacet(vec3 n, vec3 wh) {
+	return ((material_shininess+2)/(2*PI))
+		*pow(abs(dot(n,wh)),material_shininess);
+}
+float getShadowingMasking(vec3 n, vec3 wo, vec3 wi, vec3 wh) {
+	return min(1, min(
+		2*(dot(n,wh)*dot(n,wo)/dot(wo,wh)),
+		2*(dot(n,wh)*dot(n,wi)/dot(wo,wh))
+	));
+}
+float getbrdf(float fresnel, float microfacet_function, float masking_function, vec3 n, vec3 wo,vec3 wi) {
+	return fresnel * microfacet_function * masking_function / (4*dot(n,wo)*dot(n,wi));
+}
+// Light Li arriving from direction wi
+vec3 calculateDirectIllumination(vec3 wo, vec3 n, vec3 base_color, vec3 wi, vec3 Li)
+{
+	if(dot(n, wi) <= 0) {
+		return vec3(0);
+	}
+	vec3 diffuse_term = getDiffuseTerm(n,wi,Li) * base_color;
+	vec3 wh = getWh(wo,wi);
+	float fresnel = getFresnel(wi,wh);
+	float microfacet_function = getMicrofacet(n,wh);
+	float masking_function = getShadowingMasking(n,wo,wi,wh);
+	float brdf = getbrdf(fresnel, microfacet_function,masking_function, n,wo,wi);
+	vec3 dialetic_term = brdf * dot(n, wi)*Li+(1-fresnel)*diffuse_term;
+	vec3 metal_term = brdf * base_color * dot(n, wi)*Li;
+	vec3 microfacet_term = material_metalness*metal_term+(1-material_metalness)*dialetic_term;
+	return material_reflectivity*microfacet_term+(1-material_reflectivity)*diffuse_term;
+}
+vec2 getSphericalCoords(vec3 dir){
+	float theta = acos(max(-1.0f, min(1.0f, dir.y)));
+	float phi = atan(dir.z, dir.x);
+	if(phi < 0.0f)
+	{
+		phi = phi + 2.0f * PI;
+	}
+	// Use these to lookup the color in the environment map
+	return vec2(phi / (2.0 * PI), theta / PI);
+}
+vec3 calculateIndirectIllumination(vec3 wo, vec3 n, vec3 base_color)
+{
+	vec3 indirect_illum = base_color;
+	vec3 nws = mat3(viewInverse )*n;// nws.xyz
+	// Calculate the world-space position of this fragment on the near plane
+	vec3 dir = normalize(nws.xyz);
+	// Use these to lookup the color in the environment map
+	vec2 lookup = getSphericalCoords(dir);
+	vec4 irraduance = environment_multiplier * texture(irradianceMap, lookup);
+	vec3 diffuse_term = base_color * (1.0f/PI) * irraduance.xyz ;
+	vec3 wit = mat3(viewInverse) * wo;
+	vec3 wi = normalize(reflect(-wo,n));
+	// Use these to lookup the color in the environment map
+	vec2 lookup2 = getSphericalCoords( normalize(mat3(viewInverse) * wi));
+	vec3 wh = normalize(wi+wo);
+	float roughness = sqrt(sqrt(2.0f/(material_shininess+2)));
+	vec3 Li = environment_multiplier * textureLod(reflectionMap, lookup2, roughness * 7.0f).xyz;
+	float fresnel = material_fresnel+(1-material_fresnel)
+		*pow(
+			(1.0f-dot(wh,wi)),5
+		);
+	vec3 dialetic_term = fresnel*Li+(1-fresnel)*diffuse_term;
+	vec3 metal_term = fresnel*base_color*Li;
+	vec3 microfacet_term = material_metalness*metal_term+(1-material_metalness)*dialetic_term;
+	return material_reflectivity*microfacet_term+(1-material_reflectivity)*diffuse_term;
+}
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec4 emission = texelFetch(emissionTexture, pixel, 0);
+	if(emission.a == 0.0)
+		discard;
+	float depth = texelFetch(depthTexture, pixel, 0).r;
+	vec2 ndc = (vec2(pixel) + 0.5) / vec2(textureSize(depthTexture, 0)) * 2.0 - 1.0;
+	vec4 position = inverseProjectionMatrix * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+	viewSpacePosition = position.xyz / position.w;
+	vec4 albedo = texelFetch(albedoTexture, pixel, 0);
+	vec4 normalShininess = texelFetch(normalTexture, pixel, 0);
+	vec4 material = texelFetch(materialTexture, pixel, 0);
+	material_color = albedo.rgb;
+	material_reflectivity = albedo.a;
+	material_shininess = normalShininess.w;
+	material_metalness = material.r;
+	material_fresnel = material.g;
+
+	vec3 wo = -normalize(viewSpacePosition);
+	vec3 n = normalize(normalShininess.xyz);
+	vec3 base_color = material_color;
+
+	// The point light, shadowed as in shading.frag
+	vec3 toLight = viewSpaceLightPosition - viewSpacePosition;
+	vec3 Li = point_light_intensity_multiplier * point_light_color / dot(toLight, toLight)
+	          * getPointLightVisibility();
+	vec3 direct_illumination_term = calculateDirectIllumination(wo, n, base_color, normalize(toLight), Li);
+
+	// The others, faded out smoothly to nothing at their radius
+	for(int i = 0; i < numLights; i++)
+	{
+		toLight = lightPositions[i].xyz - viewSpacePosition;
+		float distance2 = dot(toLight, toLight);
+		float radius = lightPositions[i].w;
+		if(distance2 >= radius * radius)
+			continue;
+		float window = 1.0 - distance2 * distance2 / (radius * radius * radius * radius);
+		Li = lightColors[i].rgb * (window * window / max(distance2, 1e-4));
+		direct_illumination_term += calculateDirectIllumination(wo, n, base_color, normalize(toLight), Li);
+	}
+
+	vec3 indirect_illumination_term = calculateIndirectIllumination(wo, n, base_color);
+	if(ambient_occlusion_enabled != 0)
+	{
+		indirect_illumination_term *= texelFetch(ambientOcclusionMap, pixel, 0).r;
+	}
+	fragmentColor = vec4(direct_illumination_term + indirect_illumination_term + emission.rgb, 1.0);
+}
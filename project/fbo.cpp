@@ -83,6 +83,34 @@ void FboInfo::resize(int w, int h)
 	}
 }
 
+void FboInfo::attachDepthLayer(GLenum target, GLuint texture, int layer, int w, int h)
+{
+	width = w;
+	height = h;
+	if(framebufferId == UINT32_MAX)
+	{
+		glGenFramebuffers(1, &framebufferId);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebufferId);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, framebufferId);
+	if(target == GL_TEXTURE_CUBE_MAP)
+	{
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + layer,
+		                       texture, 0);
+	}
+	else
+	{
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, layer);
+	}
+	if(!isComplete)
+	{
+		isComplete = checkFramebufferComplete();
+		glBindFramebuffer(GL_FRAMEBUFFER, framebufferId);
+	}
+}
+
 bool FboInfo::checkFramebufferComplete(void)
 {
 	// Check that our FBO is correctly set up, this can fail if we have
@@ -1,3 +1,4 @@
+#pragma once
 #include <GL/glew.h>
 #include <vector>
 
@@ -13,5 +14,8 @@ public:
 	FboInfo(int numberOfColorBuffers = 1);
 		
 	void resize(int w, int h);
+	// Render to one layer (or cube face) of a depth texture made elsewhere,
+	// a shadow map, with no color buffers. Leaves the framebuffer bound.
+	void attachDepthLayer(GLenum target, GLuint texture, int layer, int w, int h);
 	bool checkFramebufferComplete(void);
 };
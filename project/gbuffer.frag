@@ -0,0 +1,56 @@
+#version 420
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+///////////////////////////////////////////////////////////////////////////////
+// The G-buffer of the deferred path (with shading.vert): the material and
+// normal of the nearest surface, for deferred_lighting.frag to shade.
+///////////////////////////////////////////////////////////////////////////////
+layout(std140, binding = 2) uniform MaterialUniforms
+{
+	vec3 material_color;
+	float material_reflectivity;
+	float material_metalness;
+	float material_fresnel;
+	float material_shininess;
+	float material_emission;
+	int has_color_texture;
+	int has_reflectivity_texture;
+	int has_metalness_texture;
+	int has_fresnel_texture;
+	int has_shininess_texture;
+	int has_emission_texture;
+	int has_bump_texture;
+};
+layout(binding = 0) uniform sampler2D colorMap;
+layout(binding = 5) uniform sampler2D emissiveMap;
+
+in vec2 texCoord;
+in vec3 viewSpaceNormal;
+in vec3 viewSpacePosition;
+
+// rgb: base color, a: reflectivity
+layout(location = 0) out vec4 albedo;
+// xyz: view space normal, w: shininess
+layout(location = 1) out vec4 normalShininess;
+// r: metalness, g: fresnel
+layout(location = 2) out vec4 material;
+// rgb: emitted light, a: 1 where there is a surface
+layout(location = 3) out vec4 emission;
+
+void main()
+{
+	vec3 base_color = material_color;
+	if(has_color_texture == 1)
+	{
+		base_color *= texture(colorMap, texCoord).xyz;
+	}
+	vec3 emission_term = material_emission * material_color;
+	if(has_emission_texture == 1)
+	{
+		emission_term *= texture(emissiveMap, texCoord).xyz;
+	}
+	albedo = vec4(base_color, material_reflectivity);
+	normalShininess = vec4(normalize(viewSpaceNormal), material_shininess);
+	material = vec4(material_metalness, material_fresnel, 0.0, 0.0);
+	emission = vec4(emission_term, 1.0);
+}
@@ -0,0 +1,29 @@
+#version 420 compatibility
+// The GPU particles (gpuparticles.h) as point sprites for particle.frag,
+// straight from their state buffer
+layout(location = 0) in vec4 position;
+layout(location = 1) in vec4 velocity;
+uniform mat4 P;
+uniform mat4 V;
+uniform float screen_x;
+uniform float screen_y;
+out float life;
+void main()
+{
+	// Dead (or never born) particles are put outside the clip volume
+	if(position.w >= velocity.w)
+	{
+		life = 1.0;
+		gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+		gl_PointSize = 0.0;
+		return;
+	}
+	life = position.w / velocity.w;
+	vec4 particle_vs = V * vec4(position.xyz, 1.0);
+	// Sized as in particle.vert
+	vec4 proj_quad = P * vec4(1.0, 1.0, particle_vs.z, particle_vs.w);
+	vec2 proj_pixel = vec2(screen_x, screen_y) * proj_quad.xy / proj_quad.w;
+	float scale_factor = (proj_pixel.x + proj_pixel.y);
+	gl_Position = P * particle_vs;
+	gl_PointSize = scale_factor * mix(0.0, 5.0, pow(life, 1.0 / 4.0));
+}
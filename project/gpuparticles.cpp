@@ -0,0 +1,97 @@
+#include "gpuparticles.h"
+#include <labhelper.h>
+#include <algorithm>
+#include <vector>
+
+using namespace glm;
+
+GpuParticleSystem::GpuParticleSystem()
+    : m_maxParticles(1000000)
+    , m_emitterPosition(0.0f)
+    , m_speed(10.0f)
+    , m_lifeLength(5.0f)
+    , m_gravity(0.0f)
+    , m_particlesPerSecond(100000.0f)
+    , m_updateProgram(0)
+    , m_current(0)
+    , m_emitStart(0)
+    , m_emitDebt(0.0f)
+    , m_frame(0)
+{
+}
+
+void GpuParticleSystem::init()
+{
+	// Age and life length 0 is dead
+	std::vector<vec4> dead(2 * size_t(m_maxParticles), vec4(0.0f));
+	glGenBuffers(2, m_stateBuffers);
+	glGenVertexArrays(2, m_vaos);
+	for(int i = 0; i < 2; i++)
+	{
+		glBindVertexArray(m_vaos[i]);
+		glBindBuffer(GL_ARRAY_BUFFER, m_stateBuffers[i]);
+		glBufferData(GL_ARRAY_BUFFER, dead.size() * sizeof(vec4), dead.data(), GL_DYNAMIC_COPY);
+		glVertexAttribPointer(0, 4, GL_FLOAT, false, 2 * sizeof(vec4), 0);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 4, GL_FLOAT, false, 2 * sizeof(vec4), (const void*)sizeof(vec4));
+		glEnableVertexAttribArray(1);
+	}
+	glBindVertexArray(0);
+	m_current = 0;
+	m_emitStart = 0;
+	m_emitDebt = 0.0f;
+}
+
+void GpuParticleSystem::loadShaders(bool is_reload)
+{
+	GLuint shader = labhelper::loadShaderProgram("../project/particle_update.vert",
+	                                             "../project/particle_update.frag", is_reload);
+	if(shader == 0)
+		return;
+	// The outputs to capture are only known at link time, so link again
+	const char* varyings[] = { "out_position", "out_velocity" };
+	glTransformFeedbackVaryings(shader, 2, varyings, GL_INTERLEAVED_ATTRIBS);
+	if(!labhelper::linkShaderProgram(shader, is_reload))
+		return;
+	m_updateProgram = shader;
+}
+
+void GpuParticleSystem::update(float deltaTime)
+{
+	m_emitDebt += m_particlesPerSecond * deltaTime;
+	const int emitCount = std::min(int(m_emitDebt), m_maxParticles);
+	m_emitDebt -= float(int(m_emitDebt));
+
+	glUseProgram(m_updateProgram);
+	labhelper::setUniform(m_updateProgram, "deltaTime", deltaTime);
+	labhelper::setUniform(m_updateProgram, "gravity", m_gravity);
+	labhelper::setUniform(m_updateProgram, "maxParticles", GLint(m_maxParticles));
+	labhelper::setUniform(m_updateProgram, "emitStart", GLint(m_emitStart));
+	labhelper::setUniform(m_updateProgram, "emitCount", GLint(emitCount));
+	labhelper::setUniform(m_updateProgram, "frame", GLint(m_frame));
+	labhelper::setUniform(m_updateProgram, "emitterPosition", m_emitterPosition);
+	labhelper::setUniform(m_updateProgram, "speed", m_speed);
+	labhelper::setUniform(m_updateProgram, "lifeLength", m_lifeLength);
+
+	const int next = 1 - m_current;
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBindVertexArray(m_vaos[m_current]);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_stateBuffers[next]);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArrays(GL_POINTS, 0, m_maxParticles);
+	glEndTransformFeedback();
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glBindVertexArray(0);
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	m_current = next;
+	m_emitStart = (m_emitStart + emitCount) % m_maxParticles;
+	m_frame++;
+}
+
+void GpuParticleSystem::submitPoints()
+{
+	glBindVertexArray(m_vaos[m_current]);
+	glDrawArrays(GL_POINTS, 0, m_maxParticles);
+	glBindVertexArray(0);
+}
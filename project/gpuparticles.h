@@ -0,0 +1,54 @@
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+///////////////////////////////////////////////////////////////////////////////
+// Particles that live on the GPU only. The state of every particle (position
+// and age, velocity and life length) is in a buffer that a transform
+// feedback pass (particle_update.vert) reads and writes the next state of
+// into the other buffer, after which the two swap. Particles are born into
+// the slots after the last ones born, like a ring buffer, with random
+// directions from a hash of their slot and the frame, so all the CPU does
+// per frame is set a few uniforms, whatever the number of particles.
+//
+// Drawing is one point sprite per slot straight from the current buffer,
+// with the two state vectors as attributes 0 and 1 (dead particles are for
+// the vertex shader to throw away).
+///////////////////////////////////////////////////////////////////////////////
+class GpuParticleSystem {
+public:
+	// Slots, set before init()
+	int m_maxParticles;
+	glm::vec3 m_emitterPosition;
+	float m_speed;
+	float m_lifeLength;
+	glm::vec3 m_gravity;
+	// At most m_maxParticles / m_lifeLength, or particles are reborn
+	// before they die
+	float m_particlesPerSecond;
+
+	GpuParticleSystem(void);
+
+	// Allocate the state buffers, all particles dead
+	void init();
+
+	// The update program, with its transform feedback outputs
+	void loadShaders(bool is_reload);
+
+	// Age, move and emit the particles
+	void update(float deltaTime);
+
+	// Draw the particles as points, with a program that is in use
+	void submitPoints();
+
+private:
+	GLuint m_updateProgram;
+	GLuint m_stateBuffers[2];
+	GLuint m_vaos[2];
+	// The buffer with the current state
+	int m_current;
+	// Slot of the next particle born
+	int m_emitStart;
+	// Particles due but not born yet (the fraction of the last frame)
+	float m_emitDebt;
+	int m_frame;
+};
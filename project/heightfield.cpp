@@ -4,8 +4,12 @@
 #include <iostream>
 #include <stdint.h>
 #include <vector>
+#include <algorithm>
+#include <cfloat>
 #include <glm/glm.hpp>
 #include <stb_image.h>
+#include <labhelper.h>
+#include <Frustum.h>
 
 using namespace glm;
 using std::string;
@@ -14,13 +18,18 @@ HeightField::HeightField(void)
     : m_meshResolution(0)
     , m_vao(UINT32_MAX)
     , m_positionBuffer(UINT32_MAX)
-    , m_uvBuffer(UINT32_MAX)
+    , m_instanceBuffer(UINT32_MAX)
     , m_indexBuffer(UINT32_MAX)
     , m_numIndices(0)
     , m_texid_hf(UINT32_MAX)
     , m_texid_diffuse(UINT32_MAX)
     , m_heightFieldPath("")
     , m_diffuseTexturePath("")
+    , m_lodCount(8)
+    , m_lodDistance(6.0f)
+    , m_numPatches(0)
+    , m_width(0)
+    , m_height(0)
 {
 }
 
@@ -48,6 +57,13 @@ void HeightField::loadHeightField(const std::string& heigtFieldPath)
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT,
 	             data); // just one component (float)
 
+	// The node bounds for culling and LOD selection need the heights
+	m_heights.assign(data, data + size_t(width) * height);
+	m_width = width;
+	m_height = height;
+	stbi_image_free(data);
+	buildNodeHeights();
+
 	m_heightFieldPath = heigtFieldPath;
 	std::cout << "Successfully loaded heigh field texture: " << heigtFieldPath << ".\n";
 }
@@ -81,18 +97,259 @@ void HeightField::loadDiffuseTexture(const std::string& diffusePath)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+// The min and max height under every node, from the texels its bilinear
+// lookups can reach, a level at a time from the finest nodes up
+///////////////////////////////////////////////////////////////////////////////
+void HeightField::buildNodeHeights()
+{
+	m_nodeHeights.assign(m_lodCount, std::vector<vec2>());
+	const int leaves = 1 << (m_lodCount - 1);
+	std::vector<vec2>& finest = m_nodeHeights[0];
+	finest.resize(size_t(leaves) * leaves);
+	for(int z = 0; z < leaves; z++)
+	{
+		// Texel centers are at (i + 0.5) / size
+		const int v0 = max(int(floor(float(z) / leaves * m_height - 0.5f)), 0);
+		const int v1 = min(int(ceil(float(z + 1) / leaves * m_height - 0.5f)), m_height - 1);
+		for(int x = 0; x < leaves; x++)
+		{
+			const int u0 = max(int(floor(float(x) / leaves * m_width - 0.5f)), 0);
+			const int u1 = min(int(ceil(float(x + 1) / leaves * m_width - 0.5f)), m_width - 1);
+			vec2 range(FLT_MAX, -FLT_MAX);
+			for(int v = v0; v <= v1; v++)
+			{
+				for(int u = u0; u <= u1; u++)
+				{
+					const float h = m_heights[size_t(v) * m_width + u];
+					range = vec2(min(range.x, h), max(range.y, h));
+				}
+			}
+			finest[size_t(z) * leaves + x] = range;
+		}
+	}
+
+	for(int level = 1; level < m_lodCount; level++)
+	{
+		const int nodes = leaves >> level;
+		const std::vector<vec2>& below = m_nodeHeights[level - 1];
+		std::vector<vec2>& heights = m_nodeHeights[level];
+		heights.resize(size_t(nodes) * nodes);
+		for(int z = 0; z < nodes; z++)
+		{
+			for(int x = 0; x < nodes; x++)
+			{
+				vec2 range(FLT_MAX, -FLT_MAX);
+				for(int c = 0; c < 4; c++)
+				{
+					const vec2 child = below[size_t(2 * z + (c >> 1)) * (2 * nodes) + 2 * x + (c & 1)];
+					range = vec2(min(range.x, child.x), max(range.y, child.y));
+				}
+				heights[size_t(z) * nodes + x] = range;
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A patch of tesselation x tesselation quads in 0 to 1, the vertices are
+// just grid coordinates (0 to tesselation) that the vertex shader places
+// and displaces. The index buffer lists the patch a quadrant at a time.
+///////////////////////////////////////////////////////////////////////////////
 void HeightField::generateMesh(int tesselation)
 {
-	// generate a mesh in range -1 to 1 in x and z
-	// (y is 0 but will be altered in height field vertex shader)
+	// Morphing moves odd vertices onto even ones, so the resolution is even
+	m_meshResolution = max(tesselation + (tesselation & 1), 2);
+	const int n = m_meshResolution;
+
+	std::vector<vec2> positions;
+	positions.reserve(size_t(n + 1) * (n + 1));
+	for(int z = 0; z <= n; z++)
+	{
+		for(int x = 0; x <= n; x++)
+		{
+			positions.push_back(vec2(float(x), float(z)));
+		}
+	}
+
+	std::vector<uint32_t> indices;
+	indices.reserve(size_t(n) * n * 6);
+	const int half = n / 2;
+	for(int quadrant = 0; quadrant < 4; quadrant++)
+	{
+		const int x0 = (quadrant & 1) * half, z0 = (quadrant >> 1) * half;
+		for(int z = z0; z < z0 + half; z++)
+		{
+			for(int x = x0; x < x0 + half; x++)
+			{
+				// Counterclockwise seen from above
+				const uint32_t p00 = uint32_t(z * (n + 1) + x), p10 = p00 + 1;
+				const uint32_t p01 = p00 + uint32_t(n + 1), p11 = p01 + 1;
+				indices.push_back(p00);
+				indices.push_back(p01);
+				indices.push_back(p10);
+				indices.push_back(p10);
+				indices.push_back(p01);
+				indices.push_back(p11);
+			}
+		}
+	}
+	m_numIndices = GLuint(indices.size());
+
+	if(m_vao == UINT32_MAX)
+	{
+		glGenVertexArrays(1, &m_vao);
+		glGenBuffers(1, &m_positionBuffer);
+		glGenBuffers(1, &m_instanceBuffer);
+		glGenBuffers(1, &m_indexBuffer);
+	}
+	glBindVertexArray(m_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, m_positionBuffer);
+	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(vec2), positions.data(), GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 2, GL_FLOAT, false, 0, 0);
+	glEnableVertexAttribArray(0);
+	// One node per instance, the pointer is set for each draw
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+	glVertexAttribPointer(3, 4, GL_FLOAT, false, 0, 0);
+	glVertexAttribDivisor(3, 1);
+	glEnableVertexAttribArray(3);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+	glBindVertexArray(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// World space bounds of a node
+///////////////////////////////////////////////////////////////////////////////
+void HeightField::nodeBounds(int level, int x, int z, const mat4& modelMatrix, vec3& bmin, vec3& bmax) const
+{
+	const float size = nodeSize(level);
+	const int nodes = 1 << (m_lodCount - 1 - level);
+	const vec2 heights = m_nodeHeights[level][size_t(z) * nodes + x];
+	const vec3 lo(-1.0f + x * size, heights.x, -1.0f + z * size);
+	const vec3 hi(lo.x + size, heights.y, lo.z + size);
+	bmin = vec3(FLT_MAX);
+	bmax = vec3(-FLT_MAX);
+	for(int corner = 0; corner < 8; corner++)
+	{
+		const vec3 p((corner & 1) ? hi.x : lo.x, (corner & 2) ? hi.y : lo.y, (corner & 4) ? hi.z : lo.z);
+		const vec3 w = vec3(modelMatrix * vec4(p, 1.0f));
+		bmin = min(bmin, w);
+		bmax = max(bmax, w);
+	}
+}
+
+static bool withinRange(const vec3& bmin, const vec3& bmax, const vec3& cameraPosition, float range)
+{
+	return length(clamp(cameraPosition, bmin, bmax) - cameraPosition) <= range;
 }
 
-void HeightField::submitTriangles(void)
+///////////////////////////////////////////////////////////////////////////////
+// Returns false if the node is beyond its level's range, then its parent
+// covers its area instead
+///////////////////////////////////////////////////////////////////////////////
+bool HeightField::selectNode(int level, int x, int z, const mat4& modelMatrix, const labhelper::Frustum& frustum,
+                             const vec3& cameraPosition)
+{
+	vec3 bmin, bmax;
+	nodeBounds(level, x, z, modelMatrix, bmin, bmax);
+	if(!withinRange(bmin, bmax, cameraPosition, m_lodRanges[level]))
+		return false;
+	if(frustum.testAABB(bmin, bmax) == labhelper::Frustum::OUTSIDE)
+		return true;
+
+	const vec4 node(-1.0f + x * nodeSize(level), -1.0f + z * nodeSize(level), nodeSize(level), float(level));
+	if(level == 0 || !withinRange(bmin, bmax, cameraPosition, m_lodRanges[level - 1]))
+	{
+		m_patches[WHOLE_NODE].push_back(node);
+		return true;
+	}
+	for(int quadrant = 0; quadrant < 4; quadrant++)
+	{
+		const int cx = 2 * x + (quadrant & 1), cz = 2 * z + (quadrant >> 1);
+		if(!selectNode(level - 1, cx, cz, modelMatrix, frustum, cameraPosition))
+			m_patches[quadrant].push_back(node);
+	}
+	return true;
+}
+
+void HeightField::selectPatches(const mat4& modelMatrix, const mat4& viewProjectionMatrix,
+                                const vec3& cameraPosition)
+{
+	for(auto& patches : m_patches)
+		patches.clear();
+	m_numPatches = 0;
+	if(m_nodeHeights.empty())
+		return;
+
+	///////////////////////////////////////////////////////////////////////////
+	// Ranges double per level, and each level morphs into the next over the
+	// last 30% of its range. The coarsest level has nothing to morph into
+	// and goes on forever.
+	///////////////////////////////////////////////////////////////////////////
+	const float scale = max(length(vec3(modelMatrix[0])), length(vec3(modelMatrix[2])));
+	m_lodRanges.resize(m_lodCount);
+	m_morphRanges.resize(m_lodCount);
+	float previous = 0.0f;
+	for(int level = 0; level < m_lodCount; level++)
+	{
+		m_lodRanges[level] = m_lodDistance * nodeSize(0) * scale * float(1 << level);
+		m_morphRanges[level] = vec2(mix(previous, m_lodRanges[level], 0.7f), m_lodRanges[level]);
+		previous = m_lodRanges[level];
+	}
+	m_lodRanges.back() = FLT_MAX;
+	m_morphRanges.back() = vec2(0.5f * FLT_MAX, FLT_MAX);
+
+	// The node bounds are in world space
+	const labhelper::Frustum frustum(viewProjectionMatrix);
+	selectNode(m_lodCount - 1, 0, 0, modelMatrix, frustum, cameraPosition);
+	for(auto& patches : m_patches)
+		m_numPatches += int(patches.size());
+}
+
+void HeightField::submitTriangles(GLuint shaderProgram)
 {
 	if(m_vao == UINT32_MAX)
 	{
 		std::cout << "No vertex array is generated, cannot draw anything.\n";
 		return;
 	}
+	if(m_numPatches == 0)
+		return;
 
-}
\ No newline at end of file
+	labhelper::setUniform(shaderProgram, "patchResolution", float(m_meshResolution));
+	glUniform2fv(labhelper::getUniformLocation(shaderProgram, "morphRanges"), GLsizei(m_morphRanges.size()),
+	             &m_morphRanges[0].x);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, m_texid_hf);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, m_texid_diffuse == UINT32_MAX ? 0 : m_texid_diffuse);
+	labhelper::setUniform(shaderProgram, "has_diffuse_texture", GLint(m_texid_diffuse == UINT32_MAX ? 0 : 1));
+
+	///////////////////////////////////////////////////////////////////////////
+	// All patches go in one instance buffer, and each kind is one instanced
+	// draw of its range of the index buffer
+	///////////////////////////////////////////////////////////////////////////
+	std::vector<vec4> instances;
+	instances.reserve(m_numPatches);
+	for(auto& patches : m_patches)
+		instances.insert(instances.end(), patches.begin(), patches.end());
+	glBindVertexArray(m_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(vec4), instances.data(), GL_STREAM_DRAW);
+
+	size_t first = 0;
+	for(int kind = 0; kind < PATCH_KINDS; kind++)
+	{
+		const size_t count = m_patches[kind].size();
+		if(count == 0)
+			continue;
+		glVertexAttribPointer(3, 4, GL_FLOAT, false, 0, (const void*)(first * sizeof(vec4)));
+		const GLuint quadrant_indices = m_numIndices / 4;
+		const GLuint offset = kind == WHOLE_NODE ? 0 : kind * quadrant_indices;
+		glDrawElementsInstanced(GL_TRIANGLES, kind == WHOLE_NODE ? m_numIndices : quadrant_indices,
+		                        GL_UNSIGNED_INT, (const void*)(offset * sizeof(uint32_t)), GLsizei(count));
+		first += count;
+	}
+	glBindVertexArray(0);
+}
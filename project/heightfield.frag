@@ -4,17 +4,47 @@
 precision highp float;
 
 uniform vec3 material_color;
+uniform int has_diffuse_texture;
+layout(binding = 0) uniform sampler2D diffuseMap;
+uniform vec3 viewSpaceLightDir;
+///////////////////////////////////////////////////////////////////////////////
+// Shadow maps (see shadowmaps.h)
+///////////////////////////////////////////////////////////////////////////////
+layout(std140, binding = 3) uniform ShadowUniforms
+{
+	mat4 cascadeMatrices[4];
+	vec4 cascadeSplits;
+	vec2 pointShadowDepth;
+	float shadowBias;
+	int shadowsEnabled;
+};
+layout(binding = 10) uniform sampler2DArrayShadow cascadeShadowMap;
 
 
 in vec2 texCoord;
+in vec3 viewSpacePosition;
+in vec3 viewSpaceNormal;
 layout(location = 0) out vec4 fragmentColor;
 
-// This simple fragment shader is meant to be used for debug purposes
-// When the geometry is ok, we will migrate to use shading.frag instead.
+// How much of the directional light reaches this fragment, from the
+// cascade that covers its distance (lit beyond the last one)
+float getDirectionalLightVisibility()
+{
+	float depth = -viewSpacePosition.z;
+	if(shadowsEnabled == 0 || depth >= cascadeSplits.w)
+		return 1.0;
+	int cascade = depth < cascadeSplits.x ? 0 : depth < cascadeSplits.y ? 1 : depth < cascadeSplits.z ? 2 : 3;
+	vec4 shadowCoord = cascadeMatrices[cascade] * vec4(viewSpacePosition, 1.0);
+	return texture(cascadeShadowMap, vec4(shadowCoord.xy, float(cascade), shadowCoord.z - shadowBias));
+}
+
+// The terrain is lit by the directional light only, with some ambient so
+// that the slopes facing away from it still show their shape.
 
 void main()
 {
-	//fragmentColor = vec4(texCoord.x, texCoord.y, 0.0, 1.0);
-	//fragmentColor = vec4(1, 1, 1, 1);
-	fragmentColor = vec4(material_color, 1.0);
+	vec3 color = has_diffuse_texture == 1 ? texture(diffuseMap, texCoord).rgb : material_color;
+	vec3 n = normalize(viewSpaceNormal);
+	float diffuse = max(dot(n, -normalize(viewSpaceLightDir)), 0.0) * getDirectionalLightVisibility();
+	fragmentColor = vec4(color * (0.3 + 0.7 * diffuse), 1.0);
 }
@@ -1,19 +1,50 @@
 #include <string>
+#include <vector>
 #include <GL/glew.h>
+#include <glm/glm.hpp>
 
+namespace labhelper
+{
+struct Frustum;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A terrain in -1 to 1 in x and z, with the heights (0 to 1) of the height
+// field texture, drawn with continuous distance-dependent LOD (CDLOD,
+// Strugar 2009).
+//
+// One grid patch is generated and drawn instanced, once per selected node
+// of a quadtree over the terrain: nodes far from the camera are large and
+// nodes close to it small, so every patch covers about the same part of
+// the screen. heightfield.vert displaces the patch vertices with the height
+// field, and morphs the odd vertices of a patch onto the even ones as it
+// approaches the distance where the next coarser level takes over, so
+// levels meet without cracks or popping.
+///////////////////////////////////////////////////////////////////////////////
 class HeightField {
 public:
-	int m_meshResolution; // triangles edges per quad side
+	int m_meshResolution; // triangles edges per patch side
 	GLuint m_texid_hf;
 	GLuint m_texid_diffuse;
 	GLuint m_vao;
 	GLuint m_positionBuffer;
-	GLuint m_uvBuffer;
+	GLuint m_instanceBuffer;
 	GLuint m_indexBuffer;
 	GLuint m_numIndices;
 	std::string m_heightFieldPath;
 	std::string m_diffuseTexturePath;
 
+	// Quadtree levels (at most 16), the finest nodes are
+	// 2 / 2^(m_lodCount - 1) wide. Set before loadHeightField().
+	int m_lodCount;
+	// The finest level is drawn up to this many of its node sizes from the
+	// camera, and every coarser level twice as far as the one before. Below
+	// about 4 a node can reach past where its coarser neighbour starts to
+	// morph, and cracks open between them.
+	float m_lodDistance;
+	// Patches selected by the last selectPatches()
+	int m_numPatches;
+
 	HeightField(void);
 
 	// load height field
@@ -25,7 +56,41 @@ public:
 	// generate mesh
 	void generateMesh(int tesselation);
 
-	// render height map
-	void submitTriangles(void);
+	// Walk the quadtree for this frame: nodes outside the view frustum are
+	// dropped, and nodes are split while the camera is within the range of
+	// the next finer level
+	void selectPatches(const glm::mat4& modelMatrix, const glm::mat4& viewProjectionMatrix,
+	                   const glm::vec3& cameraPosition);
+
+	// render height map (the selected patches, with shaderProgram which
+	// must be in use)
+	void submitTriangles(GLuint shaderProgram);
+
+private:
+	// Patches are either whole nodes or one quadrant of a node (where the
+	// node's other quadrants are drawn by its finer children). The index
+	// buffer holds the quadrants one after the other, so both are a range of
+	// it.
+	enum { WHOLE_NODE = 4, PATCH_KINDS = 5 };
+
+	std::vector<float> m_heights;
+	int m_width, m_height;
+	// Min and max height of every node, per level (0 is the finest)
+	std::vector<std::vector<glm::vec2>> m_nodeHeights;
+	// Per level, the distance where it ends and its morph range
+	std::vector<float> m_lodRanges;
+	std::vector<glm::vec2> m_morphRanges;
+	// Instance data of the selected patches: xz corner, size and level of
+	// the node
+	std::vector<glm::vec4> m_patches[PATCH_KINDS];
 
+	void buildNodeHeights();
+	bool selectNode(int level, int x, int z, const glm::mat4& modelMatrix, const labhelper::Frustum& frustum,
+	                const glm::vec3& cameraPosition);
+	void nodeBounds(int level, int x, int z, const glm::mat4& modelMatrix, glm::vec3& bmin,
+	                glm::vec3& bmax) const;
+	float nodeSize(int level) const
+	{
+		return 2.0f / float(1 << (m_lodCount - 1 - level));
+	}
 };
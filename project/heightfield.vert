@@ -2,8 +2,10 @@
 ///////////////////////////////////////////////////////////////////////////////
 // Input vertex attributes
 ///////////////////////////////////////////////////////////////////////////////
-layout(location = 0) in vec3 position;
-layout(location = 2) in vec2 texCoordIn;
+// Grid coordinates in the patch, 0 to patchResolution
+layout(location = 0) in vec2 gridPosition;
+// Per instance: xz corner, size and level of the node the patch covers
+layout(location = 3) in vec4 node;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Input uniform variables
@@ -13,6 +15,12 @@ uniform mat4 normalMatrix;
 uniform mat4 modelViewMatrix;
 uniform mat4 modelViewProjectionMatrix;
 
+uniform float patchResolution;
+// Per level, the view distances where its morph into the next level starts
+// and ends
+uniform vec2 morphRanges[16];
+layout(binding = 1) uniform sampler2D heightField;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Output to fragment shader
 ///////////////////////////////////////////////////////////////////////////////
@@ -20,8 +28,33 @@ out vec2 texCoord;
 out vec3 viewSpacePosition;
 out vec3 viewSpaceNormal;
 
+// The terrain is -1 to 1 in x and z
+float heightAt(vec2 xz)
+{
+	return textureLod(heightField, xz * 0.5 + 0.5, 0.0).r;
+}
+
 void main()
 {
+	// Odd grid vertices slide onto their even neighbours as the distance to
+	// the camera goes through the morph range, until the patch has the
+	// vertices of the next coarser level
+	vec2 xz = node.xy + gridPosition / patchResolution * node.z;
+	vec2 morphRange = morphRanges[int(node.w)];
+	float distance = length((modelViewMatrix * vec4(xz.x, heightAt(xz), xz.y, 1.0)).xyz);
+	float morph = clamp((distance - morphRange.x) / (morphRange.y - morphRange.x), 0.0, 1.0);
+	vec2 morphed = gridPosition - fract(gridPosition * 0.5) * 2.0 * morph;
+	xz = node.xy + morphed / patchResolution * node.z;
+	vec3 position = vec3(xz.x, heightAt(xz), xz.y);
+
+	// Normal from central differences of the heights, a texel apart
+	vec2 step = 2.0 / vec2(textureSize(heightField, 0));
+	float dhdx = (heightAt(xz + vec2(step.x, 0.0)) - heightAt(xz - vec2(step.x, 0.0))) / (2.0 * step.x);
+	float dhdz = (heightAt(xz + vec2(0.0, step.y)) - heightAt(xz - vec2(0.0, step.y))) / (2.0 * step.y);
+	vec3 normal = normalize(vec3(-dhdx, 1.0, -dhdz));
+
 	gl_Position = modelViewProjectionMatrix * vec4(position, 1.0);
-	texCoord = texCoordIn;
+	texCoord = xz * 0.5 + 0.5;
+	viewSpacePosition = (modelViewMatrix * vec4(position, 1.0)).xyz;
+	viewSpaceNormal = (normalMatrix * vec4(normal, 0.0)).xyz;
 }
@@ -7,6 +7,7 @@ extern "C" _declspec(dllexport) unsigned int NvOptimusEnablement = 0x00000001;
 #include <GL/glew.h>
 #include <cmath>
 #include <cstdlib>
+#include <cstddef>
 #include <algorithm>
 #include <chrono>
 
@@ -19,8 +20,17 @@ extern "C" _declspec(dllexport) unsigned int NvOptimusEnablement = 0x00000001;
 using namespace glm;
 
 #include <Model.h>
+#include <RenderQueue.h>
+#include <Frustum.h>
+#include <ParticleSystem.h>
+#include <ParticleDepthOrder.h>
+#include <stb_image.h>
 #include "hdr.h"
 #include "fbo.h"
+#include "heightfield.h"
+#include "gpuparticles.h"
+#include "shadowmaps.h"
+#include "ssao.h"
 
 
 
@@ -48,6 +58,63 @@ bool g_isMouseDragging = false;
 GLuint shaderProgram;       // Shader for rendering the final image
 GLuint simpleShaderProgram; // Shader used to draw the shadow map
 GLuint backgroundProgram;
+GLuint heightfieldProgram;
+GLuint particleProgram;
+GLuint gpuParticleProgram;
+GLuint oitResolveProgram;
+GLuint shadowProgram;
+GLuint heightfieldShadowProgram;
+GLuint ssaoPrepassProgram;
+GLuint heightfieldPrepassProgram;
+GLuint gbufferProgram;
+GLuint deferredLightingProgram;
+
+///////////////////////////////////////////////////////////////////////////////
+// Uniform buffers (std140, as declared in shading.frag and shading.vert):
+// one per frame, and one with a slot for each object drawn in it. The
+// materials' are in the models, bound by labhelper::render and the queue.
+///////////////////////////////////////////////////////////////////////////////
+struct FrameUniforms
+{
+	mat4 viewInverse;
+	vec3 viewSpaceLightPosition;
+	float environment_multiplier;
+	vec3 point_light_color;
+	float point_light_intensity_multiplier;
+	vec3 viewSpaceLightDir;
+	int32_t ambient_occlusion_enabled;
+};
+
+struct ObjectUniforms
+{
+	mat4 modelViewProjectionMatrix;
+	mat4 modelViewMatrix;
+	mat4 normalMatrix;
+};
+
+// More point lights, for the deferred path (deferred_lighting.frag)
+const int MAX_LIGHTS = 128;
+struct LightUniforms
+{
+	int32_t numLights;
+	int32_t padding[3];
+	// xyz: view space position, w: radius
+	vec4 lightPositions[MAX_LIGHTS];
+	// rgb: color times intensity
+	vec4 lightColors[MAX_LIGHTS];
+};
+
+const GLuint FRAME_UNIFORM_BINDING = 0;
+const GLuint OBJECT_UNIFORM_BINDING = 1;
+const uint32_t MAX_OBJECTS = 256;
+const GLuint LIGHT_UNIFORM_BINDING = 4;
+GLuint frameUniformBuffer, objectUniformBuffer, lightUniformBuffer;
+// Object slots are this far apart (the uniform buffer offset alignment)
+uint32_t objectUniformStride;
+uint32_t numObjects = 0;
+
+// The scene's models, drawn sorted by material
+labhelper::RenderQueue renderQueue;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Environment
@@ -61,6 +128,14 @@ const std::string envmap_base_name = "001";
 ///////////////////////////////////////////////////////////////////////////////
 vec3 lightPosition;
 vec3 point_light_color = vec3(1.f, 1.f, 1.f);
+// The light circles the scene while animated. Off by default, since a moving
+// light invalidates the cached static shadow maps every frame
+bool animateLight = false;
+float lightTime = 0.0f;
+// Small lights swarming around the fighter, drawn by the deferred path only
+int numSwarmLights = 32;
+float swarmLightIntensity = 300.0f;
+float swarmLightRadius = 30.0f;
 
 float point_light_intensity_multiplier = 10000.0f;
 
@@ -88,6 +163,58 @@ mat4 roomModelMatrix;
 mat4 landingPadModelMatrix;
 mat4 fighterModelMatrix;
 
+///////////////////////////////////////////////////////////////////////////////
+// Terrain
+///////////////////////////////////////////////////////////////////////////////
+HeightField terrain;
+mat4 terrainModelMatrix = translate(vec3(0.0f, -60.0f, 0.0f)) * scale(vec3(1000.0f, 100.0f, 1000.0f));
+bool drawTerrain = true;
+bool terrainWireframe = false;
+
+///////////////////////////////////////////////////////////////////////////////
+// Shadows, of the directional light (along -lightPosition) the terrain is
+// lit by and of the point light. The terrain is a static caster, only drawn
+// into the maps again when the light moves, the models are dynamic.
+///////////////////////////////////////////////////////////////////////////////
+ShadowMaps shadowMaps;
+// For the shadow maps and the SSAO prepass, without materials
+labhelper::RenderQueue depthOnlyQueue;
+
+///////////////////////////////////////////////////////////////////////////////
+// Screen space ambient occlusion, of the ambient light on the models
+///////////////////////////////////////////////////////////////////////////////
+AmbientOcclusion ssao;
+
+///////////////////////////////////////////////////////////////////////////////
+// Particles, simulated on the CPU and drawn as point sprites
+///////////////////////////////////////////////////////////////////////////////
+ParticleSystem particleSystem(100000);
+ParticleEmitter particleEmitter;
+ParticleDepthOrder particleOrder;
+int particlesPerSecond = 5000;
+std::vector<vec4> particleData;
+GLuint particleVAO, particleBuffer, particleIndexBuffer, particleTexture;
+bool drawParticles = true;
+// Or the ones simulated on the GPU, many more but unsorted
+GpuParticleSystem gpuParticles;
+bool useGpuParticles = false;
+// Composite the particles with weighted blended order-independent
+// transparency instead of blending them back to front (the CPU particles
+// are then not sorted)
+bool particlesOIT = false;
+
+///////////////////////////////////////////////////////////////////////////////
+// Framebuffers: the scene is drawn into sceneFb and copied to the window,
+// oitFb's targets are the OIT accumulation and revealage
+///////////////////////////////////////////////////////////////////////////////
+FboInfo sceneFb(1);
+FboInfo oitFb(2);
+// Shade the models from a G-buffer (see gbuffer.frag) instead of as they are
+// drawn: albedo and reflectivity, normal and shininess, metalness and
+// fresnel, emission
+FboInfo gbufferFb(4);
+bool useDeferredShading = false;
+
 void loadShaders(bool is_reload)
 {
 	GLuint shader = labhelper::loadShaderProgram("../project/simple.vert", "../project/simple.frag",
@@ -101,6 +228,40 @@ void loadShaders(bool is_reload)
 	shader = labhelper::loadShaderProgram("../project/shading.vert", "../project/shading.frag", is_reload);
 	if(shader != 0)
 		shaderProgram = shader;
+	shader = labhelper::loadShaderProgram("../project/heightfield.vert", "../project/heightfield.frag",
+	                                      is_reload);
+	if(shader != 0)
+		heightfieldProgram = shader;
+	shader = labhelper::loadShaderProgram("../project/particle.vert", "../project/particle.frag", is_reload);
+	if(shader != 0)
+		particleProgram = shader;
+	shader = labhelper::loadShaderProgram("../project/gpuparticle.vert", "../project/particle.frag", is_reload);
+	if(shader != 0)
+		gpuParticleProgram = shader;
+	gpuParticles.loadShaders(is_reload);
+	shader = labhelper::loadShaderProgram("../project/background.vert", "../project/oit_resolve.frag", is_reload);
+	if(shader != 0)
+		oitResolveProgram = shader;
+	shader = labhelper::loadShaderProgram("../project/simple.vert", "../project/shadow.frag", is_reload);
+	if(shader != 0)
+		shadowProgram = shader;
+	shader = labhelper::loadShaderProgram("../project/heightfield.vert", "../project/shadow.frag", is_reload);
+	if(shader != 0)
+		heightfieldShadowProgram = shader;
+	shader = labhelper::loadShaderProgram("../project/ssaoInput.vert", "../project/ssaoInput.frag", is_reload);
+	if(shader != 0)
+		ssaoPrepassProgram = shader;
+	shader = labhelper::loadShaderProgram("../project/heightfield.vert", "../project/ssaoInput.frag", is_reload);
+	if(shader != 0)
+		heightfieldPrepassProgram = shader;
+	ssao.loadShaders(is_reload);
+	shader = labhelper::loadShaderProgram("../project/shading.vert", "../project/gbuffer.frag", is_reload);
+	if(shader != 0)
+		gbufferProgram = shader;
+	shader = labhelper::loadShaderProgram("../project/background.vert", "../project/deferred_lighting.frag",
+	                                      is_reload);
+	if(shader != 0)
+		deferredLightingProgram = shader;
 }
 
 void initGL()
@@ -112,6 +273,22 @@ void initGL()
 	                                                 "../project/background.frag");
 	shaderProgram = labhelper::loadShaderProgram("../project/shading.vert", "../project/shading.frag");
 	simpleShaderProgram = labhelper::loadShaderProgram("../project/simple.vert", "../project/simple.frag");
+	heightfieldProgram = labhelper::loadShaderProgram("../project/heightfield.vert",
+	                                                  "../project/heightfield.frag");
+	particleProgram = labhelper::loadShaderProgram("../project/particle.vert", "../project/particle.frag");
+	gpuParticleProgram = labhelper::loadShaderProgram("../project/gpuparticle.vert", "../project/particle.frag");
+	gpuParticles.loadShaders(false);
+	oitResolveProgram = labhelper::loadShaderProgram("../project/background.vert", "../project/oit_resolve.frag");
+	shadowProgram = labhelper::loadShaderProgram("../project/simple.vert", "../project/shadow.frag");
+	heightfieldShadowProgram = labhelper::loadShaderProgram("../project/heightfield.vert",
+	                                                        "../project/shadow.frag");
+	ssaoPrepassProgram = labhelper::loadShaderProgram("../project/ssaoInput.vert", "../project/ssaoInput.frag");
+	heightfieldPrepassProgram = labhelper::loadShaderProgram("../project/heightfield.vert",
+	                                                         "../project/ssaoInput.frag");
+	ssao.loadShaders(false);
+	gbufferProgram = labhelper::loadShaderProgram("../project/shading.vert", "../project/gbuffer.frag");
+	deferredLightingProgram = labhelper::loadShaderProgram("../project/background.vert",
+	                                                       "../project/deferred_lighting.frag");
 
 	///////////////////////////////////////////////////////////////////////
 	// Load models and set up model matrices
@@ -126,6 +303,44 @@ void initGL()
 	fighterModelMatrix = translate(15.0f * worldUp);
 	landingPadModelMatrix = mat4(1.0f);
 
+	terrain.loadHeightField("../scenes/nlsFinland/L3123F.png");
+	terrain.generateMesh(32);
+
+	///////////////////////////////////////////////////////////////////////
+	// Particles: a buffer for as many as can be alive, refilled every frame
+	///////////////////////////////////////////////////////////////////////
+	particleEmitter.position = vec3(0.0f, 40.0f, 0.0f);
+	particleEmitter.speed = 10.0f;
+	particleEmitter.life_length = 5.0f;
+
+	glGenVertexArrays(1, &particleVAO);
+	glBindVertexArray(particleVAO);
+	glGenBuffers(1, &particleBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, particleBuffer);
+	glBufferData(GL_ARRAY_BUFFER, particleSystem.max_size * sizeof(vec4), nullptr, GL_STREAM_DRAW);
+	glVertexAttribPointer(0, 4, GL_FLOAT, false, 0, 0);
+	glEnableVertexAttribArray(0);
+	glGenBuffers(1, &particleIndexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, particleIndexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, particleSystem.max_size * sizeof(uint32_t), nullptr, GL_STREAM_DRAW);
+	glBindVertexArray(0);
+
+	int width, height, components;
+	unsigned char* image = stbi_load("../scenes/explosion.png", &width, &height, &components, 4);
+	glGenTextures(1, &particleTexture);
+	glBindTexture(GL_TEXTURE_2D, particleTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	stbi_image_free(image);
+
+	gpuParticles.m_emitterPosition = particleEmitter.position;
+	gpuParticles.m_speed = particleEmitter.speed;
+	gpuParticles.m_lifeLength = particleEmitter.life_length;
+	gpuParticles.init();
+
 	///////////////////////////////////////////////////////////////////////
 	// Load environment map
 	///////////////////////////////////////////////////////////////////////
@@ -139,20 +354,176 @@ void initGL()
 	irradianceMap = labhelper::loadHdrTexture("../scenes/envmaps/" + envmap_base_name + "_irradiance.hdr");
 
 
+	///////////////////////////////////////////////////////////////////////
+	// Uniform buffers, bound once
+	///////////////////////////////////////////////////////////////////////
+	glGenBuffers(1, &frameUniformBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, frameUniformBuffer);
+	glGenBuffers(1, &objectUniformBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, objectUniformBuffer);
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	objectUniformStride = uint32_t((sizeof(ObjectUniforms) + alignment - 1) / alignment * alignment);
+	glBufferData(GL_UNIFORM_BUFFER, MAX_OBJECTS * objectUniformStride, nullptr, GL_DYNAMIC_DRAW);
+	renderQueue.m_object_binding = OBJECT_UNIFORM_BINDING;
+	glGenBuffers(1, &lightUniformBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, lightUniformBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(LightUniforms), nullptr, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_UNIFORM_BINDING, lightUniformBuffer);
+	depthOnlyQueue.m_object_binding = OBJECT_UNIFORM_BINDING;
+	depthOnlyQueue.m_bind_materials = false;
+
+	shadowMaps.init();
+	ssao.init();
+
 	glEnable(GL_DEPTH_TEST); // enable Z-buffering
 	glEnable(GL_CULL_FACE);  // enables backface culling
 
 
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Camera, light and environment for everything drawn this frame
+///////////////////////////////////////////////////////////////////////////////
+void setFrameUniforms(const mat4& viewMatrix)
+{
+	FrameUniforms frame;
+	frame.viewInverse = inverse(viewMatrix);
+	frame.viewSpaceLightPosition = vec3(viewMatrix * vec4(lightPosition, 1.0f));
+	frame.environment_multiplier = environment_multiplier;
+	frame.point_light_color = point_light_color;
+	frame.point_light_intensity_multiplier = point_light_intensity_multiplier;
+	frame.viewSpaceLightDir = normalize(vec3(viewMatrix * vec4(-lightPosition, 0.0f)));
+	frame.ambient_occlusion_enabled = ssao.m_enabled;
+	glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame), &frame);
+	numObjects = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The swarm lights, on circles of their own around the fighter
+///////////////////////////////////////////////////////////////////////////////
+void setLightUniforms(const mat4& viewMatrix)
+{
+	LightUniforms lights;
+	lights.numLights = std::min(numSwarmLights, MAX_LIGHTS);
+	for(int i = 0; i < lights.numLights; i++)
+	{
+		float phase = float(i) * 2.39996f; // The golden angle
+		float orbit = 10.0f + 15.0f * fract(float(i) * 0.618034f);
+		vec3 position(orbit * cos(phase + lightTime * 0.5f), 5.0f + 25.0f * fract(float(i) * 0.414214f),
+		              orbit * sin(phase + lightTime * 0.5f));
+		vec3 color = abs(sin(vec3(phase, phase + 2.094f, phase + 4.189f)));
+		lights.lightPositions[i] = vec4(vec3(viewMatrix * vec4(position, 1.0f)), swarmLightRadius);
+		lights.lightColors[i] = vec4(color * swarmLightIntensity, 0.0f);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, lightUniformBuffer);
+	const size_t positionsEnd = offsetof(LightUniforms, lightPositions) + lights.numLights * sizeof(vec4);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, positionsEnd, &lights);
+	glBufferSubData(GL_UNIFORM_BUFFER, offsetof(LightUniforms, lightColors), lights.numLights * sizeof(vec4),
+	                lights.lightColors);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The matrices of an object, in the next free slot of the object buffer,
+// which is also bound for drawing it right away. Returns the slot's offset,
+// to submit the object to renderQueue with.
+///////////////////////////////////////////////////////////////////////////////
+uint32_t setObjectUniforms(const mat4& modelMatrix, const mat4& viewMatrix, const mat4& projectionMatrix)
+{
+	ObjectUniforms object;
+	object.modelViewMatrix = viewMatrix * modelMatrix;
+	object.modelViewProjectionMatrix = projectionMatrix * object.modelViewMatrix;
+	object.normalMatrix = inverse(transpose(object.modelViewMatrix));
+	const uint32_t offset = (numObjects++ % MAX_OBJECTS) * objectUniformStride;
+	glBindBuffer(GL_UNIFORM_BUFFER, objectUniformBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(object), &object);
+	glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_UNIFORM_BINDING, objectUniformBuffer, offset,
+	                  sizeof(ObjectUniforms));
+	return offset;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Shadow casters, depth only from a light. The terrain's patches are selected
+// for the camera (and morph with the distance to it), so that it casts with
+// the triangles it is drawn with.
+///////////////////////////////////////////////////////////////////////////////
+void drawStaticShadowCasters(const mat4& lightViewMatrix, const mat4& lightProjectionMatrix, const mat4& viewMatrix)
+{
+	if(!drawTerrain)
+		return;
+	terrain.selectPatches(terrainModelMatrix, lightProjectionMatrix * lightViewMatrix, cameraPosition);
+	glUseProgram(heightfieldShadowProgram);
+	labhelper::setUniform(heightfieldShadowProgram, "modelViewProjectionMatrix",
+	                      lightProjectionMatrix * lightViewMatrix * terrainModelMatrix);
+	labhelper::setUniform(heightfieldShadowProgram, "modelViewMatrix", viewMatrix * terrainModelMatrix);
+	terrain.submitTriangles(heightfieldShadowProgram);
+}
+
+void drawDynamicShadowCasters(const mat4& lightViewMatrix, const mat4& lightProjectionMatrix)
+{
+	uint32_t fighterObject = setObjectUniforms(fighterModelMatrix, lightViewMatrix, lightProjectionMatrix);
+	labhelper::Frustum fighterFrustum(lightProjectionMatrix * lightViewMatrix * fighterModelMatrix);
+	depthOnlyQueue.submit(fighterModel, shadowProgram, objectUniformBuffer, fighterObject, sizeof(ObjectUniforms),
+	                   &fighterFrustum);
+	depthOnlyQueue.flush();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The depth and normals of what the SSAO darkens and is darkened by
+///////////////////////////////////////////////////////////////////////////////
+void drawSsaoPrepass(const mat4& viewMatrix, const mat4& projectionMatrix)
+{
+	uint32_t fighterObject = setObjectUniforms(fighterModelMatrix, viewMatrix, projectionMatrix);
+	labhelper::Frustum fighterFrustum(projectionMatrix * viewMatrix * fighterModelMatrix);
+	depthOnlyQueue.submit(fighterModel, ssaoPrepassProgram, objectUniformBuffer, fighterObject,
+	                      sizeof(ObjectUniforms), &fighterFrustum);
+	depthOnlyQueue.flush();
+
+	if(drawTerrain)
+	{
+		terrain.selectPatches(terrainModelMatrix, projectionMatrix * viewMatrix, cameraPosition);
+		glUseProgram(heightfieldPrepassProgram);
+		labhelper::setUniform(heightfieldPrepassProgram, "modelViewProjectionMatrix",
+		                      projectionMatrix * viewMatrix * terrainModelMatrix);
+		labhelper::setUniform(heightfieldPrepassProgram, "modelViewMatrix", viewMatrix * terrainModelMatrix);
+		labhelper::setUniform(heightfieldPrepassProgram, "normalMatrix",
+		                      inverse(transpose(viewMatrix * terrainModelMatrix)));
+		terrain.submitTriangles(heightfieldPrepassProgram);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The lighting pass of the deferred path, over the background, then the
+// G-buffer's depth for what is drawn forward after it
+///////////////////////////////////////////////////////////////////////////////
+void drawDeferredLighting(const mat4& projectionMatrix)
+{
+	glUseProgram(deferredLightingProgram);
+	labhelper::setUniform(deferredLightingProgram, "inverseProjectionMatrix", inverse(projectionMatrix));
+	GLuint gbuffer[] = { gbufferFb.colorTextureTargets[0], gbufferFb.colorTextureTargets[1],
+		                 gbufferFb.colorTextureTargets[2], gbufferFb.colorTextureTargets[3],
+		                 gbufferFb.depthBuffer };
+	glBindTextures(0, 5, gbuffer);
+	labhelper::drawFullScreenQuad();
+	glBindTextures(0, 5, nullptr);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, gbufferFb.framebufferId);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, sceneFb.framebufferId);
+	glBlitFramebuffer(0, 0, gbufferFb.width, gbufferFb.height, 0, 0, sceneFb.width, sceneFb.height,
+	                  GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFb.framebufferId);
+}
+
 void debugDrawLight(const glm::mat4& viewMatrix,
                     const glm::mat4& projectionMatrix,
                     const glm::vec3& worldSpaceLightPos)
 {
 	mat4 modelMatrix = glm::translate(worldSpaceLightPos);
 	glUseProgram(shaderProgram);
-	labhelper::setUniformSlow(shaderProgram, "modelViewProjectionMatrix",
-	                          projectionMatrix * viewMatrix * modelMatrix);
+	setObjectUniforms(modelMatrix, viewMatrix, projectionMatrix);
 	labhelper::render(sphereModel);
 }
 
@@ -160,9 +531,9 @@ void debugDrawLight(const glm::mat4& viewMatrix,
 void drawBackground(const mat4& viewMatrix, const mat4& projectionMatrix)
 {
 	glUseProgram(backgroundProgram);
-	labhelper::setUniformSlow(backgroundProgram, "environment_multiplier", environment_multiplier);
-	labhelper::setUniformSlow(backgroundProgram, "inv_PV", inverse(projectionMatrix * viewMatrix));
-	labhelper::setUniformSlow(backgroundProgram, "camera_pos", cameraPosition);
+	labhelper::setUniform(backgroundProgram, "environment_multiplier", environment_multiplier);
+	labhelper::setUniform(backgroundProgram, "inv_PV", inverse(projectionMatrix * viewMatrix));
+	labhelper::setUniform(backgroundProgram, "camera_pos", cameraPosition);
 	labhelper::drawFullScreenQuad();
 }
 
@@ -172,44 +543,157 @@ void drawScene(GLuint currentShaderProgram,
                const mat4& lightViewMatrix,
                const mat4& lightProjectionMatrix)
 {
-	glUseProgram(currentShaderProgram);
-	// Light source
-	vec4 viewSpaceLightPosition = viewMatrix * vec4(lightPosition, 1.0f);
-	labhelper::setUniformSlow(currentShaderProgram, "point_light_color", point_light_color);
-	labhelper::setUniformSlow(currentShaderProgram, "point_light_intensity_multiplier",
-	                          point_light_intensity_multiplier);
-	labhelper::setUniformSlow(currentShaderProgram, "viewSpaceLightPosition", vec3(viewSpaceLightPosition));
-	labhelper::setUniformSlow(currentShaderProgram, "viewSpaceLightDir",
-	                          normalize(vec3(viewMatrix * vec4(-lightPosition, 0.0f))));
-
-
-	// Environment
-	labhelper::setUniformSlow(currentShaderProgram, "environment_multiplier", environment_multiplier);
-
-	// camera
-	labhelper::setUniformSlow(currentShaderProgram, "viewInverse", inverse(viewMatrix));
+	// Light source, environment and camera are in the frame uniforms
 
 	// landing pad
 	landingPadModelMatrix = scale(vec3(0.05f, 0.05f, 0.05f));
-	labhelper::setUniformSlow(currentShaderProgram, "modelViewProjectionMatrix",
-	                          projectionMatrix * viewMatrix * landingPadModelMatrix);
-	labhelper::setUniformSlow(currentShaderProgram, "modelViewMatrix", viewMatrix * landingPadModelMatrix);
-	labhelper::setUniformSlow(currentShaderProgram, "normalMatrix",
-	                          inverse(transpose(viewMatrix * landingPadModelMatrix)));
-
-	//labhelper::render(landingpadModel);
 
 	// Fighter
 	fighterModelMatrix = scale(vec3(5.0f, 5.0f, 5.0f));
-	labhelper::setUniformSlow(currentShaderProgram, "modelViewProjectionMatrix",
-	                          projectionMatrix * viewMatrix * fighterModelMatrix);
-	labhelper::setUniformSlow(currentShaderProgram, "modelViewMatrix", viewMatrix * fighterModelMatrix);
-	labhelper::setUniformSlow(currentShaderProgram, "normalMatrix",
-	                          inverse(transpose(viewMatrix * fighterModelMatrix)));
+	uint32_t fighterObject = setObjectUniforms(fighterModelMatrix, viewMatrix, projectionMatrix);
+	labhelper::Frustum fighterFrustum(projectionMatrix * viewMatrix * fighterModelMatrix);
+	renderQueue.submit(fighterModel, currentShaderProgram, objectUniformBuffer, fighterObject,
+	                   sizeof(ObjectUniforms), &fighterFrustum);
+
+	renderQueue.flush();
+}
+
 
-	labhelper::render(fighterModel);
+///////////////////////////////////////////////////////////////////////////////
+// The terrain's patches are selected for this camera, then drawn instanced
+///////////////////////////////////////////////////////////////////////////////
+void drawHeightField(const mat4& viewMatrix, const mat4& projectionMatrix)
+{
+	terrain.selectPatches(terrainModelMatrix, projectionMatrix * viewMatrix, cameraPosition);
+
+	glUseProgram(heightfieldProgram);
+	labhelper::setUniform(heightfieldProgram, "modelViewProjectionMatrix",
+	                      projectionMatrix * viewMatrix * terrainModelMatrix);
+	labhelper::setUniform(heightfieldProgram, "modelViewMatrix", viewMatrix * terrainModelMatrix);
+	labhelper::setUniform(heightfieldProgram, "normalMatrix",
+	                      inverse(transpose(viewMatrix * terrainModelMatrix)));
+	labhelper::setUniform(heightfieldProgram, "viewSpaceLightDir",
+	                      normalize(vec3(viewMatrix * vec4(-lightPosition, 0.0f))));
+	labhelper::setUniform(heightfieldProgram, "material_color", vec3(0.35f, 0.45f, 0.25f));
+	if(terrainWireframe)
+		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+	terrain.submitTriangles(heightfieldProgram);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// The particles are updated and uploaded as they are, with their age (0 to
+// 1) in w, and drawn back to front through the depth order's indices (or
+// in any order with OIT)
+///////////////////////////////////////////////////////////////////////////////
+void drawParticleSystem(const mat4& viewMatrix, const mat4& projectionMatrix)
+{
+	particleSystem.update(deltaTime);
+	particleSystem.emit(particleEmitter, int(particlesPerSecond * deltaTime + 0.5f));
+	if(particleSystem.size() == 0)
+		return;
+	if(!particlesOIT)
+		particleOrder.sort(particleSystem, viewMatrix);
+
+	const ParticleArrays& particles = particleSystem.particles;
+	particleData.resize(particleSystem.size());
+	for(size_t i = 0; i < particleData.size(); i++)
+		particleData[i] = vec4(particleSystem.position(i), particles.lifetime[i] / particles.life_length[i]);
+
+	glBindBuffer(GL_ARRAY_BUFFER, particleBuffer);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, particleData.size() * sizeof(vec4), particleData.data());
+	glBindVertexArray(particleVAO);
+	if(!particlesOIT)
+	{
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, particleOrder.indices.size() * sizeof(uint32_t),
+		                particleOrder.indices.data());
+	}
+
+	glUseProgram(particleProgram);
+	labhelper::setUniform(particleProgram, "P", projectionMatrix);
+	labhelper::setUniform(particleProgram, "V", viewMatrix);
+	labhelper::setUniform(particleProgram, "screen_x", float(windowWidth));
+	labhelper::setUniform(particleProgram, "screen_y", float(windowHeight));
+	labhelper::setUniform(particleProgram, "oit", GLint(particlesOIT));
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, particleTexture);
+
+	if(particlesOIT)
+		glDrawArrays(GL_POINTS, 0, GLsizei(particleData.size()));
+	else
+		glDrawElements(GL_POINTS, GLsizei(particleOrder.indices.size()), GL_UNSIGNED_INT, 0);
+	glBindVertexArray(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The GPU particles are stepped and drawn without coming back to the CPU
+///////////////////////////////////////////////////////////////////////////////
+void drawGpuParticleSystem(const mat4& viewMatrix, const mat4& projectionMatrix)
+{
+	gpuParticles.update(deltaTime);
+
+	glUseProgram(gpuParticleProgram);
+	labhelper::setUniform(gpuParticleProgram, "P", projectionMatrix);
+	labhelper::setUniform(gpuParticleProgram, "V", viewMatrix);
+	labhelper::setUniform(gpuParticleProgram, "screen_x", float(windowWidth));
+	labhelper::setUniform(gpuParticleProgram, "screen_y", float(windowHeight));
+	labhelper::setUniform(gpuParticleProgram, "oit", GLint(particlesOIT));
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, particleTexture);
+	gpuParticles.submitPoints();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Particles are blended into sceneFb back to front, or with weighted
+// blended OIT (McGuire and Bavoil 2013): into oitFb, which gets sceneFb's
+// depth to test against, then resolved over sceneFb
+///////////////////////////////////////////////////////////////////////////////
+void renderParticles(const mat4& viewMatrix, const mat4& projectionMatrix)
+{
+	if(particlesOIT)
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFb.framebufferId);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, oitFb.framebufferId);
+		glBlitFramebuffer(0, 0, sceneFb.width, sceneFb.height, 0, 0, oitFb.width, oitFb.height,
+		                  GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, oitFb.framebufferId);
+		const float accumClear[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		const float revealageClear[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		glClearBufferfv(GL_COLOR, 0, accumClear);
+		glClearBufferfv(GL_COLOR, 1, revealageClear);
+		glEnable(GL_BLEND);
+		glBlendFunci(0, GL_ONE, GL_ONE);
+		glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+	}
+	else
+	{
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	}
+	glEnable(GL_PROGRAM_POINT_SIZE);
+	glDepthMask(GL_FALSE);
+
+	if(useGpuParticles)
+		drawGpuParticleSystem(viewMatrix, projectionMatrix);
+	else
+		drawParticleSystem(viewMatrix, projectionMatrix);
+
+	glDepthMask(GL_TRUE);
+	glDisable(GL_PROGRAM_POINT_SIZE);
+	if(particlesOIT)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, sceneFb.framebufferId);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glUseProgram(oitResolveProgram);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, oitFb.colorTextureTargets[0]);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, oitFb.colorTextureTargets[1]);
+		glActiveTexture(GL_TEXTURE0);
+		labhelper::drawFullScreenQuad();
+	}
+	glDisable(GL_BLEND);
+}
 
 void display(void)
 {
@@ -223,6 +707,10 @@ void display(void)
 		{
 			windowWidth = w;
 			windowHeight = h;
+			sceneFb.resize(w, h);
+			oitFb.resize(w, h);
+			ssao.resize(w, h);
+			gbufferFb.resize(w, h);
 		}
 	}
 
@@ -233,7 +721,9 @@ void display(void)
 	mat4 viewMatrix = lookAt(cameraPosition, cameraPosition + cameraDirection, worldUp);
 
 	vec4 lightStartPosition = vec4(40.0f, 40.0f, 0.0f, 1.0f);
-	lightPosition = vec3(rotate(currentTime, worldUp) * lightStartPosition);
+	if(animateLight)
+		lightTime += deltaTime;
+	lightPosition = vec3(rotate(lightTime, worldUp) * lightStartPosition);
 	mat4 lightViewMatrix = lookAt(lightPosition, vec3(0.0f), worldUp);
 	mat4 lightProjMatrix = perspective(radians(45.0f), 1.0f, 25.0f, 100.0f);
 
@@ -248,19 +738,63 @@ void display(void)
 	glBindTexture(GL_TEXTURE_2D, reflectionMap);
 	glActiveTexture(GL_TEXTURE0);
 
+	setFrameUniforms(viewMatrix);
 
+	///////////////////////////////////////////////////////////////////////////
+	// Shadow maps
+	///////////////////////////////////////////////////////////////////////////
+	shadowMaps.update(normalize(-lightPosition), lightPosition, viewMatrix, projMatrix,
+	                  [&](const mat4& lightView, const mat4& lightProj) {
+		                  drawStaticShadowCasters(lightView, lightProj, viewMatrix);
+	                  },
+	                  drawDynamicShadowCasters);
+	shadowMaps.bind();
+
+	///////////////////////////////////////////////////////////////////////////
+	// Ambient occlusion
+	///////////////////////////////////////////////////////////////////////////
+	if(ssao.m_enabled)
+	{
+		ssao.beginPrepass();
+		drawSsaoPrepass(viewMatrix, projMatrix);
+		ssao.compute(projMatrix);
+	}
+	ssao.bind();
 
 	///////////////////////////////////////////////////////////////////////////
 	// Draw from camera
 	///////////////////////////////////////////////////////////////////////////
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if(useDeferredShading)
+	{
+		setLightUniforms(viewMatrix);
+		glBindFramebuffer(GL_FRAMEBUFFER, gbufferFb.framebufferId);
+		glViewport(0, 0, windowWidth, windowHeight);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		drawScene(gbufferProgram, viewMatrix, projMatrix, lightViewMatrix, lightProjMatrix);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFb.framebufferId);
 	glViewport(0, 0, windowWidth, windowHeight);
 	glClearColor(0.2f, 0.2f, 0.8f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	drawBackground(viewMatrix, projMatrix);
-	drawScene(shaderProgram, viewMatrix, projMatrix, lightViewMatrix, lightProjMatrix);
+	if(useDeferredShading)
+		drawDeferredLighting(projMatrix);
+	else
+		drawScene(shaderProgram, viewMatrix, projMatrix, lightViewMatrix, lightProjMatrix);
+	if(drawTerrain)
+		drawHeightField(viewMatrix, projMatrix);
 	debugDrawLight(viewMatrix, projMatrix, vec3(lightPosition));
+	if(drawParticles)
+		renderParticles(viewMatrix, projMatrix);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFb.framebufferId);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, windowWidth, windowHeight, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT,
+	                  GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 
 
@@ -351,6 +885,42 @@ void gui()
 	// ----------------- Set variables --------------------------
 	ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate,
 	            ImGui::GetIO().Framerate);
+	ImGui::Text("Scene: %d meshes (%d culled) in %d draw calls, %d state changes", renderQueue.m_meshes,
+	            renderQueue.m_culled_meshes, renderQueue.m_draw_calls, renderQueue.m_state_changes);
+	if(ImGui::Checkbox("Terrain", &drawTerrain))
+		shadowMaps.invalidate();
+	ImGui::Checkbox("Terrain wireframe", &terrainWireframe);
+	ImGui::SliderFloat("Terrain LOD distance", &terrain.m_lodDistance, 4.0f, 16.0f);
+	ImGui::Text("Terrain patches: %d (%d vertices)", terrain.m_numPatches,
+	            terrain.m_numPatches * (terrain.m_meshResolution + 1) * (terrain.m_meshResolution + 1));
+	if(ImGui::Checkbox("Shadows", &shadowMaps.m_enabled))
+		shadowMaps.invalidate();
+	ImGui::Checkbox("Animate light", &animateLight);
+	ImGui::Text("Shadow maps drawn again: %d", shadowMaps.m_staticRedraws);
+	ImGui::Checkbox("Deferred shading", &useDeferredShading);
+	ImGui::SliderInt("Swarm lights (deferred)", &numSwarmLights, 0, MAX_LIGHTS);
+	ImGui::SliderFloat("Swarm light intensity", &swarmLightIntensity, 0.0f, 2000.0f);
+	ImGui::Checkbox("SSAO", &ssao.m_enabled);
+	ImGui::SliderFloat("SSAO radius", &ssao.m_radius, 0.1f, 10.0f);
+	ImGui::Checkbox("SSAO within budget", &ssao.m_adaptive);
+	ImGui::SliderFloat("SSAO budget (ms)", &ssao.m_budgetMs, 0.25f, 4.0f);
+	ImGui::SliderInt("SSAO samples", &ssao.m_numSamples, 4, AmbientOcclusion::MAX_SAMPLES);
+	ImGui::Text("SSAO: %.2f ms", ssao.m_timeMs);
+	ImGui::Checkbox("Particles", &drawParticles);
+	ImGui::SliderInt("Particles per second", &particlesPerSecond, 0, 50000);
+	ImGui::Checkbox("GPU particles", &useGpuParticles);
+	ImGui::Checkbox("Order-independent particles", &particlesOIT);
+	if(useGpuParticles)
+	{
+		ImGui::SliderFloat("GPU particles per second", &gpuParticles.m_particlesPerSecond, 0.0f,
+		                   gpuParticles.m_maxParticles / gpuParticles.m_lifeLength);
+		ImGui::SliderFloat("GPU particle gravity", &gpuParticles.m_gravity.y, -10.0f, 10.0f);
+	}
+	else
+	{
+		ImGui::Text("Particles: %d (%s sort)", int(particleSystem.size()),
+		            particleOrder.incremental ? "incremental" : "radix");
+	}
 	// ----------------------------------------------------------
 	// Render the GUI.
 	ImGui::Render();
@@ -0,0 +1,24 @@
+#version 420
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+///////////////////////////////////////////////////////////////////////////////
+// Composites the weighted blended OIT targets (see particle.frag) over the
+// framebuffer, with glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA):
+// the weighted average color, covering 1 - revealage of what is behind
+///////////////////////////////////////////////////////////////////////////////
+layout(binding = 0) uniform sampler2D accumTexture;
+layout(binding = 1) uniform sampler2D revealageTexture;
+
+layout(location = 0) out vec4 fragmentColor;
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float revealage = texelFetch(revealageTexture, pixel, 0).r;
+	if(revealage >= 1.0)
+		discard;
+	vec4 accum = texelFetch(accumTexture, pixel, 0);
+	fragmentColor = vec4(accum.rgb / max(accum.a, 1e-5), 1.0 - revealage);
+}
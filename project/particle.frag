@@ -3,14 +3,39 @@ in float life;
 uniform float screen_x;
 uniform float screen_y;
 layout(binding = 0) uniform sampler2D colortexture;
+// 0: blend straight into the framebuffer (back to front), 1: weighted
+// blended order-independent transparency into oit_resolve.frag's targets
+uniform int oit;
+
+// Blended color, or OIT accumulation (premultiplied color and alpha, weighted)
+layout(location = 0) out vec4 fragmentColor;
+// OIT revealage: alpha, blended as the product of (1 - alpha)
+layout(location = 1) out vec4 revealage;
+
+// Weight of a fragment in the OIT average, more for nearer and more opaque
+// ones (McGuire and Bavoil 2013, eq. 7), scaled down by 100 so that
+// thousands of overlapping particles still fit in half floats
+float oitWeight(float depth, float alpha)
+{
+	return clamp(pow(min(1.0, alpha * 10.0) + 0.01, 3.0) * 1e8 * pow(1.0 - depth * 0.9, 3.0), 1e-2, 3e3) * 1e-2;
+}
 
 void main()
 {
 	// Basse color.
-	gl_FragColor = texture2D(colortexture, gl_PointCoord);
+	vec4 color = texture2D(colortexture, gl_PointCoord);
 	// Make it darker the older it is.
-	gl_FragColor.xyz *= (1.0 - life);
+	color.xyz *= (1.0 - life);
 	// Make it fade out the older it is, also all particles have a
 	// very low base alpha so they blend together.
-	gl_FragColor.w = gl_FragColor.w * (1.0 - pow(life, 4.0)) * 0.05;
-}
\ No newline at end of file
+	color.w = color.w * (1.0 - pow(life, 4.0)) * 0.05;
+
+	if(oit == 0)
+	{
+		fragmentColor = color;
+		return;
+	}
+	float w = oitWeight(gl_FragCoord.z, color.w);
+	fragmentColor = vec4(color.xyz * color.w, color.w) * w;
+	revealage = vec4(color.w);
+}
@@ -1,14 +1,15 @@
 #version 400 compatibility
 layout(location = 0) in vec4 particle;
 uniform mat4 P;
+uniform mat4 V;
 uniform float screen_x;
 uniform float screen_y;
 out float life;
 void main()
 {
 	life = particle.w;
-	// Particle is already in view space.
-	vec4 particle_vs = vec4(particle.xyz, 1.0);
+	// Particle is in world space.
+	vec4 particle_vs = V * vec4(particle.xyz, 1.0);
 	// Calculate one projected corner of a quad at the particles view space depth.
 	vec4 proj_quad = P * vec4(1.0, 1.0, particle_vs.z, particle_vs.w);
 	// Calculate the projected pixel size.
@@ -0,0 +1,8 @@
+#version 420
+// Never runs, particle_update.vert is drawn with rasterizer discard
+layout(location = 0) out vec4 fragmentColor;
+
+void main()
+{
+	fragmentColor = vec4(0.0);
+}
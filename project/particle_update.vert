@@ -0,0 +1,71 @@
+#version 420
+///////////////////////////////////////////////////////////////////////////////
+// One step of the GPU particles, see gpuparticles.h. Runs with rasterizer
+// discard, out_position and out_velocity go to the other state buffer.
+///////////////////////////////////////////////////////////////////////////////
+// xyz: position, w: age in seconds
+layout(location = 0) in vec4 position;
+// xyz: velocity, w: life length in seconds (dead when age reaches it)
+layout(location = 1) in vec4 velocity;
+
+out vec4 out_position;
+out vec4 out_velocity;
+
+uniform float deltaTime;
+uniform vec3 gravity;
+// Slots emitStart to emitStart + emitCount (wrapping) are born this frame
+uniform int maxParticles;
+uniform int emitStart;
+uniform int emitCount;
+uniform int frame;
+uniform vec3 emitterPosition;
+uniform float speed;
+uniform float lifeLength;
+
+#define PI 3.14159265359
+
+// PCG hash (Jarzynski and Olano, Hash Functions for GPU Rendering, 2020)
+uint hash(uint x)
+{
+	uint state = x * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+// In [0, 1)
+float random(inout uint seed)
+{
+	seed = hash(seed);
+	return float(seed >> 8u) * (1.0 / 16777216.0);
+}
+
+void main()
+{
+	int slot = gl_VertexID - emitStart;
+	if(slot < 0)
+		slot += maxParticles;
+	if(slot < emitCount)
+	{
+		// A random direction in the whole sphere, and a random time in
+		// the frame to be born at, so a frame's particles do not move as one
+		uint seed = hash(uint(gl_VertexID) ^ hash(uint(frame)));
+		float theta = 2.0 * PI * random(seed);
+		float u = 2.0 * random(seed) - 1.0;
+		float r = sqrt(max(1.0 - u * u, 0.0));
+		vec3 v = speed * vec3(u, r * cos(theta), r * sin(theta));
+		float age = deltaTime * random(seed);
+		out_position = vec4(emitterPosition + v * age, age);
+		out_velocity = vec4(v, lifeLength);
+		return;
+	}
+
+	if(position.w >= velocity.w)
+	{
+		out_position = position;
+		out_velocity = velocity;
+		return;
+	}
+	vec3 v = velocity.xyz + gravity * deltaTime;
+	out_position = vec4(position.xyz + v * deltaTime, position.w + deltaTime);
+	out_velocity = vec4(v, velocity.w);
+}
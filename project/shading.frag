@@ -2,17 +2,25 @@
 // required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
 precision highp float;
 ///////////////////////////////////////////////////////////////////////////////
-// Material
+// Material, per mesh (see labhelper::MaterialUniforms)
 ///////////////////////////////////////////////////////////////////////////////
-uniform vec3 material_color;
-uniform float material_reflectivity;
-uniform float material_metalness;
-uniform float material_fresnel;
-uniform float material_shininess;
-uniform float material_emission;
-uniform int has_color_texture;
+layout(std140, binding = 2) uniform MaterialUniforms
+{
+	vec3 material_color;
+	float material_reflectivity;
+	float material_metalness;
+	float material_fresnel;
+	float material_shininess;
+	float material_emission;
+	int has_color_texture;
+	int has_reflectivity_texture;
+	int has_metalness_texture;
+	int has_fresnel_texture;
+	int has_shininess_texture;
+	int has_emission_texture;
+	int has_bump_texture;
+};
 layout(binding = 0) uniform sampler2D colorMap;
-uniform int has_emission_texture;
 layout(binding = 5) uniform sampler2D emissiveMap;
 ///////////////////////////////////////////////////////////////////////////////
 // Environment
@@ -20,12 +28,33 @@ layout(binding = 5) uniform sampler2D emissiveMap;
 layout(binding = 6) uniform sampler2D environmentMap;
 layout(binding = 7) uniform sampler2D irradianceMap;
 layout(binding = 8) uniform sampler2D reflectionMap;
-uniform float environment_multiplier;
 ///////////////////////////////////////////////////////////////////////////////
-// Light source
+// Camera, light source and environment, per frame
+///////////////////////////////////////////////////////////////////////////////
+layout(std140, binding = 0) uniform FrameUniforms
+{
+	mat4 viewInverse;
+	vec3 viewSpaceLightPosition;
+	float environment_multiplier;
+	vec3 point_light_color;
+	float point_light_intensity_multiplier;
+	vec3 viewSpaceLightDir;
+	int ambient_occlusion_enabled;
+};
+// Of the ambient light, at full resolution (see ssao.h)
+layout(binding = 11) uniform sampler2D ambientOcclusionMap;
+///////////////////////////////////////////////////////////////////////////////
+// Shadow maps (see shadowmaps.h)
 ///////////////////////////////////////////////////////////////////////////////
-uniform vec3 point_light_color = vec3(1.0, 1.0, 1.0);
-uniform float point_light_intensity_multiplier = 50.0;
+layout(std140, binding = 3) uniform ShadowUniforms
+{
+	mat4 cascadeMatrices[4];
+	vec4 cascadeSplits;
+	vec2 pointShadowDepth;
+	float shadowBias;
+	int shadowsEnabled;
+};
+layout(binding = 9) uniform samplerCubeShadow pointShadowMap;
 ///////////////////////////////////////////////////////////////////////////////
 // Constants
 ///////////////////////////////////////////////////////////////////////////////
@@ -37,11 +66,6 @@ in vec2 texCoord;
 in vec3 viewSpaceNormal;
 in vec3 viewSpacePosition;
 ///////////////////////////////////////////////////////////////////////////////
-// Input uniform variables
-///////////////////////////////////////////////////////////////////////////////
-uniform mat4 viewInverse;
-uniform vec3 viewSpaceLightPosition;
-///////////////////////////////////////////////////////////////////////////////
 // Output color
 ///////////////////////////////////////////////////////////////////////////////
 layout(location = 0) out vec4 fragmentColor;
@@ -56,9 +80,9 @@ vec3 getLi() {
 vec3 getWi() {
 	return normalize(viewSpaceLightPosition - viewSpacePosition);
 }
+// Without the color, the caller multiplies with the (textured) base color
 vec3 getDiffuseTerm(vec3 normal, vec3 wi, vec3 Li) {
-	return material_color *
-		(1.0f/PI) *
+	return (1.0f/PI) *
 		abs(dot(normal,wi))*Li;
 }
 vec3 getWh(vec3 wo,vec3 wi) {
@@ -83,10 +107,21 @@ float getShadowingMasking(vec3 n, vec3 wo, vec3 wi, vec3 wh) {
 float getbrdf(float fresnel, float microfacet_function, float masking_function, vec3 n, vec3 wo,vec3 wi) {
 	return fresnel * microfacet_function * masking_function / (4*dot(n,wo)*dot(n,wi));
 }
+// How much of the point light reaches this fragment, from the cube map's
+// depth along the major axis of the direction from the light
+float getPointLightVisibility()
+{
+	if(shadowsEnabled == 0)
+		return 1.0;
+	vec3 fromLight = mat3(viewInverse) * (viewSpacePosition - viewSpaceLightPosition);
+	vec3 a = abs(fromLight);
+	float depth = pointShadowDepth.x - pointShadowDepth.y / max(a.x, max(a.y, a.z));
+	return texture(pointShadowMap, vec4(fromLight, depth - shadowBias));
+}
 vec3 calculateDirectIllumiunation(vec3 wo, vec3 n, vec3 base_color)
 {
 	vec3 direct_illum = base_color;
-	vec3 Li = getLi();
+	vec3 Li = getLi() * getPointLightVisibility();
 	vec3 wi = getWi();
 	if(dot(n, wi) <= 0) {
 		return vec3(0);
@@ -151,6 +186,10 @@ void main()
 	vec3 direct_illumination_term = calculateDirectIllumiunation(wo, n, base_color);
 	// Indirect illumination
 	vec3 indirect_illumination_term = calculateIndirectIllumination(wo, n, base_color);
+	if(ambient_occlusion_enabled != 0)
+	{
+		indirect_illumination_term *= texelFetch(ambientOcclusionMap, ivec2(gl_FragCoord.xy), 0).r;
+	}
 	///////////////////////////////////////////////////////////////////////////
 	// Add emissive term. If emissive texture exists, sample this term.
 	///////////////////////////////////////////////////////////////////////////
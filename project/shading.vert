@@ -7,11 +7,14 @@ layout(location = 1) in vec3 normalIn;
 layout(location = 2) in vec2 texCoordIn;
 
 ///////////////////////////////////////////////////////////////////////////////
-// Input uniform variables
+// Input uniform variables, per object
 ///////////////////////////////////////////////////////////////////////////////
-uniform mat4 normalMatrix;
-uniform mat4 modelViewMatrix;
-uniform mat4 modelViewProjectionMatrix;
+layout(std140, binding = 1) uniform ObjectUniforms
+{
+	mat4 modelViewProjectionMatrix;
+	mat4 modelViewMatrix;
+	mat4 normalMatrix;
+};
 
 ///////////////////////////////////////////////////////////////////////////////
 // Output to fragment shader
@@ -0,0 +1,6 @@
+#version 420
+// Depth only, for the shadow maps (shadowmaps.h), which have no color buffers
+
+void main()
+{
+}
@@ -0,0 +1,250 @@
+#include "shadowmaps.h"
+#include <algorithm>
+#include <cmath>
+#include <glm/gtx/transform.hpp>
+
+using namespace glm;
+
+ShadowMaps::ShadowMaps()
+    : m_cascadeResolution(2048)
+    , m_cubeResolution(1024)
+    , m_numCascades(MAX_CASCADES)
+    , m_shadowDistance(500.0f)
+    , m_splitLambda(0.75f)
+    , m_cascadeSlack(1.25f)
+    , m_casterDepth(300.0f)
+    , m_pointNear(1.0f)
+    , m_pointFar(300.0f)
+    , m_bias(0.0005f)
+    , m_enabled(true)
+    , m_staticRedraws(0)
+    , m_cascadeMaps(0)
+    , m_staticCascadeMaps(0)
+    , m_cubeMap(0)
+    , m_staticCubeMap(0)
+    , m_uniformBuffer(0)
+    , m_fbo(0)
+    , m_cascadeLightDirection(0.0f)
+    , m_cubeLightPosition(0.0f)
+    , m_cubeValid(false)
+{
+	invalidate();
+}
+
+// The maps that are sampled compare depths, and filter the comparisons
+static void setShadowSampling(GLenum target, bool compare)
+{
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, compare ? GL_LINEAR : GL_NEAREST);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, compare ? GL_LINEAR : GL_NEAREST);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	if(compare)
+	{
+		glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	}
+}
+
+void ShadowMaps::init()
+{
+	GLuint* arrays[] = { &m_cascadeMaps, &m_staticCascadeMaps };
+	for(int i = 0; i < 2; i++)
+	{
+		glGenTextures(1, arrays[i]);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, *arrays[i]);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, m_cascadeResolution, m_cascadeResolution,
+		               m_numCascades);
+		setShadowSampling(GL_TEXTURE_2D_ARRAY, arrays[i] == &m_cascadeMaps);
+	}
+	GLuint* cubes[] = { &m_cubeMap, &m_staticCubeMap };
+	for(int i = 0; i < 2; i++)
+	{
+		glGenTextures(1, cubes[i]);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, *cubes[i]);
+		glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_DEPTH_COMPONENT32F, m_cubeResolution, m_cubeResolution);
+		setShadowSampling(GL_TEXTURE_CUBE_MAP, cubes[i] == &m_cubeMap);
+	}
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	glGenBuffers(1, &m_uniformBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowUniforms), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	invalidate();
+}
+
+void ShadowMaps::invalidate()
+{
+	for(int i = 0; i < MAX_CASCADES; i++)
+		m_cascadeValid[i] = false;
+	m_cubeValid = false;
+}
+
+void ShadowMaps::placeCascade(int cascade, const vec3& center, float radius, const vec3& lightDirection)
+{
+	const float extent = radius * m_cascadeSlack;
+	// Snap the center to the texels, across the light
+	vec3 up = abs(lightDirection.y) > 0.99f ? vec3(1.0f, 0.0f, 0.0f) : vec3(0.0f, 1.0f, 0.0f);
+	mat4 lightRotation = lookAt(vec3(0.0f), lightDirection, up);
+	vec3 lightSpaceCenter = vec3(lightRotation * vec4(center, 1.0f));
+	const float texel = 2.0f * extent / float(m_cascadeResolution);
+	lightSpaceCenter.x = floor(lightSpaceCenter.x / texel) * texel;
+	lightSpaceCenter.y = floor(lightSpaceCenter.y / texel) * texel;
+	const vec3 snapped = vec3(inverse(lightRotation) * vec4(lightSpaceCenter, 1.0f));
+
+	m_cascadeCenters[cascade] = snapped;
+	m_cascadeExtents[cascade] = extent;
+	m_cascadeViews[cascade] = lookAt(snapped - lightDirection * (extent + m_casterDepth), snapped, up);
+	m_cascadeProjections[cascade] = ortho(-extent, extent, -extent, extent, 0.0f, 2.0f * extent + m_casterDepth);
+	m_cascadeValid[cascade] = false;
+}
+
+void ShadowMaps::drawLayer(GLenum target, GLuint texture, int layer, int resolution, bool clear,
+                           const mat4& viewMatrix, const mat4& projectionMatrix, const DrawCasters& draw)
+{
+	m_fbo.attachDepthLayer(target, texture, layer, resolution, resolution);
+	if(clear)
+		glClear(GL_DEPTH_BUFFER_BIT);
+	draw(viewMatrix, projectionMatrix);
+}
+
+void ShadowMaps::update(const vec3& lightDirection, const vec3& lightPosition, const mat4& viewMatrix,
+                        const mat4& projectionMatrix, const DrawCasters& drawStatic,
+                        const DrawCasters& drawDynamic)
+{
+	ShadowUniforms uniforms = {};
+	uniforms.shadowsEnabled = m_enabled;
+	uniforms.shadowBias = m_bias;
+	m_staticRedraws = 0;
+	if(!m_enabled)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(uniforms), &uniforms);
+		return;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Place the cascades: the camera's near plane and field of view are in
+	// its projection matrix
+	///////////////////////////////////////////////////////////////////////
+	if(lightDirection != m_cascadeLightDirection)
+	{
+		m_cascadeLightDirection = lightDirection;
+		for(int i = 0; i < MAX_CASCADES; i++)
+			m_cascadeValid[i] = false;
+	}
+	const float zNear = projectionMatrix[3][2] / (projectionMatrix[2][2] - 1.0f);
+	const float tanY = 1.0f / projectionMatrix[1][1];
+	const float tanX = 1.0f / projectionMatrix[0][0];
+	const mat4 viewInverse = inverse(viewMatrix);
+	float splitStart = zNear;
+	for(int i = 0; i < m_numCascades; i++)
+	{
+		float t = float(i + 1) / float(m_numCascades);
+		float splitEnd = m_splitLambda * zNear * pow(m_shadowDistance / zNear, t)
+		                 + (1.0f - m_splitLambda) * (zNear + (m_shadowDistance - zNear) * t);
+		uniforms.cascadeSplits[i] = splitEnd;
+		vec3 corners[8];
+		vec3 center(0.0f);
+		for(int c = 0; c < 8; c++)
+		{
+			float z = (c & 4) ? splitEnd : splitStart;
+			vec3 corner((c & 1 ? 1.0f : -1.0f) * z * tanX, (c & 2 ? 1.0f : -1.0f) * z * tanY, -z);
+			corners[c] = vec3(viewInverse * vec4(corner, 1.0f));
+			center += corners[c] / 8.0f;
+		}
+		float radius = 0.0f;
+		for(int c = 0; c < 8; c++)
+			radius = std::max(radius, distance(corners[c], center));
+		// Placed again only once the slice's sphere leaves the cascade
+		if(!m_cascadeValid[i] || distance(center, m_cascadeCenters[i]) + radius > m_cascadeExtents[i])
+			placeCascade(i, center, radius, lightDirection);
+		splitStart = splitEnd;
+	}
+	// Unused cascades end where the last one does, so none are chosen
+	for(int i = m_numCascades; i < MAX_CASCADES; i++)
+		uniforms.cascadeSplits[i] = splitStart;
+
+	///////////////////////////////////////////////////////////////////////
+	// The cube map's faces, in the order and orientation of GL cube maps
+	///////////////////////////////////////////////////////////////////////
+	static const vec3 faceDirections[6] = { vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0),
+		                                    vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1) };
+	static const vec3 faceUps[6] = { vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1),
+		                             vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0) };
+	mat4 faceViews[6];
+	for(int i = 0; i < 6; i++)
+		faceViews[i] = lookAt(lightPosition, lightPosition + faceDirections[i], faceUps[i]);
+	const mat4 faceProjection = perspective(radians(90.0f), 1.0f, m_pointNear, m_pointFar);
+	if(lightPosition != m_cubeLightPosition)
+	{
+		m_cubeLightPosition = lightPosition;
+		m_cubeValid = false;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// The static casters, where they are out of date, then the dynamic
+	// ones on a copy of them
+	///////////////////////////////////////////////////////////////////////
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.0f, 4.0f);
+
+	glViewport(0, 0, m_cascadeResolution, m_cascadeResolution);
+	for(int i = 0; i < m_numCascades; i++)
+	{
+		if(m_cascadeValid[i])
+			continue;
+		drawLayer(GL_TEXTURE_2D_ARRAY, m_staticCascadeMaps, i, m_cascadeResolution, true, m_cascadeViews[i],
+		          m_cascadeProjections[i], drawStatic);
+		m_cascadeValid[i] = true;
+		m_staticRedraws++;
+	}
+	glCopyImageSubData(m_staticCascadeMaps, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, m_cascadeMaps, GL_TEXTURE_2D_ARRAY, 0,
+	                   0, 0, 0, m_cascadeResolution, m_cascadeResolution, m_numCascades);
+	for(int i = 0; i < m_numCascades; i++)
+		drawLayer(GL_TEXTURE_2D_ARRAY, m_cascadeMaps, i, m_cascadeResolution, false, m_cascadeViews[i],
+		          m_cascadeProjections[i], drawDynamic);
+
+	glViewport(0, 0, m_cubeResolution, m_cubeResolution);
+	if(!m_cubeValid)
+	{
+		for(int i = 0; i < 6; i++)
+		{
+			drawLayer(GL_TEXTURE_CUBE_MAP, m_staticCubeMap, i, m_cubeResolution, true, faceViews[i],
+			          faceProjection, drawStatic);
+			m_staticRedraws++;
+		}
+		m_cubeValid = true;
+	}
+	glCopyImageSubData(m_staticCubeMap, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, m_cubeMap, GL_TEXTURE_CUBE_MAP, 0, 0, 0,
+	                   0, m_cubeResolution, m_cubeResolution, 6);
+	for(int i = 0; i < 6; i++)
+		drawLayer(GL_TEXTURE_CUBE_MAP, m_cubeMap, i, m_cubeResolution, false, faceViews[i], faceProjection,
+		          drawDynamic);
+
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+	///////////////////////////////////////////////////////////////////////
+	// From the camera's view space into the maps
+	///////////////////////////////////////////////////////////////////////
+	const mat4 bias = translate(vec3(0.5f)) * scale(vec3(0.5f));
+	for(int i = 0; i < m_numCascades; i++)
+		uniforms.cascadeMatrices[i] = bias * m_cascadeProjections[i] * m_cascadeViews[i] * viewInverse;
+	const float n = m_pointNear, f = m_pointFar;
+	uniforms.pointShadowDepth = vec2(0.5f * (f + n) / (f - n) + 0.5f, f * n / (f - n));
+	glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(uniforms), &uniforms);
+}
+
+void ShadowMaps::bind()
+{
+	glBindBufferBase(GL_UNIFORM_BUFFER, SHADOW_UNIFORM_BINDING, m_uniformBuffer);
+	GLuint textures[] = { m_cubeMap, m_cascadeMaps };
+	glBindTextures(9, 2, textures);
+}
@@ -0,0 +1,107 @@
+#include <functional>
+#include <cstdint>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "fbo.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// The shadow maps as a std140 uniform block, see ShadowMaps below:
+//
+// layout(std140, binding = 3) uniform ShadowUniforms
+// {
+//	mat4 cascadeMatrices[4];
+//	vec4 cascadeSplits;
+//	vec2 pointShadowDepth;
+//	float shadowBias;
+//	int shadowsEnabled;
+// };
+///////////////////////////////////////////////////////////////////////////////
+const GLuint SHADOW_UNIFORM_BINDING = 3;
+const int MAX_CASCADES = 4;
+
+struct ShadowUniforms
+{
+	// View space to the cascades' texture coordinates and depth
+	glm::mat4 cascadeMatrices[MAX_CASCADES];
+	// The view space distance where each cascade ends
+	glm::vec4 cascadeSplits;
+	// A depth in the cube map is x - y / (distance along the face's axis)
+	glm::vec2 pointShadowDepth;
+	float shadowBias;
+	int32_t shadowsEnabled;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Shadow maps for the directional light, cascaded over the view distance,
+// and a cube map for the point light, that keep what static geometry casts.
+//
+// Every map has a copy with the static casters only, which is only drawn
+// again when the light (or the cascade) moves, or invalidate() is called.
+// Each frame that copy is copied to the map that is sampled, and the
+// dynamic casters are drawn on top of it. The cascades are placed around
+// bounding spheres of their slice of the view frustum, with some slack, and
+// only move when the slice no longer fits; when they do, they snap to their
+// texels so that the shadows do not crawl.
+//
+// The cascades are bound to texture unit 10 as a sampler2DArrayShadow and
+// the cube map to unit 9 as a samplerCubeShadow.
+///////////////////////////////////////////////////////////////////////////////
+class ShadowMaps {
+public:
+	// Draws casters with a light's view and projection matrices, to the
+	// bound depth-only framebuffer
+	typedef std::function<void(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix)> DrawCasters;
+
+	// Set before init()
+	int m_cascadeResolution;
+	int m_cubeResolution;
+	int m_numCascades;
+	// The cascades cover the view up to this distance, split between
+	// logarithmically (1) and evenly (0)
+	float m_shadowDistance;
+	float m_splitLambda;
+	// Cascades are this much larger than the spheres around their slices
+	float m_cascadeSlack;
+	// Casters this far beyond a cascade, towards the light, are kept
+	float m_casterDepth;
+	float m_pointNear;
+	float m_pointFar;
+	float m_bias;
+	bool m_enabled;
+	// Static maps (cascades or cube faces) drawn again by the last update()
+	int m_staticRedraws;
+
+	ShadowMaps(void);
+
+	void init();
+
+	// Draw the static casters again at the next update()
+	void invalidate();
+
+	// Bring the maps up to date for this frame's camera and lights, and
+	// write the uniform block
+	void update(const glm::vec3& lightDirection, const glm::vec3& lightPosition, const glm::mat4& viewMatrix,
+	            const glm::mat4& projectionMatrix, const DrawCasters& drawStatic, const DrawCasters& drawDynamic);
+
+	// The maps and the uniform block, for shaders that take them
+	void bind();
+
+private:
+	GLuint m_cascadeMaps, m_staticCascadeMaps;
+	GLuint m_cubeMap, m_staticCubeMap;
+	GLuint m_uniformBuffer;
+	FboInfo m_fbo;
+	// Where the cascades are and what they were drawn for
+	glm::vec3 m_cascadeCenters[MAX_CASCADES];
+	float m_cascadeExtents[MAX_CASCADES];
+	bool m_cascadeValid[MAX_CASCADES];
+	glm::vec3 m_cascadeLightDirection;
+	glm::mat4 m_cascadeViews[MAX_CASCADES];
+	glm::mat4 m_cascadeProjections[MAX_CASCADES];
+	glm::vec3 m_cubeLightPosition;
+	bool m_cubeValid;
+
+	void placeCascade(int cascade, const glm::vec3& center, float radius, const glm::vec3& lightDirection);
+	void drawLayer(GLenum target, GLuint texture, int layer, int resolution, bool clear,
+	               const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, const DrawCasters& draw);
+};
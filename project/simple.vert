@@ -1,7 +1,12 @@
 #version 420
 
 layout(location = 0) in vec3 position;
-uniform mat4 modelViewProjectionMatrix;
+layout(std140, binding = 1) uniform ObjectUniforms
+{
+	mat4 modelViewProjectionMatrix;
+	mat4 modelViewMatrix;
+	mat4 normalMatrix;
+};
 
 void main()
 {
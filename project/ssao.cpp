@@ -0,0 +1,176 @@
+#include "ssao.h"
+#include <algorithm>
+#include <cmath>
+#include <labhelper.h>
+
+using namespace glm;
+
+AmbientOcclusion::AmbientOcclusion()
+    : m_enabled(true)
+    , m_radius(2.0f)
+    , m_depthSharpness(20.0f)
+    , m_numSamples(16)
+    , m_adaptive(true)
+    , m_budgetMs(1.0f)
+    , m_timeMs(0.0f)
+    , m_prepassFb(1)
+    , m_occlusionFb(1)
+    , m_blurFb(1)
+    , m_resultFb(1)
+    , m_occlusionProgram(0)
+    , m_blurProgram(0)
+    , m_upsampleProgram(0)
+    , m_noiseTexture(0)
+    , m_frame(0)
+{
+}
+
+void AmbientOcclusion::init()
+{
+	///////////////////////////////////////////////////////////////////////
+	// Samples in the unit hemisphere around z, more of them near the
+	// center. Their lengths follow the golden ratio sequence, so that the
+	// first m_numSamples of them spread over it, whatever m_numSamples is.
+	///////////////////////////////////////////////////////////////////////
+	m_kernel.resize(MAX_SAMPLES);
+	for(int i = 0; i < MAX_SAMPLES; i++)
+	{
+		vec3 direction;
+		do
+		{
+			direction = vec3(labhelper::uniform_randf(-1.0f, 1.0f), labhelper::uniform_randf(-1.0f, 1.0f),
+			                 labhelper::uniform_randf(0.0f, 1.0f));
+		} while(dot(direction, direction) > 1.0f || dot(direction, direction) < 1e-4f);
+		float t = fract(float(i) * 0.618034f);
+		m_kernel[i] = normalize(direction) * mix(0.1f, 1.0f, t * t);
+	}
+
+	// Rotations about the normal (as vectors in the tangent plane)
+	vec4 noise[16];
+	for(auto& n : noise)
+		n = vec4(labhelper::uniform_randf(-1.0f, 1.0f), labhelper::uniform_randf(-1.0f, 1.0f), 0.0f, 0.0f);
+	glGenTextures(1, &m_noiseTexture);
+	glBindTexture(GL_TEXTURE_2D, m_noiseTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, 4, 4, 0, GL_RGBA, GL_FLOAT, noise);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenQueries(NUM_QUERIES, m_queries);
+}
+
+void AmbientOcclusion::loadShaders(bool is_reload)
+{
+	GLuint shader = labhelper::loadShaderProgram("../project/ssaoOutput.vert", "../project/ssaoOutput.frag",
+	                                             is_reload);
+	if(shader != 0)
+		m_occlusionProgram = shader;
+	shader = labhelper::loadShaderProgram("../project/ssaoOutput.vert", "../project/ssao_blur.frag", is_reload);
+	if(shader != 0)
+		m_blurProgram = shader;
+	shader = labhelper::loadShaderProgram("../project/ssaoOutput.vert", "../project/ssao_upsample.frag",
+	                                      is_reload);
+	if(shader != 0)
+		m_upsampleProgram = shader;
+}
+
+void AmbientOcclusion::resize(int w, int h)
+{
+	m_prepassFb.resize(w, h);
+	m_occlusionFb.resize((w + 1) / 2, (h + 1) / 2);
+	m_blurFb.resize((w + 1) / 2, (h + 1) / 2);
+	m_resultFb.resize(w, h);
+}
+
+void AmbientOcclusion::beginPrepass()
+{
+	///////////////////////////////////////////////////////////////////////
+	// Read the time of the query about to be issued again, and adapt
+	///////////////////////////////////////////////////////////////////////
+	const GLuint query = m_queries[m_frame % NUM_QUERIES];
+	if(m_frame >= NUM_QUERIES)
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if(available)
+		{
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+			m_timeMs = float(nanoseconds) * 1e-6f;
+			if(m_adaptive && m_timeMs > m_budgetMs)
+				m_numSamples = std::max(m_numSamples - 2, 4);
+			else if(m_adaptive && m_timeMs < 0.8f * m_budgetMs)
+				m_numSamples = std::min(m_numSamples + 1, int(MAX_SAMPLES));
+		}
+	}
+	glBeginQuery(GL_TIME_ELAPSED, query);
+	m_frame++;
+
+	glGetIntegerv(GL_VIEWPORT, m_viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_prepassFb.framebufferId);
+	glViewport(0, 0, m_prepassFb.width, m_prepassFb.height);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void AmbientOcclusion::compute(const mat4& projectionMatrix)
+{
+	const vec2 depthParams(projectionMatrix[3][2], projectionMatrix[2][2]);
+
+	///////////////////////////////////////////////////////////////////////
+	// Occlusion, at half resolution
+	///////////////////////////////////////////////////////////////////////
+	glBindFramebuffer(GL_FRAMEBUFFER, m_occlusionFb.framebufferId);
+	glViewport(0, 0, m_occlusionFb.width, m_occlusionFb.height);
+	glUseProgram(m_occlusionProgram);
+	labhelper::setUniform(m_occlusionProgram, "projectionMatrix", projectionMatrix);
+	labhelper::setUniform(m_occlusionProgram, "inverseProjectionMatrix", inverse(projectionMatrix));
+	labhelper::setUniform(m_occlusionProgram, "samples", uint32_t(m_numSamples), m_kernel.data());
+	labhelper::setUniform(m_occlusionProgram, "numSamples", GLint(m_numSamples));
+	labhelper::setUniform(m_occlusionProgram, "radius", m_radius);
+	GLuint occlusionInputs[] = { m_prepassFb.depthBuffer, m_prepassFb.colorTextureTargets[0], m_noiseTexture };
+	glBindTextures(0, 3, occlusionInputs);
+	labhelper::drawFullScreenQuad();
+
+	///////////////////////////////////////////////////////////////////////
+	// Blur, across and then along, back into m_occlusionFb
+	///////////////////////////////////////////////////////////////////////
+	glUseProgram(m_blurProgram);
+	glUniform2fv(labhelper::getUniformLocation(m_blurProgram, "depthParams"), 1, &depthParams.x);
+	labhelper::setUniform(m_blurProgram, "depthSharpness", m_depthSharpness);
+	FboInfo* targets[] = { &m_blurFb, &m_occlusionFb };
+	FboInfo* sources[] = { &m_occlusionFb, &m_blurFb };
+	for(int pass = 0; pass < 2; pass++)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, targets[pass]->framebufferId);
+		glUniform2i(labhelper::getUniformLocation(m_blurProgram, "direction"), pass == 0 ? 1 : 0,
+		            pass == 0 ? 0 : 1);
+		GLuint blurInputs[] = { sources[pass]->colorTextureTargets[0], m_prepassFb.depthBuffer };
+		glBindTextures(0, 2, blurInputs);
+		labhelper::drawFullScreenQuad();
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Upsample
+	///////////////////////////////////////////////////////////////////////
+	glBindFramebuffer(GL_FRAMEBUFFER, m_resultFb.framebufferId);
+	glViewport(0, 0, m_resultFb.width, m_resultFb.height);
+	glUseProgram(m_upsampleProgram);
+	glUniform2fv(labhelper::getUniformLocation(m_upsampleProgram, "depthParams"), 1, &depthParams.x);
+	labhelper::setUniform(m_upsampleProgram, "depthSharpness", m_depthSharpness);
+	GLuint upsampleInputs[] = { m_occlusionFb.colorTextureTargets[0], m_prepassFb.depthBuffer };
+	glBindTextures(0, 2, upsampleInputs);
+	labhelper::drawFullScreenQuad();
+
+	glEndQuery(GL_TIME_ELAPSED);
+	glBindTextures(0, 3, nullptr);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(m_viewport[0], m_viewport[1], m_viewport[2], m_viewport[3]);
+}
+
+void AmbientOcclusion::bind()
+{
+	glActiveTexture(GL_TEXTURE11);
+	glBindTexture(GL_TEXTURE_2D, m_resultFb.colorTextureTargets[0]);
+	glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,69 @@
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "fbo.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Screen space ambient occlusion, for the ambient light in shading.frag.
+//
+// The scene's depth and view space normals are drawn first into a prepass
+// framebuffer (with ssaoInput.vert/.frag), from which the occlusion is
+// computed at half resolution (ssaoOutput.frag), blurred in two passes that
+// stop at depth edges (ssao_blur.frag), and brought back to full resolution
+// with a bilateral upsample (ssao_upsample.frag) into the texture that
+// bind() puts on unit 11.
+//
+// The whole of it is timed with a query, and the number of samples is
+// adapted to keep it within m_budgetMs (the result is read a few frames
+// late, so that the query never stalls).
+///////////////////////////////////////////////////////////////////////////////
+class AmbientOcclusion {
+public:
+	bool m_enabled;
+	// View space radius of the sampled hemisphere
+	float m_radius;
+	// How quickly the blur and upsample weights fall off across depths
+	float m_depthSharpness;
+	// Samples per pixel, between 4 and MAX_SAMPLES, adapted if m_adaptive
+	int m_numSamples;
+	bool m_adaptive;
+	float m_budgetMs;
+	// The time of the last measured frame
+	float m_timeMs;
+
+	static const int MAX_SAMPLES = 64;
+
+	AmbientOcclusion(void);
+
+	// The kernel, noise texture and timer queries
+	void init();
+
+	void loadShaders(bool is_reload);
+
+	void resize(int w, int h);
+
+	// Bind and clear the prepass framebuffer, for the caller to draw the
+	// scene's depth and normals into
+	void beginPrepass();
+
+	// The occlusion of what was drawn since beginPrepass()
+	void compute(const glm::mat4& projectionMatrix);
+
+	void bind();
+
+private:
+	FboInfo m_prepassFb;
+	FboInfo m_occlusionFb;
+	FboInfo m_blurFb;
+	FboInfo m_resultFb;
+	GLuint m_occlusionProgram;
+	GLuint m_blurProgram;
+	GLuint m_upsampleProgram;
+	GLuint m_noiseTexture;
+	std::vector<glm::vec3> m_kernel;
+	// A ring of queries, the oldest is read before it is issued again
+	enum { NUM_QUERIES = 4 };
+	GLuint m_queries[NUM_QUERIES];
+	int m_frame;
+	GLint m_viewport[4];
+};
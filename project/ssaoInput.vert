@@ -1 +1,21 @@
 #version 420
+///////////////////////////////////////////////////////////////////////////////
+// The depth and normal prepass of the SSAO (see ssao.h), for the models
+///////////////////////////////////////////////////////////////////////////////
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normalIn;
+
+layout(std140, binding = 1) uniform ObjectUniforms
+{
+	mat4 modelViewProjectionMatrix;
+	mat4 modelViewMatrix;
+	mat4 normalMatrix;
+};
+
+out vec3 viewSpaceNormal;
+
+void main()
+{
+	gl_Position = modelViewProjectionMatrix * vec4(position, 1.0);
+	viewSpaceNormal = (normalMatrix * vec4(normalIn, 0.0)).xyz;
+}
@@ -1 +1,59 @@
 #version 420
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+///////////////////////////////////////////////////////////////////////////////
+// Ambient occlusion at half resolution (see ssao.h), from every other
+// pixel of the prepass: samples in the hemisphere around the normal count
+// as occluded where the scene is in front of them. The kernel is turned by
+// a tiled 4x4 noise texture, so that few samples leave noise (which the
+// blur takes out) rather than bands.
+///////////////////////////////////////////////////////////////////////////////
+layout(binding = 0) uniform sampler2D depthTexture;
+layout(binding = 1) uniform sampler2D normalTexture;
+layout(binding = 2) uniform sampler2D noiseTexture;
+
+uniform mat4 projectionMatrix;
+uniform mat4 inverseProjectionMatrix;
+uniform vec3 samples[64];
+uniform int numSamples;
+uniform float radius;
+
+layout(location = 0) out vec4 fragmentColor;
+
+vec3 viewSpacePositionAt(ivec2 pixel)
+{
+	float depth = texelFetch(depthTexture, pixel, 0).r;
+	vec2 ndc = (vec2(pixel) + 0.5) / vec2(textureSize(depthTexture, 0)) * 2.0 - 1.0;
+	vec4 position = inverseProjectionMatrix * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+	return position.xyz / position.w;
+}
+
+void main()
+{
+	ivec2 fullSize = textureSize(depthTexture, 0);
+	ivec2 pixel = min(ivec2(gl_FragCoord.xy) * 2, fullSize - 1);
+	if(texelFetch(depthTexture, pixel, 0).r >= 1.0)
+	{
+		fragmentColor = vec4(1.0);
+		return;
+	}
+	vec3 position = viewSpacePositionAt(pixel);
+	vec3 normal = normalize(texelFetch(normalTexture, pixel, 0).xyz);
+	vec3 random = texelFetch(noiseTexture, ivec2(gl_FragCoord.xy) % 4, 0).xyz;
+	vec3 tangent = normalize(random - normal * dot(random, normal));
+	mat3 tbn = mat3(tangent, cross(normal, tangent), normal);
+
+	float occlusion = 0.0;
+	for(int i = 0; i < numSamples; i++)
+	{
+		vec3 samplePosition = position + tbn * samples[i] * radius;
+		vec4 clip = projectionMatrix * vec4(samplePosition, 1.0);
+		vec2 uv = clip.xy / clip.w * 0.5 + 0.5;
+		ivec2 samplePixel = clamp(ivec2(uv * vec2(fullSize)), ivec2(0), fullSize - 1);
+		float sceneZ = viewSpacePositionAt(samplePixel).z;
+		// Geometry much closer to the camera than the radius does not count
+		float inRange = smoothstep(0.0, 1.0, radius / abs(position.z - sceneZ));
+		occlusion += (sceneZ >= samplePosition.z + 0.02 * radius ? 1.0 : 0.0) * inRange;
+	}
+	fragmentColor = vec4(1.0 - occlusion / float(max(numSamples, 1)));
+}
@@ -1 +1,11 @@
 #version 420
+// The full screen passes of the SSAO (see ssao.h), with texCoord over the target
+layout(location = 0) in vec2 position;
+
+out vec2 texCoord;
+
+void main()
+{
+	gl_Position = vec4(position, 0.0, 1.0);
+	texCoord = 0.5 * (position + vec2(1, 1));
+}
\ No newline at end of file
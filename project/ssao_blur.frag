@@ -0,0 +1,43 @@
+#version 420
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+///////////////////////////////////////////////////////////////////////////////
+// One direction of the separable blur of the half resolution SSAO (see
+// ssao.h), weighted down across depth edges so occlusion does not bleed
+// from one surface onto another
+///////////////////////////////////////////////////////////////////////////////
+layout(binding = 0) uniform sampler2D occlusionTexture;
+layout(binding = 1) uniform sampler2D depthTexture;
+
+uniform ivec2 direction;
+// projectionMatrix[3][2] and [2][2], for the view space distance of a depth
+uniform vec2 depthParams;
+uniform float depthSharpness;
+
+layout(location = 0) out vec4 fragmentColor;
+
+// At a half resolution pixel, which the SSAO took from every other one
+float linearDepthAt(ivec2 pixel)
+{
+	ivec2 fullPixel = min(pixel * 2, textureSize(depthTexture, 0) - 1);
+	float depth = texelFetch(depthTexture, fullPixel, 0).r * 2.0 - 1.0;
+	return depthParams.x / (depth + depthParams.y);
+}
+
+void main()
+{
+	ivec2 size = textureSize(occlusionTexture, 0);
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float centerDepth = linearDepthAt(pixel);
+	float sum = 0.0;
+	float weights = 0.0;
+	for(int i = -4; i <= 4; i++)
+	{
+		ivec2 p = clamp(pixel + direction * i, ivec2(0), size - 1);
+		float w = exp(-float(i * i) / 8.0)
+		          * exp(-abs(linearDepthAt(p) - centerDepth) / centerDepth * depthSharpness);
+		sum += texelFetch(occlusionTexture, p, 0).r * w;
+		weights += w;
+	}
+	fragmentColor = vec4(sum / weights);
+}
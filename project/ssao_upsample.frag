@@ -0,0 +1,44 @@
+#version 420
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+///////////////////////////////////////////////////////////////////////////////
+// The blurred half resolution SSAO (see ssao.h) to full resolution: the
+// bilinear weights of the four nearest half resolution pixels, times how
+// close their depths are to this pixel's, so edges stay sharp
+///////////////////////////////////////////////////////////////////////////////
+layout(binding = 0) uniform sampler2D occlusionTexture;
+layout(binding = 1) uniform sampler2D depthTexture;
+
+uniform vec2 depthParams;
+uniform float depthSharpness;
+
+layout(location = 0) out vec4 fragmentColor;
+
+float linearDepthAt(ivec2 fullPixel)
+{
+	fullPixel = min(fullPixel, textureSize(depthTexture, 0) - 1);
+	float depth = texelFetch(depthTexture, fullPixel, 0).r * 2.0 - 1.0;
+	return depthParams.x / (depth + depthParams.y);
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	ivec2 halfSize = textureSize(occlusionTexture, 0);
+	float depth = linearDepthAt(pixel);
+	// Half resolution pixel p was taken at full resolution pixel 2p
+	ivec2 base = pixel / 2;
+	vec2 f = vec2(pixel % 2) * 0.5;
+	float sum = 0.0;
+	float weights = 0.0;
+	for(int i = 0; i < 4; i++)
+	{
+		ivec2 offset = ivec2(i & 1, i >> 1);
+		ivec2 p = min(base + offset, halfSize - 1);
+		float bilinear = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+		float w = (bilinear + 1e-3) * exp(-abs(linearDepthAt(p * 2) - depth) / depth * depthSharpness);
+		sum += texelFetch(occlusionTexture, p, 0).r * w;
+		weights += w;
+	}
+	fragmentColor = vec4(weights > 1e-6 ? sum / weights : texelFetch(occlusionTexture, base, 0).r);
+}